@@ -0,0 +1,77 @@
+#include "airoffset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+CAirOffset::CAirOffset()
+: m_sourceWidth(0)
+, m_sourceHeight(0)
+, m_fov(AIR_DEFAULT_FOV)
+{
+}
+
+bool CAirOffset::parse(const std::string& offset)
+{
+	std::vector<double> fields;
+	const char* p = offset.c_str();
+	while (*p)
+	{
+		char* end = nullptr;
+		double value = strtod(p, &end);
+		if (end == p)
+		{
+			return false;
+		}
+		fields.push_back(value);
+		p = end;
+		while (*p == '_' || *p == ' ' || *p == '\r' || *p == '\n')
+		{
+			p++;
+		}
+	}
+
+	if (fields.empty() || fields[0] < 1 || fields[0] > 8)
+	{
+		return false;
+	}
+	size_t count = (size_t)fields[0];
+	if (fields.size() < 1 + 6 * count)
+	{
+		return false;
+	}
+
+	std::vector<LensParams> lenses(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const double* f = &fields[1 + 6 * i];
+		lenses[i].center_x = f[0];
+		lenses[i].center_y = f[1];
+		lenses[i].radius = f[2];
+		lenses[i].yaw = f[3];
+		lenses[i].pitch = f[4];
+		lenses[i].roll = f[5];
+		if (lenses[i].radius <= 0)
+		{
+			return false;
+		}
+	}
+
+	m_sourceWidth = 0;
+	m_sourceHeight = 0;
+	if (fields.size() >= 3 + 6 * count && fields[1 + 6 * count] > 0 && fields[2 + 6 * count] > 0)
+	{
+		m_sourceWidth = (unsigned int)fields[1 + 6 * count];
+		m_sourceHeight = (unsigned int)fields[2 + 6 * count];
+	}
+	m_lenses.swap(lenses);
+	return true;
+}
+
+std::string CAirOffset::synthetic(unsigned int width, unsigned int height)
+{
+	char offset[256];
+	double radius = (width / 2.0 < height ? width / 2.0 : height) / 2.0;
+	snprintf(offset, sizeof(offset), "2_%.3f_%.3f_%.3f_0.000_0.000_0.000_%.3f_%.3f_%.3f_180.000_0.000_0.000_%u_%u",
+		width / 4.0, height / 2.0, radius, width * 3 / 4.0, height / 2.0, radius, width, height);
+	return offset;
+}
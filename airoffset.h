@@ -0,0 +1,54 @@
+#ifndef AIR_OFFSET_H
+#define AIR_OFFSET_H
+
+//
+// Dual fisheye calibration of the Insta360 Air, the "offset" string read by
+// CMultipinMft::GetAirOffset(). Fields are separated by '_':
+//
+//   lens_count, then per lens: center_x, center_y, radius, yaw, pitch, roll,
+//   then optionally the width and height of the frame the values refer to.
+//
+// Positions are in pixels of that frame, angles in degrees. Anything after
+// the frame size is ignored.
+//
+
+#include <string>
+#include <vector>
+
+#define AIR_DEFAULT_FOV     210.0   // field of view of one lens, degrees
+
+typedef struct _LensParams {
+	double  center_x    = 0;
+	double  center_y    = 0;
+	double  radius      = 0;    // image circle radius for half the field of view
+	double  yaw         = 0;
+	double  pitch       = 0;
+	double  roll        = 0;
+}LensParams, *LensParamsPtr;
+
+class CAirOffset
+{
+public:
+	CAirOffset();
+
+	bool parse(const std::string& offset);
+
+	size_t lensCount() const { return m_lenses.size(); }
+	const LensParams& lens(size_t index) const { return m_lenses[index]; }
+	// Frame size the lens parameters refer to, 0 when the string does not say
+	unsigned int sourceWidth() const { return m_sourceWidth; }
+	unsigned int sourceHeight() const { return m_sourceHeight; }
+	double fov() const { return m_fov; }
+	void setFov(double fov) { m_fov = fov; }
+
+	// Two lenses side by side, back to back, filling a width x height frame
+	static std::string synthetic(unsigned int width, unsigned int height);
+
+private:
+	std::vector<LensParams> m_lenses;
+	unsigned int            m_sourceWidth;
+	unsigned int            m_sourceHeight;
+	double                  m_fov;
+};
+
+#endif
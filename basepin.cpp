@@ -27,6 +27,7 @@ CBasePin::CBasePin( _In_ ULONG id, _In_ CMultipinMft *parent) :
     m_StreamId(id)
     , m_Parent(parent)
     , m_setMediaType(nullptr)
+    , m_fMediaTypesIndexed(TRUE)
 {
     
 }
@@ -43,9 +44,43 @@ CBasePin::~CBasePin()
     m_spAttributes = nullptr;
 }
 
+/*++
+Description:
+    The canonical key of a media type, see mediatypeindex.h. Attributes the
+    type does not carry stay zero.
+--*/
+static VOID GetMediaTypeKey( _In_ IMFMediaType *pMediaType, _Out_ MediaTypeKey *pKey )
+{
+    GUID    guid = GUID_NULL;
+    UINT32  uHigh = 0, uLow = 0;
+
+    *pKey = MediaTypeKey();
+    if ( SUCCEEDED( pMediaType->GetGUID( MF_MT_MAJOR_TYPE, &guid ) ) )
+    {
+        memcpy( pKey->major_type, &guid, sizeof( pKey->major_type ) );
+    }
+    if ( SUCCEEDED( pMediaType->GetGUID( MF_MT_SUBTYPE, &guid ) ) )
+    {
+        memcpy( pKey->subtype, &guid, sizeof( pKey->subtype ) );
+    }
+    if ( SUCCEEDED( MFGetAttributeSize( pMediaType, MF_MT_FRAME_SIZE, &uHigh, &uLow ) ) )
+    {
+        pKey->width  = uHigh;
+        pKey->height = uLow;
+    }
+    if ( SUCCEEDED( MFGetAttributeRatio( pMediaType, MF_MT_FRAME_RATE, &uHigh, &uLow ) ) )
+    {
+        pKey->rate_numerator   = uHigh;
+        pKey->rate_denominator = uLow;
+    }
+    pKey->interlace = MFGetAttributeUINT32( pMediaType, MF_MT_INTERLACE_MODE, 0 );
+    pKey->stride    = (INT32)MFGetAttributeUINT32( pMediaType, MF_MT_DEFAULT_STRIDE, 0 );
+}
+
 HRESULT CBasePin::AddMediaType( _Inout_ DWORD *pos, _In_ IMFMediaType *pMediaType)
 {
     HRESULT hr = S_OK;
+    MediaTypeKey key;
     CAutoLock Lock(lock());
     DMFTCHECKNULL_GOTO(pMediaType, done, E_INVALIDARG);
 
@@ -57,6 +92,18 @@ HRESULT CBasePin::AddMediaType( _Inout_ DWORD *pos, _In_ IMFMediaType *pMediaTyp
     DMFTCHECKHR_GOTO(hr, done);
     pMediaType->AddRef();
 
+    if ( m_fMediaTypesIndexed )
+    {
+        GetMediaTypeKey( pMediaType, &key );
+        //
+        //Without the index IsMediaTypeSupported scans the list, the type is still added
+        //
+        m_fMediaTypesIndexed = SUCCEEDED( ExceptionBoundary([&]()
+        {
+            m_mediaTypeIndex.add( key, (UINT)( m_listOfMediaTypes.size() - 1 ) );
+        }));
+    }
+
     if (pos)
     {
         *pos = (DWORD)(m_listOfMediaTypes.size() - 1);
@@ -85,6 +132,34 @@ done:
     return hr;
 }
 
+/*++
+Description:
+    Rebuilds the key index of m_listOfMediaTypes, for when the list was reordered
+--*/
+STDMETHODIMP CBasePin::RebuildMediaTypeIndex()
+{
+    HRESULT hr = S_OK;
+
+    m_mediaTypeIndex.clear();
+    hr = ExceptionBoundary([&]()
+    {
+        for ( UINT uIIndex = 0, uISize = (UINT)m_listOfMediaTypes.size(); uIIndex < uISize; uIIndex++ )
+        {
+            MediaTypeKey key;
+            GetMediaTypeKey( m_listOfMediaTypes[ uIIndex ], &key );
+            m_mediaTypeIndex.add( key, uIIndex );
+        }
+    });
+    m_fMediaTypesIndexed = SUCCEEDED( hr );
+    return hr;
+}
+
+/*++
+Description:
+    Only the types listed under the key of pMediaType can be equal to it, those
+    are compared in full in list order. The whole list is compared when the
+    index could not be kept.
+--*/
 STDMETHODIMP_(BOOL) CBasePin::IsMediaTypeSupported
 (
     _In_ IMFMediaType *pMediaType, 
@@ -94,6 +169,8 @@ STDMETHODIMP_(BOOL) CBasePin::IsMediaTypeSupported
 {
     HRESULT hr = S_OK;
     BOOL bFound = FALSE;
+    const vector<UINT> *pCandidates = nullptr;
+    UINT uISize = 0;
     CAutoLock Lock(lock());
     DMFTCHECKNULL_GOTO(pMediaType,done,E_INVALIDARG);
     if (ppIMFMediaTypeFull)
@@ -101,10 +178,20 @@ STDMETHODIMP_(BOOL) CBasePin::IsMediaTypeSupported
         *ppIMFMediaTypeFull = nullptr;
     }
 
-    for (UINT uIIndex = 0, uISize = (UINT)m_listOfMediaTypes.size(); uIIndex < uISize ; uIIndex++ )
+    uISize = (UINT)m_listOfMediaTypes.size();
+    if ( m_fMediaTypesIndexed )
+    {
+        MediaTypeKey key;
+        GetMediaTypeKey( pMediaType, &key );
+        pCandidates = m_mediaTypeIndex.find( key );
+        uISize = pCandidates ? (UINT)pCandidates->size() : 0;
+    }
+
+    for (UINT uIIndex = 0; uIIndex < uISize ; uIIndex++ )
     {
         DWORD dwResult = 0;
-        hr = m_listOfMediaTypes[ uIIndex ]->IsEqual( pMediaType, &dwResult );
+        UINT uPos = pCandidates ? ( *pCandidates )[ uIIndex ] : uIIndex;
+        hr = m_listOfMediaTypes[ uPos ]->IsEqual( pMediaType, &dwResult );
         if (hr == S_FALSE)
         {
 
@@ -119,7 +206,7 @@ STDMETHODIMP_(BOOL) CBasePin::IsMediaTypeSupported
         {
             bFound = TRUE;
             if (ppIMFMediaTypeFull) {
-                *ppIMFMediaTypeFull = m_listOfMediaTypes[uIIndex];
+                *ppIMFMediaTypeFull = m_listOfMediaTypes[uPos];
                 (*ppIMFMediaTypeFull)->AddRef();
             }
             break;
@@ -193,7 +280,8 @@ CInPin::CInPin(
     m_state(DeviceStreamState_Stop),
     m_prefferedMediaType(nullptr),
     m_waitInputMediaTypeWaiter(NULL),
-    m_preferredStreamState(DeviceStreamState_Stop)
+    m_preferredStreamState(DeviceStreamState_Stop),
+    m_pConversions(new (std::nothrow) CConversionCache())
 {
     setAttributes(pAttributes);
 }
@@ -204,6 +292,7 @@ CInPin::~CInPin()
 {
     setAttributes( nullptr );
     m_spSourceTransform = nullptr;
+    m_outpinRoutes.Clear();
 
     for (ULONG ulIndex = 0, ulSize = (ULONG)m_outpins.size();
         ulIndex < ulSize;
@@ -216,7 +305,7 @@ CInPin::~CInPin()
     {
         CloseHandle(m_waitInputMediaTypeWaiter);
     }
-    
+    SAFE_DELETE(m_pConversions);
 }
 
 
@@ -298,11 +387,28 @@ STDMETHODIMP CInPin::SendSample(
 {
     HRESULT hr = S_OK;
     BOOL    sentOne = TRUE;
+    BOOL    fanOut = FALSE;
+    const CBasePinArray *pOutpins = m_outpinRoutes.Get();
     DMFTCHECKNULL_GOTO(pSample, done, S_OK);
+    DMFTCHECKNULL_GOTO(pOutpins, done, S_OK); //Not connected yet
 
-    for ( ULONG ulIndex = 0, ulSize = (ULONG) m_outpins.size(); ulIndex < ulSize; ulIndex++ )
+    //
+    //The output pins share the sample instead of copying it, and their tees
+    //share what they convert it to
+    //
+    if ( pOutpins->size() > 1 )
     {
-        COutPin *poPin = (COutPin *)m_outpins[ ulIndex ];
+        fanOut = TRUE;
+        (VOID)MarkSampleShared( pSample );
+        if ( m_pConversions )
+        {
+            m_pConversions->Open( pSample );
+        }
+    }
+
+    for ( ULONG ulIndex = 0, ulSize = (ULONG) pOutpins->size(); ulIndex < ulSize; ulIndex++ )
+    {
+        COutPin *poPin = (COutPin *)( *pOutpins )[ ulIndex ];
 
         pSample->AddRef();
         
@@ -312,6 +418,10 @@ STDMETHODIMP CInPin::SendSample(
         }
         sentOne = (sentOne || SUCCEEDED(hr));
     }
+    if ( fanOut && m_pConversions )
+    {
+        m_pConversions->Close();
+    }
 done: 
     return sentOne ? S_OK : E_FAIL;
 }
@@ -323,6 +433,10 @@ STDMETHODIMP_(VOID) CInPin::ConnectPin( _In_ CBasePin * poPin )
     {
         m_outpins.push_back(poPin);
         poPin->AddRef();
+        //
+        //SendSample walks its own copy, the list can grow under it
+        //
+        (VOID)m_outpinRoutes.Publish( new CBasePinArray( m_outpins ) );
     }
 }
 
@@ -416,7 +530,11 @@ COutPin::COutPin(
     _In_     IKsControl*   pIksControl  
     )
     : CBasePin( ulPinId, pparent ),
-    m_firstSample( false )
+    m_firstSample( FALSE ),
+    m_queuesSealed( FALSE ),
+    m_queuePolicy( DMFT_QUEUE_DROP_NEWEST ),
+    m_queueMaxDepth( SAMPLE_QUEUE_CAPACITY ),
+    m_queueSpace( NULL )
 {
     HRESULT                 hr              = S_OK;
     CPinState*              pState          = NULL;
@@ -449,6 +567,9 @@ COutPin::COutPin(
     //
     m_spIkscontrol = pIksControl;
 
+    m_queueSpace = CreateEvent( NULL, FALSE, FALSE, NULL );
+    DMFTCHECKNULL_GOTO( m_queueSpace, done, E_OUTOFMEMORY );
+
     MFCreateAttributes( &spAttributes, 3 ); //Create the space for the attribute store!!
     setAttributes( spAttributes.Get());
     DMFTCHECKHR_GOTO( SetUINT32( MFT_SUPPORT_DYNAMIC_FORMAT_CHANGE, TRUE ), done );
@@ -464,6 +585,7 @@ COutPin::~COutPin()
     CPinQueue *que = NULL;
     m_spAttributes = nullptr;
 
+    m_queueRoutes.Clear();
     for ( ULONG ulIndex = 0, ulSize = (ULONG)m_queues.size(); ulIndex < ulSize; ulIndex++ )
     {
         que = m_queues[ ulIndex ];
@@ -479,6 +601,11 @@ COutPin::~COutPin()
     }
     m_states.clear();
     m_queues.clear();
+    if ( m_queueSpace )
+    {
+        CloseHandle( m_queueSpace );
+        m_queueSpace = NULL;
+    }
 }
 
 /*++
@@ -486,36 +613,83 @@ COutPin::AddPin
 Description:
 Called from AddSample if the Output Pin is in open state. This function looks for the queue
 corresponding to the input pin and adds it in the queue.
+ProcessOutput walks m_queues without the pin lock, so queues can only be added while the pin
+has never left the stopped state, i.e. while the device transform bridges its pins
 --*/
 STDMETHODIMP COutPin::AddPin(
-    _In_ DWORD inputPinId
+    _In_ DWORD inputPinId,
+    _In_opt_ CConversionCache *pConversions
     )
 {
     //
     //Add a new queue corresponding to the input pin
     //
     HRESULT hr = S_OK;
+    CPinQueue *que = nullptr;
     CAutoLock Lock(lock());
 
-    CPinQueue *que = new (std::nothrow) CPinQueue(inputPinId);
+    if ( m_queuesSealed )
+    {
+        DMFTCHECKHR_GOTO( MF_E_INVALIDREQUEST, done );
+    }
+    que = new (std::nothrow) CPinQueue(inputPinId, pConversions);
     DMFTCHECKNULL_GOTO( que, done, E_OUTOFMEMORY );
+    que->SetPolicy( m_queuePolicy, m_queueMaxDepth );
     hr = ExceptionBoundary([&]()
     {
         (void)m_queues.push_back(que);
     });
     DMFTCHECKHR_GOTO(hr, done);
     //
+    //Index the queues by input pin so AddSample does not scan them
+    //
+    {
+        vector< CPinQueue* > *pRoutes = nullptr;
+        hr = ExceptionBoundary([&]()
+        {
+            pRoutes = new vector< CPinQueue* >();
+            for ( DWORD dwIndex = 0, dwSize = (DWORD)m_queues.size(); dwIndex < dwSize; dwIndex++ )
+            {
+                DWORD dwPinId = m_queues[ dwIndex ]->pinStreamId();
+                if ( dwPinId >= DMFT_ROUTE_MAX_STREAM_ID )
+                {
+                    throw std::out_of_range( "input stream id" );
+                }
+                if ( dwPinId >= pRoutes->size() )
+                {
+                    pRoutes->resize( dwPinId + 1, nullptr );
+                }
+                if ( ( *pRoutes )[ dwPinId ] == nullptr )
+                {
+                    ( *pRoutes )[ dwPinId ] = m_queues[ dwIndex ];
+                }
+            }
+        });
+        if ( FAILED( hr ) )
+        {
+            //The queues stay unindexed and QueueFor scans them
+            delete pRoutes;
+            m_queueRoutes.Clear();
+            hr = S_OK;
+        }
+        else
+        {
+            DMFTCHECKHR_GOTO( m_queueRoutes.Publish( pRoutes ), done );
+        }
+    }
+    //
     //Just ramdonmize media types for odd numbered pins
     //
     if ( streamId() != 0 && streamId() % 2 != 0 )
     {
         RandomnizeMediaTypes(m_listOfMediaTypes);
+        (VOID)RebuildMediaTypeIndex();
     }
 
 done:
 
     DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr);
-    return S_OK;
+    return hr;
 }
 
 /*++
@@ -527,48 +701,157 @@ corresponding to the input pin and adds it in the queue.
 
 STDMETHODIMP COutPin::AddSampleInternal( _In_ IMFSample *pSample, _In_ CBasePin *pPin )
 {
-    BOOL    res = true;
     CAutoLock Lock( lock() );
-
-    for ( DWORD dwIndex = 0, dwSize = (DWORD)m_queues.size(); dwIndex < dwSize; dwIndex++ )
+    //
+    //This output pin maybe connected to multiple input pins
+    //Only insert into the queue corresponding to the input pin on which the
+    //sample is received
+    //
+    CPinQueue *que = QueueFor( pPin );
+    if ( que )
     {
         //
-        //This output pin maybe connected to multiple input pins
-        //Only insert into the corresponding queue to the input pin on which the
-        //sample is received
+        //The tee owns the sample from here, a dropped sample is not an error
         //
-        if (m_queues[dwIndex]->pinStreamId() == pPin->streamId())
+        (VOID)que->Insert( pSample );
+    }
+    return S_OK;
+}
+
+/*++
+COutPin::QueueFor
+Description:
+The queue fed by pPin, looked up in the table AddPin publishes. Without a table,
+for stream ids beyond DMFT_ROUTE_MAX_STREAM_ID, the queues are scanned. Called
+with the pin lock held
+--*/
+STDMETHODIMP_(CPinQueue*) COutPin::QueueFor( _In_ CBasePin *pPin )
+{
+    const vector< CPinQueue* > *pRoutes = m_queueRoutes.Get();
+    DWORD dwStreamId = pPin->streamId();
+
+    if ( pRoutes )
+    {
+        return ( dwStreamId < pRoutes->size() ) ? ( *pRoutes )[ dwStreamId ] : NULL;
+    }
+    for ( DWORD dwIndex = 0, dwSize = (DWORD)m_queues.size(); dwIndex < dwSize; dwIndex++ )
+    {
+        if ( m_queues[ dwIndex ]->pinStreamId() == dwStreamId )
         {
-            if (! m_queues[ dwIndex ]->Insert( pSample ) )
-            {
-                res |= false;
-            }
-             
+            return m_queues[ dwIndex ];
         }
     }
-    return res ? S_OK : E_FAIL;
+    return NULL;
 }
 
 /*++
 COutPin::AddSample
 Description:
 Called when ProcessInput is called on the Device Transform. The Input Pin puts the samples
-in the pins connected. If the Output pins are in open state the sample lands in the queues
+in the pins connected. If the Output pins are in open state the sample lands in the queues.
+A full blocking queue holds the caller here, outside the pin lock, until ProcessOutput makes
+room or DMFT_QUEUE_BLOCK_TIMEOUT_MS passes and the queue drops the sample instead
 --*/
 
 STDMETHODIMP COutPin::AddSample( _In_ IMFSample *pSample, _In_ CBasePin *pPin)
 {
     HRESULT hr = S_OK;
-    CAutoLock lock( lock() );
-    
-    DMFTCHECKHR_GOTO( m_state->Open(), done );
-    
-    DMFTCHECKHR_GOTO( AddSampleInternal( pSample, pPin ),done );
+    ULONGLONG ullDeadline = GetTickCount64() + DMFT_QUEUE_BLOCK_TIMEOUT_MS;
+
+    for ( ;; )
+    {
+        {
+            CAutoLock lock( lock() );
+
+            DMFTCHECKHR_GOTO( m_state->Open(), done );
+
+            if ( !QueueBlocked( pPin ) || ( GetTickCount64() >= ullDeadline ) )
+            {
+                DMFTCHECKHR_GOTO( AddSampleInternal( pSample, pPin ),done );
+                break;
+            }
+        }
+        (VOID)WaitForSingleObject( m_queueSpace, DMFT_QUEUE_BLOCK_TIMEOUT_MS );
+    }
 
 done:
     return hr;
 }
 
+/*++
+COutPin::QueueBlocked
+Description:
+True when the queue fed by pPin blocks and is at its depth. Called with the pin lock held
+--*/
+BOOL COutPin::QueueBlocked( _In_ CBasePin *pPin )
+{
+    CPinQueue *que = QueueFor( pPin );
+    return que && ( que->policy() == DMFT_QUEUE_BLOCK ) && que->Full();
+}
+
+/*++
+COutPin::SetQueuePolicy
+Description:
+Sets the depth and the policy of every queue of the pin, and of the queues added later
+--*/
+STDMETHODIMP COutPin::SetQueuePolicy( _In_ DMFT_QUEUE_POLICY policy, _In_ ULONG ulMaxDepth )
+{
+    HRESULT hr = S_OK;
+    CAutoLock Lock( lock() );
+
+    if ( ( policy > DMFT_QUEUE_BLOCK ) || ( ulMaxDepth == 0 ) || ( ulMaxDepth > SAMPLE_QUEUE_CAPACITY ) )
+    {
+        DMFTCHECKHR_GOTO( E_INVALIDARG, done );
+    }
+    m_queuePolicy   = policy;
+    m_queueMaxDepth = ulMaxDepth;
+    for ( DWORD dwIndex = 0, dwSize = (DWORD)m_queues.size(); dwIndex < dwSize; dwIndex++ )
+    {
+        m_queues[ dwIndex ]->SetPolicy( policy, ulMaxDepth );
+    }
+    //
+    // A producer waiting on the old depth looks again
+    //
+    (VOID)SetEvent( m_queueSpace );
+done:
+    DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! pin %d policy %d depth %d exiting %x = %!HRESULT!", streamId(), policy, ulMaxDepth, hr, hr);
+    return hr;
+}
+
+STDMETHODIMP_(VOID) COutPin::GetQueuePolicy( _Out_ DMFT_QUEUE_POLICY *pPolicy, _Out_ ULONG *pulMaxDepth )
+{
+    CAutoLock Lock( lock() );
+    *pPolicy     = m_queuePolicy;
+    *pulMaxDepth = m_queueMaxDepth;
+}
+
+/*++
+COutPin::GetQueueStatistics
+Description:
+Sums the counters of the queues of the pin. The depths are the current and the deepest
+of any one queue
+--*/
+STDMETHODIMP_(VOID) COutPin::GetQueueStatistics(
+    _Out_ ULONGLONG *pullQueued,
+    _Out_ ULONGLONG *pullDropped,
+    _Out_ ULONG *pulDepth,
+    _Out_ ULONG *pulHighWater )
+{
+    CAutoLock Lock( lock() );
+    *pullQueued   = 0;
+    *pullDropped  = 0;
+    *pulDepth     = 0;
+    *pulHighWater = 0;
+    for ( DWORD dwIndex = 0, dwSize = (DWORD)m_queues.size(); dwIndex < dwSize; dwIndex++ )
+    {
+        CPinQueue *que = m_queues[ dwIndex ];
+        *pullQueued  += que->queued();
+        *pullDropped += que->dropped();
+        *pulDepth     = ( que->depth() > *pulDepth ) ? que->depth() : *pulDepth;
+        *pulHighWater = ( que->highWater() > *pulHighWater ) ? que->highWater() : *pulHighWater;
+    }
+}
+
 /*++
 COutPin::SetState
 Description:
@@ -577,7 +860,7 @@ State setter for the output pin
 STDMETHODIMP_(VOID) COutPin::SetFirstSample(
     _In_ BOOL fisrtSample )
 {
-    m_firstSample = fisrtSample;
+    (VOID)InterlockedExchange( &m_firstSample, fisrtSample ? TRUE : FALSE );
 }
 
 /*++
@@ -600,7 +883,13 @@ DeviceStreamState COutPin::SetState(DeviceStreamState state)
 {
     CAutoLock Lock(lock());
     DeviceStreamState oldState = m_state->State();
-    m_state = m_states[state];
+    if ( state != DeviceStreamState_Stop )
+    {
+        m_queuesSealed = TRUE;
+    }
+    InterlockedExchangePointer( ( PVOID* )&m_state, m_states[state] );
+    // a producer blocked on a full queue finds the pin closed
+    (VOID)SetEvent( m_queueSpace );
     return oldState;
         
 }
@@ -621,6 +910,7 @@ HRESULT COutPin::FlushQueues()
         CPinQueue *que = m_queues[ dwIndex ];
         que->Clear();
     }
+    (VOID)SetEvent( m_queueSpace );
 
      DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr);
     return hr;
@@ -726,8 +1016,12 @@ STDMETHODIMP COutPin::ProcessOutput(_In_  DWORD dwFlags,
     BOOL            IsSkipSample = FALSE;
     UNREFERENCED_PARAMETER(pdwStatus);
     UNREFERENCED_PARAMETER(dwFlags);
-    CAutoLock lock(lock());
-    DMFTCHECKHR_GOTO(m_state->Open(), done);
+    //
+    // No pin lock here: the pin lock is held by ProcessInput while the tee converts a
+    // sample, the queues pop without a lock. m_queues is walked unlocked
+    // because AddPin refuses new queues once the pin has left the stopped state
+    //
+    DMFTCHECKHR_GOTO(CurrentState()->Open(), done);
    
     //
     //Check if we are an image photo pin. The process output in that case should only proceed if trigger has been sent
@@ -757,10 +1051,15 @@ STDMETHODIMP COutPin::ProcessOutput(_In_  DWORD dwFlags,
         {
             break;
         }
+        (VOID)SetEvent( m_queueSpace );
 
         MFTIME llTime = 0L;
         
-        if (FAILED(pSample->GetSampleTime(&llTime)))
+        //
+        //Other pins may hold the same sample, take a private one before writing to it.
+        //Without one the shared sample goes out untouched
+        //
+        if (FAILED(pSample->GetSampleTime(&llTime)) && SUCCEEDED(MakeSampleWritable(&pSample)))
         {
             llTime = MFGetSystemTime();
             pSample->SetSampleTime(llTime);
@@ -768,10 +1067,20 @@ STDMETHODIMP COutPin::ProcessOutput(_In_  DWORD dwFlags,
 
         if (!IsSkipSample)
         {
-            if (m_firstSample)
+            //
+            //Only one of two concurrent pulls takes the discontinuity
+            //
+            if (InterlockedExchange(&m_firstSample, FALSE))
             {
-                pSample->SetUINT32(MFSampleExtension_Discontinuity,TRUE);
-                SetFirstSample(FALSE);
+                if (SUCCEEDED(MakeSampleWritable(&pSample)))
+                {
+                    pSample->SetUINT32(MFSampleExtension_Discontinuity,TRUE);
+                }
+                else
+                {
+                    //The next sample carries the discontinuity instead
+                    (VOID)InterlockedExchange(&m_firstSample, TRUE);
+                }
             }
 
             //
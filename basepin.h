@@ -8,12 +8,14 @@
 #pragma once
 #include "stdafx.h"
 #include "common.h"
+#include "mediatypeindex.h"
 
 
 extern DeviceStreamState pinStateTransition[][4];
 
 
 class CPinQueue;
+class CConversionCache;
 class CPinState;
 class CMultipinMft;
 
@@ -427,6 +429,7 @@ protected:
         {
             return m_lock;
         }
+        STDMETHODIMP RebuildMediaTypeIndex(); /*After m_listOfMediaTypes is reordered, with the pin lock held*/
         IMFMediaTypeArray        m_listOfMediaTypes;
         ComPtr<IMFAttributes>   m_spAttributes;
         ComPtr<IKsControl>      m_spIkscontrol;
@@ -435,6 +438,8 @@ private:
     ULONG                        m_StreamId;                  /*Device Stream Id*/
     CCritSec                     m_lock;                      /*This is only used to change the reference count i.e. active users of this stream*/
     ComPtr<IMFMediaType>        m_setMediaType;
+    CMediaTypeIndex              m_mediaTypeIndex;            /*m_listOfMediaTypes by canonical key*/
+    BOOL                         m_fMediaTypesIndexed;        /*FALSE once an index update failed, the list is scanned then*/
     ComPtr<CMultipinMft>        m_Parent;
     ULONG                        m_nRefCount;
 };
@@ -498,6 +503,10 @@ public:
     {
         return m_preferredStreamState;
     }
+    __inline CConversionCache* Conversions()
+    {
+        return m_pConversions;
+    }
 
 protected:
     ComPtr<IMFTransform>        m_spSourceTransform;  /*Source Transform*/
@@ -505,10 +514,12 @@ private:
     GUID                        m_stStreamType;      /*GUID representing the GUID*/
     ULONG                       m_activeStreamCount; /*Set when this stream is active*/
     vector<CBasePin*>           m_outpins;
+    CTopologySnapshot< CBasePinArray > m_outpinRoutes; /*m_outpins as SendSample reads it, republished by ConnectPin*/
     DeviceStreamState           m_state;
     DeviceStreamState           m_preferredStreamState;
     ComPtr<IMFMediaType>        m_prefferedMediaType;
     HANDLE                      m_waitInputMediaTypeWaiter; /*Set when the input media type is changed*/
+    CConversionCache*           m_pConversions;     /*Lets the output pins' tees share conversions of a sample*/
 };
 
 
@@ -520,7 +531,8 @@ public:
          _In_     IKsControl*   iksControl=NULL);
     ~COutPin();
     STDMETHODIMP AddPin(
-        _In_ DWORD pinId
+        _In_ DWORD pinId,
+        _In_opt_ CConversionCache *pConversions = nullptr
         );
     STDMETHODIMP AddSample(
         _In_ IMFSample *pSample,
@@ -566,13 +578,44 @@ public:
     STDMETHODIMP_(VOID) SetFirstSample(
         _In_    BOOL 
         );
+    STDMETHODIMP SetQueuePolicy(
+        _In_    DMFT_QUEUE_POLICY policy,
+        _In_    ULONG ulMaxDepth
+        );
+    STDMETHODIMP_(VOID) GetQueuePolicy(
+        _Out_   DMFT_QUEUE_POLICY *pPolicy,
+        _Out_   ULONG *pulMaxDepth
+        );
+    STDMETHODIMP_(VOID) GetQueueStatistics(
+        _Out_   ULONGLONG *pullQueued,
+        _Out_   ULONGLONG *pullDropped,
+        _Out_   ULONG *pulDepth,
+        _Out_   ULONG *pulHighWater
+        );
 
     
 private:
+    BOOL QueueBlocked(
+        _In_    CBasePin *pPin
+        );
+    //
+    // ProcessOutput reads the state without the pin lock, SetState swaps it atomically
+    //
+    __inline CPinState* CurrentState()
+    {
+        return ( CPinState* )InterlockedCompareExchangePointer( ( PVOID* )&m_state, NULL, NULL );
+    }
+    STDMETHODIMP_(CPinQueue*) QueueFor( _In_ CBasePin *pPin );
+
     vector< CPinState *>      m_states;          /*Array of possible states*/
     CPinState*                m_state;            /*Current state*/
     vector< CPinQueue *>      m_queues;           /*List of Queues corresponding to input pins*/
-    BOOL                      m_firstSample;
+    CTopologySnapshot< vector< CPinQueue* > > m_queueRoutes; /*m_queues indexed by input pin stream id*/
+    volatile LONG             m_firstSample;      /*Swapped with InterlockedExchange, ProcessOutput runs without the pin lock*/
+    BOOL                      m_queuesSealed;     /*Set once the pin leaves Stop, m_queues no longer changes*/
+    DMFT_QUEUE_POLICY         m_queuePolicy;      /*Applied to every queue of the pin*/
+    ULONG                     m_queueMaxDepth;
+    HANDLE                    m_queueSpace;       /*Set when ProcessOutput or a flush makes room*/
    friend class CPinState;
 };
 
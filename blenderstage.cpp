@@ -0,0 +1,65 @@
+#include "blenderstage.h"
+
+CBlenderStage::CBlenderStage()
+: m_type(CBlenderWrapper::PANORAMIC_BLENDER)
+{
+}
+
+CBlenderStage::~CBlenderStage()
+{
+	m_blender = nullptr;
+}
+
+void CBlenderStage::configure(const BlenderParams& params, CBlenderWrapper::BLENDER_TYPE type)
+{
+	m_params = params;
+	m_params.input_data = nullptr;
+	m_params.output_data = nullptr;
+	m_type = type;
+}
+
+bool CBlenderStage::initializeDevice()
+{
+	m_blender.reset(new CBlenderWrapper());
+	m_blender->capabilityAssessment();
+	m_blender->getSingleInstance(BLENDER_FOUR_CHANNELS);
+	if (!m_blender->initializeDevice())
+	{
+		m_blender = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void CBlenderStage::outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const
+{
+	out_width = m_params.output_width ? m_params.output_width : in_width;
+	out_height = m_params.output_height ? m_params.output_height : in_height;
+}
+
+bool CBlenderStage::process(const FrameDesc& input, FrameDesc& output)
+{
+	if (!m_blender)
+	{
+		return frameCopy(input, output);
+	}
+
+	//
+	// The blender only understands tightly packed frames
+	//
+	if (input.planes[0].stride != input.width * 4 || output.planes[0].stride != output.width * 4)
+	{
+		return false;
+	}
+
+	m_params.input_width = input.width;
+	m_params.input_height = input.height;
+	m_params.output_width = output.width;
+	m_params.output_height = output.height;
+	m_params.input_data = input.planes[0].data;
+	m_params.output_data = output.planes[0].data;
+	bool ok = m_blender->runImageBlender(m_params, m_type);
+	m_params.input_data = nullptr;
+	m_params.output_data = nullptr;
+	return ok;
+}
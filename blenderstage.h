@@ -0,0 +1,35 @@
+#ifndef BLENDER_STAGE_H
+#define BLENDER_STAGE_H
+
+#include "framecore.h"
+#include "BlenderWrapper.h"
+#include <memory>
+
+//
+// Stitch stage backed by CBlenderWrapper (CUDA / OpenCL / CPU blender from
+// Blender.lib). Until the blender has been brought up with initializeDevice()
+// the stage passes the equirectangular frame through unchanged.
+//
+class CBlenderStage : public CFrameStage
+{
+public:
+	CBlenderStage();
+	~CBlenderStage();
+
+	void configure(const BlenderParams& params, CBlenderWrapper::BLENDER_TYPE type);
+	bool initializeDevice();
+	bool hasDevice() const { return m_blender != nullptr; }
+
+	const char* name() const { return "blender"; }
+	FRAME_FORMAT inputFormat() const { return FRAME_FORMAT_BGRA; }
+	FRAME_FORMAT outputFormat() const { return FRAME_FORMAT_BGRA; }
+	void outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const;
+	bool process(const FrameDesc& input, FrameDesc& output);
+
+private:
+	std::unique_ptr<CBlenderWrapper>    m_blender;
+	BlenderParams                       m_params;
+	CBlenderWrapper::BLENDER_TYPE       m_type;
+};
+
+#endif
@@ -0,0 +1,157 @@
+//
+// Benchmark of the colour conversion kernels. Every kernel set the CPU offers
+// is timed against the scalar reference at full equirectangular resolution and
+// its output is compared byte for byte with the reference, for every matrix
+// and range. Exits with 1 when a kernel is not bit exact.
+//
+// usage: colorbench [-w width] [-h height] [-n iterations]
+//
+
+#include "framecore.h"
+#include "colorconvert.h"
+#include "cpufeatures.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock BenchClock;
+typedef bool (*ConvertFunc)(const FrameDesc& input, FrameDesc& output, COLOR_MATRIX matrix, COLOR_RANGE range);
+
+struct KernelSet {
+	const char*     name;
+	unsigned int    mask;
+};
+
+static const KernelSet s_kernels[] = {
+	{ "c", 0 },
+	{ "sse2", CPU_FEATURE_SSE2 },
+	{ "avx2", CPU_FEATURE_SSE2 | CPU_FEATURE_AVX2 },
+};
+
+static void fillRandom(CFrameBuffer& frame, unsigned int seed)
+{
+	srand(seed);
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		frame.data()[i] = (unsigned char)(rand() >> 4);
+	}
+}
+
+static bool framesEqual(const FrameDesc& a, const FrameDesc& b)
+{
+	for (unsigned int plane = 0; plane < framePlaneCount(a.format); plane++)
+	{
+		unsigned int rows = plane ? (a.height + 1) / 2 : a.height;
+		size_t row_bytes = a.format == FRAME_FORMAT_BGRA ? (size_t)a.width * 4 :
+			(plane == 0 ? a.width : (a.format == FRAME_FORMAT_NV12 ? ((a.width + 1) / 2) * 2 : (a.width + 1) / 2));
+		for (unsigned int y = 0; y < rows; y++)
+		{
+			if (memcmp(a.planes[plane].data + (size_t)y * a.planes[plane].stride,
+				b.planes[plane].data + (size_t)y * b.planes[plane].stride, row_bytes))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//
+// Runs one conversion with every kernel set, returns false on a mismatch
+//
+static bool benchConversion(const char* title, ConvertFunc convert, FRAME_FORMAT in_format, FRAME_FORMAT out_format,
+	unsigned int width, unsigned int height, unsigned int iterations)
+{
+	CFrameBuffer input, reference, output;
+	if (!input.allocate(in_format, width, height) || !reference.allocate(out_format, width, height) ||
+		!output.allocate(out_format, width, height))
+	{
+		printf("%s: out of memory\n", title);
+		return false;
+	}
+	fillRandom(input, width * 31 + height);
+
+	bool exact = true;
+	double reference_ms = 0;
+	printf("%s %ux%u\n", title, width, height);
+	for (size_t k = 0; k < sizeof(s_kernels) / sizeof(s_kernels[0]); k++)
+	{
+		if ((cpuFeatures() & s_kernels[k].mask) != s_kernels[k].mask)
+		{
+			continue;
+		}
+		setCpuFeatureMask(s_kernels[k].mask);
+
+		// bit exactness against the scalar kernels for every matrix and range
+		bool kernel_exact = true;
+		for (int matrix = COLOR_MATRIX_BT601; matrix <= COLOR_MATRIX_BT709; matrix++)
+		{
+			for (int range = COLOR_RANGE_LIMITED; range <= COLOR_RANGE_FULL; range++)
+			{
+				setCpuFeatureMask(0);
+				convert(input.desc(), reference.desc(), (COLOR_MATRIX)matrix, (COLOR_RANGE)range);
+				setCpuFeatureMask(s_kernels[k].mask);
+				convert(input.desc(), output.desc(), (COLOR_MATRIX)matrix, (COLOR_RANGE)range);
+				kernel_exact = kernel_exact && framesEqual(reference.desc(), output.desc());
+			}
+		}
+
+		double best_ms = 1e30, total_ms = 0;
+		for (unsigned int i = 0; i < iterations; i++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			convert(input.desc(), output.desc(), COLOR_MATRIX_BT601, COLOR_RANGE_LIMITED);
+			double ms = std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+			total_ms += ms;
+			best_ms = ms < best_ms ? ms : best_ms;
+		}
+		if (k == 0)
+		{
+			reference_ms = best_ms;
+		}
+		setCpuFeatureMask(~0u);
+
+		printf("  %-5s best %7.3f ms  avg %7.3f ms  x%.2f  %s\n", s_kernels[k].name, best_ms, total_ms / iterations,
+			reference_ms / best_ms, kernel_exact ? "bit exact" : "MISMATCH");
+		exact = exact && kernel_exact;
+	}
+	return exact;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 3040;
+	unsigned int height = 1520;
+	unsigned int iterations = 50;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			width = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-h"))
+		{
+			height = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			iterations = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+	if (width == 0 || height == 0 || iterations == 0)
+	{
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	bool exact = benchConversion("i420->bgra", convertI420ToBGRA, FRAME_FORMAT_I420, FRAME_FORMAT_BGRA, width, height, iterations);
+	exact = benchConversion("bgra->nv12", convertBGRAToNV12, FRAME_FORMAT_BGRA, FRAME_FORMAT_NV12, width, height, iterations) && exact;
+
+	// odd sizes exercise the tails of the SIMD rows
+	exact = benchConversion("i420->bgra", convertI420ToBGRA, FRAME_FORMAT_I420, FRAME_FORMAT_BGRA, 37, 19, 1) && exact;
+	exact = benchConversion("bgra->nv12", convertBGRAToNV12, FRAME_FORMAT_BGRA, FRAME_FORMAT_NV12, 37, 19, 1) && exact;
+	return exact ? 0 : 1;
+}
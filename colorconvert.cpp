@@ -0,0 +1,163 @@
+#include "colorconvert.h"
+#include "colorkernels.h"
+
+static inline unsigned char clamp255(int value)
+{
+	return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+//
+// Indexed by [COLOR_MATRIX][COLOR_RANGE]
+//
+static const YuvToRgbCoeffs s_yuvToRgb[2][2] = {
+	{ { 16, 9539, 16525, -3209, -6660, 13075 }, { 0, 8192, 14516, -2819, -5850, 11485 } },
+	{ { 16, 9539, 17305, -1747, -4366, 14686 }, { 0, 8192, 15201, -1535, -3835, 12901 } },
+};
+
+void i420ToBGRARow_C(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs)
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		int y = (src_y[x] - coeffs.y_offset) * coeffs.yc + (1 << 12);
+		int u = src_u[x / 2] - 128;
+		int v = src_v[x / 2] - 128;
+
+		dst_bgra[4 * x + 0] = clamp255((y + coeffs.ub * u) >> 13);
+		dst_bgra[4 * x + 1] = clamp255((y + coeffs.ug * u + coeffs.vg * v) >> 13);
+		dst_bgra[4 * x + 2] = clamp255((y + coeffs.vr * v) >> 13);
+		dst_bgra[4 * x + 3] = 0xff;
+	}
+}
+
+static I420ToBGRARowFunc selectI420ToBGRARow()
+{
+#if (defined CPU_X86)
+	unsigned int features = cpuFeatures();
+	if (features & CPU_FEATURE_AVX2)
+	{
+		return i420ToBGRARow_AVX2;
+	}
+	if (features & CPU_FEATURE_SSE2)
+	{
+		return i420ToBGRARow_SSE2;
+	}
+#endif
+	return i420ToBGRARow_C;
+}
+
+const char* colorConvertKernelName()
+{
+	unsigned int features = cpuFeatures();
+	if (features & CPU_FEATURE_AVX2)
+	{
+		return "avx2";
+	}
+	if (features & CPU_FEATURE_SSE2)
+	{
+		return "sse2";
+	}
+	return "c";
+}
+
+bool convertI420ToBGRA(const FrameDesc& input, FrameDesc& output, COLOR_MATRIX matrix, COLOR_RANGE range)
+{
+	if (input.format != FRAME_FORMAT_I420 || output.format != FRAME_FORMAT_BGRA ||
+		input.width != output.width || input.height != output.height)
+	{
+		return false;
+	}
+
+	const YuvToRgbCoeffs& coeffs = s_yuvToRgb[matrix == COLOR_MATRIX_BT709][range == COLOR_RANGE_FULL];
+	I420ToBGRARowFunc row = selectI420ToBGRARow();
+	for (unsigned int y = 0; y < input.height; y++)
+	{
+		row(input.planes[0].data + (size_t)y * input.planes[0].stride,
+			input.planes[1].data + (size_t)(y / 2) * input.planes[1].stride,
+			input.planes[2].data + (size_t)(y / 2) * input.planes[2].stride,
+			output.planes[0].data + (size_t)y * output.planes[0].stride,
+			input.width, coeffs);
+	}
+	output.sample_time = input.sample_time;
+	output.sample_duration = input.sample_duration;
+	return true;
+}
+
+//
+// Indexed by [COLOR_MATRIX][COLOR_RANGE]
+//
+static const RgbToYuvCoeffs s_rgbToYuv[2][2] = {
+	{
+		{ 16, 1604, 8260, 4207, 7196, -4768, -2428, -1170, -6026, 7196 },
+		{ 0, 1868, 9617, 4899, 8192, -5427, -2765, -1332, -6860, 8192 },
+	},
+	{
+		{ 16, 1016, 10064, 2991, 7196, -5547, -1649, -660, -6536, 7196 },
+		{ 0, 1183, 11718, 3483, 8192, -6315, -1877, -751, -7441, 8192 },
+	},
+};
+
+void bgraToYRow_C(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		const unsigned char* p = src_bgra + 4 * x;
+		dst_y[x] = clamp255(((coeffs.yb * p[0] + coeffs.yg * p[1] + coeffs.yr * p[2] + (1 << 13)) >> 14) + coeffs.y_offset);
+	}
+}
+
+void bgraToUVRow_C(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	for (unsigned int x = 0; x < width; x += 2)
+	{
+		// the last column of an odd width is counted twice
+		unsigned int x1 = (x + 1 < width) ? x + 1 : x;
+		int b = src_bgra0[4 * x] + src_bgra0[4 * x1] + src_bgra1[4 * x] + src_bgra1[4 * x1];
+		int g = src_bgra0[4 * x + 1] + src_bgra0[4 * x1 + 1] + src_bgra1[4 * x + 1] + src_bgra1[4 * x1 + 1];
+		int r = src_bgra0[4 * x + 2] + src_bgra0[4 * x1 + 2] + src_bgra1[4 * x + 2] + src_bgra1[4 * x1 + 2];
+
+		dst_uv[x] = clamp255(((coeffs.ub * b + coeffs.ug * g + coeffs.ur * r + (1 << 15)) >> 16) + 128);
+		dst_uv[x + 1] = clamp255(((coeffs.vb * b + coeffs.vg * g + coeffs.vr * r + (1 << 15)) >> 16) + 128);
+	}
+}
+
+bool convertBGRAToNV12(const FrameDesc& input, FrameDesc& output, COLOR_MATRIX matrix, COLOR_RANGE range)
+{
+	if (input.format != FRAME_FORMAT_BGRA || output.format != FRAME_FORMAT_NV12 ||
+		input.width != output.width || input.height != output.height)
+	{
+		return false;
+	}
+
+	const RgbToYuvCoeffs& coeffs = s_rgbToYuv[matrix == COLOR_MATRIX_BT709][range == COLOR_RANGE_FULL];
+	BGRAToYRowFunc yRow = bgraToYRow_C;
+	BGRAToUVRowFunc uvRow = bgraToUVRow_C;
+#if (defined CPU_X86)
+	unsigned int features = cpuFeatures();
+	if (features & CPU_FEATURE_AVX2)
+	{
+		yRow = bgraToYRow_AVX2;
+		uvRow = bgraToUVRow_AVX2;
+	}
+	else if (features & CPU_FEATURE_SSE2)
+	{
+		yRow = bgraToYRow_SSE2;
+		uvRow = bgraToUVRow_SSE2;
+	}
+#endif
+
+	for (unsigned int y = 0; y < input.height; y++)
+	{
+		const unsigned char* src = input.planes[0].data + (size_t)y * input.planes[0].stride;
+		yRow(src, output.planes[0].data + (size_t)y * output.planes[0].stride, input.width, coeffs);
+		if ((y & 1) == 0)
+		{
+			const unsigned char* below = (y + 1 < input.height) ? src + input.planes[0].stride : src;
+			uvRow(src, below, output.planes[1].data + (size_t)(y / 2) * output.planes[1].stride, input.width, coeffs);
+		}
+	}
+	output.sample_time = input.sample_time;
+	output.sample_duration = input.sample_duration;
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+#include "framecore.h"
+
+enum COLOR_MATRIX {
+	COLOR_MATRIX_BT601 = 0,
+	COLOR_MATRIX_BT709 = 1,
+};
+
+enum COLOR_RANGE {
+	COLOR_RANGE_LIMITED = 0,    // Y 16..235, UV 16..240
+	COLOR_RANGE_FULL    = 1,    // Y and UV 0..255
+};
+
+//
+// Colour space conversion kernels of the stitch path. The kernels are picked
+// at run time from cpuFeatures() (AVX2, SSE2, scalar); all of them produce the
+// same bytes. Frames may have any stride, the defaults are what the video
+// processor MFT assumed for the camera's I420.
+//
+bool convertI420ToBGRA(const FrameDesc& input, FrameDesc& output,
+	COLOR_MATRIX matrix = COLOR_MATRIX_BT601, COLOR_RANGE range = COLOR_RANGE_LIMITED);
+bool convertBGRAToNV12(const FrameDesc& input, FrameDesc& output,
+	COLOR_MATRIX matrix = COLOR_MATRIX_BT601, COLOR_RANGE range = COLOR_RANGE_LIMITED);
+
+// Name of the kernel set the converters currently dispatch to ("avx2", "sse2" or "c")
+const char* colorConvertKernelName();
+
+class CI420ToBGRAStage : public CFrameStage
+{
+public:
+	CI420ToBGRAStage(COLOR_MATRIX matrix = COLOR_MATRIX_BT601, COLOR_RANGE range = COLOR_RANGE_LIMITED)
+	: m_matrix(matrix), m_range(range) {}
+
+	const char* name() const { return "i420_to_bgra"; }
+	FRAME_FORMAT inputFormat() const { return FRAME_FORMAT_I420; }
+	FRAME_FORMAT outputFormat() const { return FRAME_FORMAT_BGRA; }
+	bool process(const FrameDesc& input, FrameDesc& output) { return convertI420ToBGRA(input, output, m_matrix, m_range); }
+
+private:
+	COLOR_MATRIX    m_matrix;
+	COLOR_RANGE     m_range;
+};
+
+class CBGRAToNV12Stage : public CFrameStage
+{
+public:
+	CBGRAToNV12Stage(COLOR_MATRIX matrix = COLOR_MATRIX_BT601, COLOR_RANGE range = COLOR_RANGE_LIMITED)
+	: m_matrix(matrix), m_range(range) {}
+
+	const char* name() const { return "bgra_to_nv12"; }
+	FRAME_FORMAT inputFormat() const { return FRAME_FORMAT_BGRA; }
+	FRAME_FORMAT outputFormat() const { return FRAME_FORMAT_NV12; }
+	bool process(const FrameDesc& input, FrameDesc& output) { return convertBGRAToNV12(input, output, m_matrix, m_range); }
+
+private:
+	COLOR_MATRIX    m_matrix;
+	COLOR_RANGE     m_range;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef COLOR_KERNELS_H
+#define COLOR_KERNELS_H
+
+//
+// Row kernels behind colorconvert.h. Every SIMD kernel writes exactly the same
+// bytes as its _C counterpart and hands the leftover pixels of a row to it.
+//
+
+#include "cpufeatures.h"
+
+//
+// YUV to RGB in Q13 fixed point:
+//   Y' = (Y - y_offset) * yc + 4096
+//   B = (Y' + ub * (U - 128)) >> 13
+//   G = (Y' + ug * (U - 128) + vg * (V - 128)) >> 13
+//   R = (Y' + vr * (V - 128)) >> 13
+//
+typedef struct _YuvToRgbCoeffs {
+	int     y_offset;
+	short   yc;
+	short   ub;
+	short   ug;
+	short   vg;
+	short   vr;
+}YuvToRgbCoeffs;
+
+typedef void (*I420ToBGRARowFunc)(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs);
+
+void i420ToBGRARow_C(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs);
+#if (defined CPU_X86)
+void i420ToBGRARow_SSE2(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs);
+void i420ToBGRARow_AVX2(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs);
+#endif
+
+//
+// RGB to YUV in Q14 fixed point. Chroma comes from the sum of a 2x2 block:
+//   Y = ((yb * B + yg * G + yr * R + (1 << 13)) >> 14) + y_offset
+//   U = ((ub * sum(B) + ug * sum(G) + ur * sum(R) + (1 << 15)) >> 16) + 128
+//   V = ((vb * sum(B) + vg * sum(G) + vr * sum(R) + (1 << 15)) >> 16) + 128
+//
+typedef struct _RgbToYuvCoeffs {
+	int     y_offset;
+	short   yb, yg, yr;
+	short   ub, ug, ur;
+	short   vb, vg, vr;
+}RgbToYuvCoeffs;
+
+typedef void (*BGRAToYRowFunc)(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs);
+
+// src_bgra1 is the row below src_bgra0, or src_bgra0 again for the last row of an odd height
+typedef void (*BGRAToUVRowFunc)(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs);
+
+void bgraToYRow_C(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs);
+void bgraToUVRow_C(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs);
+#if (defined CPU_X86)
+void bgraToYRow_SSE2(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs);
+void bgraToUVRow_SSE2(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs);
+void bgraToYRow_AVX2(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs);
+void bgraToUVRow_AVX2(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs);
+#endif
+
+#endif
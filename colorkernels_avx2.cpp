@@ -0,0 +1,162 @@
+//
+// Built with AVX2 code generation (-mavx2, /arch:AVX2). Only reached through
+// the cpuFeatures() dispatch in colorconvert.cpp.
+//
+#include "colorkernels.h"
+
+#if (defined CPU_X86)
+#include <immintrin.h>
+
+static inline __m256i pairCoeffs(short lo, short hi)
+{
+	return _mm256_set1_epi32((int)(((unsigned int)(unsigned short)hi << 16) | (unsigned short)lo));
+}
+
+static inline __m256i yuvChannel(__m256i luma_lo, __m256i luma_hi, __m256i chroma)
+{
+	__m256i lo = _mm256_srai_epi32(_mm256_add_epi32(luma_lo, _mm256_unpacklo_epi32(chroma, chroma)), 13);
+	__m256i hi = _mm256_srai_epi32(_mm256_add_epi32(luma_hi, _mm256_unpackhi_epi32(chroma, chroma)), 13);
+	return _mm256_packs_epi32(lo, hi);
+}
+
+void i420ToBGRARow_AVX2(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i alpha = _mm256_set1_epi16(0xff);
+	const __m256i y_offset = _mm256_set1_epi16((short)coeffs.y_offset);
+	const __m256i uv_bias = _mm256_set1_epi16(128);
+	const __m256i y_coeffs = pairCoeffs(coeffs.yc, 1 << 12);
+	const __m256i b_coeffs = pairCoeffs(coeffs.ub, 0);
+	const __m256i g_coeffs = pairCoeffs(coeffs.ug, coeffs.vg);
+	const __m256i r_coeffs = pairCoeffs(0, coeffs.vr);
+
+	//
+	// 16 pixels per iteration. The 128 bit lanes hold pixels 0-3|8-11 and
+	// 4-7|12-15 until the final permute puts them back in order.
+	//
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i y16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src_y + x))), y_offset);
+		__m128i uv8 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src_u + x / 2)), _mm_loadl_epi64((const __m128i*)(src_v + x / 2)));
+		__m256i uv16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(uv8), uv_bias);
+
+		__m256i luma_lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y16, one), y_coeffs);
+		__m256i luma_hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y16, one), y_coeffs);
+
+		__m256i b16 = yuvChannel(luma_lo, luma_hi, _mm256_madd_epi16(uv16, b_coeffs));
+		__m256i g16 = yuvChannel(luma_lo, luma_hi, _mm256_madd_epi16(uv16, g_coeffs));
+		__m256i r16 = yuvChannel(luma_lo, luma_hi, _mm256_madd_epi16(uv16, r_coeffs));
+
+		__m256i br = _mm256_packus_epi16(b16, r16);
+		__m256i ga = _mm256_packus_epi16(g16, alpha);
+		__m256i bg = _mm256_unpacklo_epi8(br, ga);
+		__m256i ra = _mm256_unpackhi_epi8(br, ga);
+		__m256i lo = _mm256_unpacklo_epi16(bg, ra);
+		__m256i hi = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256((__m256i*)(dst_bgra + 4 * x), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst_bgra + 4 * x + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	if (x < width)
+	{
+		i420ToBGRARow_SSE2(src_y + x, src_u + x / 2, src_v + x / 2, dst_bgra + 4 * x, width - x, coeffs);
+	}
+}
+
+static inline __m256i pixelSum2(__m256i m0, __m256i m1)
+{
+	__m256 f0 = _mm256_castsi256_ps(m0), f1 = _mm256_castsi256_ps(m1);
+	return _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+static inline __m256i horizontalSum4(__m256i m0, __m256i m1, __m256i m2, __m256i m3)
+{
+	return pixelSum2(pixelSum2(m0, m1), pixelSum2(m2, m3));
+}
+
+// Packs 16 in-lane shuffled 16 bit values (64 bit groups 0,2,1,3) to bytes in order
+static inline __m128i packOrdered(__m256i v16)
+{
+	v16 = _mm256_permute4x64_epi64(v16, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm_packus_epi16(_mm256_castsi256_si128(v16), _mm256_extracti128_si256(v16, 1));
+}
+
+void bgraToYRow_AVX2(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i y_coeffs = _mm256_setr_epi16(coeffs.yb, coeffs.yg, coeffs.yr, 0, coeffs.yb, coeffs.yg, coeffs.yr, 0,
+		coeffs.yb, coeffs.yg, coeffs.yr, 0, coeffs.yb, coeffs.yg, coeffs.yr, 0);
+	const __m256i round = _mm256_set1_epi32(1 << 13);
+	const __m256i y_offset = _mm256_set1_epi16((short)coeffs.y_offset);
+
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i p0 = _mm256_loadu_si256((const __m256i*)(src_bgra + 4 * x));
+		__m256i p1 = _mm256_loadu_si256((const __m256i*)(src_bgra + 4 * x + 32));
+
+		// pixels 0-3|4-7 and 8-11|12-15
+		__m256i y0 = pixelSum2(_mm256_madd_epi16(_mm256_unpacklo_epi8(p0, zero), y_coeffs), _mm256_madd_epi16(_mm256_unpackhi_epi8(p0, zero), y_coeffs));
+		__m256i y1 = pixelSum2(_mm256_madd_epi16(_mm256_unpacklo_epi8(p1, zero), y_coeffs), _mm256_madd_epi16(_mm256_unpackhi_epi8(p1, zero), y_coeffs));
+		y0 = _mm256_srai_epi32(_mm256_add_epi32(y0, round), 14);
+		y1 = _mm256_srai_epi32(_mm256_add_epi32(y1, round), 14);
+
+		__m256i y16 = _mm256_add_epi16(_mm256_packs_epi32(y0, y1), y_offset);
+		_mm_storeu_si128((__m128i*)(dst_y + x), packOrdered(y16));
+	}
+
+	if (x < width)
+	{
+		bgraToYRow_SSE2(src_bgra + 4 * x, dst_y + x, width - x, coeffs);
+	}
+}
+
+void bgraToUVRow_AVX2(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i u_coeffs = _mm256_setr_epi16(coeffs.ub, coeffs.ug, coeffs.ur, 0, coeffs.ub, coeffs.ug, coeffs.ur, 0,
+		coeffs.ub, coeffs.ug, coeffs.ur, 0, coeffs.ub, coeffs.ug, coeffs.ur, 0);
+	const __m256i v_coeffs = _mm256_setr_epi16(coeffs.vb, coeffs.vg, coeffs.vr, 0, coeffs.vb, coeffs.vg, coeffs.vr, 0,
+		coeffs.vb, coeffs.vg, coeffs.vr, 0, coeffs.vb, coeffs.vg, coeffs.vr, 0);
+	const __m256i round = _mm256_set1_epi32(1 << 15);
+	const __m256i uv_bias = _mm256_set1_epi16(128);
+
+	//
+	// 16 pixels of two rows give 8 UV pairs, in lane order 0,1,4,5|2,3,6,7
+	//
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i a0 = _mm256_loadu_si256((const __m256i*)(src_bgra0 + 4 * x));
+		__m256i a1 = _mm256_loadu_si256((const __m256i*)(src_bgra0 + 4 * x + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)(src_bgra1 + 4 * x));
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(src_bgra1 + 4 * x + 32));
+
+		__m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i s1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i s2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		__m256i s3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+
+		__m256i u = horizontalSum4(_mm256_madd_epi16(s0, u_coeffs), _mm256_madd_epi16(s1, u_coeffs),
+			_mm256_madd_epi16(s2, u_coeffs), _mm256_madd_epi16(s3, u_coeffs));
+		__m256i v = horizontalSum4(_mm256_madd_epi16(s0, v_coeffs), _mm256_madd_epi16(s1, v_coeffs),
+			_mm256_madd_epi16(s2, v_coeffs), _mm256_madd_epi16(s3, v_coeffs));
+		u = _mm256_srai_epi32(_mm256_add_epi32(u, round), 16);
+		v = _mm256_srai_epi32(_mm256_add_epi32(v, round), 16);
+
+		__m256i uv16 = _mm256_packs_epi32(u, v);
+		uv16 = _mm256_add_epi16(_mm256_unpacklo_epi16(uv16, _mm256_srli_si256(uv16, 8)), uv_bias);
+		_mm_storeu_si128((__m128i*)(dst_uv + x), packOrdered(uv16));
+	}
+
+	if (x < width)
+	{
+		bgraToUVRow_SSE2(src_bgra0 + 4 * x, src_bgra1 + 4 * x, dst_uv + x, width - x, coeffs);
+	}
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "colorkernels.h"
+
+#if (defined CPU_X86)
+#include <emmintrin.h>
+#include <string.h>
+
+// Two 16 bit coefficients for _mm_madd_epi16, lo multiplies the even lane
+static inline __m128i pairCoeffs(short lo, short hi)
+{
+	return _mm_set1_epi32((int)(((unsigned int)(unsigned short)hi << 16) | (unsigned short)lo));
+}
+
+static inline __m128i loadChroma4(const unsigned char* src)
+{
+	int value;
+	memcpy(&value, src, sizeof(value));
+	return _mm_cvtsi32_si128(value);
+}
+
+// Adds the chroma term of pixels 0..7 to their luma term, shifts and packs to 16 bit
+static inline __m128i yuvChannel(__m128i luma_lo, __m128i luma_hi, __m128i chroma)
+{
+	__m128i lo = _mm_srai_epi32(_mm_add_epi32(luma_lo, _mm_unpacklo_epi32(chroma, chroma)), 13);
+	__m128i hi = _mm_srai_epi32(_mm_add_epi32(luma_hi, _mm_unpackhi_epi32(chroma, chroma)), 13);
+	return _mm_packs_epi32(lo, hi);
+}
+
+void i420ToBGRARow_SSE2(const unsigned char* src_y, const unsigned char* src_u, const unsigned char* src_v,
+	unsigned char* dst_bgra, unsigned int width, const YuvToRgbCoeffs& coeffs)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i alpha = _mm_set1_epi16(0xff);
+	const __m128i y_offset = _mm_set1_epi16((short)coeffs.y_offset);
+	const __m128i uv_bias = _mm_set1_epi16(128);
+	const __m128i y_coeffs = pairCoeffs(coeffs.yc, 1 << 12);
+	const __m128i b_coeffs = pairCoeffs(coeffs.ub, 0);
+	const __m128i g_coeffs = pairCoeffs(coeffs.ug, coeffs.vg);
+	const __m128i r_coeffs = pairCoeffs(0, coeffs.vr);
+
+	unsigned int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i y16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src_y + x)), zero), y_offset);
+		__m128i uv8 = _mm_unpacklo_epi8(loadChroma4(src_u + x / 2), loadChroma4(src_v + x / 2));
+		__m128i uv16 = _mm_sub_epi16(_mm_unpacklo_epi8(uv8, zero), uv_bias);
+
+		__m128i luma_lo = _mm_madd_epi16(_mm_unpacklo_epi16(y16, one), y_coeffs);
+		__m128i luma_hi = _mm_madd_epi16(_mm_unpackhi_epi16(y16, one), y_coeffs);
+
+		__m128i b16 = yuvChannel(luma_lo, luma_hi, _mm_madd_epi16(uv16, b_coeffs));
+		__m128i g16 = yuvChannel(luma_lo, luma_hi, _mm_madd_epi16(uv16, g_coeffs));
+		__m128i r16 = yuvChannel(luma_lo, luma_hi, _mm_madd_epi16(uv16, r_coeffs));
+
+		__m128i br = _mm_packus_epi16(b16, r16);
+		__m128i ga = _mm_packus_epi16(g16, alpha);
+		__m128i bg = _mm_unpacklo_epi8(br, ga);
+		__m128i ra = _mm_unpackhi_epi8(br, ga);
+		_mm_storeu_si128((__m128i*)(dst_bgra + 4 * x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i*)(dst_bgra + 4 * x + 16), _mm_unpackhi_epi16(bg, ra));
+	}
+
+	if (x < width)
+	{
+		i420ToBGRARow_C(src_y + x, src_u + x / 2, src_v + x / 2, dst_bgra + 4 * x, width - x, coeffs);
+	}
+}
+
+// Sums the two 32 bit lanes of each pixel of m0 (pixels 0,1) and m1 (pixels 2,3)
+static inline __m128i pixelSum2(__m128i m0, __m128i m1)
+{
+	__m128 f0 = _mm_castsi128_ps(m0), f1 = _mm_castsi128_ps(m1);
+	return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+// Sums the four 32 bit lanes of each of m0..m3, lane i of the result belongs to mi
+static inline __m128i horizontalSum4(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+	return pixelSum2(pixelSum2(m0, m1), pixelSum2(m2, m3));
+}
+
+void bgraToYRow_SSE2(const unsigned char* src_bgra, unsigned char* dst_y, unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i y_coeffs = _mm_setr_epi16(coeffs.yb, coeffs.yg, coeffs.yr, 0, coeffs.yb, coeffs.yg, coeffs.yr, 0);
+	const __m128i round = _mm_set1_epi32(1 << 13);
+	const __m128i y_offset = _mm_set1_epi16((short)coeffs.y_offset);
+
+	unsigned int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i p0 = _mm_loadu_si128((const __m128i*)(src_bgra + 4 * x));
+		__m128i p1 = _mm_loadu_si128((const __m128i*)(src_bgra + 4 * x + 16));
+
+		__m128i y0 = pixelSum2(_mm_madd_epi16(_mm_unpacklo_epi8(p0, zero), y_coeffs), _mm_madd_epi16(_mm_unpackhi_epi8(p0, zero), y_coeffs));
+		__m128i y1 = pixelSum2(_mm_madd_epi16(_mm_unpacklo_epi8(p1, zero), y_coeffs), _mm_madd_epi16(_mm_unpackhi_epi8(p1, zero), y_coeffs));
+		y0 = _mm_srai_epi32(_mm_add_epi32(y0, round), 14);
+		y1 = _mm_srai_epi32(_mm_add_epi32(y1, round), 14);
+
+		__m128i y16 = _mm_add_epi16(_mm_packs_epi32(y0, y1), y_offset);
+		_mm_storel_epi64((__m128i*)(dst_y + x), _mm_packus_epi16(y16, y16));
+	}
+
+	if (x < width)
+	{
+		bgraToYRow_C(src_bgra + 4 * x, dst_y + x, width - x, coeffs);
+	}
+}
+
+void bgraToUVRow_SSE2(const unsigned char* src_bgra0, const unsigned char* src_bgra1, unsigned char* dst_uv,
+	unsigned int width, const RgbToYuvCoeffs& coeffs)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i u_coeffs = _mm_setr_epi16(coeffs.ub, coeffs.ug, coeffs.ur, 0, coeffs.ub, coeffs.ug, coeffs.ur, 0);
+	const __m128i v_coeffs = _mm_setr_epi16(coeffs.vb, coeffs.vg, coeffs.vr, 0, coeffs.vb, coeffs.vg, coeffs.vr, 0);
+	const __m128i round = _mm_set1_epi32(1 << 15);
+	const __m128i uv_bias = _mm_set1_epi16(128);
+
+	//
+	// 8 pixels of two rows give 4 UV pairs. Each 2x2 block is summed into one
+	// group of 16 bit B,G,R,A lanes first.
+	//
+	unsigned int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src_bgra0 + 4 * x));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src_bgra0 + 4 * x + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(src_bgra1 + 4 * x));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(src_bgra1 + 4 * x + 16));
+
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		__m128i u = horizontalSum4(_mm_madd_epi16(s0, u_coeffs), _mm_madd_epi16(s1, u_coeffs),
+			_mm_madd_epi16(s2, u_coeffs), _mm_madd_epi16(s3, u_coeffs));
+		__m128i v = horizontalSum4(_mm_madd_epi16(s0, v_coeffs), _mm_madd_epi16(s1, v_coeffs),
+			_mm_madd_epi16(s2, v_coeffs), _mm_madd_epi16(s3, v_coeffs));
+		u = _mm_srai_epi32(_mm_add_epi32(u, round), 16);
+		v = _mm_srai_epi32(_mm_add_epi32(v, round), 16);
+
+		__m128i uv16 = _mm_packs_epi32(u, v);
+		uv16 = _mm_add_epi16(_mm_unpacklo_epi16(uv16, _mm_srli_si128(uv16, 8)), uv_bias);
+		_mm_storel_epi64((__m128i*)(dst_uv + x), _mm_packus_epi16(uv16, uv16));
+	}
+
+	if (x < width)
+	{
+		bgraToUVRow_C(src_bgra0 + 4 * x, src_bgra1 + 4 * x, dst_uv + x, width - x, coeffs);
+	}
+}
+
+#endif
@@ -476,6 +476,81 @@ HRESULT ExceptionBoundary(Lambda&& lambda)
     }
 }
 
+//
+// What an output pin queue does with a sample that finds it at its maximum depth
+//
+typedef enum _DMFT_QUEUE_POLICY {
+    DMFT_QUEUE_DROP_OLDEST = 0,     /*Keeps latency at the depth, the consumer sees the newest frames*/
+    DMFT_QUEUE_DROP_NEWEST = 1,
+    DMFT_QUEUE_BLOCK       = 2      /*Holds the producer back, then drops the newest after the timeout*/
+} DMFT_QUEUE_POLICY;
+
+#define DMFT_PREVIEW_QUEUE_DEPTH        2
+#define DMFT_QUEUE_BLOCK_TIMEOUT_MS     100
+
+#define DMFT_ROUTE_MAX_STREAM_ID        256     /*Stream ids up to this are looked up by index*/
+
+//
+// Publishes immutable snapshots of the pin topology to the data path. The
+// writer builds a new snapshot under its own lock and swaps it in; readers
+// load the pointer without locking. Replaced snapshots are kept until the
+// owner goes away so a reader can never hold a freed one. Topology changes
+// only happen when pins connect, so there are a handful of them at most.
+//
+template <class T>
+class CTopologySnapshot{
+public:
+    CTopologySnapshot()
+        : m_pCurrent( nullptr )
+    {
+    }
+    ~CTopologySnapshot()
+    {
+        for ( size_t i = 0; i < m_retired.size(); i++ )
+        {
+            delete m_retired[ i ];
+        }
+    }
+
+    //
+    // Takes ownership of pNext, also when it fails
+    //
+    STDMETHODIMP Publish( _In_ T *pNext )
+    {
+        HRESULT hr = ExceptionBoundary( [&]()
+        {
+            m_retired.push_back( pNext );
+        });
+        if ( FAILED( hr ) )
+        {
+            delete pNext;
+            return hr;
+        }
+        InterlockedExchangePointer( ( PVOID volatile * )&m_pCurrent, pNext );
+        return S_OK;
+    }
+
+    //
+    // Readers fall back to whatever they did without a snapshot
+    //
+    __inline VOID Clear()
+    {
+        InterlockedExchangePointer( ( PVOID volatile * )&m_pCurrent, nullptr );
+    }
+
+    __inline const T* Get()
+    {
+        return ( const T* )InterlockedCompareExchangePointer( ( PVOID volatile * )&m_pCurrent, nullptr, nullptr );
+    }
+
+private:
+    CTopologySnapshot( const CTopologySnapshot& );
+    CTopologySnapshot& operator=( const CTopologySnapshot& );
+
+    T * volatile    m_pCurrent;
+    std::vector< T* > m_retired;  /*Every snapshot published, the current one included*/
+};
+
 
 //
 // Custom Pin GUID. The avstream driver should define a PIN_DESCRIPTOR with this GUID
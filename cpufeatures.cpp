@@ -0,0 +1,57 @@
+#include "cpufeatures.h"
+
+#include <atomic>
+#if (defined CPU_X86) && (defined _MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static std::atomic<unsigned int> s_featureMask(~0u);
+
+static unsigned int detectCpuFeatures()
+{
+	unsigned int features = 0;
+#if (defined CPU_X86) && (defined _MSC_VER)
+	int info[4] = { 0 };
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26))
+	{
+		features |= CPU_FEATURE_SSE2;
+	}
+	// AVX2 also needs the OS to save the YMM state (OSXSAVE + XCR0 bits 1 and 2)
+	bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 0x6) == 0x6);
+	if (os_avx && max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+		{
+			features |= CPU_FEATURE_AVX2;
+		}
+	}
+#elif (defined CPU_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	{
+		features |= CPU_FEATURE_SSE2;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		features |= CPU_FEATURE_AVX2;
+	}
+#endif
+	return features;
+}
+
+unsigned int cpuFeatures()
+{
+	static const unsigned int detected = detectCpuFeatures();
+	return detected & s_featureMask.load(std::memory_order_relaxed);
+}
+
+void setCpuFeatureMask(unsigned int mask)
+{
+	s_featureMask.store(mask, std::memory_order_relaxed);
+}
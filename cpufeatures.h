@@ -0,0 +1,22 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if (defined _M_X64) || (defined _M_IX86) || (defined __x86_64__) || (defined __i386__)
+#define CPU_X86 1
+#endif
+
+enum CPU_FEATURE {
+	CPU_FEATURE_SSE2 = 0x1,
+	CPU_FEATURE_AVX2 = 0x2,
+};
+
+// Instruction set extensions the kernels may use, detected once on first call
+unsigned int cpuFeatures();
+
+//
+// Restricts the features cpuFeatures() reports, so the scalar and SSE2 paths
+// can be exercised and measured on a machine with AVX2. ~0u restores them.
+//
+void setCpuFeatureMask(unsigned int mask);
+
+#endif
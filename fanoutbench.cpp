@@ -0,0 +1,222 @@
+//
+// One NV12 input pin feeding four output pins: preview passes the frame
+// through, record and stream both scale it to 720p and a thumbnail pin scales
+// it to 360p. The fan-out runs once with every tee converting for itself and
+// once sharing conversions, the way CInPin::SendSample and CConversionCache
+// deliver now. Then pins write to their frames to check that a write only
+// copies a shared frame and never shows through to another pin. Exits with 1
+// when sharing converts more than once per distinct conversion, changes a
+// pin's output, or a write leaks into or needlessly copies another pin's frame.
+//
+// usage: fanoutbench [-w width] [-h height] [-n frames]
+//
+
+#include "framescale.h"
+#include "hostsample.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock FanOutClock;
+
+enum {
+	PIN_PREVIEW,
+	PIN_RECORD,
+	PIN_STREAM,
+	PIN_THUMBNAIL,
+	PIN_COUNT
+};
+
+struct FanOutRun {
+	unsigned long long  conversions;
+	double              ms;
+	std::vector<std::vector<unsigned char> > lastFrames;     // per pin
+};
+
+static void addPins(CHostFanOut& fanOut)
+{
+	fanOut.addPin(std::unique_ptr<CFrameStage>());
+	fanOut.addPin(std::unique_ptr<CFrameStage>(new CScaleStage(FRAME_FORMAT_NV12, 1280, 720)));
+	fanOut.addPin(std::unique_ptr<CFrameStage>(new CScaleStage(FRAME_FORMAT_NV12, 1280, 720)));
+	fanOut.addPin(std::unique_ptr<CFrameStage>(new CScaleStage(FRAME_FORMAT_NV12, 640, 360)));
+}
+
+static void releaseAll(std::vector<CHostSample*>& outputs)
+{
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		if (outputs[i])
+		{
+			outputs[i]->Release();
+			outputs[i] = nullptr;
+		}
+	}
+}
+
+static bool runFanOut(bool share, CHostSample* input, unsigned int width, unsigned int height, unsigned int frames, FanOutRun& run)
+{
+	CHostFanOut fanOut(width, height, share);
+	addPins(fanOut);
+
+	bool ok = true;
+	std::vector<CHostSample*> outputs;
+	FanOutClock::time_point start = FanOutClock::now();
+	for (unsigned int frame = 0; frame < frames && ok; frame++)
+	{
+		input->buffer()[0] = (unsigned char)frame;
+		input->setSampleTime((long long)frame * 333333);
+
+		ok = fanOut.deliver(input, outputs);
+		if (ok && frame + 1 == frames)
+		{
+			run.lastFrames.resize(outputs.size());
+			for (size_t pin = 0; pin < outputs.size(); pin++)
+			{
+				run.lastFrames[pin].assign(outputs[pin]->buffer(), outputs[pin]->buffer() + outputs[pin]->currentLength());
+			}
+		}
+		releaseAll(outputs);
+	}
+	run.ms = std::chrono::duration<double, std::milli>(FanOutClock::now() - start).count();
+	run.conversions = fanOut.conversions();
+	return ok;
+}
+
+//
+// Writes the way ProcessOutput does to one pin's frame, through makeWritable
+//
+static bool writePin(std::vector<CHostSample*>& outputs, size_t pin, unsigned char value)
+{
+	CHostSample* writable = outputs[pin]->makeWritable();
+	if (!writable)
+	{
+		return false;
+	}
+	outputs[pin] = writable;
+	writable->setDiscontinuity(true);
+	writable->buffer()[0] = value;
+	return true;
+}
+
+static bool checkCopyOnWrite(CHostSample* input, unsigned int width, unsigned int height)
+{
+	CHostFanOut fanOut(width, height, true);
+	addPins(fanOut);
+
+	input->buffer()[0] = 0x10;
+	input->setDiscontinuity(false);
+
+	std::vector<CHostSample*> outputs;
+	if (!fanOut.deliver(input, outputs))
+	{
+		printf("fan-out failed\n");
+		return false;
+	}
+
+	bool ok = true;
+	CHostSample* sharedInput = outputs[PIN_PREVIEW];
+	CHostSample* sharedScaled = outputs[PIN_RECORD];
+	unsigned char streamByte = outputs[PIN_STREAM]->buffer()[0];
+	CHostSample* thumbnail = outputs[PIN_THUMBNAIL];
+
+	if (sharedInput != input || outputs[PIN_STREAM] != sharedScaled)
+	{
+		printf("pins were handed copies instead of the shared frames\n");
+		ok = false;
+	}
+	else if (!writePin(outputs, PIN_PREVIEW, 0x20) || !writePin(outputs, PIN_RECORD, 0x30) || !writePin(outputs, PIN_THUMBNAIL, 0x40))
+	{
+		printf("copy on write failed to allocate\n");
+		ok = false;
+	}
+	else if (outputs[PIN_PREVIEW] == input || input->buffer()[0] != 0x10 || input->discontinuity())
+	{
+		printf("preview wrote through to the input frame\n");
+		ok = false;
+	}
+	else if (outputs[PIN_RECORD] == outputs[PIN_STREAM] || outputs[PIN_STREAM]->buffer()[0] != streamByte ||
+		outputs[PIN_STREAM]->discontinuity())
+	{
+		printf("record wrote through to the stream pin's frame\n");
+		ok = false;
+	}
+	else if (outputs[PIN_THUMBNAIL] != thumbnail)
+	{
+		printf("thumbnail frame was copied though no other pin holds it\n");
+		ok = false;
+	}
+	releaseAll(outputs);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 1920;
+	unsigned int height = 1080;
+	unsigned int frames = 120;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			width = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-h"))
+		{
+			height = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			frames = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+	if (!frames)
+	{
+		return 0;
+	}
+
+	CHostSample* input = CHostSample::create(frameBufferSize(FRAME_FORMAT_NV12, width, height));
+	if (!input)
+	{
+		return 1;
+	}
+	for (size_t i = 0; i < input->maxLength(); i++)
+	{
+		input->buffer()[i] = (unsigned char)(i * 7 + (i >> 11));
+	}
+	input->setCurrentLength(frameBufferSize(FRAME_FORMAT_NV12, width, height));
+
+	FanOutRun perPin, shared;
+	if (!runFanOut(false, input, width, height, frames, perPin) || !runFanOut(true, input, width, height, frames, shared))
+	{
+		printf("fan-out failed to convert a frame\n");
+		input->Release();
+		return 1;
+	}
+
+	printf("%u frames of %ux%u nv12 to preview, 2 x 720p and 360p\n", frames, width, height);
+	printf("  %-8s %12s %8s %8s\n", "tees", "conversions", "/frame", "fps");
+	printf("  %-8s %12llu %8.2f %8.1f\n", "per-pin", perPin.conversions, (double)perPin.conversions / frames, frames * 1000.0 / perPin.ms);
+	printf("  %-8s %12llu %8.2f %8.1f\n", "shared", shared.conversions, (double)shared.conversions / frames, frames * 1000.0 / shared.ms);
+
+	int result = 0;
+	if (shared.conversions != 2ULL * frames)
+	{
+		printf("shared fan-out converted %llu times, expected one per distinct conversion\n", shared.conversions);
+		result = 1;
+	}
+	else if (shared.lastFrames != perPin.lastFrames)
+	{
+		printf("shared fan-out output differs from the per-pin tees\n");
+		result = 1;
+	}
+	else if (!checkCopyOnWrite(input, width, height))
+	{
+		result = 1;
+	}
+	input->Release();
+	return result;
+}
@@ -0,0 +1,291 @@
+#include "framecore.h"
+
+#include <stdlib.h>
+#include <string.h>
+#if (defined _WINDOWS)
+#include <malloc.h>
+#endif
+
+size_t frameBufferSize(FRAME_FORMAT format, unsigned int width, unsigned int height)
+{
+	size_t pixels = (size_t)width * height;
+	switch (format)
+	{
+	case FRAME_FORMAT_I420:
+		return pixels + 2 * ((size_t)((width + 1) / 2) * ((height + 1) / 2));
+	case FRAME_FORMAT_NV12:
+		return (size_t)(width + (width & 1)) * (height + (height + 1) / 2);
+	case FRAME_FORMAT_BGRA:
+		return pixels * 4;
+	default:
+		return 0;
+	}
+}
+
+unsigned int framePlaneCount(FRAME_FORMAT format)
+{
+	switch (format)
+	{
+	case FRAME_FORMAT_I420:
+		return 3;
+	case FRAME_FORMAT_NV12:
+		return 2;
+	case FRAME_FORMAT_BGRA:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+bool frameAttach(FrameDesc& desc, FRAME_FORMAT format, unsigned int width, unsigned int height,
+	unsigned char* buffer, size_t length, unsigned int stride)
+{
+	if (!buffer || width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	desc.format = format;
+	desc.width = width;
+	desc.height = height;
+	for (unsigned int i = 0; i < FRAME_MAX_PLANES; i++)
+	{
+		desc.planes[i].data = nullptr;
+		desc.planes[i].stride = 0;
+	}
+
+	size_t needed = 0;
+	switch (format)
+	{
+	case FRAME_FORMAT_BGRA:
+		stride = stride ? stride : width * 4;
+		needed = (size_t)stride * height;
+		desc.planes[0].data = buffer;
+		desc.planes[0].stride = stride;
+		break;
+	case FRAME_FORMAT_NV12:
+		// the UV rows hold a full pair for the last column, so pad odd widths
+		stride = stride ? stride : width + (width & 1);
+		needed = (size_t)stride * height + (size_t)stride * ((height + 1) / 2);
+		desc.planes[0].data = buffer;
+		desc.planes[0].stride = stride;
+		desc.planes[1].data = buffer + (size_t)stride * height;
+		desc.planes[1].stride = stride;
+		break;
+	case FRAME_FORMAT_I420:
+	{
+		stride = stride ? stride : width;
+		unsigned int chroma_stride = (stride + 1) / 2;
+		size_t chroma_size = (size_t)chroma_stride * ((height + 1) / 2);
+		needed = (size_t)stride * height + 2 * chroma_size;
+		desc.planes[0].data = buffer;
+		desc.planes[0].stride = stride;
+		desc.planes[1].data = buffer + (size_t)stride * height;
+		desc.planes[1].stride = chroma_stride;
+		desc.planes[2].data = desc.planes[1].data + chroma_size;
+		desc.planes[2].stride = chroma_stride;
+		break;
+	}
+	default:
+		return false;
+	}
+	return length >= needed;
+}
+
+static void copyPlane(const unsigned char* src, unsigned int src_stride, unsigned char* dst, unsigned int dst_stride,
+	size_t row_bytes, unsigned int rows)
+{
+	if (src_stride == dst_stride && src_stride == row_bytes)
+	{
+		memcpy(dst, src, row_bytes * rows);
+		return;
+	}
+	for (unsigned int y = 0; y < rows; y++)
+	{
+		memcpy(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, row_bytes);
+	}
+}
+
+bool frameCopy(const FrameDesc& src, FrameDesc& dst)
+{
+	if (src.format != dst.format || src.width != dst.width || src.height != dst.height)
+	{
+		return false;
+	}
+
+	unsigned int chroma_w = (src.width + 1) / 2;
+	unsigned int chroma_h = (src.height + 1) / 2;
+	switch (src.format)
+	{
+	case FRAME_FORMAT_BGRA:
+		copyPlane(src.planes[0].data, src.planes[0].stride, dst.planes[0].data, dst.planes[0].stride, (size_t)src.width * 4, src.height);
+		break;
+	case FRAME_FORMAT_NV12:
+		copyPlane(src.planes[0].data, src.planes[0].stride, dst.planes[0].data, dst.planes[0].stride, src.width, src.height);
+		copyPlane(src.planes[1].data, src.planes[1].stride, dst.planes[1].data, dst.planes[1].stride, (size_t)chroma_w * 2, chroma_h);
+		break;
+	case FRAME_FORMAT_I420:
+		copyPlane(src.planes[0].data, src.planes[0].stride, dst.planes[0].data, dst.planes[0].stride, src.width, src.height);
+		copyPlane(src.planes[1].data, src.planes[1].stride, dst.planes[1].data, dst.planes[1].stride, chroma_w, chroma_h);
+		copyPlane(src.planes[2].data, src.planes[2].stride, dst.planes[2].data, dst.planes[2].stride, chroma_w, chroma_h);
+		break;
+	default:
+		return false;
+	}
+	dst.sample_time = src.sample_time;
+	dst.sample_duration = src.sample_duration;
+	return true;
+}
+
+void* alignedAlloc(size_t size, size_t alignment)
+{
+#if (defined _WINDOWS)
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+	{
+		return nullptr;
+	}
+	return ptr;
+#endif
+}
+
+void alignedFree(void* ptr)
+{
+#if (defined _WINDOWS)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+//
+// CFrameBuffer
+//
+CFrameBuffer::CFrameBuffer()
+: m_data(nullptr)
+, m_size(0)
+{
+}
+
+CFrameBuffer::~CFrameBuffer()
+{
+	release();
+}
+
+bool CFrameBuffer::allocate(FRAME_FORMAT format, unsigned int width, unsigned int height)
+{
+	size_t size = frameBufferSize(format, width, height);
+	if (size == 0)
+	{
+		return false;
+	}
+	if (size != m_size)
+	{
+		release();
+		m_data = (unsigned char*)alignedAlloc(size);
+		if (!m_data)
+		{
+			return false;
+		}
+		m_size = size;
+	}
+	return frameAttach(m_desc, format, width, height, m_data, m_size);
+}
+
+void CFrameBuffer::release()
+{
+	if (m_data)
+	{
+		alignedFree(m_data);
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_desc = FrameDesc();
+}
+
+//
+// CFramePipeline
+//
+CFramePipeline::CFramePipeline()
+{
+}
+
+CFramePipeline::~CFramePipeline()
+{
+	clear();
+}
+
+void CFramePipeline::addStage(std::unique_ptr<CFrameStage> stage)
+{
+	m_stages.push_back(std::move(stage));
+	m_intermediate.push_back(std::unique_ptr<CFrameBuffer>(new CFrameBuffer()));
+}
+
+void CFramePipeline::clear()
+{
+	m_stages.clear();
+	m_intermediate.clear();
+}
+
+bool CFramePipeline::outputFormat(const FrameDesc& input, FRAME_FORMAT& format, unsigned int& width, unsigned int& height) const
+{
+	format = input.format;
+	width = input.width;
+	height = input.height;
+	for (size_t i = 0; i < m_stages.size(); i++)
+	{
+		if (m_stages[i]->inputFormat() != format)
+		{
+			return false;
+		}
+		m_stages[i]->outputSize(width, height, width, height);
+		format = m_stages[i]->outputFormat();
+	}
+	return true;
+}
+
+bool CFramePipeline::run(const FrameDesc& input, FrameDesc& output)
+{
+	if (m_stages.empty())
+	{
+		return frameCopy(input, output);
+	}
+
+	const FrameDesc* current = &input;
+	for (size_t i = 0; i < m_stages.size(); i++)
+	{
+		CFrameStage* stage = m_stages[i].get();
+		if (stage->inputFormat() != current->format)
+		{
+			return false;
+		}
+
+		FrameDesc* target = &output;
+		if (i + 1 < m_stages.size())
+		{
+			unsigned int width = 0, height = 0;
+			stage->outputSize(current->width, current->height, width, height);
+			CFrameBuffer* buffer = m_intermediate[i].get();
+			if (buffer->desc().format != stage->outputFormat() ||
+				buffer->desc().width != width || buffer->desc().height != height)
+			{
+				if (!buffer->allocate(stage->outputFormat(), width, height))
+				{
+					return false;
+				}
+			}
+			target = &buffer->desc();
+		}
+
+		if (!stage->process(*current, *target))
+		{
+			return false;
+		}
+		target->sample_time = input.sample_time;
+		target->sample_duration = input.sample_duration;
+		current = target;
+	}
+	return true;
+}
@@ -0,0 +1,150 @@
+#ifndef FRAME_CORE_H
+#define FRAME_CORE_H
+
+//
+// Platform neutral frame descriptors and stage interfaces. Nothing in here
+// knows about IMFSample or IMFTransform; the Media Foundation pins lock their
+// buffers, describe them with a FrameDesc and hand them to the stages below.
+// The same code runs in the Linux host harness (hostharness.cpp).
+//
+
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+enum FRAME_FORMAT {
+	FRAME_FORMAT_UNKNOWN = 0,
+	FRAME_FORMAT_I420    = 1,   // 8 bit Y plane, then U and V at half resolution
+	FRAME_FORMAT_NV12    = 2,   // 8 bit Y plane, then interleaved UV at half resolution
+	FRAME_FORMAT_BGRA    = 3,   // 32 bit B,G,R,A in memory order (MFVideoFormat_ARGB32)
+};
+
+#define FRAME_MAX_PLANES    3
+#define FRAME_ALIGNMENT     64
+
+typedef struct _FramePlane {
+	unsigned char*  data    = nullptr;
+	unsigned int    stride  = 0;        // bytes between two rows
+} FramePlane;
+
+typedef struct _FrameDesc {
+	FRAME_FORMAT    format          = FRAME_FORMAT_UNKNOWN;
+	unsigned int    width           = 0;
+	unsigned int    height          = 0;
+	FramePlane      planes[FRAME_MAX_PLANES];
+	long long       sample_time     = 0;    // 100ns units, same as MFTIME
+	long long       sample_duration = 0;
+}FrameDesc, *FrameDescPtr;
+
+// Number of bytes a tightly packed frame of the given format occupies
+size_t frameBufferSize(FRAME_FORMAT format, unsigned int width, unsigned int height);
+
+// Number of planes the format carries
+unsigned int framePlaneCount(FRAME_FORMAT format);
+
+//
+// Describes a contiguous buffer. stride is the luma (or packed) row pitch, 0
+// means tightly packed. The chroma planes follow the luma plane the same way
+// MFCreateMemoryBuffer / MFCreate2DMediaBuffer lay them out.
+//
+bool frameAttach(FrameDesc& desc, FRAME_FORMAT format, unsigned int width, unsigned int height,
+	unsigned char* buffer, size_t length, unsigned int stride = 0);
+
+// Copies the pixels of src into dst, both must have the same format and size
+bool frameCopy(const FrameDesc& src, FrameDesc& dst);
+
+//
+// Owns an aligned, tightly packed frame. Used for the intermediate frames of a
+// pipeline and by the host harness.
+//
+class CFrameBuffer
+{
+public:
+	CFrameBuffer();
+	~CFrameBuffer();
+
+	bool allocate(FRAME_FORMAT format, unsigned int width, unsigned int height);
+	void release();
+
+	FrameDesc& desc() { return m_desc; }
+	const FrameDesc& desc() const { return m_desc; }
+	unsigned char* data() { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	CFrameBuffer(const CFrameBuffer&);
+	CFrameBuffer& operator=(const CFrameBuffer&);
+
+	unsigned char*  m_data;
+	size_t          m_size;
+	FrameDesc       m_desc;
+};
+
+void* alignedAlloc(size_t size, size_t alignment = FRAME_ALIGNMENT);
+void  alignedFree(void* ptr);
+
+//
+// One step of the frame path: colour conversion, stitching, scaling ...
+// process() must not keep pointers into either frame after it returns.
+//
+class CFrameStage
+{
+public:
+	virtual ~CFrameStage() {}
+
+	virtual const char* name() const = 0;
+	virtual FRAME_FORMAT inputFormat() const = 0;
+	virtual FRAME_FORMAT outputFormat() const = 0;
+	virtual void outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const
+	{
+		out_width = in_width;
+		out_height = in_height;
+	}
+	virtual bool process(const FrameDesc& input, FrameDesc& output) = 0;
+};
+
+//
+// Runs a chain of stages. The last stage writes into the frame supplied by the
+// caller, the ones before it write into intermediate buffers owned by the
+// pipeline which are only reallocated when the frame size changes.
+//
+class CFramePipeline
+{
+public:
+	CFramePipeline();
+	~CFramePipeline();
+
+	void addStage(std::unique_ptr<CFrameStage> stage);
+	void clear();
+	size_t stageCount() const { return m_stages.size(); }
+	CFrameStage* stage(size_t index) { return m_stages[index].get(); }
+
+	// Output format and size of the whole chain for a given input
+	bool outputFormat(const FrameDesc& input, FRAME_FORMAT& format, unsigned int& width, unsigned int& height) const;
+
+	bool run(const FrameDesc& input, FrameDesc& output);
+
+private:
+	std::vector<std::unique_ptr<CFrameStage>>   m_stages;
+	std::vector<std::unique_ptr<CFrameBuffer>>  m_intermediate;
+};
+
+//
+// Stand-in for the blender when it is not available (no GPU library, host
+// harness). Copies the equirectangular input straight through.
+//
+class CPassThroughStage : public CFrameStage
+{
+public:
+	explicit CPassThroughStage(FRAME_FORMAT format) : m_format(format) {}
+
+	const char* name() const { return "passthrough"; }
+	FRAME_FORMAT inputFormat() const { return m_format; }
+	FRAME_FORMAT outputFormat() const { return m_format; }
+	bool process(const FrameDesc& input, FrameDesc& output) { return frameCopy(input, output); }
+
+private:
+	FRAME_FORMAT m_format;
+};
+
+#endif
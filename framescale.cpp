@@ -0,0 +1,250 @@
+#include "framescale.h"
+#include "scalekernels.h"
+
+#include <math.h>
+
+static inline unsigned char clamp255(int value)
+{
+	return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+void scaleRowVertical_C(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		int sum = 1 << (SCALE_ROW_BITS - 1);
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			sum += weights[k] * rows[k][x];
+		}
+		dst[x] = (short)(sum >> SCALE_ROW_BITS);
+	}
+}
+
+void scaleRowHorizontal_C(const short* src, const unsigned int* starts, const short* weights,
+	unsigned int taps, unsigned int channels, unsigned char* dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x++)
+	{
+		const short* w = weights + x * taps;
+		for (unsigned int c = 0; c < channels; c++)
+		{
+			const short* s = src + starts[x] * channels + c;
+			int sum = 1 << (SCALE_WEIGHT_BITS + SCALE_ROW_BITS - 1);
+			for (unsigned int k = 0; k < taps; k++)
+			{
+				sum += w[k] * s[k * channels];
+			}
+			dst[x * channels + c] = clamp255(sum >> (SCALE_WEIGHT_BITS + SCALE_ROW_BITS));
+		}
+	}
+}
+
+static ScaleRowVerticalFunc selectScaleRowVertical()
+{
+#if (defined CPU_X86)
+	unsigned int features = cpuFeatures();
+	if (features & CPU_FEATURE_AVX2)
+	{
+		return scaleRowVertical_AVX2;
+	}
+	if (features & CPU_FEATURE_SSE2)
+	{
+		return scaleRowVertical_SSE2;
+	}
+#endif
+	return scaleRowVertical_C;
+}
+
+static ScaleRowHorizontalFunc selectScaleRowHorizontal()
+{
+#if (defined CPU_X86)
+	if (cpuFeatures() & CPU_FEATURE_SSE2)
+	{
+		return scaleRowHorizontal_SSE2;
+	}
+#endif
+	return scaleRowHorizontal_C;
+}
+
+//
+// CFrameScaler
+//
+CFrameScaler::CFrameScaler(SCALE_FILTER filter)
+: m_filter(filter)
+{
+}
+
+bool CFrameScaler::buildAxis(SCALE_FILTER filter, unsigned int src_size, unsigned int dst_size, ScaleAxis& axis)
+{
+	if (!src_size || !dst_size)
+	{
+		return false;
+	}
+
+	// the box filter only helps when shrinking, growing is always bilinear
+	const double ratio = (double)src_size / dst_size;
+	const bool area = filter == SCALE_FILTER_AREA && ratio > 1.0;
+
+	//
+	// Source interval of every output: the box it covers, or the two
+	// neighbours of its centre. The widest one sets the tap count.
+	//
+	std::vector<double> begins(dst_size), ends(dst_size);
+	unsigned int taps = 2;
+	for (unsigned int i = 0; i < dst_size; i++)
+	{
+		if (area)
+		{
+			begins[i] = i * ratio;
+			ends[i] = (i + 1 == dst_size) ? (double)src_size : (i + 1) * ratio;
+			unsigned int span = (unsigned int)ceil(ends[i]) - (unsigned int)begins[i];
+			taps = span > taps ? span : taps;
+		}
+		else
+		{
+			double centre = (i + 0.5) * ratio - 0.5;
+			begins[i] = centre < 0 ? 0 : (centre > src_size - 1 ? src_size - 1 : centre);
+		}
+	}
+	taps += taps & 1;
+	if (taps > SCALE_MAX_TAPS)
+	{
+		return false;
+	}
+
+	axis.src_size = src_size;
+	axis.dst_size = dst_size;
+	axis.taps = taps;
+	axis.starts.assign(dst_size, 0);
+	axis.weights.assign((size_t)dst_size * taps, 0);
+
+	std::vector<double> weights(taps);
+	for (unsigned int i = 0; i < dst_size; i++)
+	{
+		unsigned int start = (unsigned int)begins[i];
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			if (area)
+			{
+				double lo = begins[i] > start + k ? begins[i] : start + k;
+				double hi = ends[i] < start + k + 1 ? ends[i] : start + k + 1;
+				weights[k] = hi > lo ? (hi - lo) / (ends[i] - begins[i]) : 0;
+			}
+			else
+			{
+				double fraction = begins[i] - start;
+				weights[k] = k == 0 ? 1 - fraction : (k == 1 ? fraction : 0);
+			}
+		}
+
+		// rounding error goes to the largest tap so every output sums to exactly one
+		short* quantized = &axis.weights[(size_t)i * taps];
+		int total = 0;
+		unsigned int largest = 0;
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			quantized[k] = (short)floor(weights[k] * (1 << SCALE_WEIGHT_BITS) + 0.5);
+			total += quantized[k];
+			largest = quantized[k] > quantized[largest] ? k : largest;
+		}
+		quantized[largest] = (short)(quantized[largest] + (1 << SCALE_WEIGHT_BITS) - total);
+		axis.starts[i] = start;
+	}
+	return true;
+}
+
+bool CFrameScaler::prepare(unsigned int input_width, unsigned int input_height, unsigned int output_width, unsigned int output_height)
+{
+	if (m_lumaX.src_size != input_width || m_lumaX.dst_size != output_width)
+	{
+		if (!buildAxis(m_filter, input_width, output_width, m_lumaX) ||
+			!buildAxis(m_filter, (input_width + 1) / 2, (output_width + 1) / 2, m_chromaX))
+		{
+			m_lumaX = ScaleAxis();
+			return false;
+		}
+	}
+	if (m_lumaY.src_size != input_height || m_lumaY.dst_size != output_height)
+	{
+		if (!buildAxis(m_filter, input_height, output_height, m_lumaY) ||
+			!buildAxis(m_filter, (input_height + 1) / 2, (output_height + 1) / 2, m_chromaY))
+		{
+			m_lumaY = ScaleAxis();
+			return false;
+		}
+	}
+
+	// the widest row the vertical pass writes, the NV12 UV row with both channels
+	size_t luma = m_lumaX.src_size + m_lumaX.taps;
+	size_t chroma = 2 * (m_chromaX.src_size + m_chromaX.taps);
+	m_row.resize(luma > chroma ? luma : chroma);
+	return true;
+}
+
+void CFrameScaler::scalePlane(const unsigned char* src, unsigned int src_stride, unsigned char* dst, unsigned int dst_stride,
+	unsigned int channels, const ScaleAxis& x_axis, const ScaleAxis& y_axis)
+{
+	ScaleRowVerticalFunc vertical = selectScaleRowVertical();
+	ScaleRowHorizontalFunc horizontal = selectScaleRowHorizontal();
+	const unsigned int samples = x_axis.src_size * channels;
+	const unsigned char* rows[SCALE_MAX_TAPS];
+	short* row = &m_row[0];
+
+	for (unsigned int y = 0; y < y_axis.dst_size; y++)
+	{
+		for (unsigned int k = 0; k < y_axis.taps; k++)
+		{
+			unsigned int source = y_axis.starts[y] + k;
+			source = source < y_axis.src_size ? source : y_axis.src_size - 1;
+			rows[k] = src + (size_t)source * src_stride;
+		}
+		vertical(rows, &y_axis.weights[(size_t)y * y_axis.taps], y_axis.taps, row, samples);
+
+		// taps at the right edge read the last column again
+		for (unsigned int i = samples; i < samples + x_axis.taps * channels; i++)
+		{
+			row[i] = row[i - channels];
+		}
+		horizontal(row, &x_axis.starts[0], &x_axis.weights[0], x_axis.taps, channels,
+			dst + (size_t)y * dst_stride, x_axis.dst_size);
+	}
+}
+
+bool CFrameScaler::scale(const FrameDesc& input, FrameDesc& output)
+{
+	if (input.format != output.format ||
+		(input.format != FRAME_FORMAT_I420 && input.format != FRAME_FORMAT_NV12) ||
+		!input.width || !input.height || !output.width || !output.height)
+	{
+		return false;
+	}
+	if (input.width == output.width && input.height == output.height)
+	{
+		return frameCopy(input, output);
+	}
+	if (!prepare(input.width, input.height, output.width, output.height))
+	{
+		return false;
+	}
+
+	scalePlane(input.planes[0].data, input.planes[0].stride, output.planes[0].data, output.planes[0].stride,
+		1, m_lumaX, m_lumaY);
+	if (input.format == FRAME_FORMAT_NV12)
+	{
+		scalePlane(input.planes[1].data, input.planes[1].stride, output.planes[1].data, output.planes[1].stride,
+			2, m_chromaX, m_chromaY);
+	}
+	else
+	{
+		for (unsigned int plane = 1; plane < 3; plane++)
+		{
+			scalePlane(input.planes[plane].data, input.planes[plane].stride, output.planes[plane].data, output.planes[plane].stride,
+				1, m_chromaX, m_chromaY);
+		}
+	}
+	output.sample_time = input.sample_time;
+	output.sample_duration = input.sample_duration;
+	return true;
+}
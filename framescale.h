@@ -0,0 +1,84 @@
+#ifndef FRAME_SCALE_H
+#define FRAME_SCALE_H
+
+//
+// Resizes I420 and NV12 frames without leaving YUV, for output pins whose
+// media type only differs from the input pin's in frame size. Luma and chroma
+// are filtered plane by plane at their own resolution, the UV plane of NV12
+// as two interleaved channels. Both frames may have any stride.
+//
+
+#include "framecore.h"
+#include <vector>
+
+enum SCALE_FILTER {
+	SCALE_FILTER_BILINEAR   = 0,    // two taps per axis, for upscaling and ratios up to 2
+	SCALE_FILTER_AREA       = 1,    // box average over the source pixels an output covers
+};
+
+// Filter weights of one axis, see scalekernels.h for the fixed point format
+typedef struct _ScaleAxis {
+	unsigned int                src_size    = 0;
+	unsigned int                dst_size    = 0;
+	unsigned int                taps        = 0;    // even, padded with zero weights
+	std::vector<unsigned int>   starts;             // first source sample of every output
+	std::vector<short>          weights;            // taps per output
+}ScaleAxis, *ScaleAxisPtr;
+
+//
+// Scales one frame to the size of another of the same format. The filter
+// tables are built on the first frame and kept while the sizes stay the same.
+// One scaler must not be used from two threads at once.
+//
+class CFrameScaler
+{
+public:
+	explicit CFrameScaler(SCALE_FILTER filter = SCALE_FILTER_AREA);
+
+	SCALE_FILTER filter() const { return m_filter; }
+	bool scale(const FrameDesc& input, FrameDesc& output);
+
+	// Builds the weights of one axis, false when the ratio needs more than SCALE_MAX_TAPS
+	static bool buildAxis(SCALE_FILTER filter, unsigned int src_size, unsigned int dst_size, ScaleAxis& axis);
+	// Builds the tables for a pair of frame sizes ahead of the first frame, false when the ratio cannot be scaled
+	bool prepare(unsigned int input_width, unsigned int input_height, unsigned int output_width, unsigned int output_height);
+
+private:
+	void scalePlane(const unsigned char* src, unsigned int src_stride, unsigned char* dst, unsigned int dst_stride,
+		unsigned int channels, const ScaleAxis& x_axis, const ScaleAxis& y_axis);
+
+	SCALE_FILTER        m_filter;
+	ScaleAxis           m_lumaX;
+	ScaleAxis           m_lumaY;
+	ScaleAxis           m_chromaX;
+	ScaleAxis           m_chromaY;
+	std::vector<short>  m_row;      // vertical pass output, one source row wide plus padding
+};
+
+class CScaleStage : public CFrameStage
+{
+public:
+	CScaleStage(FRAME_FORMAT format, unsigned int output_width, unsigned int output_height,
+		SCALE_FILTER filter = SCALE_FILTER_AREA)
+	: m_format(format), m_outputWidth(output_width), m_outputHeight(output_height), m_scaler(filter) {}
+
+	const char* name() const { return m_scaler.filter() == SCALE_FILTER_AREA ? "scale_area" : "scale_bilinear"; }
+	FRAME_FORMAT inputFormat() const { return m_format; }
+	FRAME_FORMAT outputFormat() const { return m_format; }
+	void outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const
+	{
+		(void)in_width;
+		(void)in_height;
+		out_width = m_outputWidth;
+		out_height = m_outputHeight;
+	}
+	bool process(const FrameDesc& input, FrameDesc& output) { return m_scaler.scale(input, output); }
+
+private:
+	FRAME_FORMAT    m_format;
+	unsigned int    m_outputWidth;
+	unsigned int    m_outputHeight;
+	CFrameScaler    m_scaler;
+};
+
+#endif
@@ -0,0 +1,413 @@
+//
+// Host harness for the frame path. Feeds synthetic camera frames through the
+// same stages CMultipinMft::ProcessInput runs and drains them the way
+// COutPin::ProcessOutput does, so the hot path can be run under perf,
+// sanitizers and synthetic load without a Windows capture graph.
+//
+// usage: dmfthost [-w width] [-h height] [-n frames] [-k c|sse2|avx2] [-m bgra|yuv|lut|mesh] [-c cache_dir] [-t threads] [-r degrees]
+//                [-p 0|1] [-s 0|1] [-j trace.json]
+//
+
+#include "framecore.h"
+#include "colorconvert.h"
+#include "cpufeatures.h"
+#include "hostsample.h"
+#include "meshremap.h"
+#include "remapcache.h"
+#include "samplequeue.h"
+#include "spantrace.h"
+#include "stagepipeline.h"
+#include "yuvstitch.h"
+
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock HostClock;
+
+struct HarnessStage {
+	std::unique_ptr<CHostTransform> transform;
+	double                          total_ms;
+};
+
+static double elapsedMs(HostClock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(HostClock::now() - start).count();
+}
+
+static void fillSyntheticI420(CHostSample* sample, unsigned int width, unsigned int height, unsigned int frame)
+{
+	FrameDesc desc;
+	sample->lockFrame(FRAME_FORMAT_I420, width, height, desc);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		unsigned char* row = desc.planes[0].data + (size_t)y * desc.planes[0].stride;
+		for (unsigned int x = 0; x < width; x++)
+		{
+			row[x] = (unsigned char)(x + y + frame);
+		}
+	}
+	for (unsigned int y = 0; y < (height + 1) / 2; y++)
+	{
+		memset(desc.planes[1].data + (size_t)y * desc.planes[1].stride, (int)(64 + (y & 127)), (width + 1) / 2);
+		memset(desc.planes[2].data + (size_t)y * desc.planes[2].stride, (int)(192 - (y & 127)), (width + 1) / 2);
+	}
+	sample->setCurrentLength(frameBufferSize(FRAME_FORMAT_I420, width, height));
+	sample->setSampleTime((long long)frame * 333333);
+	sample->setSampleDuration(333333);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 3040;
+	unsigned int height = 1520;
+	unsigned int frames = 300;
+	STITCH_MODE mode = STITCH_MODE_BGRA;
+	bool lut = false;
+	bool mesh = false;
+	const char* cacheDirectory = nullptr;
+	unsigned int threads = 0;
+	double spin = 0;
+	bool pooled = true;
+	bool pipelined = false;
+	const char* spanPath = nullptr;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			width = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-h"))
+		{
+			height = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			frames = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-k"))
+		{
+			// caps the kernels the converters may dispatch to
+			if (!strcmp(argv[i + 1], "c"))
+			{
+				setCpuFeatureMask(0);
+			}
+			else if (!strcmp(argv[i + 1], "sse2"))
+			{
+				setCpuFeatureMask(CPU_FEATURE_SSE2);
+			}
+		}
+		else if (!strcmp(argv[i], "-m"))
+		{
+			// lut and mesh are the planar path with the lens remap of a synthetic offset
+			lut = !strcmp(argv[i + 1], "lut");
+			mesh = !strcmp(argv[i + 1], "mesh");
+			mode = (lut || mesh || !strcmp(argv[i + 1], "yuv")) ? STITCH_MODE_YUV : STITCH_MODE_BGRA;
+		}
+		else if (!strcmp(argv[i], "-t"))
+		{
+			// threads of the planar stitcher, 0 for one per core
+			threads = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-p"))
+		{
+			// 0 allocates every sample like CreateMediaSample used to
+			pooled = atoi(argv[i + 1]) != 0;
+		}
+		else if (!strcmp(argv[i], "-s"))
+		{
+			// 1 runs every stage on its own thread, frames overlap like the pipelined transform
+			pipelined = atoi(argv[i + 1]) != 0;
+		}
+		else if (!strcmp(argv[i], "-r"))
+		{
+			// turns the panorama by this many degrees of yaw every frame, through the remap
+			spin = atof(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-j"))
+		{
+			// records the stage spans of every frame and writes them as Chrome trace JSON
+			spanPath = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-c"))
+		{
+			// keeps the lut in a table cache, a second run maps it instead of building it
+			cacheDirectory = argv[i + 1];
+		}
+	}
+	if (width == 0 || height == 0)
+	{
+		printf("invalid frame size\n");
+		return 1;
+	}
+
+	if (spanPath)
+	{
+		CSpanTrace::instance().setExportPath(spanPath);
+		CSpanTrace::instance().start();
+	}
+	else
+	{
+		CSpanTrace::instance().startFromEnvironment();
+	}
+
+	// declared before the queue and the chain, it has to outlive their samples
+	CHostSamplePool samplePool;
+	auto createSample = [&](size_t length) { return pooled ? samplePool.create(length) : CHostSample::create(length); };
+
+	//
+	// The stage chain of CMultipinMft::ProcessInput for the selected stitch mode
+	//
+	std::vector<HarnessStage> chain;
+	std::vector<std::unique_ptr<CFrameStage>> stages;
+	std::vector<const char*> spanNames;     // the step of CMultipinMft each stage stands for
+	std::shared_ptr<CPlaneRemap> rotating;
+	if (mode == STITCH_MODE_YUV)
+	{
+		CYuvStitchStage* stitch = new CYuvStitchStage();
+		stages.push_back(std::unique_ptr<CFrameStage>(stitch));
+		spanNames.push_back("stitch");
+		std::shared_ptr<CWorkerPool> pool = std::make_shared<CWorkerPool>(threads);
+		printf("planar stitch on %u threads\n", pool->threadCount());
+		stitch->setWorkerPool(pool);
+		if (lut)
+		{
+			std::string offset = CAirOffset::synthetic(width, height);
+			RemapKey key;
+			key.input_width = key.output_width = width;
+			key.input_height = key.output_height = height;
+
+			HostClock::time_point start = HostClock::now();
+			bool cacheHit = false;
+			std::shared_ptr<CRemapTable> table;
+			if (cacheDirectory)
+			{
+				table = CRemapCache(cacheDirectory).acquire(offset, key, &cacheHit);
+			}
+			else
+			{
+				CAirOffset airOffset;
+				table = std::make_shared<CRemapTable>();
+				if (!airOffset.parse(offset) || !table->build(airOffset, key))
+				{
+					table = nullptr;
+				}
+			}
+			if (!table)
+			{
+				printf("remap table build failed\n");
+				return 1;
+			}
+			printf("remap table %.1f MB, %s in %.1f ms\n", table->memorySize() / (1024.0 * 1024.0),
+				cacheHit ? "mapped" : "built", elapsedMs(start));
+			stitch->setRemap(table);
+		}
+		else if (mesh)
+		{
+			CAirOffset airOffset;
+			RemapKey key;
+			key.input_width = key.output_width = width;
+			key.input_height = key.output_height = height;
+
+			HostClock::time_point start = HostClock::now();
+			std::shared_ptr<CMeshRemap> remap = std::make_shared<CMeshRemap>();
+			if (!airOffset.parse(CAirOffset::synthetic(width, height)) || !remap->build(airOffset, key))
+			{
+				printf("remap mesh build failed\n");
+				return 1;
+			}
+			printf("remap mesh %.1f KB, built in %.1f ms\n", remap->memorySize() / 1024.0, elapsedMs(start));
+			stitch->setRemap(remap);
+		}
+		if (spin != 0)
+		{
+			rotating = stitch->remap();
+		}
+	}
+	else
+	{
+		stages.push_back(std::unique_ptr<CFrameStage>(new CI420ToBGRAStage()));
+		stages.push_back(std::unique_ptr<CFrameStage>(new CPassThroughStage(FRAME_FORMAT_BGRA)));
+		stages.push_back(std::unique_ptr<CFrameStage>(new CBGRAToNV12Stage()));
+		spanNames.push_back("convert");
+		spanNames.push_back("stitch");
+		spanNames.push_back("convert");
+	}
+
+	// bytes each stage reads and writes, the memory traffic of one frame
+	size_t traffic = 0;
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		traffic += frameBufferSize(stages[i]->inputFormat(), width, height) + frameBufferSize(stages[i]->outputFormat(), width, height);
+		HarnessStage stage;
+		stage.transform.reset(new CHostTransform(std::move(stages[i]), width, height));
+		stage.total_ms = 0;
+		chain.push_back(std::move(stage));
+	}
+	const size_t chainLength = chain.size();
+
+	CSampleQueue<CHostSample*> outputQueue;
+	double queueMs = 0;
+	double rotateMs = 0;
+	unsigned int delivered = 0;
+	std::atomic<bool> failed(false);
+
+	//
+	// One function per stage, run inline or on the stage threads. The
+	// rotation goes with the first stage so it stays in frame order.
+	//
+	std::vector<CStagePipeline<CHostSample*>::StageFunc> stageFuncs;
+	for (size_t i = 0; i < chainLength; i++)
+	{
+		stageFuncs.push_back([&, i](CHostSample*& sample) -> bool {
+			const long long frame = sample->sampleTime() / 333333;
+			if (pipelined && CSpanTrace::enabled())
+			{
+				CSpanTrace::instance().nameThread(spanNames[i]);
+			}
+			if (i == 0 && rotating)
+			{
+				HostClock::time_point start = HostClock::now();
+				double yaw = spin * (double)(sample->sampleTime() / 333333) * 3.14159265358979323846 / 180.0;
+				float matrix[9] = {
+					(float)cos(yaw), 0, (float)sin(yaw),
+					0, 1, 0,
+					(float)-sin(yaw), 0, (float)cos(yaw),
+				};
+				if (!rotating->setRotation(matrix))
+				{
+					printf("remap %s cannot rotate\n", rotating->name());
+					failed = true;
+					return false;
+				}
+				rotateMs += elapsedMs(start);
+			}
+
+			HostClock::time_point start = HostClock::now();
+			CSpanScope span(spanNames[i], frame);
+			CHostTransform* transform = chain[i].transform.get();
+			CHostSample* output = createSample(transform->outputSize());
+			bool ok = output && transform->processInput(sample) && transform->processOutput(output);
+			sample->Release();
+			sample = output;
+			chain[i].total_ms += elapsedMs(start);
+			if (!ok)
+			{
+				printf("stage %s failed on frame %lld\n", transform->stage()->name(), sample ? sample->sampleTime() / 333333 : -1);
+				failed = true;
+				return false;
+			}
+
+			if (i + 1 == chainLength)
+			{
+				start = HostClock::now();
+				{
+					CSpanScope queueSpan("queue", frame);
+					outputQueue.push(sample);
+					sample = nullptr;
+				}
+				{
+					CSpanScope outputSpan("ProcessOutput", frame);
+					CHostSample* pulled = nullptr;
+					while (outputQueue.pop(&pulled))
+					{
+						delivered++;
+						pulled->Release();
+					}
+				}
+				queueMs += elapsedMs(start);
+			}
+			return true;
+		});
+	}
+	auto releaseSample = [](CHostSample*& sample) {
+		if (sample)
+		{
+			sample->Release();
+			sample = nullptr;
+		}
+	};
+	std::unique_ptr<CStagePipeline<CHostSample*>> pipeline;
+	if (pipelined)
+	{
+		pipeline.reset(new CStagePipeline<CHostSample*>(stageFuncs, releaseSample));
+	}
+
+	if (CSpanTrace::enabled())
+	{
+		CSpanTrace::instance().nameThread("ProcessInput");
+	}
+	HostClock::time_point runStart = HostClock::now();
+	for (unsigned int frame = 0; frame < frames && !failed; frame++)
+	{
+		CHostSample* sample = nullptr;
+		{
+			// the synthetic frame stands in for the decoder output
+			CSpanScope decodeSpan("decode", frame);
+			sample = createSample(frameBufferSize(FRAME_FORMAT_I420, width, height));
+			if (!sample)
+			{
+				printf("out of memory\n");
+				return 1;
+			}
+			fillSyntheticI420(sample, width, height, frame);
+		}
+
+		if (pipeline)
+		{
+			pipeline->push(sample);
+			continue;
+		}
+		for (size_t i = 0; i < chainLength && sample; i++)
+		{
+			if (!stageFuncs[i](sample))
+			{
+				releaseSample(sample);
+			}
+		}
+	}
+	if (pipeline)
+	{
+		pipeline->drain();
+		pipeline.reset();
+	}
+	double totalMs = elapsedMs(runStart);
+	if (failed)
+	{
+		return 1;
+	}
+
+	printf("%ux%u, %u frames, %u delivered, %s kernels%s\n", width, height, frames, delivered, colorConvertKernelName(),
+		pipelined ? ", pipelined" : "");
+	for (size_t i = 0; i < chainLength; i++)
+	{
+		printf("  %-20s %8.3f ms/frame\n", chain[i].transform->stage()->name(), chain[i].total_ms / frames);
+	}
+	printf("  %-20s %8.1f MB/frame\n", "stage traffic", traffic / (1024.0 * 1024.0));
+	if (rotating)
+	{
+		printf("  %-20s %8.3f ms/frame\n", "rotation", rotateMs / frames);
+	}
+	printf("  %-20s %8.3f ms/frame\n", "queue", queueMs / frames);
+	if (pooled)
+	{
+		SamplePoolStats stats = samplePool.stats();
+		printf("  %-20s %llu allocated, %llu reused, %u high water\n", "sample pool", stats.allocations, stats.reuses, stats.high_water);
+	}
+	printf("  %-20s %8.3f ms/frame (%.1f fps)\n", "total", totalMs / frames, frames * 1000.0 / totalMs);
+	if (CSpanTrace::enabled())
+	{
+		if (!CSpanTrace::instance().stop())
+		{
+			printf("cannot write the span trace\n");
+			return 1;
+		}
+		printf("  %-20s %llu overwritten\n", "span trace", CSpanTrace::instance().overwritten());
+	}
+	return 0;
+}
@@ -0,0 +1,493 @@
+#include "hostsample.h"
+
+#include <string.h>
+
+//
+// CHostSample
+//
+CHostSample* CHostSample::create(size_t max_length)
+{
+	CHostSample* sample = new CHostSample(max_length);
+	if (!sample->m_buffer)
+	{
+		delete sample;
+		return nullptr;
+	}
+	return sample;
+}
+
+CHostSample::CHostSample(size_t max_length)
+: m_refCount(1)
+, m_pool(nullptr)
+, m_buffer(nullptr)
+, m_maxLength(max_length)
+, m_currentLength(0)
+, m_sampleTime(0)
+, m_sampleDuration(0)
+, m_discontinuity(false)
+{
+	m_buffer = (unsigned char*)alignedAlloc(max_length ? max_length : 1);
+}
+
+CHostSample::~CHostSample()
+{
+	if (m_buffer)
+	{
+		alignedFree(m_buffer);
+	}
+}
+
+unsigned long CHostSample::AddRef()
+{
+	return ++m_refCount;
+}
+
+unsigned long CHostSample::Release()
+{
+	unsigned long count = --m_refCount;
+	if (count == 0)
+	{
+		if (m_pool)
+		{
+			m_pool->recycle(this);
+		}
+		else
+		{
+			delete this;
+		}
+	}
+	return count;
+}
+
+CHostSample* CHostSample::makeWritable()
+{
+	if (!shared())
+	{
+		return this;
+	}
+
+	CHostSample* copy = CHostSample::create(m_maxLength);
+	if (!copy)
+	{
+		return nullptr;
+	}
+	memcpy(copy->m_buffer, m_buffer, m_currentLength);
+	copy->m_currentLength = m_currentLength;
+	copy->m_sampleTime = m_sampleTime;
+	copy->m_sampleDuration = m_sampleDuration;
+	copy->m_discontinuity = m_discontinuity;
+	Release();
+	return copy;
+}
+
+bool CHostSample::lockFrame(FRAME_FORMAT format, unsigned int width, unsigned int height, FrameDesc& desc)
+{
+	if (!frameAttach(desc, format, width, height, m_buffer, m_maxLength))
+	{
+		return false;
+	}
+	desc.sample_time = m_sampleTime;
+	desc.sample_duration = m_sampleDuration;
+	return true;
+}
+
+//
+// CHostSamplePool
+//
+CHostSamplePool::CHostSamplePool()
+: m_pool([](CHostSample* sample) { delete sample; })
+{
+}
+
+CHostSample* CHostSamplePool::create(size_t max_length)
+{
+	CHostSample* sample = nullptr;
+	if (m_pool.acquire(max_length, &sample))
+	{
+		sample->m_refCount = 1;
+		sample->m_currentLength = 0;
+		sample->m_sampleTime = 0;
+		sample->m_sampleDuration = 0;
+		sample->m_discontinuity = false;
+		return sample;
+	}
+
+	sample = CHostSample::create(max_length);
+	if (sample)
+	{
+		sample->m_pool = this;
+		m_pool.created();
+	}
+	return sample;
+}
+
+void CHostSamplePool::recycle(CHostSample* sample)
+{
+	m_pool.recycle(sample->m_maxLength, sample);
+}
+
+//
+// CHostTransform
+//
+CHostTransform::CHostTransform(std::unique_ptr<CFrameStage> stage, unsigned int width, unsigned int height)
+: m_stage(std::move(stage))
+, m_width(width)
+, m_height(height)
+, m_pending(nullptr)
+, m_streaming(false)
+, m_stats()
+{
+}
+
+CHostTransform::~CHostTransform()
+{
+	if (m_pending)
+	{
+		m_pending->Release();
+	}
+}
+
+bool CHostTransform::processMessage(HOST_MESSAGE message)
+{
+	m_stats.messages++;
+	switch (message)
+	{
+	case HOST_MESSAGE_NOTIFY_BEGIN_STREAMING:
+		m_stats.sessions++;
+		m_streaming = true;
+		break;
+	case HOST_MESSAGE_NOTIFY_END_STREAMING:
+		m_streaming = false;
+		break;
+	case HOST_MESSAGE_COMMAND_FLUSH:
+		m_stats.flushes++;
+		if (m_pending)
+		{
+			m_pending->Release();
+			m_pending = nullptr;
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+bool CHostTransform::processInput(CHostSample* sample)
+{
+	if (!sample || m_pending)
+	{
+		return false;
+	}
+	sample->AddRef();
+	m_pending = sample;
+	return true;
+}
+
+bool CHostTransform::processOutput(CHostSample* sample)
+{
+	if (!m_pending || !sample)
+	{
+		return false;
+	}
+
+	unsigned int out_width = 0, out_height = 0;
+	m_stage->outputSize(m_width, m_height, out_width, out_height);
+
+	FrameDesc input, output;
+	bool ok = m_pending->lockFrame(m_stage->inputFormat(), m_width, m_height, input) &&
+		sample->lockFrame(m_stage->outputFormat(), out_width, out_height, output) &&
+		m_stage->process(input, output);
+	if (ok)
+	{
+		sample->setCurrentLength(frameBufferSize(m_stage->outputFormat(), out_width, out_height));
+		sample->setSampleTime(m_pending->sampleTime());
+		sample->setSampleDuration(m_pending->sampleDuration());
+		m_stats.frames++;
+	}
+
+	m_pending->Release();
+	m_pending = nullptr;
+	return ok;
+}
+
+size_t CHostTransform::outputSize() const
+{
+	unsigned int out_width = 0, out_height = 0;
+	m_stage->outputSize(m_width, m_height, out_width, out_height);
+	return frameBufferSize(m_stage->outputFormat(), out_width, out_height);
+}
+
+//
+// CHostXvpTee
+//
+CHostXvpTee::CHostXvpTee(CHostTransform* transform, bool session)
+: m_transform(transform)
+, m_session(session)
+, m_created(0)
+{
+}
+
+CHostXvpTee::~CHostXvpTee()
+{
+	stopStreaming();
+}
+
+bool CHostXvpTee::startStreaming()
+{
+	if (m_transform->streaming())
+	{
+		return true;
+	}
+	return m_transform->processMessage(HOST_MESSAGE_NOTIFY_BEGIN_STREAMING) &&
+		m_transform->processMessage(HOST_MESSAGE_NOTIFY_START_OF_STREAM);
+}
+
+void CHostXvpTee::stopStreaming()
+{
+	if (m_transform->streaming())
+	{
+		m_transform->processMessage(HOST_MESSAGE_NOTIFY_END_OF_STREAM);
+		m_transform->processMessage(HOST_MESSAGE_NOTIFY_END_STREAMING);
+	}
+}
+
+CHostSample* CHostXvpTee::process(CHostSample* sample)
+{
+	if (!startStreaming())
+	{
+		return nullptr;
+	}
+
+	CHostSample* output = nullptr;
+	if (m_session)
+	{
+		output = m_pool.create(m_transform->outputSize());
+	}
+	else
+	{
+		output = CHostSample::create(m_transform->outputSize());
+		m_created++;
+	}
+
+	if (!output || !m_transform->processInput(sample) || !m_transform->processOutput(output))
+	{
+		if (output)
+		{
+			output->Release();
+			output = nullptr;
+		}
+		m_transform->processMessage(HOST_MESSAGE_COMMAND_FLUSH);
+	}
+
+	if (!m_session)
+	{
+		m_transform->processMessage(HOST_MESSAGE_COMMAND_FLUSH);
+		stopStreaming();
+	}
+	return output;
+}
+
+unsigned long long CHostXvpTee::allocations() const
+{
+	return m_session ? m_pool.stats().allocations : m_created;
+}
+
+//
+// CHostMediaType
+//
+CHostMediaType::HostTypeItem* CHostMediaType::item(HOST_TYPE_ATTRIBUTE attribute, bool create)
+{
+	size_t i = 0;
+	while (i < m_items.size() && m_items[i].attribute < attribute)
+	{
+		i++;
+	}
+	if (i < m_items.size() && m_items[i].attribute == attribute)
+	{
+		return &m_items[i];
+	}
+	if (!create)
+	{
+		return nullptr;
+	}
+	HostTypeItem added = { attribute, 0, {} };
+	return &*m_items.insert(m_items.begin() + i, added);
+}
+
+const CHostMediaType::HostTypeItem* CHostMediaType::item(HOST_TYPE_ATTRIBUTE attribute) const
+{
+	return const_cast<CHostMediaType*>(this)->item(attribute, false);
+}
+
+void CHostMediaType::setUINT64(HOST_TYPE_ATTRIBUTE attribute, unsigned long long value)
+{
+	item(attribute, true)->value = value;
+}
+
+void CHostMediaType::setGUID(HOST_TYPE_ATTRIBUTE attribute, const unsigned char guid[16])
+{
+	memcpy(item(attribute, true)->guid, guid, 16);
+}
+
+bool CHostMediaType::getUINT64(HOST_TYPE_ATTRIBUTE attribute, unsigned long long& value) const
+{
+	const HostTypeItem* found = item(attribute);
+	if (found)
+	{
+		value = found->value;
+	}
+	return found != nullptr;
+}
+
+bool CHostMediaType::getGUID(HOST_TYPE_ATTRIBUTE attribute, unsigned char guid[16]) const
+{
+	const HostTypeItem* found = item(attribute);
+	if (found)
+	{
+		memcpy(guid, found->guid, 16);
+	}
+	return found != nullptr;
+}
+
+bool CHostMediaType::isEqual(const CHostMediaType& other) const
+{
+	if (m_items.size() != other.m_items.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < m_items.size(); i++)
+	{
+		if (m_items[i].attribute != other.m_items[i].attribute || m_items[i].value != other.m_items[i].value ||
+			memcmp(m_items[i].guid, other.m_items[i].guid, 16))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+MediaTypeKey CHostMediaType::key() const
+{
+	MediaTypeKey key;
+	unsigned long long value = 0;
+	getGUID(HOST_MT_MAJOR_TYPE, key.major_type);
+	getGUID(HOST_MT_SUBTYPE, key.subtype);
+	if (getUINT64(HOST_MT_FRAME_SIZE, value))
+	{
+		key.width = (unsigned int)(value >> 32);
+		key.height = (unsigned int)value;
+	}
+	if (getUINT64(HOST_MT_FRAME_RATE, value))
+	{
+		key.rate_numerator = (unsigned int)(value >> 32);
+		key.rate_denominator = (unsigned int)value;
+	}
+	if (getUINT64(HOST_MT_INTERLACE_MODE, value))
+	{
+		key.interlace = (unsigned int)value;
+	}
+	if (getUINT64(HOST_MT_DEFAULT_STRIDE, value))
+	{
+		key.stride = (int)value;
+	}
+	return key;
+}
+
+//
+// CHostFanOut
+//
+CHostFanOut::CHostFanOut(unsigned int width, unsigned int height, bool share)
+: m_width(width)
+, m_height(height)
+, m_share(share)
+, m_conversions(0)
+{
+}
+
+size_t CHostFanOut::addPin(std::unique_ptr<CFrameStage> stage)
+{
+	m_pins.push_back(std::move(stage));
+	return m_pins.size() - 1;
+}
+
+bool CHostFanOut::sameConversion(size_t a, size_t b) const
+{
+	const CFrameStage* first = m_pins[a].get();
+	const CFrameStage* second = m_pins[b].get();
+	if (!first || !second)
+	{
+		return false;
+	}
+
+	unsigned int first_width = 0, first_height = 0, second_width = 0, second_height = 0;
+	first->outputSize(m_width, m_height, first_width, first_height);
+	second->outputSize(m_width, m_height, second_width, second_height);
+	return !strcmp(first->name(), second->name()) &&
+		first->inputFormat() == second->inputFormat() &&
+		first->outputFormat() == second->outputFormat() &&
+		first_width == second_width && first_height == second_height;
+}
+
+CHostSample* CHostFanOut::convert(size_t pin, CHostSample* input)
+{
+	CFrameStage* stage = m_pins[pin].get();
+	unsigned int out_width = 0, out_height = 0;
+	stage->outputSize(m_width, m_height, out_width, out_height);
+
+	CHostSample* output = m_pool.create(frameBufferSize(stage->outputFormat(), out_width, out_height));
+	if (!output)
+	{
+		return nullptr;
+	}
+
+	FrameDesc in, out;
+	if (!input->lockFrame(stage->inputFormat(), m_width, m_height, in) ||
+		!output->lockFrame(stage->outputFormat(), out_width, out_height, out) ||
+		!stage->process(in, out))
+	{
+		output->Release();
+		return nullptr;
+	}
+	m_conversions++;
+	output->setCurrentLength(frameBufferSize(stage->outputFormat(), out_width, out_height));
+	output->setSampleTime(input->sampleTime());
+	output->setSampleDuration(input->sampleDuration());
+	output->setDiscontinuity(input->discontinuity());
+	return output;
+}
+
+bool CHostFanOut::deliver(CHostSample* input, std::vector<CHostSample*>& outputs)
+{
+	outputs.assign(m_pins.size(), nullptr);
+	bool ok = true;
+
+	for (size_t pin = 0; pin < m_pins.size(); pin++)
+	{
+		if (!m_pins[pin])
+		{
+			input->AddRef();
+			outputs[pin] = input;
+			continue;
+		}
+
+		if (m_share)
+		{
+			for (size_t earlier = 0; earlier < pin; earlier++)
+			{
+				if (outputs[earlier] && sameConversion(earlier, pin))
+				{
+					outputs[earlier]->AddRef();
+					outputs[pin] = outputs[earlier];
+					break;
+				}
+			}
+		}
+		if (!outputs[pin])
+		{
+			outputs[pin] = convert(pin, input);
+			ok = ok && outputs[pin] != nullptr;
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,240 @@
+#ifndef HOST_SAMPLE_H
+#define HOST_SAMPLE_H
+
+//
+// Stand-ins for the Media Foundation plumbing used by the host harness. They
+// mirror the parts of IMFSample / IMFTransform the device MFT relies on so the
+// frame path can run, be profiled and be sanitized without a capture graph.
+//
+
+#include "framecore.h"
+#include "mediatypeindex.h"
+#include "samplepool.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class CHostSamplePool;
+
+class CHostSample
+{
+public:
+	static CHostSample* create(size_t max_length);
+
+	unsigned long AddRef();
+	unsigned long Release();
+
+	unsigned char* buffer() { return m_buffer; }
+	size_t maxLength() const { return m_maxLength; }
+	size_t currentLength() const { return m_currentLength; }
+	void setCurrentLength(size_t length) { m_currentLength = length; }
+
+	long long sampleTime() const { return m_sampleTime; }
+	void setSampleTime(long long time) { m_sampleTime = time; }
+	long long sampleDuration() const { return m_sampleDuration; }
+	void setSampleDuration(long long duration) { m_sampleDuration = duration; }
+	bool discontinuity() const { return m_discontinuity; }
+	void setDiscontinuity(bool discontinuity) { m_discontinuity = discontinuity; }
+
+	// True when a reference besides the caller's is out
+	bool shared() const { return m_refCount.load() > 1; }
+
+	// Takes the caller's reference and returns a sample it may write to: this
+	// one when nobody else holds it, otherwise a copy of it. nullptr when the
+	// copy cannot be allocated, the reference is kept then.
+	CHostSample* makeWritable();
+
+	// Describes the buffer as a frame of the given format, like locking an IMFMediaBuffer
+	bool lockFrame(FRAME_FORMAT format, unsigned int width, unsigned int height, FrameDesc& desc);
+
+private:
+	friend class CHostSamplePool;
+
+	explicit CHostSample(size_t max_length);
+	~CHostSample();
+	CHostSample(const CHostSample&);
+	CHostSample& operator=(const CHostSample&);
+
+	std::atomic<unsigned long>  m_refCount;
+	CHostSamplePool*            m_pool;     // takes the sample back when the last reference goes
+	unsigned char*              m_buffer;
+	size_t                      m_maxLength;
+	size_t                      m_currentLength;
+	long long                   m_sampleTime;
+	long long                   m_sampleDuration;
+	bool                        m_discontinuity;
+};
+
+//
+// Recycles samples the way CSamplePool does in the transform. The pool must
+// outlive every sample it hands out.
+//
+class CHostSamplePool
+{
+public:
+	CHostSamplePool();
+
+	CHostSample* create(size_t max_length);
+	void trim() { m_pool.trim(); }
+	SamplePoolStats stats() const { return m_pool.stats(); }
+
+private:
+	friend class CHostSample;
+	void recycle(CHostSample* sample);
+
+	CRecyclePool<CHostSample*>  m_pool;
+};
+
+enum HOST_MESSAGE {
+	HOST_MESSAGE_NOTIFY_BEGIN_STREAMING,
+	HOST_MESSAGE_NOTIFY_START_OF_STREAM,
+	HOST_MESSAGE_COMMAND_FLUSH,
+	HOST_MESSAGE_NOTIFY_END_OF_STREAM,
+	HOST_MESSAGE_NOTIFY_END_STREAMING
+};
+
+typedef struct _HostTransformStats {
+	unsigned long long  messages;       // processMessage() calls of any kind
+	unsigned long long  sessions;       // BEGIN_STREAMING messages
+	unsigned long long  flushes;
+	unsigned long long  frames;         // processOutput() calls that produced a frame
+} HostTransformStats, *HostTransformStatsPtr;
+
+//
+// Synchronous one-in one-out transform around a CFrameStage, shaped like the
+// video processor MFT: processInput() takes a reference on the sample and
+// processOutput() fills the caller's sample, as MFT_OUTPUT_DATA_BUFFER does.
+//
+class CHostTransform
+{
+public:
+	CHostTransform(std::unique_ptr<CFrameStage> stage, unsigned int width, unsigned int height);
+	~CHostTransform();
+
+	bool processMessage(HOST_MESSAGE message);
+	bool processInput(CHostSample* sample);
+	bool processOutput(CHostSample* sample);
+
+	// Size of the sample processOutput() needs, like MFT_OUTPUT_STREAM_INFO::cbSize
+	size_t outputSize() const;
+	CFrameStage* stage() { return m_stage.get(); }
+	const HostTransformStats& stats() const { return m_stats; }
+	bool streaming() const { return m_streaming; }
+
+private:
+	std::unique_ptr<CFrameStage>    m_stage;
+	unsigned int                    m_width;
+	unsigned int                    m_height;
+	CHostSample*                    m_pending;
+	bool                            m_streaming;
+	HostTransformStats              m_stats;
+};
+
+//
+// The software path of CXvptee::Do over a CHostTransform. In session mode it
+// opens the streaming session on the first frame, closes it when destroyed
+// and takes its output samples from a pool, as the tee does. Otherwise it
+// sends the whole message sequence and creates a sample for every frame, as
+// the tee used to.
+//
+class CHostXvpTee
+{
+public:
+	CHostXvpTee(CHostTransform* transform, bool session);
+	~CHostXvpTee();
+
+	// Returns the converted frame, nullptr on failure. The input stays the caller's.
+	CHostSample* process(CHostSample* sample);
+
+	// Output samples created rather than recycled
+	unsigned long long allocations() const;
+
+private:
+	bool startStreaming();
+	void stopStreaming();
+
+	CHostTransform*     m_transform;
+	bool                m_session;
+	unsigned long long  m_created;
+	CHostSamplePool     m_pool;     // frames from process() are released before the tee goes
+};
+
+enum HOST_TYPE_ATTRIBUTE {
+	HOST_MT_MAJOR_TYPE,                 // guid
+	HOST_MT_SUBTYPE,                    // guid
+	HOST_MT_FRAME_SIZE,                 // width << 32 | height
+	HOST_MT_FRAME_RATE,                 // numerator << 32 | denominator
+	HOST_MT_INTERLACE_MODE,
+	HOST_MT_DEFAULT_STRIDE,
+	HOST_MT_ALL_SAMPLES_INDEPENDENT,
+	HOST_MT_FIXED_SIZE_SAMPLES,
+	HOST_MT_PIXEL_ASPECT_RATIO,
+	HOST_MT_VIDEO_NOMINAL_RANGE
+};
+
+//
+// Attribute store standing in for IMFMediaType. isEqual() compares every
+// attribute of both types, as IsEqual does for the format data, and key()
+// is what CBasePin indexes the type under.
+//
+class CHostMediaType
+{
+public:
+	void setUINT64(HOST_TYPE_ATTRIBUTE attribute, unsigned long long value);
+	void setGUID(HOST_TYPE_ATTRIBUTE attribute, const unsigned char guid[16]);
+	bool getUINT64(HOST_TYPE_ATTRIBUTE attribute, unsigned long long& value) const;
+	bool getGUID(HOST_TYPE_ATTRIBUTE attribute, unsigned char guid[16]) const;
+
+	bool isEqual(const CHostMediaType& other) const;
+	MediaTypeKey key() const;
+
+private:
+	typedef struct _HostTypeItem {
+		HOST_TYPE_ATTRIBUTE attribute;
+		unsigned long long  value;
+		unsigned char       guid[16];
+	} HostTypeItem;
+
+	HostTypeItem* item(HOST_TYPE_ATTRIBUTE attribute, bool create);
+	const HostTypeItem* item(HOST_TYPE_ATTRIBUTE attribute) const;
+
+	std::vector<HostTypeItem>   m_items;    // sorted by attribute
+};
+
+//
+// CInPin::SendSample over host samples: one input frame goes to every pin, a
+// pin without a stage passes it through, the others convert it. Shared mode
+// is the transform's fan-out: pass-through pins hold the input itself and a
+// pin whose stage makes the same conversion as an earlier pin's (same stage,
+// formats and output size) takes that pin's result, as the tees do through
+// CConversionCache. Otherwise every converting pin runs its own stage, as
+// each tee did before. A pin writing to its frame calls makeWritable first.
+//
+class CHostFanOut
+{
+public:
+	CHostFanOut(unsigned int width, unsigned int height, bool share);
+
+	// A null stage passes the frame through. Returns the pin's index.
+	size_t addPin(std::unique_ptr<CFrameStage> stage);
+	size_t pinCount() const { return m_pins.size(); }
+
+	// Adds one reference per pin to outputs. The input stays the caller's.
+	bool deliver(CHostSample* input, std::vector<CHostSample*>& outputs);
+
+	// CFrameStage::process() calls
+	unsigned long long conversions() const { return m_conversions; }
+
+private:
+	bool sameConversion(size_t a, size_t b) const;
+	CHostSample* convert(size_t pin, CHostSample* input);
+
+	unsigned int        m_width;
+	unsigned int        m_height;
+	bool                m_share;
+	std::vector<std::unique_ptr<CFrameStage>> m_pins;
+	unsigned long long  m_conversions;
+	CHostSamplePool     m_pool;     // frames from deliver() are released before the fan-out goes
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "lensgeometry.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void lensModel(const LensParams& lens, double scale, double fov, LensModel& model)
+{
+	model.center_x = lens.center_x * scale;
+	model.center_y = lens.center_y * scale;
+	model.half_fov = fov * M_PI / 360.0;
+	model.pixels_per_radian = lens.radius * scale / model.half_fov;
+
+	//
+	// Lens orientation R = Ry(yaw) * Rx(pitch) * Rz(roll); world to lens is its transpose
+	//
+	double cy = cos(lens.yaw * M_PI / 180.0), sy = sin(lens.yaw * M_PI / 180.0);
+	double cp = cos(lens.pitch * M_PI / 180.0), sp = sin(lens.pitch * M_PI / 180.0);
+	double cr = cos(lens.roll * M_PI / 180.0), sr = sin(lens.roll * M_PI / 180.0);
+	double r[3][3] = {
+		{ cy * cr + sy * sp * sr, -cy * sr + sy * sp * cr, sy * cp },
+		{ cp * sr, cp * cr, -sp },
+		{ -sy * cr + cy * sp * sr, sy * sr + cy * sp * cr, cy * cp },
+	};
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			model.rotation[i][j] = r[j][i];
+		}
+	}
+}
+
+void outputDirection(STITCH_PROJECTION projection, double u, double v, double dir[3])
+{
+	double longitude = (u - 0.5) * 2.0 * M_PI;
+	double latitude = 0;
+	if (projection == STITCH_PROJECTION_CYLINDRICAL)
+	{
+		// +-60 degrees of latitude, straight verticals
+		latitude = atan((0.5 - v) * 2.0 * tan(M_PI / 3.0));
+	}
+	else
+	{
+		latitude = (0.5 - v) * M_PI;
+	}
+	dir[0] = cos(latitude) * sin(longitude);
+	dir[1] = sin(latitude);
+	dir[2] = cos(latitude) * cos(longitude);
+}
+
+void rotateDirection(const double rotation[3][3], const double dir[3], double out[3])
+{
+	for (int i = 0; i < 3; i++)
+	{
+		out[i] = rotation[i][0] * dir[0] + rotation[i][1] * dir[1] + rotation[i][2] * dir[2];
+	}
+}
+
+double projectToLens(const LensModel& lens, const double dir[3], double& x, double& y)
+{
+	double lx = lens.rotation[0][0] * dir[0] + lens.rotation[0][1] * dir[1] + lens.rotation[0][2] * dir[2];
+	double ly = lens.rotation[1][0] * dir[0] + lens.rotation[1][1] * dir[1] + lens.rotation[1][2] * dir[2];
+	double lz = lens.rotation[2][0] * dir[0] + lens.rotation[2][1] * dir[1] + lens.rotation[2][2] * dir[2];
+
+	double theta = acos(lz < -1.0 ? -1.0 : (lz > 1.0 ? 1.0 : lz));
+	double planar = sqrt(lx * lx + ly * ly);
+	double radius = theta * lens.pixels_per_radian;
+	x = lens.center_x + (planar > 0 ? radius * lx / planar : 0);
+	y = lens.center_y - (planar > 0 ? radius * ly / planar : 0);
+	return theta;
+}
+
+double featherWidth(const LensModel& lens)
+{
+	// the band where both lenses see the scene is feathered over its full width
+	double feather = lens.half_fov - M_PI / 2;
+	return feather > 0.01 ? feather : 0.01;
+}
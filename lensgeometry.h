@@ -0,0 +1,43 @@
+#ifndef LENS_GEOMETRY_H
+#define LENS_GEOMETRY_H
+
+//
+// Geometry shared by the stitch remaps: output projections and the
+// equidistant fisheye model of the Air lenses.
+//
+
+#include "airoffset.h"
+
+enum STITCH_PROJECTION {
+	STITCH_PROJECTION_EQUIRECTANGULAR   = 0,
+	STITCH_PROJECTION_CYLINDRICAL       = 1,
+};
+
+//
+// One lens in plane pixel units. rotation takes a world direction into the
+// lens frame: x right, y up, z along the optical axis.
+//
+typedef struct _LensModel {
+	double  center_x;
+	double  center_y;
+	double  pixels_per_radian;
+	double  half_fov;
+	double  rotation[3][3];
+}LensModel, *LensModelPtr;
+
+// Lens parameters of the offset string scaled to a plane
+void lensModel(const LensParams& lens, double scale, double fov, LensModel& model);
+
+// Unit view direction of the output position (u, v), both in 0..1
+void outputDirection(STITCH_PROJECTION projection, double u, double v, double dir[3]);
+
+// out = rotation * dir
+void rotateDirection(const double rotation[3][3], const double dir[3], double out[3]);
+
+// Projects a direction into a lens, returns the angle to the optical axis
+double projectToLens(const LensModel& lens, const double dir[3], double& x, double& y);
+
+// Angle over which the overlap of two back to back lenses is blended, radians
+double featherWidth(const LensModel& lens);
+
+#endif
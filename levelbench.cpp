@@ -0,0 +1,176 @@
+//
+// Cost of a disabled log line. A debug line at the default info level goes
+// through CMyLog::Log as the LOG macros called it before, arguments evaluated
+// and the level checked inside Log, and through LOGDBG with its atomic level
+// check in front. The gated line must not evaluate its arguments. Then the
+// level is changed at runtime by writing dmft.level, for the async writer and
+// then for synchronous lines to pick up, and a trace must put back the level
+// it raised. Exits with 1 when an argument was evaluated or the level did not
+// change.
+//
+// usage: levelbench [-n lines] [-d dir]
+//
+
+// keep LOGDBG in this build whatever NDEBUG says, the runtime check is what is measured
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DBG
+#include "log.h"
+
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock LevelClock;
+
+static volatile unsigned int s_evaluated = 0;
+
+// an argument with a side effect, counts how often a line's arguments are evaluated
+static unsigned int evaluate(unsigned int i)
+{
+	s_evaluated = s_evaluated + 1;
+	return i;
+}
+
+static bool writeLevel(const std::string& dir, const char* text)
+{
+	FILE* fp = fopen((dir + "/dmft.level").c_str(), "w");
+	if (!fp)
+	{
+		return false;
+	}
+	fputs(text, fp);
+	fclose(fp);
+	return true;
+}
+
+// Waits up to three poll periods for the level to be taken, logging an error line meanwhile when log is set
+static bool waitLevel(unsigned char level, CMyLog* log = NULL)
+{
+	LevelClock::time_point end = LevelClock::now() + std::chrono::milliseconds(3 * LOG_LEVEL_POLL_MS);
+	while (CMyLog::Level() != level && LevelClock::now() < end)
+	{
+		if (log)
+		{
+			log->Log(LOG_LEVEL_ERR, "waiting for dmft.level");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return CMyLog::Level() == level;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int lines = 10000000;
+	std::string dir;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			lines = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-d"))
+		{
+			dir = argv[i + 1];
+		}
+	}
+	if (!lines)
+	{
+		return 0;
+	}
+	if (dir.empty())
+	{
+		char temp[] = "/tmp/levelbenchXXXXXX";
+		if (!mkdtemp(temp))
+		{
+			printf("cannot create a log directory\n");
+			return 1;
+		}
+		dir = temp;
+	}
+	mkdir(dir.c_str(), 0766);
+	remove((dir + "/dmft.level").c_str());
+
+	CMyLog log(dir.c_str());
+	CMyLog::SetLevel(LOG_LEVEL_INFO);
+	int result = 0;
+
+	LevelClock::time_point start = LevelClock::now();
+	for (unsigned int i = 0; i < lines; i++)
+	{
+		log.Log(LOG_LEVEL_DBG, __FILE__, __LINE__, "frame %u stage %s", evaluate(i), "convert");
+	}
+	double callNs = std::chrono::duration<double, std::nano>(LevelClock::now() - start).count() / lines;
+	unsigned int callEvaluated = s_evaluated;
+
+	s_evaluated = 0;
+	start = LevelClock::now();
+	for (unsigned int i = 0; i < lines; i++)
+	{
+		LOGDBG("frame %u stage %s", evaluate(i), "convert");
+	}
+	double gatedNs = std::chrono::duration<double, std::nano>(LevelClock::now() - start).count() / lines;
+	unsigned int gatedEvaluated = s_evaluated;
+
+	printf("%u debug lines at info level\n", lines);
+	printf("  %-6s %10s %10s\n", "check", "ns/line", "evaluated");
+	printf("  %-6s %10.2f %10u\n", "Log", callNs, callEvaluated);
+	printf("  %-6s %10.2f %10u\n", "LOGDBG", gatedNs, gatedEvaluated);
+	if (gatedEvaluated)
+	{
+		printf("disabled LOGDBG evaluated its arguments\n");
+		result = 1;
+	}
+
+	// hot change through dmft.level
+	if (!log.StartAsync(LOG_RING_LINES))
+	{
+		printf("cannot start the async writer\n");
+		return 1;
+	}
+	const char* texts[] = { "debug\n", "0\n", "Info" };
+	const unsigned char levels[] = { LOG_LEVEL_DBG, LOG_LEVEL_ERR, LOG_LEVEL_INFO };
+	for (int i = 0; i < 3; i++)
+	{
+		LevelClock::time_point written = LevelClock::now();
+		if (!writeLevel(dir, texts[i]) || !waitLevel(levels[i]))
+		{
+			printf("dmft.level \"%s\" not taken, level %u\n", texts[i], CMyLog::Level());
+			result = 1;
+			break;
+		}
+		printf("dmft.level set to %u after %.0f ms\n", levels[i],
+			std::chrono::duration<double, std::milli>(LevelClock::now() - written).count());
+	}
+	log.StopAsync();
+
+	// the same without the writer thread, read by the lines logged
+	for (int i = 0; i < 3 && !result; i++)
+	{
+		LevelClock::time_point written = LevelClock::now();
+		if (!writeLevel(dir, texts[i]) || !waitLevel(levels[i], &log))
+		{
+			printf("synchronous dmft.level \"%s\" not taken, level %u\n", texts[i], CMyLog::Level());
+			result = 1;
+			break;
+		}
+		printf("synchronous dmft.level set to %u after %.0f ms\n", levels[i],
+			std::chrono::duration<double, std::milli>(LevelClock::now() - written).count());
+	}
+	remove((dir + "/dmft.level").c_str());
+
+	// a trace raises the level to debug for its duration only
+	CMyLog::SetLevel(LOG_LEVEL_INFO);
+	if (log.StartTrace(dir.c_str(), LOG_TRACE_SEGMENT_SIZE, 2))
+	{
+		unsigned char traced = CMyLog::Level();
+		log.StopTrace();
+		if (traced != LOG_LEVEL_DBG || CMyLog::Level() != LOG_LEVEL_INFO)
+		{
+			printf("trace level %u, %u after it, expected %u and %u\n", traced, CMyLog::Level(), LOG_LEVEL_DBG, LOG_LEVEL_INFO);
+			result = 1;
+		}
+	}
+	return result;
+}
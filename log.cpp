@@ -1,12 +1,75 @@
 ﻿#include <time.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
 #include "log.h" 
 
+static const char LogLevelString[][10] = { "ERROR", "INFO ", "DEBUG" };
+
+std::atomic<unsigned char> CMyLog::s_ucLevel(LOG_LEVEL_INFO);
+
+/*
+ * "date time level " in front of an async line. localtime is only redone when
+ * the second changes, per thread.
+ */
+static unsigned int FormatPrefix(char* text, unsigned int size, unsigned char level)
+{
+	static thread_local time_t s_second = (time_t)-1;
+	static thread_local char s_stamp[64];
+
+	time_t timer = time(NULL);
+	if (timer != s_second)
+	{
+		struct tm tmt;
+#ifdef _WINDOWS
+		localtime_s(&tmt, &timer);
+#else
+		localtime_r(&timer, &tmt);
+#endif
+		snprintf(s_stamp, sizeof(s_stamp), "%04d-%02d-%02d %02d:%02d:%02d",
+			tmt.tm_year + 1900,
+			tmt.tm_mon + 1,
+			tmt.tm_mday,
+			tmt.tm_hour,
+			tmt.tm_min,
+			tmt.tm_sec);
+		s_second = timer;
+	}
+	int written = snprintf(text, size, "%s %s ", s_stamp, LogLevelString[level]);
+	return written < 0 ? 0 : ((unsigned int)written >= size ? size - 1 : (unsigned int)written);
+}
+
+/* length of a ring line after appending written characters, a cut line ends at the last byte */
+static unsigned int AdvanceLine(unsigned int length, int written)
+{
+	if (written < 0)
+	{
+		return length;
+	}
+	return length + (unsigned int)written >= LOG_RING_LINE_SIZE ? LOG_RING_LINE_SIZE - 1 : length + (unsigned int)written;
+}
+
 CMyLog::CMyLog()
+: CMyLog(NULL)
+{
+}
+
+CMyLog::CMyLog(const char* dir)
 : m_fp(NULL)
 , m_ulFileSize(0)
+, m_ulWritten(0)
+, m_uiRetained(LOG_RETAINED_FILES)
+, m_levelDue(0)
+, m_ring(nullptr)
+, m_stop(false)
+, m_flushWaiters(0)
+, m_durable(0)
+, m_dropped(0)
+, m_droppedReported(0)
+, m_traceRaised(false)
+, m_traceLevel(LOG_LEVEL_INFO)
 { 
-	m_ulFileSize = 1024 * 1024 * 5;
-	m_ucLevel = LOG_LEVEL_INFO;
+	m_ulFileSize = LOG_FILE_SIZE;
 
 #ifdef _WINDOWS
 	m_hMutex = CreateMutex(NULL, false, NULL);
@@ -18,6 +81,12 @@ CMyLog::CMyLog()
 	pthread_mutex_init(&m_mutex, NULL);
 #endif
 
+	if (dir)
+	{
+		Open(dir);
+		return;
+	}
+
 #ifdef _WINDOWS
 	char* home = getenv("HOMEDRIVE");
 	assert(home != NULL);
@@ -45,8 +114,6 @@ CMyLog::CMyLog()
 		_mkdir(m_path.c_str());
 	}
 
-	std::string logfile = m_path + "\\dmft.log";
-	m_fp = fopen(logfile.c_str(), "a+");
 #else
 	char* home = getenv("HOME");
 	if (!home)
@@ -75,10 +142,9 @@ CMyLog::CMyLog()
 		mkdir(m_path.c_str(), 0766);
 	}
 
-	std::string logfile = m_path + "/dmft.log";
-	m_fp = fopen(logfile.c_str(), "a+");
 #endif 
 	
+	OpenFile();
 	if (!m_fp)
 	{
 		printf("Open log file fail\r\n");
@@ -88,6 +154,9 @@ CMyLog::CMyLog()
 
 CMyLog::~CMyLog()
 {
+	StopAsync();
+	StopTrace();
+
 	if (m_fp)
 	{
 		fclose(m_fp);
@@ -103,84 +172,109 @@ CMyLog::~CMyLog()
 
 CMyLog& CMyLog::GetInstance()
 {
-	static CMyLog* pLog = NULL;
-
-	if (!pLog)
-	{
-		pLog = new CMyLog;
-	}
+	// initialised once even when threads race here; never deleted, so logging still works from static destructors
+	static CMyLog* pLog = new CMyLog;
 
 	return *pLog;
 }
 
+void CMyLog::SetLevel(unsigned char level)
+{
+	s_ucLevel.store(level > LOG_LEVEL_DBG ? LOG_LEVEL_DBG : level, std::memory_order_relaxed);
+}
+
 void CMyLog::Log(unsigned char level, const char* file, int line, const char* fmt, ...)
 {
-	static char LogLevelString[][10] = { "ERROR", "INFO ", "DEBUG" };
+	if (!Enabled(level))
+	{
+		return;
+	}
 
-	if (level > m_ucLevel)
+	va_list arg;
+	CLogRing* ring = m_ring.load(std::memory_order_acquire);
+	if (ring)
 	{
+		unsigned int length = 0;
+		LogRingLine* ringLine = BeginLine(ring, level, &length);
+		if (ringLine)
+		{
+			va_start(arg, fmt);
+			length = AdvanceLine(length, vsnprintf(ringLine->text + length, LOG_RING_LINE_SIZE - length, fmt, arg));
+			va_end(arg);
+			length = AdvanceLine(length, snprintf(ringLine->text + length, LOG_RING_LINE_SIZE - length, " %s:%d", file, line));
+			EndLine(ring, ringLine, length);
+		}
 		return;
 	}
-#ifdef _WINDOWS
-	WaitForSingleObject(m_hMutex, INFINITE);
-#else
-	pthread_mutex_lock(&m_mutex);
-#endif
+
+	PollLevelFile();
+	Lock();
 	
 	time_t timer = time(NULL);
 	struct tm *tmt = localtime(&timer);
-	va_list arg;
 
-	/* to log file */
+	/* to log file, rotated first if it is full */
+	if (m_fp)
+	{
+		ChangeLogFile();
+	}
 	if (m_fp)
 	{
-		fprintf(m_fp, "%04d-%02d-%02d %02d:%02d:%02d %s ",
+		CountWritten(fprintf(m_fp, "%04d-%02d-%02d %02d:%02d:%02d %s ",
 			tmt->tm_year + 1900,
 			tmt->tm_mon + 1,
 			tmt->tm_mday,
 			tmt->tm_hour,
 			tmt->tm_min,
 			tmt->tm_sec,
-			LogLevelString[level]);
+			LogLevelString[level]));
 
 		/* log content */
 		va_start(arg, fmt);
-		vfprintf(m_fp, fmt, arg);
+		CountWritten(vfprintf(m_fp, fmt, arg));
 		va_end(arg);
 
 		/* log file */
-		fprintf(m_fp, " %s:%d\n", file, line);
+		CountWritten(fprintf(m_fp, " %s:%d\n", file, line));
 		fflush(m_fp);
-		ChangeLogFile();
 	}
 
-#ifdef _WINDOWS
-	ReleaseMutex(m_hMutex);
-#else
-	pthread_mutex_unlock(&m_mutex);
-#endif 
+	Unlock();
 }
 
 void CMyLog::Log(unsigned char level, const char* str)
 {
-	static char LogLevelString[][10] = { "ERROR", "INFO ", "DEBUG" };
-	if (level > m_ucLevel)
+	if (!Enabled(level))
 	{
 		return;
 	}
 
-#ifdef _WINDOWS
-	WaitForSingleObject(m_hMutex, INFINITE);
-#else
-	pthread_mutex_lock(&m_mutex);
-#endif
+	CLogRing* ring = m_ring.load(std::memory_order_acquire);
+	if (ring)
+	{
+		unsigned int length = 0;
+		LogRingLine* ringLine = BeginLine(ring, level, &length);
+		if (ringLine)
+		{
+			length = AdvanceLine(length, snprintf(ringLine->text + length, LOG_RING_LINE_SIZE - length, "%s", str));
+			EndLine(ring, ringLine, length);
+		}
+		return;
+	}
+
+	PollLevelFile();
+	Lock();
 	
 	time_t timer = time(NULL);
 	struct tm *tmt = localtime(&timer);
-	/* to log file */
+	/* to log file, rotated first if it is full */
+	if (m_fp)
+	{
+		ChangeLogFile();
+	}
 	if (m_fp)
 	{
-		fprintf(m_fp, "%04d-%02d-%02d %02d:%02d:%02d %s %s\n",
+		CountWritten(fprintf(m_fp, "%04d-%02d-%02d %02d:%02d:%02d %s %s\n",
 			tmt->tm_year + 1900,
 			tmt->tm_mon + 1,
 			tmt->tm_mday,
@@ -188,58 +282,410 @@ void CMyLog::Log(unsigned char level, const char* str)
 			tmt->tm_min,
 			tmt->tm_sec,
 			LogLevelString[level],
-			str);
+			str));
 
 		fflush(m_fp);
-		ChangeLogFile();
 	}
 
+	Unlock();
+}
+
+/*
+ * Rotates before a write once the bytes in dmft.log reach m_ulFileSize: dmft.log
+ * becomes dmft.1.log, dmft.1.log becomes dmft.2.log and so on, and the file
+ * past m_uiRetained is removed. The names are built when the directory is
+ * set, the check per line is a compare.
+ */
+void CMyLog::ChangeLogFile()
+{
+	if (m_ulWritten < m_ulFileSize || m_files.empty())
+	{
+		return;
+	}
+
+	fclose(m_fp);
+	m_fp = NULL;
+
+	remove(m_files.back().c_str());
+	for (size_t i = m_files.size() - 1; i > 0; i--)
+	{
+		rename(m_files[i - 1].c_str(), m_files[i].c_str());
+	}
+
+	m_fp = fopen(m_files[0].c_str(), "a+");
+	m_ulWritten = 0;
+	if (!m_fp)
+	{
+		printf("Failed to open log file.\r\n");
+	}
+}
+
+/* Opens dmft.log under m_path, the names of the rotated files are built here too */
+void CMyLog::OpenFile()
+{
+	char number[16] = { 0 };
+
+	m_levelFile = m_path + "/dmft.level";
+	m_files.clear();
+	m_files.push_back(m_path + "/dmft.log");
+	for (unsigned int i = 1; i <= m_uiRetained; i++)
+	{
+		CC_SPRINTF(number, sizeof(number) - 1, "%u", i);
+		m_files.push_back(m_path + "/dmft." + number + ".log");
+	}
+
+	m_fp = fopen(m_files[0].c_str(), "a+");
+	m_ulWritten = 0;
+	if (m_fp && !fseek(m_fp, 0, SEEK_END))
+	{
+		long size = ftell(m_fp);
+		m_ulWritten = size > 0 ? (unsigned long long)size : 0;
+	}
+}
+
+void CMyLog::SetRotation(unsigned int fileSize, unsigned int retained)
+{
+	Lock();
+	m_ulFileSize = fileSize;
+	if (retained != m_uiRetained)
+	{
+		m_uiRetained = retained;
+		if (m_fp)
+		{
+			fclose(m_fp);
+			OpenFile();
+		}
+	}
+	Unlock();
+}
+
+void CMyLog::Lock()
+{
+#ifdef _WINDOWS
+	WaitForSingleObject(m_hMutex, INFINITE);
+#else
+	pthread_mutex_lock(&m_mutex);
+#endif
+}
+
+void CMyLog::Unlock()
+{
 #ifdef _WINDOWS
 	ReleaseMutex(m_hMutex);
 #else
 	pthread_mutex_unlock(&m_mutex);
 #endif
-	
 }
 
-void CMyLog::ChangeLogFile()
+bool CMyLog::Open(const char* dir)
 {
-	std::string origfile = m_path + "/dmft.log";
+	Lock();
+	if (m_fp)
+	{
+		fclose(m_fp);
+	}
+	m_path = dir;
+	OpenFile();
+	bool opened = m_fp != NULL;
+	Unlock();
+
+	if (!opened)
+	{
+		printf("Open log file fail\r\n");
+	}
+	return opened;
+}
 
+bool CMyLog::StartAsync(size_t lines)
+{
+	if (m_ring.load(std::memory_order_acquire))
+	{
+		return true;
+	}
 
-	struct stat statbuff;
-	if (stat(origfile.c_str(), &statbuff) < 0)
+	CLogRing* ring = NULL;
+	try
+	{
+		ring = new CLogRing(lines);
+		m_batch.resize(LOG_WRITE_BATCH);
+		m_stop = false;
+		m_durable = 0;
+		m_ring.store(ring, std::memory_order_release);
+		m_writer = std::thread(&CMyLog::WriterLoop, this);
+	}
+	catch (...)
+	{
+		m_ring.store(nullptr, std::memory_order_release);
+		delete ring;
+		printf("Start async log fail\r\n");
+		return false;
+	}
+	return true;
+}
+
+void CMyLog::StopAsync()
+{
+	CLogRing* ring = m_ring.load(std::memory_order_acquire);
+	if (!ring)
 	{
 		return;
 	}
 
-	if (statbuff.st_size < (int)m_ulFileSize)
 	{
+		std::lock_guard<std::mutex> lock(m_wakeLock);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_writer.join();
+
+	m_ring.store(nullptr, std::memory_order_release);
+	delete ring;
+}
+
+void CMyLog::Flush()
+{
+	CLogRing* ring = m_ring.load(std::memory_order_acquire);
+	if (!ring)
+	{
+		Lock();
+		if (m_fp)
+		{
+			fflush(m_fp);
+		}
+		Unlock();
 		return;
 	}
 
-	fclose(m_fp);
-	m_fp = NULL;
+	size_t target = ring->claimed();
+	std::unique_lock<std::mutex> lock(m_wakeLock);
+	m_flushWaiters++;
+	m_wake.notify_one();
+	while (m_durable < target)
+	{
+		m_flushed.wait(lock);
+	}
+	m_flushWaiters--;
+}
 
-	char filename[256] = { 0 };
-	time_t timer = time(NULL);
-	struct tm *tmt = localtime(&timer);
+/*
+ * Claims a ring line and writes the prefix into it, nullptr and one more
+ * dropped line when the ring is full.
+ */
+LogRingLine* CMyLog::BeginLine(CLogRing* ring, unsigned char level, unsigned int* length)
+{
+	LogRingLine* line = ring->claim();
+	if (!line)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		m_wake.notify_one();
+		return NULL;
+	}
+	*length = FormatPrefix(line->text, LOG_RING_LINE_SIZE, level);
+	return line;
+}
 
-	CC_SPRINTF(filename, 256 - 1, "/dmft.%04d_%02d_%02d_%02d_%02d_%02d.log",
-		tmt->tm_year + 1900,
-		tmt->tm_mon + 1,
-		tmt->tm_mday,
-		tmt->tm_hour,
-		tmt->tm_min,
-		tmt->tm_sec);
+void CMyLog::EndLine(CLogRing* ring, LogRingLine* line, unsigned int length)
+{
+	if (length == LOG_RING_LINE_SIZE - 1)
+	{
+		length--;
+	}
+	line->text[length++] = '\n';
+	line->length = length;
+	ring->commit(line);
 
-	std::string newfile = m_path + filename;
+	// the writer sleeps between batches, wake it before the ring fills up
+	if (ring->claimed() - ring->released() >= ring->capacity() / 2)
+	{
+		m_wake.notify_one();
+	}
+}
 
-	rename(origfile.c_str(), newfile.c_str());
-	m_fp = fopen(origfile.c_str(), "a+");
-	if (!m_fp)
+/*
+ * Moves the committed lines from the ring to the file, in batches of up to
+ * LOG_WRITE_BATCH bytes per fwrite. Returns the number of lines written.
+ */
+size_t CMyLog::WriteLines()
+{
+	CLogRing* ring = m_ring.load(std::memory_order_acquire);
+	const LogRingLine* line = NULL;
+	size_t lines = 0;
+	size_t reported = 0;
+	size_t used = 0;
+
+	unsigned long long dropped = m_dropped.load(std::memory_order_relaxed);
+	if (dropped != m_droppedReported)
 	{
-		printf("Failed to open log file.\r\n");
+		unsigned int length = FormatPrefix(&m_batch[0], LOG_RING_LINE_SIZE, LOG_LEVEL_ERR);
+		length = AdvanceLine(length, snprintf(&m_batch[length], LOG_RING_LINE_SIZE - length,
+			"%llu log lines dropped, the log writer fell behind\n", dropped - m_droppedReported));
+		used = length;
+		reported = 1;
+		m_droppedReported = dropped;
+	}
+
+	Lock();
+	// at most one ring's worth, so flush waiters are not kept waiting by a ring that never empties
+	while (lines < ring->capacity() && (line = ring->peek()) != NULL)
+	{
+		if (used + line->length > m_batch.size())
+		{
+			WriteBatch(used);
+			used = 0;
+		}
+		memcpy(&m_batch[used], line->text, line->length);
+		used += line->length;
+		ring->release();
+		lines++;
+	}
+	if (used)
+	{
+		WriteBatch(used);
+	}
+	Unlock();
+	return lines + reported;
+}
+
+/* Writes a batch of lines, into a new file if the current one is full. Called under the log lock */
+void CMyLog::WriteBatch(size_t used)
+{
+	if (m_fp)
+	{
+		ChangeLogFile();
+	}
+	if (m_fp)
+	{
+		CountWritten((int)fwrite(&m_batch[0], 1, used, m_fp));
+	}
+}
+
+/* Takes the level from dmft.level if there is one */
+void CMyLog::ReadLevelFile()
+{
+	char text[16] = { 0 };
+
+	Lock();
+	FILE* fp = fopen(m_levelFile.c_str(), "r");
+	Unlock();
+	if (!fp)
+	{
+		return;
+	}
+	if (fgets(text, sizeof(text), fp))
+	{
+		if (text[0] >= '0' && text[0] <= '0' + LOG_LEVEL_DBG)
+		{
+			SetLevel((unsigned char)(text[0] - '0'));
+		}
+		else
+		{
+			for (unsigned char level = 0; level <= LOG_LEVEL_DBG; level++)
+			{
+				int i = 0;
+				while (i < 4 && toupper((unsigned char)text[i]) == LogLevelString[level][i])
+				{
+					i++;
+				}
+				if (i == 4)
+				{
+					SetLevel(level);
+				}
+			}
+		}
 	}
+	fclose(fp);
 }
 
+/* Reads dmft.level from a synchronous line once LOG_LEVEL_POLL_MS passed since the last read */
+void CMyLog::PollLevelFile()
+{
+	long long now = (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	long long due = m_levelDue.load(std::memory_order_relaxed);
+	if (now < due ||
+		!m_levelDue.compare_exchange_strong(due, now + (long long)LOG_LEVEL_POLL_MS * 1000000, std::memory_order_relaxed))
+	{
+		return;
+	}
+	ReadLevelFile();
+}
+
+void CMyLog::WriterLoop()
+{
+	bool unflushed = false;
+	std::chrono::steady_clock::time_point levelRead = std::chrono::steady_clock::now();
+
+	ReadLevelFile();
+	for (;;)
+	{
+		if (std::chrono::steady_clock::now() - levelRead >= std::chrono::milliseconds(LOG_LEVEL_POLL_MS))
+		{
+			ReadLevelFile();
+			levelRead = std::chrono::steady_clock::now();
+		}
+
+		size_t lines = WriteLines();
+		unflushed = unflushed || lines;
+
+		std::unique_lock<std::mutex> lock(m_wakeLock);
+		if (unflushed && (!lines || m_flushWaiters))
+		{
+			size_t released = m_ring.load(std::memory_order_relaxed)->released();
+			lock.unlock();
+			Lock();
+			if (m_fp)
+			{
+				fflush(m_fp);
+			}
+			Unlock();
+			lock.lock();
+			unflushed = false;
+			m_durable = released;
+			m_flushed.notify_all();
+		}
+		if (!lines)
+		{
+			if (m_stop)
+			{
+				break;
+			}
+			m_wake.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_IDLE_MS));
+		}
+	}
+}
+
+bool CMyLog::StartTrace(const char* dir, size_t segmentSize, unsigned int segments)
+{
+	std::string path = dir ? std::string(dir) : m_path;
+	if (path.empty())
+	{
+		printf("No directory for the trace\r\n");
+		return false;
+	}
+	if (!m_trace.open(path, segmentSize, segments))
+	{
+		printf("Open trace fail\r\n");
+		return false;
+	}
+	if (!Enabled(LOG_LEVEL_DBG))
+	{
+		m_traceLevel = Level();
+		m_traceRaised = true;
+		SetLevel(LOG_LEVEL_DBG);
+	}
+	return true;
+}
+
+void CMyLog::StopTrace()
+{
+	m_trace.close();
+	if (m_traceRaised)
+	{
+		// unless dmft.level or SetLevel changed it meanwhile
+		if (Level() == LOG_LEVEL_DBG)
+		{
+			SetLevel(m_traceLevel);
+		}
+		m_traceRaised = false;
+	}
+}
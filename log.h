@@ -6,6 +6,13 @@
 #include <stdlib.h>
 #include <string>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "logring.h"
+#include "logtrace.h"
 
 #if (defined _WINDOWS)
 #include <windows.h>
@@ -28,22 +35,97 @@
 #define CC_SPRINTF snprintf
 #endif
 
+#define LOG_WRITE_BATCH     (64 * 1024)     // bytes of lines the writer gathers per fwrite
+#define LOG_WRITER_IDLE_MS  10              // how long the writer sleeps once the ring is empty
+#define LOG_FILE_SIZE       (5 * 1024 * 1024)   // dmft.log is rotated at this size
+#define LOG_RETAINED_FILES  5               // rotated files kept, dmft.1.log is the newest
+#define LOG_LEVEL_POLL_MS   1000            // how often dmft.level is read
+
 class  CMyLog
 {
 public:
 	CMyLog();
+	// Logs to dir/dmft.log instead of the per-user directory
+	explicit CMyLog(const char* dir);
 	~CMyLog();
 
 	static CMyLog& GetInstance();
+
+	//
+	// The level is process wide and checked by the LOG macros before their
+	// arguments are evaluated. It can be changed at any time: by SetLevel, or
+	// by writing 0, 1 or 2 (or error, info, debug) into dmft.level in the log
+	// directory. The async writer reads the file every LOG_LEVEL_POLL_MS; in
+	// synchronous mode a logged line reads it when it is that old.
+	//
+	static bool Enabled(unsigned char level) { return level <= s_ucLevel.load(std::memory_order_relaxed); }
+	static unsigned char Level() { return s_ucLevel.load(std::memory_order_relaxed); }
+	static void SetLevel(unsigned char level);
+
 	void Log(unsigned char level, const char* file, int line, const char* fmt, ...);
 	void Log(unsigned char level, const char* str);
 
+	// Logs to dir/dmft.log from now on instead of the per-user directory
+	bool Open(const char* dir);
+
+	// Rotates dmft.log at fileSize bytes and keeps retained older files
+	void SetRotation(unsigned int fileSize, unsigned int retained);
+
+	//
+	// Async mode. Log formats the line into a ring and returns, a background
+	// thread batches the lines into the file; when the ring is full the line is
+	// dropped and counted rather than waiting for the disk. StopAsync writes
+	// what is left and returns to synchronous writes, call it once no other
+	// thread logs. Flush returns once every line logged before it is in the
+	// file, for errors that may be followed by a crash.
+	//
+	bool StartAsync(size_t lines = LOG_RING_LINES);
+	void StopAsync();
+	void Flush();
+	unsigned long long Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	//
+	// Trace mode. LOGDBG lines are not formatted any more but stored as binary
+	// records in memory mapped dmft.<n>.trace segments in dir, the log
+	// directory when NULL; tracedecode turns them into text. The other levels
+	// still go to dmft.log. Starting the trace raises the level to debug,
+	// stopping it puts back the level it replaced.
+	//
+	bool StartTrace(const char* dir = NULL, size_t segmentSize = LOG_TRACE_SEGMENT_SIZE, unsigned int segments = LOG_TRACE_SEGMENTS);
+	void StopTrace();
+	bool Tracing() const { return m_trace.isOpen(); }
+	unsigned int DefineTrace(unsigned char level, const char* file, int line, const char* fmt) { return m_trace.define(level, file, line, fmt); }
+	unsigned long long TraceDropped() const { return m_trace.dropped(); }
+
+	template <typename... Args>
+	void Trace(unsigned int format, Args... args)
+	{
+		TraceArg list[] = { TraceArg(args)..., TraceArg() };
+		m_trace.write(format, list, (unsigned int)sizeof...(Args));
+	}
+
 private:
 	void ChangeLogFile();
+	void OpenFile();
+	void CountWritten(int written) { if (written > 0) m_ulWritten += (unsigned int)written; }
+	void Lock();
+	void Unlock();
+	LogRingLine* BeginLine(CLogRing* ring, unsigned char level, unsigned int* length);
+	void EndLine(CLogRing* ring, LogRingLine* line, unsigned int length);
+	void WriterLoop();
+	size_t WriteLines();
+	void WriteBatch(size_t used);
+	void ReadLevelFile();
+	void PollLevelFile();
 	// 全局文件指针
 	FILE* m_fp;
 	unsigned int m_ulFileSize;
-	unsigned char m_ucLevel;
+	unsigned long long m_ulWritten;     // bytes in dmft.log, counted rather than stat'ed
+	unsigned int m_uiRetained;
+	std::vector<std::string> m_files;   // dmft.log, dmft.1.log ... dmft.<m_uiRetained>.log
+	static std::atomic<unsigned char> s_ucLevel;
+	std::string m_levelFile;            // dmft.level next to dmft.log
+	std::atomic<long long> m_levelDue;  // steady clock ns of the next synchronous read of dmft.level
 
 	std::string m_path;
 
@@ -53,15 +135,64 @@ private:
 	pthread_mutex_t m_mutex;
 #endif
 
+	std::atomic<CLogRing*>  m_ring;             // set while in async mode
+	std::thread             m_writer;
+	std::vector<char>       m_batch;            // writer thread only
+	std::mutex              m_wakeLock;         // guards the members below
+	std::condition_variable m_wake;
+	std::condition_variable m_flushed;
+	bool                    m_stop;
+	unsigned int            m_flushWaiters;
+	size_t                  m_durable;          // lines released from the ring and flushed to the file
+	std::atomic<unsigned long long> m_dropped;
+	unsigned long long      m_droppedReported;
+
+	CLogTrace               m_trace;
+	bool                    m_traceRaised;      // StartTrace raised the level from m_traceLevel
+	unsigned char           m_traceLevel;
 };
 
 #define LOG_LEVEL_ERR  0 
 #define LOG_LEVEL_INFO 1
 #define LOG_LEVEL_DBG  2
 
-#define LOGERR(fmt, ...)  CMyLog::GetInstance().Log(LOG_LEVEL_ERR,  __FILE__, __LINE__, fmt, ##__VA_ARGS__);
-#define LOGINFO(fmt, ...) CMyLog::GetInstance().Log(LOG_LEVEL_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__);
-#define LOGDBG(fmt, ...)  CMyLog::GetInstance().Log(LOG_LEVEL_DBG,  __FILE__, __LINE__, fmt, ##__VA_ARGS__);
+//
+// Lines above LOG_COMPILE_LEVEL are compiled out, by default debug lines in
+// release builds. Define LOG_COMPILE_LEVEL as LOG_LEVEL_DBG to keep them, for
+// example for an always-on trace.
+//
+#ifndef LOG_COMPILE_LEVEL
+#if defined(NDEBUG) || (defined(_MSC_VER) && !defined(_DEBUG))
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DBG
+#endif
+#endif
+
+#define LOG_ENABLED(level) ((level) <= LOG_COMPILE_LEVEL && CMyLog::Enabled(level))
+
+#define LOGERR(fmt, ...)  do { if (LOG_ENABLED(LOG_LEVEL_ERR))  CMyLog::GetInstance().Log(LOG_LEVEL_ERR,  __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0);
+#define LOGINFO(fmt, ...) do { if (LOG_ENABLED(LOG_LEVEL_INFO)) CMyLog::GetInstance().Log(LOG_LEVEL_INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__); } while (0);
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_DBG
+// In trace mode each call site defines its format string once and then only stores its arguments
+#define LOGDBG(fmt, ...) \
+	do { \
+		if (!CMyLog::Enabled(LOG_LEVEL_DBG)) \
+			break; \
+		if (CMyLog::GetInstance().Tracing()) \
+		{ \
+			static const unsigned int s_traceFormat = CMyLog::GetInstance().DefineTrace(LOG_LEVEL_DBG, __FILE__, __LINE__, fmt); \
+			CMyLog::GetInstance().Trace(s_traceFormat, ##__VA_ARGS__); \
+		} \
+		else \
+		{ \
+			CMyLog::GetInstance().Log(LOG_LEVEL_DBG, __FILE__, __LINE__, fmt, ##__VA_ARGS__); \
+		} \
+	} while (0);
+#else
+#define LOGDBG(fmt, ...)  do { } while (0);
+#endif
 #endif
 
 
@@ -0,0 +1,261 @@
+//
+// Caller side cost of CMyLog while the disk is busy. Several threads log in
+// short bursts, the way a frame path logs a few lines per frame, while another
+// thread keeps writing and syncing a large file in the same directory. The
+// time each Log call takes is measured once with synchronous writes and once
+// in async mode. Afterwards the log is read back: every line must be there, or
+// counted as dropped, and in order per thread, and a line logged right before
+// Flush must be in the file when Flush returns. Exits with 1 otherwise.
+//
+// usage: logbench [-n lines] [-t threads] [-d dir] [-p 0|1]
+//
+
+#include "log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock LogClock;
+
+#define BURST_LINES     8       // lines a thread logs per simulated frame
+#define PRESSURE_CHUNK  (4 * 1024 * 1024)
+
+struct LogRun {
+	std::vector<double>     callUs;     // every Log call, all threads
+	double                  ms;
+	unsigned long long      dropped;
+	bool                    flushed;
+};
+
+static void logThread(CMyLog* log, unsigned int thread, unsigned int lines, double* callUs)
+{
+	for (unsigned int i = 0; i < lines; i++)
+	{
+		LogClock::time_point start = LogClock::now();
+		log->Log(LOG_LEVEL_INFO, __FILE__, __LINE__, "thread %u line %u frame stage done", thread, i);
+		callUs[i] = std::chrono::duration<double, std::micro>(LogClock::now() - start).count();
+		if (i % BURST_LINES == BURST_LINES - 1)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+static bool runLog(const std::string& dir, bool async, unsigned int lines, unsigned int threads, LogRun& run)
+{
+	std::string logDir = dir + (async ? "/async" : "/sync");
+	mkdir(logDir.c_str(), 0766);
+	remove((logDir + "/dmft.log").c_str());
+
+	CMyLog log(logDir.c_str());
+	if (async && !log.StartAsync())
+	{
+		return false;
+	}
+
+	unsigned int perThread = lines / threads;
+	run.callUs.assign((size_t)perThread * threads, 0.0);
+	std::vector<std::thread> workers;
+	LogClock::time_point start = LogClock::now();
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread(logThread, &log, t, perThread, &run.callUs[(size_t)t * perThread]));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+	{
+		workers[t].join();
+	}
+	run.ms = std::chrono::duration<double, std::milli>(LogClock::now() - start).count();
+
+	// the marker has to be readable as soon as Flush returns, before the writer stops
+	log.Log(LOG_LEVEL_ERR, __FILE__, __LINE__, "flush marker");
+	log.Flush();
+	run.flushed = false;
+	FILE* fp = fopen((logDir + "/dmft.log").c_str(), "r");
+	if (fp)
+	{
+		char text[LOG_RING_LINE_SIZE * 2];
+		while (fgets(text, sizeof(text), fp))
+		{
+			run.flushed = run.flushed || strstr(text, "flush marker") != NULL;
+		}
+		fclose(fp);
+	}
+	log.StopAsync();
+	run.dropped = log.Dropped();
+	return true;
+}
+
+//
+// Reads the log back. Every line of every thread is there once, in order, or was dropped
+//
+static bool checkLog(const std::string& dir, bool async, unsigned int lines, unsigned int threads, unsigned long long dropped)
+{
+	std::string logfile = dir + (async ? "/async" : "/sync") + "/dmft.log";
+	FILE* fp = fopen(logfile.c_str(), "r");
+	if (!fp)
+	{
+		printf("cannot read %s\n", logfile.c_str());
+		return false;
+	}
+
+	unsigned int perThread = lines / threads;
+	std::vector<long long> last(threads, -1);
+	unsigned long long found = 0;
+	bool ok = true;
+	char text[LOG_RING_LINE_SIZE * 2];
+	while (fgets(text, sizeof(text), fp) && ok)
+	{
+		unsigned int thread = 0, line = 0;
+		const char* body = strstr(text, "thread ");
+		if (!body || sscanf(body, "thread %u line %u", &thread, &line) != 2)
+		{
+			continue;
+		}
+		if (thread >= threads || line >= perThread || (long long)line <= last[thread])
+		{
+			printf("%s log: thread %u line %u out of order\n", async ? "async" : "sync", thread, line);
+			ok = false;
+		}
+		last[thread] = line;
+		found++;
+	}
+	fclose(fp);
+
+	if (ok && found + dropped != (unsigned long long)perThread * threads)
+	{
+		printf("%s log: %llu lines written and %llu dropped of %u\n", async ? "async" : "sync", found, dropped, perThread * threads);
+		ok = false;
+	}
+	return ok;
+}
+
+static double percentile(std::vector<double> values, double fraction)
+{
+	if (values.empty())
+	{
+		return 0.0;
+	}
+	size_t index = (size_t)(fraction * (values.size() - 1));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int lines = 40000;
+	unsigned int threads = 4;
+	unsigned int pressure = 1;
+	std::string dir;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			lines = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-t"))
+		{
+			threads = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-d"))
+		{
+			dir = argv[i + 1];
+		}
+		else if (!strcmp(argv[i], "-p"))
+		{
+			pressure = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+	if (!threads || lines < threads)
+	{
+		return 0;
+	}
+	if (dir.empty())
+	{
+		char temp[] = "/tmp/logbenchXXXXXX";
+		if (!mkdtemp(temp))
+		{
+			printf("cannot create a log directory\n");
+			return 1;
+		}
+		dir = temp;
+	}
+
+	// the disk pressure: a large file rewritten and synced until the runs are done
+	std::atomic<bool> stop(false);
+	std::thread presser;
+	if (pressure)
+	{
+		presser = std::thread([&] {
+			std::vector<char> chunk(PRESSURE_CHUNK, 0x5a);
+			std::string path = dir + "/pressure.bin";
+			while (!stop.load())
+			{
+				int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0)
+				{
+					break;
+				}
+				for (int i = 0; i < 4 && !stop.load(); i++)
+				{
+					if (write(fd, &chunk[0], chunk.size()) < 0)
+					{
+						break;
+					}
+					fsync(fd);
+				}
+				close(fd);
+			}
+			remove(path.c_str());
+		});
+	}
+
+	LogRun sync, async;
+	bool ran = runLog(dir, false, lines, threads, sync) && runLog(dir, true, lines, threads, async);
+	stop.store(true);
+	if (presser.joinable())
+	{
+		presser.join();
+	}
+	if (!ran)
+	{
+		printf("cannot open the log in %s\n", dir.c_str());
+		return 1;
+	}
+
+	printf("%u lines from %u threads in bursts of %u, %s\n", (lines / threads) * threads, threads, BURST_LINES,
+		pressure ? "disk busy with synced writes" : "idle disk");
+	printf("  %-6s %10s %10s %10s %10s %8s\n", "mode", "mean us", "p50 us", "p99 us", "max us", "dropped");
+	const LogRun* runs[] = { &sync, &async };
+	for (int r = 0; r < 2; r++)
+	{
+		const std::vector<double>& us = runs[r]->callUs;
+		double total = 0.0;
+		for (size_t i = 0; i < us.size(); i++)
+		{
+			total += us[i];
+		}
+		printf("  %-6s %10.2f %10.2f %10.2f %10.1f %8llu\n", r ? "async" : "sync", total / us.size(),
+			percentile(us, 0.5), percentile(us, 0.99), *std::max_element(us.begin(), us.end()), runs[r]->dropped);
+	}
+
+	int result = 0;
+	if (!checkLog(dir, false, lines, threads, sync.dropped) || !checkLog(dir, true, lines, threads, async.dropped))
+	{
+		result = 1;
+	}
+	else if (!sync.flushed || !async.flushed)
+	{
+		printf("a line logged before Flush was not in the file when it returned\n");
+		result = 1;
+	}
+	return result;
+}
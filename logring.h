@@ -0,0 +1,112 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+#define LOG_RING_LINES      4096    // lines the ring holds before callers drop new ones
+#define LOG_RING_LINE_SIZE  256     // longest line kept, longer ones are cut
+#define LOG_RING_CACHE_LINE 64
+
+typedef struct _LogRingLine {
+	std::atomic<size_t> sequence;               // ticket the line is free or ready for
+	unsigned int        length = 0;
+	char                text[LOG_RING_LINE_SIZE];
+}LogRingLine, *LogRingLinePtr;
+
+//
+// Fixed capacity FIFO of formatted log lines between any number of logging
+// threads and the one thread writing the log file. Callers claim a line,
+// format straight into it and commit it; no one locks, and a caller finding
+// the ring full gets nullptr instead of waiting. Lines are read in the order
+// they were claimed, a line claimed but not yet committed holds back the
+// ones behind it. The lines are allocated by the constructor.
+//
+class CLogRing
+{
+public:
+	// lines is rounded up to a power of two
+	explicit CLogRing(size_t lines = LOG_RING_LINES)
+	: m_tail(0)
+	, m_head(0)
+	{
+		size_t count = 1;
+		while (count < lines)
+		{
+			count <<= 1;
+		}
+		m_lines = std::vector<LogRingLine>(count);
+		m_mask = count - 1;
+		for (size_t i = 0; i < count; i++)
+		{
+			m_lines[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Caller side, nullptr when the ring is full
+	LogRingLine* claim()
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			LogRingLine* line = &m_lines[tail & m_mask];
+			size_t sequence = line->sequence.load(std::memory_order_acquire);
+			if (sequence == tail)
+			{
+				if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					return line;
+				}
+			}
+			else if ((ptrdiff_t)(sequence - tail) < 0)
+			{
+				return nullptr;
+			}
+			else
+			{
+				tail = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Hands a claimed line, text and length filled in, to the writer
+	void commit(LogRingLine* line)
+	{
+		line->sequence.store(line->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// Writer side, the oldest committed line or nullptr. Stays valid until release()
+	const LogRingLine* peek() const
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		const LogRingLine* line = &m_lines[head & m_mask];
+		return line->sequence.load(std::memory_order_acquire) == head + 1 ? line : nullptr;
+	}
+
+	void release()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		m_lines[head & m_mask].sequence.store(head + m_mask + 1, std::memory_order_release);
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	// Lines claimed so far and lines the writer has released, both counted from the start
+	size_t claimed() const { return m_tail.load(std::memory_order_acquire); }
+	size_t released() const { return m_head.load(std::memory_order_acquire); }
+	size_t capacity() const { return m_lines.size(); }
+
+private:
+	CLogRing(const CLogRing&);
+	CLogRing& operator=(const CLogRing&);
+
+	std::vector<LogRingLine>    m_lines;
+	size_t                      m_mask;
+	char                        m_pad0[LOG_RING_CACHE_LINE];
+	std::atomic<size_t>         m_tail;     // claimed by callers
+	char                        m_pad1[LOG_RING_CACHE_LINE];
+	std::atomic<size_t>         m_head;     // released by the writer
+	char                        m_pad2[LOG_RING_CACHE_LINE];
+};
+
+#endif
@@ -0,0 +1,795 @@
+#include "logtrace.h"
+
+#include <chrono>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_SEPARATOR "\\"
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PATH_SEPARATOR "/"
+#endif
+
+#define TRACE_DEFINITION    0       // format of a record defining a format string
+#define TRACE_ALIGN         8
+#define TRACE_NULL_STRING   0xFFFF  // string length stored for a null pointer
+
+//
+// File layout: header, then records back to back, each TRACE_ALIGN aligned.
+// A segment starts with the definition of every format string known when it
+// was opened; a record of size 0 or the end of the file ends it.
+//
+typedef struct _TraceSegmentHeader {
+	char                magic[8];
+	unsigned int        version;
+	unsigned int        header_size;
+	unsigned long long  start_seconds;      // wall clock the trace was opened at
+	unsigned int        start_nanoseconds;
+	unsigned int        sequence;
+}TraceSegmentHeader;
+
+typedef struct _TraceRecord {
+	unsigned int        size;           // bytes including this header
+	unsigned int        format;         // TRACE_DEFINITION or the id of the format string
+	unsigned long long  time;           // nanoseconds since the trace was opened
+	unsigned int        thread;
+	unsigned int        count;          // arguments that follow, tag byte then value each
+}TraceRecord;
+
+// Follows the record header of a definition, then the file name and the format string
+typedef struct _TraceDefinition {
+	unsigned int        id;
+	unsigned int        level;
+	unsigned int        line;
+	unsigned int        file_length;
+	unsigned int        format_length;
+}TraceDefinition;
+
+static const char s_magic[8] = { 'D', 'M', 'F', 'T', 'T', 'R', 'C', 0 };
+static const char s_levels[][8] = { "ERROR", "INFO ", "DEBUG" };
+
+static size_t alignRecord(size_t size)
+{
+	return (size + TRACE_ALIGN - 1) & ~(size_t)(TRACE_ALIGN - 1);
+}
+
+static unsigned long long steadyNanoseconds()
+{
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// OS id of the calling thread, asked for once per thread
+static unsigned int currentThread()
+{
+	static thread_local unsigned int s_thread = 0;
+	if (!s_thread)
+	{
+#ifdef _WIN32
+		s_thread = (unsigned int)GetCurrentThreadId();
+#elif defined(__APPLE__)
+		unsigned long long id = 0;
+		pthread_threadid_np(NULL, &id);
+		s_thread = (unsigned int)id;
+#else
+		s_thread = (unsigned int)syscall(SYS_gettid);
+#endif
+	}
+	return s_thread;
+}
+
+static size_t stringLength(const char* s)
+{
+	if (!s)
+	{
+		return 0;
+	}
+	size_t length = strlen(s);
+	return length > LOG_TRACE_STRING_MAX ? LOG_TRACE_STRING_MAX : length;
+}
+
+//
+// CLogTrace
+//
+CLogTrace::CLogTrace()
+: m_segment(nullptr)
+, m_open(false)
+, m_dropped(0)
+, m_segmentSize(LOG_TRACE_SEGMENT_SIZE)
+, m_retained(LOG_TRACE_SEGMENTS)
+, m_startSeconds(0)
+, m_startNanoseconds(0)
+, m_startTicks(0)
+, m_rollFailed(false)
+{
+}
+
+CLogTrace::~CLogTrace()
+{
+	close();
+	for (size_t i = 0; i < m_segments.size(); i++)
+	{
+		delete m_segments[i];
+	}
+}
+
+std::string CLogTrace::segmentPath(unsigned int sequence) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "dmft.%u.trace", sequence);
+	return m_directory + PATH_SEPARATOR + name;
+}
+
+// Segments left from an earlier trace in the directory would read as part of the new one
+void CLogTrace::removeSegments()
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((m_directory + "\\dmft.*.trace").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	do
+	{
+		DeleteFileA((m_directory + "\\" + data.cFileName).c_str());
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(m_directory.c_str());
+	if (!dir)
+	{
+		return;
+	}
+	while (struct dirent* entry = readdir(dir))
+	{
+		size_t length = strlen(entry->d_name);
+		if (strncmp(entry->d_name, "dmft.", 5) || length < 12 || strcmp(entry->d_name + length - 6, ".trace"))
+		{
+			continue;
+		}
+		remove((m_directory + "/" + entry->d_name).c_str());
+	}
+	closedir(dir);
+#endif
+}
+
+bool CLogTrace::open(const std::string& directory, size_t segmentSize, unsigned int segments)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_segment.load())
+	{
+		return true;
+	}
+
+	m_directory = directory;
+	m_segmentSize = segmentSize < 4096 ? 4096 : segmentSize;
+	m_retained = segments ? segments : 1;
+	m_rollFailed = false;
+
+	std::chrono::nanoseconds wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch());
+	m_startSeconds = (unsigned long long)(wall.count() / 1000000000);
+	m_startNanoseconds = (unsigned int)(wall.count() % 1000000000);
+	m_startTicks = steadyNanoseconds();
+
+	removeSegments();
+
+	TraceSegment* segment = mapSegment(0);
+	if (!segment)
+	{
+		return false;
+	}
+	m_segment.store(segment);
+	m_open.store(true);
+	return true;
+}
+
+void CLogTrace::close()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	TraceSegment* segment = m_segment.exchange(nullptr);
+	m_open.store(false);
+	if (segment)
+	{
+		while (segment->writers.load())
+		{
+			std::this_thread::yield();
+		}
+		unmapSegment(segment);
+	}
+}
+
+size_t CLogTrace::definitionSize(const TraceFormat& format)
+{
+	return alignRecord(sizeof(TraceRecord) + sizeof(TraceDefinition) + format.file.size() + format.format.size());
+}
+
+void CLogTrace::putDefinition(unsigned char* data, unsigned int id, const TraceFormat& format)
+{
+	TraceRecord record;
+	record.size = (unsigned int)definitionSize(format);
+	record.format = TRACE_DEFINITION;
+	record.time = 0;
+	record.thread = 0;
+	record.count = 0;
+
+	TraceDefinition definition;
+	definition.id = id;
+	definition.level = format.level;
+	definition.line = format.line;
+	definition.file_length = (unsigned int)format.file.size();
+	definition.format_length = (unsigned int)format.format.size();
+
+	unsigned char* p = data + sizeof(record);
+	memcpy(p, &definition, sizeof(definition));
+	p += sizeof(definition);
+	memcpy(p, format.file.data(), format.file.size());
+	p += format.file.size();
+	memcpy(p, format.format.data(), format.format.size());
+	memcpy(data, &record, sizeof(record));
+}
+
+unsigned int CLogTrace::define(unsigned int level, const char* file, int line, const char* format)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	TraceFormat entry;
+	entry.level = level;
+	entry.line = (unsigned int)line;
+	entry.file = file ? file : "";
+	entry.format = format ? format : "";
+	m_formats.push_back(entry);
+	unsigned int id = (unsigned int)m_formats.size();
+
+	TraceSegment* segment = nullptr;
+	unsigned char* data = reserve(definitionSize(entry), &segment, true);
+	if (data)
+	{
+		putDefinition(data, id, entry);
+		done(segment);
+	}
+	return id;
+}
+
+//
+// Space for one record in the current segment, nullptr when tracing is off or
+// a new segment could not be opened. Pair with done(). locked tells whether
+// the caller holds m_lock.
+//
+unsigned char* CLogTrace::reserve(size_t size, TraceSegment** segment, bool locked)
+{
+	if (size > m_segmentSize - sizeof(TraceSegmentHeader))
+	{
+		return nullptr;
+	}
+
+	for (;;)
+	{
+		TraceSegment* current = m_segment.load(std::memory_order_acquire);
+		if (!current)
+		{
+			return nullptr;
+		}
+
+		// announce the write before checking the segment is still current, roll() waits for it
+		current->writers.fetch_add(1);
+		if (m_segment.load() != current)
+		{
+			done(current);
+			continue;
+		}
+
+		unsigned long long offset = current->used.fetch_add(size, std::memory_order_relaxed);
+		if (offset + size <= current->size)
+		{
+			*segment = current;
+			return current->data + offset;
+		}
+		done(current);
+
+		if (locked)
+		{
+			if (!roll(current))
+			{
+				return nullptr;
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (!roll(current))
+			{
+				return nullptr;
+			}
+		}
+	}
+}
+
+//
+// Replaces a full segment by the next one, called under m_lock by the writers
+// that found it full; the first does the work
+//
+bool CLogTrace::roll(TraceSegment* full)
+{
+	TraceSegment* current = m_segment.load();
+	if (current != full)
+	{
+		return current != nullptr;
+	}
+	if (m_rollFailed)
+	{
+		return false;
+	}
+
+	TraceSegment* next = mapSegment(full->sequence + 1);
+	if (!next)
+	{
+		m_rollFailed = true;
+		return false;
+	}
+	m_segment.store(next);
+
+	while (full->writers.load())
+	{
+		std::this_thread::yield();
+	}
+	unmapSegment(full);
+
+	if (next->sequence >= m_retained)
+	{
+		remove(segmentPath(next->sequence - m_retained).c_str());
+	}
+	return true;
+}
+
+void CLogTrace::write(unsigned int format, const TraceArg* args, unsigned int count)
+{
+	size_t size = sizeof(TraceRecord);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		size += 1 + (args[i].tag == 's' ? 2 + stringLength(args[i].s) : 8);
+	}
+	size = alignRecord(size);
+
+	TraceSegment* segment = nullptr;
+	unsigned char* data = reserve(size, &segment, false);
+	if (!data)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	TraceRecord record;
+	record.size = (unsigned int)size;
+	record.format = format;
+	record.time = steadyNanoseconds() - m_startTicks;
+	record.thread = currentThread();
+	record.count = count;
+
+	unsigned char* p = data + sizeof(record);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		*p++ = (unsigned char)args[i].tag;
+		if (args[i].tag == 's')
+		{
+			size_t length = stringLength(args[i].s);
+			unsigned short stored = args[i].s ? (unsigned short)length : (unsigned short)TRACE_NULL_STRING;
+			memcpy(p, &stored, 2);
+			memcpy(p + 2, args[i].s, length);
+			p += 2 + length;
+		}
+		else
+		{
+			memcpy(p, &args[i].u, 8);
+			p += 8;
+		}
+	}
+	memcpy(data, &record, sizeof(record));
+	done(segment);
+}
+
+//
+// Creates, sizes and maps segment file sequence, then writes its header and
+// the definitions of all format strings so far. Called under m_lock.
+//
+TraceSegment* CLogTrace::mapSegment(unsigned int sequence)
+{
+	std::string path = segmentPath(sequence);
+	TraceSegment* segment = new TraceSegment();
+	segment->size = m_segmentSize;
+	segment->sequence = sequence;
+	segment->writers.store(0);
+
+#ifdef _WIN32
+	segment->file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (segment->file == INVALID_HANDLE_VALUE)
+	{
+		delete segment;
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)segment->size;
+	segment->mapping = CreateFileMappingA(segment->file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+	if (segment->mapping)
+	{
+		segment->data = (unsigned char*)MapViewOfFile(segment->mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)segment->size);
+	}
+	if (!segment->data)
+	{
+		if (segment->mapping)
+		{
+			CloseHandle(segment->mapping);
+		}
+		CloseHandle(segment->file);
+		DeleteFileA(path.c_str());
+		delete segment;
+		return nullptr;
+	}
+#else
+	segment->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (segment->fd < 0)
+	{
+		delete segment;
+		return nullptr;
+	}
+	void* data = MAP_FAILED;
+	if (ftruncate(segment->fd, (off_t)segment->size) == 0)
+	{
+		data = mmap(nullptr, (size_t)segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+	}
+	if (data == MAP_FAILED)
+	{
+		::close(segment->fd);
+		remove(path.c_str());
+		delete segment;
+		return nullptr;
+	}
+	segment->data = (unsigned char*)data;
+#endif
+
+	TraceSegmentHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, s_magic, sizeof(s_magic));
+	header.version = LOG_TRACE_VERSION;
+	header.header_size = sizeof(header);
+	header.start_seconds = m_startSeconds;
+	header.start_nanoseconds = m_startNanoseconds;
+	header.sequence = sequence;
+	memcpy(segment->data, &header, sizeof(header));
+
+	size_t used = sizeof(header);
+	for (size_t i = 0; i < m_formats.size(); i++)
+	{
+		size_t size = definitionSize(m_formats[i]);
+		if (used + size > segment->size)
+		{
+			break;
+		}
+		putDefinition(segment->data + used, (unsigned int)i + 1, m_formats[i]);
+		used += size;
+	}
+	segment->used.store(used);
+	m_segments.push_back(segment);
+	return segment;
+}
+
+// Unmaps a segment no one writes to any more and cuts the file to what was written
+void CLogTrace::unmapSegment(TraceSegment* segment)
+{
+	unsigned long long used = segment->used.load();
+	// space reserved by the records that did not fit stays zero, a zero size ends the segment
+	if (used > segment->size)
+	{
+		used = segment->size;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(segment->data);
+	CloseHandle(segment->mapping);
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)used;
+	if (SetFilePointerEx(segment->file, end, NULL, FILE_BEGIN))
+	{
+		SetEndOfFile(segment->file);
+	}
+	CloseHandle(segment->file);
+	segment->mapping = nullptr;
+	segment->file = nullptr;
+#else
+	munmap(segment->data, (size_t)segment->size);
+	if (ftruncate(segment->fd, (off_t)used) != 0)
+	{
+		// left at full size, the zero bytes after the last record end it just the same
+	}
+	::close(segment->fd);
+	segment->fd = -1;
+#endif
+	segment->data = nullptr;
+}
+
+//
+// CTraceDecoder
+//
+
+typedef struct _TraceValue {
+	char                tag = 0;
+	long long           i = 0;
+	unsigned long long  u = 0;
+	double              d = 0.0;
+	std::string         s;
+	bool                null = false;
+}TraceValue;
+
+static bool nextValue(const unsigned char** p, const unsigned char* end, unsigned int* left, TraceValue* value)
+{
+	if (!*left || *p >= end)
+	{
+		return false;
+	}
+	value->tag = (char)*(*p)++;
+	if (value->tag == 's')
+	{
+		unsigned short length = 0;
+		if (end - *p < 2)
+		{
+			return false;
+		}
+		memcpy(&length, *p, 2);
+		*p += 2;
+		value->null = length == TRACE_NULL_STRING;
+		length = value->null ? 0 : length;
+		if (end - *p < length)
+		{
+			return false;
+		}
+		value->s.assign((const char*)*p, length);
+		*p += length;
+	}
+	else
+	{
+		if (end - *p < 8)
+		{
+			return false;
+		}
+		memcpy(&value->u, *p, 8);
+		memcpy(&value->i, *p, 8);
+		memcpy(&value->d, *p, 8);
+		*p += 8;
+		// an argument of the other kind than the conversion still prints as a number
+		if (value->tag == 'd')
+		{
+			value->i = (long long)value->d;
+			value->u = (unsigned long long)value->i;
+		}
+		else
+		{
+			value->d = value->tag == 'u' || value->tag == 'p' ? (double)value->u : (double)value->i;
+		}
+	}
+	(*left)--;
+	return true;
+}
+
+template <typename T>
+static void appendFormatted(std::string& text, const std::string& spec, T value)
+{
+	char buffer[256];
+	int length = snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+	if (length < 0)
+	{
+		return;
+	}
+	if ((size_t)length < sizeof(buffer))
+	{
+		text.append(buffer, (size_t)length);
+		return;
+	}
+	std::vector<char> large((size_t)length + 1);
+	snprintf(&large[0], large.size(), spec.c_str(), value);
+	text.append(&large[0], (size_t)length);
+}
+
+std::string CTraceDecoder::expand(const std::string& format, const unsigned char* args, const unsigned char* end, unsigned int count)
+{
+	std::string text;
+	const unsigned char* p = args;
+	unsigned int left = count;
+
+	for (size_t i = 0; i < format.size(); i++)
+	{
+		if (format[i] != '%')
+		{
+			text += format[i];
+			continue;
+		}
+		if (i + 1 < format.size() && format[i + 1] == '%')
+		{
+			text += '%';
+			i++;
+			continue;
+		}
+
+		// flags, width and precision are kept, '*' is replaced by its argument; length modifiers are dropped
+		std::string spec = "%";
+		TraceValue value;
+		for (i++; i < format.size() && strchr("-+ #0", format[i]); i++)
+		{
+			spec += format[i];
+		}
+		for (; i < format.size() && (format[i] == '*' || format[i] == '.' || (format[i] >= '0' && format[i] <= '9')); i++)
+		{
+			if (format[i] == '*')
+			{
+				spec += nextValue(&p, end, &left, &value) ? std::to_string(value.i) : std::string("0");
+			}
+			else
+			{
+				spec += format[i];
+			}
+		}
+		for (; i < format.size() && strchr("hlLqjzt", format[i]); i++)
+		{
+		}
+		if (i >= format.size())
+		{
+			break;
+		}
+
+		char conversion = format[i];
+		if (conversion == 'n')
+		{
+			continue;
+		}
+		if (!strchr("diuoxXcfFeEgGaAsp", conversion))
+		{
+			text += spec + conversion;
+			continue;
+		}
+		if (!nextValue(&p, end, &left, &value))
+		{
+			text += "<missing>";
+			continue;
+		}
+
+		switch (conversion)
+		{
+		case 'd':
+		case 'i':
+			appendFormatted(text, spec + "lld", value.i);
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			appendFormatted(text, spec + "ll" + conversion, value.u);
+			break;
+		case 'c':
+			appendFormatted(text, spec + "c", (int)value.i);
+			break;
+		case 's':
+			appendFormatted(text, spec + "s", value.null ? "(null)" : value.s.c_str());
+			break;
+		case 'p':
+			appendFormatted(text, spec + "p", (const void*)(size_t)value.u);
+			break;
+		default:
+			appendFormatted(text, spec + conversion, value.d);
+			break;
+		}
+	}
+	return text;
+}
+
+bool CTraceDecoder::decode(const std::string& path, FILE* out)
+{
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp)
+	{
+		return false;
+	}
+	std::vector<unsigned char> data;
+	unsigned char chunk[65536];
+	size_t read = 0;
+	while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	{
+		data.insert(data.end(), chunk, chunk + read);
+	}
+	fclose(fp);
+
+	TraceSegmentHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, &data[0], sizeof(header));
+	if (memcmp(header.magic, s_magic, sizeof(s_magic)) || header.version != LOG_TRACE_VERSION ||
+		header.header_size < sizeof(header) || header.header_size > data.size())
+	{
+		return false;
+	}
+
+	size_t offset = header.header_size;
+	while (offset + sizeof(TraceRecord) <= data.size())
+	{
+		TraceRecord record;
+		memcpy(&record, &data[offset], sizeof(record));
+		if (record.size < sizeof(record) || offset + record.size > data.size())
+		{
+			break;
+		}
+		const unsigned char* body = &data[offset] + sizeof(record);
+		const unsigned char* end = &data[offset] + record.size;
+		offset += record.size;
+
+		if (record.format == TRACE_DEFINITION)
+		{
+			TraceDefinition definition;
+			if ((size_t)(end - body) < sizeof(definition))
+			{
+				continue;
+			}
+			memcpy(&definition, body, sizeof(definition));
+			body += sizeof(definition);
+			if (!definition.id || (size_t)(end - body) < (size_t)definition.file_length + definition.format_length)
+			{
+				continue;
+			}
+			if (m_formats.size() < definition.id)
+			{
+				m_formats.resize(definition.id);
+			}
+			TraceFormat& format = m_formats[definition.id - 1];
+			format.level = definition.level;
+			format.line = definition.line;
+			format.file.assign((const char*)body, definition.file_length);
+			format.format.assign((const char*)body + definition.file_length, definition.format_length);
+			continue;
+		}
+
+		unsigned long long nanoseconds = header.start_nanoseconds + record.time;
+		time_t seconds = (time_t)(header.start_seconds + nanoseconds / 1000000000);
+		struct tm tmt;
+#ifdef _WIN32
+		localtime_s(&tmt, &seconds);
+#else
+		localtime_r(&seconds, &tmt);
+#endif
+
+		std::string text;
+		const TraceFormat* format = record.format <= m_formats.size() ? &m_formats[record.format - 1] : nullptr;
+		if (format && !format->format.empty())
+		{
+			text = expand(format->format, body, end, record.count);
+		}
+		else
+		{
+			text = "<format " + std::to_string(record.format) + " not defined>";
+		}
+		fprintf(out, "%04d-%02d-%02d %02d:%02d:%02d.%06u %s [%u] %s %s:%u\n",
+			tmt.tm_year + 1900,
+			tmt.tm_mon + 1,
+			tmt.tm_mday,
+			tmt.tm_hour,
+			tmt.tm_min,
+			tmt.tm_sec,
+			(unsigned int)(nanoseconds % 1000000000 / 1000),
+			format && format->level < 3 ? s_levels[format->level] : "DEBUG",
+			record.thread,
+			text.c_str(),
+			format ? format->file.c_str() : "?",
+			format ? format->line : 0);
+		m_records++;
+	}
+	return true;
+}
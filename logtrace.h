@@ -0,0 +1,142 @@
+#ifndef LOG_TRACE_H
+#define LOG_TRACE_H
+
+//
+// Binary trace behind CMyLog's trace mode. A trace line is not formatted: the
+// record holds the id of its format string, a timestamp, the thread id and the
+// raw arguments, copied straight into a memory mapped segment file. Format
+// strings are stored once per segment as definition records, so every
+// segment decodes on its own. CTraceDecoder, used by tracedecode, turns
+// segments back into text lines.
+//
+// Writers reserve space with one atomic add and never lock; a full segment is
+// replaced by the next one under a lock, and the oldest segment past the
+// retained count is removed. Files are dmft.<n>.trace, n counting up from 0.
+//
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#define LOG_TRACE_VERSION       1
+#define LOG_TRACE_SEGMENT_SIZE  (16 * 1024 * 1024)
+#define LOG_TRACE_SEGMENTS      4       // segment files kept, the one being written included
+#define LOG_TRACE_STRING_MAX    255     // longest string argument kept, longer ones are cut
+
+//
+// One printf argument as it is stored: integers and pointers as 64 bits,
+// floating point as double, strings by value
+//
+typedef struct _TraceArg {
+	char                tag = 0;        // 'i', 'u', 'd', 'p', 's'
+	union {
+		long long           i;
+		unsigned long long  u;
+		double              d;
+	};
+	const char*         s = nullptr;
+
+	_TraceArg() : i(0) {}
+	_TraceArg(int value) : tag('i'), i(value) {}
+	_TraceArg(long value) : tag('i'), i(value) {}
+	_TraceArg(long long value) : tag('i'), i(value) {}
+	_TraceArg(unsigned int value) : tag('u'), u(value) {}
+	_TraceArg(unsigned long value) : tag('u'), u(value) {}
+	_TraceArg(unsigned long long value) : tag('u'), u(value) {}
+	_TraceArg(double value) : tag('d'), d(value) {}
+	_TraceArg(const char* value) : tag('s'), i(0), s(value) {}
+	_TraceArg(const void* value) : tag('p'), u((unsigned long long)(size_t)value) {}
+}TraceArg, *TraceArgPtr;
+
+// A format string as defined by a LOGDBG call site
+typedef struct _TraceFormat {
+	unsigned int        level = 0;
+	unsigned int        line = 0;
+	std::string         file;
+	std::string         format;
+}TraceFormat, *TraceFormatPtr;
+
+typedef struct _TraceSegment {
+	unsigned char*                  data = nullptr;     // the mapped file
+	unsigned long long              size = 0;
+	unsigned int                    sequence = 0;
+	std::atomic<unsigned long long> used;               // reserved, may run past size
+	std::atomic<unsigned int>       writers;            // threads between reserve and done
+#ifdef _WIN32
+	void*                           file = nullptr;
+	void*                           mapping = nullptr;
+#else
+	int                             fd = -1;
+#endif
+}TraceSegment, *TraceSegmentPtr;
+
+class CLogTrace
+{
+public:
+	CLogTrace();
+	~CLogTrace();
+
+	bool open(const std::string& directory, size_t segmentSize = LOG_TRACE_SEGMENT_SIZE, unsigned int segments = LOG_TRACE_SEGMENTS);
+	// Writers still inside write() finish first, later ones drop their records
+	void close();
+	bool isOpen() const { return m_open.load(std::memory_order_relaxed); }
+
+	// Id of a format string, for all later writes and opens
+	unsigned int define(unsigned int level, const char* file, int line, const char* format);
+	void write(unsigned int format, const TraceArg* args, unsigned int count);
+
+	unsigned long long dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+	CLogTrace(const CLogTrace&);
+	CLogTrace& operator=(const CLogTrace&);
+
+	unsigned char* reserve(size_t size, TraceSegment** segment, bool locked);
+	void done(TraceSegment* segment) { segment->writers.fetch_sub(1, std::memory_order_release); }
+	bool roll(TraceSegment* full);
+	TraceSegment* mapSegment(unsigned int sequence);
+	void unmapSegment(TraceSegment* segment);
+	void putDefinition(unsigned char* data, unsigned int id, const TraceFormat& format);
+	static size_t definitionSize(const TraceFormat& format);
+	std::string segmentPath(unsigned int sequence) const;
+	void removeSegments();
+
+	std::atomic<TraceSegment*>  m_segment;
+	std::atomic<bool>           m_open;
+	std::atomic<unsigned long long> m_dropped;
+	std::mutex                  m_lock;         // guards the members below
+	std::vector<TraceFormat>    m_formats;      // id is the index plus one
+	std::vector<TraceSegment*>  m_segments;     // every segment since open, unmapped but kept for late readers
+	std::string                 m_directory;
+	size_t                      m_segmentSize;
+	unsigned int                m_retained;
+	unsigned long long          m_startSeconds;
+	unsigned int                m_startNanoseconds;
+	unsigned long long          m_startTicks;   // steady clock at open, record times count from it
+	bool                        m_rollFailed;
+};
+
+//
+// Turns segment files back into text lines. Format definitions carry over
+// from one decoded segment to the next.
+//
+class CTraceDecoder
+{
+public:
+	CTraceDecoder() : m_records(0) {}
+
+	// Appends one line per record to out, false when path is not a trace segment
+	bool decode(const std::string& path, FILE* out);
+	unsigned long long records() const { return m_records; }
+
+	// printf of a stored argument list, for the decoder and its checks
+	static std::string expand(const std::string& format, const unsigned char* args, const unsigned char* end, unsigned int count);
+
+private:
+	std::vector<TraceFormat>    m_formats;
+	unsigned long long          m_records;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include "mediatypeindex.h"
+
+#include <string.h>
+
+bool operator==(const MediaTypeKey& a, const MediaTypeKey& b)
+{
+	return !memcmp(a.major_type, b.major_type, sizeof(a.major_type)) &&
+		!memcmp(a.subtype, b.subtype, sizeof(a.subtype)) &&
+		a.width == b.width && a.height == b.height &&
+		a.rate_numerator == b.rate_numerator && a.rate_denominator == b.rate_denominator &&
+		a.interlace == b.interlace && a.stride == b.stride;
+}
+
+static unsigned long long fnv1a(unsigned long long hash, const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+size_t MediaTypeKeyHash::operator()(const MediaTypeKey& key) const
+{
+	// field by field, the struct may carry padding on some targets
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	hash = fnv1a(hash, key.major_type, sizeof(key.major_type));
+	hash = fnv1a(hash, key.subtype, sizeof(key.subtype));
+	hash = fnv1a(hash, &key.width, sizeof(key.width));
+	hash = fnv1a(hash, &key.height, sizeof(key.height));
+	hash = fnv1a(hash, &key.rate_numerator, sizeof(key.rate_numerator));
+	hash = fnv1a(hash, &key.rate_denominator, sizeof(key.rate_denominator));
+	hash = fnv1a(hash, &key.interlace, sizeof(key.interlace));
+	hash = fnv1a(hash, &key.stride, sizeof(key.stride));
+	return (size_t)hash;
+}
+
+void CMediaTypeIndex::add(const MediaTypeKey& key, unsigned int position)
+{
+	m_positions[key].push_back(position);
+}
+
+const std::vector<unsigned int>* CMediaTypeIndex::find(const MediaTypeKey& key) const
+{
+	PositionMap::const_iterator it = m_positions.find(key);
+	return it == m_positions.end() ? nullptr : &it->second;
+}
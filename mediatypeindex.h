@@ -0,0 +1,54 @@
+#ifndef MEDIA_TYPE_INDEX_H
+#define MEDIA_TYPE_INDEX_H
+
+//
+// Hashed lookup of a pin's media types. Every type is reduced to a canonical
+// key of the attributes that tell video formats apart; two types IsEqual
+// accepts always have the same key, so a support check only compares the
+// query in full against the few types listed under its key instead of the
+// whole list. Attributes a type does not carry are zero in its key.
+//
+
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+typedef struct _MediaTypeKey {
+	unsigned char   major_type[16]      = {};   // MF_MT_MAJOR_TYPE
+	unsigned char   subtype[16]         = {};   // MF_MT_SUBTYPE
+	unsigned int    width               = 0;    // MF_MT_FRAME_SIZE
+	unsigned int    height              = 0;
+	unsigned int    rate_numerator      = 0;    // MF_MT_FRAME_RATE
+	unsigned int    rate_denominator    = 0;
+	unsigned int    interlace           = 0;    // MF_MT_INTERLACE_MODE
+	int             stride              = 0;    // MF_MT_DEFAULT_STRIDE
+}MediaTypeKey, *MediaTypeKeyPtr;
+
+bool operator==(const MediaTypeKey& a, const MediaTypeKey& b);
+
+struct MediaTypeKeyHash {
+	size_t operator()(const MediaTypeKey& key) const;
+};
+
+//
+// Positions in a media type list by key. Positions under a key stay in the
+// order they were added, so the first match is the one a scan of the list
+// would find.
+//
+class CMediaTypeIndex
+{
+public:
+	void add(const MediaTypeKey& key, unsigned int position);
+	void clear() { m_positions.clear(); }
+
+	// Positions of the types with this key, nullptr when there are none
+	const std::vector<unsigned int>* find(const MediaTypeKey& key) const;
+	size_t keyCount() const { return m_positions.size(); }
+
+private:
+	typedef std::unordered_map<MediaTypeKey, std::vector<unsigned int>, MediaTypeKeyHash> PositionMap;
+
+	PositionMap     m_positions;
+};
+
+#endif
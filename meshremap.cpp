@@ -0,0 +1,310 @@
+#include "meshremap.h"
+#include "cpufeatures.h"
+
+#include <math.h>
+#include <string.h>
+
+#if (defined CPU_X86)
+#include <emmintrin.h>
+#endif
+
+//
+// Interpolated fields of one tile row: MESH_FIELD_COUNT spans of MESH_TILE_SIZE
+// values, positions clamped so the 2x2 gather stays inside the plane
+//
+typedef struct _MeshSpan {
+	int     fields[MESH_FIELD_COUNT][MESH_TILE_SIZE];
+}MeshSpan;
+
+// Left edge value in 1/256 of the field, step per pixel and the clamp range of each field
+typedef struct _MeshEdges {
+	int     left[MESH_FIELD_COUNT];
+	int     step[MESH_FIELD_COUNT];
+	int     low[MESH_FIELD_COUNT];
+	int     high[MESH_FIELD_COUNT];
+}MeshEdges;
+
+// Interpolates fields [first, last)
+typedef void (*MeshSpanFunc)(const MeshEdges& edges, MeshSpan& span, int first, int last);
+
+static void meshSpan_C(const MeshEdges& edges, MeshSpan& span, int first, int last)
+{
+	for (int f = first; f < last; f++)
+	{
+		int value = edges.left[f] + (1 << 7);
+		for (int i = 0; i < MESH_TILE_SIZE; i++, value += edges.step[f])
+		{
+			int field = value >> 8;
+			span.fields[f][i] = field < edges.low[f] ? edges.low[f] : (field > edges.high[f] ? edges.high[f] : field);
+		}
+	}
+}
+
+#if (defined CPU_X86)
+static inline __m128i clampEpi32(__m128i value, __m128i low, __m128i high)
+{
+	__m128i below = _mm_cmplt_epi32(value, low);
+	value = _mm_or_si128(_mm_and_si128(below, low), _mm_andnot_si128(below, value));
+	__m128i above = _mm_cmpgt_epi32(value, high);
+	return _mm_or_si128(_mm_and_si128(above, high), _mm_andnot_si128(above, value));
+}
+
+// Same integer steps as meshSpan_C, four pixels at a time
+static void meshSpan_SSE2(const MeshEdges& edges, MeshSpan& span, int first, int last)
+{
+	for (int f = first; f < last; f++)
+	{
+		int left = edges.left[f] + (1 << 7);
+		int step = edges.step[f];
+		__m128i value = _mm_setr_epi32(left, left + step, left + 2 * step, left + 3 * step);
+		__m128i step4 = _mm_set1_epi32(4 * step);
+		__m128i low = _mm_set1_epi32(edges.low[f]);
+		__m128i high = _mm_set1_epi32(edges.high[f]);
+		for (int i = 0; i < MESH_TILE_SIZE; i += 4)
+		{
+			_mm_storeu_si128((__m128i*)&span.fields[f][i], clampEpi32(_mm_srai_epi32(value, 8), low, high));
+			value = _mm_add_epi32(value, step4);
+		}
+	}
+}
+#endif
+
+static MeshSpanFunc selectMeshSpan()
+{
+#if (defined CPU_X86)
+	if (cpuFeatures() & CPU_FEATURE_SSE2)
+	{
+		return meshSpan_SSE2;
+	}
+#endif
+	return meshSpan_C;
+}
+
+static int meshCoordinate(double position)
+{
+	return (int)floor((position - 0.5) * (1 << REMAP_FRACTION_BITS) + 0.5);
+}
+
+// Projects the node directions through the rotation into both lenses
+static void evaluateNodes(MeshPlane& plane, const double rotation[3][3])
+{
+	for (size_t i = 0; i < plane.nodes.size(); i++)
+	{
+		double dir[3];
+		rotateDirection(rotation, &plane.directions[3 * i], dir);
+
+		double x[2], y[2], theta[2];
+		theta[0] = projectToLens(plane.lenses[0], dir, x[0], y[0]);
+		if (plane.lens_count == 2)
+		{
+			theta[1] = projectToLens(plane.lenses[1], dir, x[1], y[1]);
+		}
+		else
+		{
+			x[1] = x[0];
+			y[1] = y[0];
+			theta[1] = 1e9;
+		}
+
+		double share = 0.5 + (theta[1] - theta[0]) / (2 * plane.feather);
+		share = share < 0 ? 0 : (share > 1 ? 1 : share);
+
+		MeshNode& node = plane.nodes[i];
+		node.fields[MESH_FIELD_X0] = meshCoordinate(x[0]);
+		node.fields[MESH_FIELD_Y0] = meshCoordinate(y[0]);
+		node.fields[MESH_FIELD_X1] = meshCoordinate(x[1]);
+		node.fields[MESH_FIELD_Y1] = meshCoordinate(y[1]);
+		node.fields[MESH_FIELD_WEIGHT] = (int)floor(share * 256 + 0.5);
+	}
+}
+
+static bool buildPlane(const CAirOffset& offset, STITCH_PROJECTION projection, double scale,
+	unsigned int src_width, unsigned int src_height, unsigned int dst_width, unsigned int dst_height,
+	const double rotation[3][3], MeshPlane& plane)
+{
+	if (src_width < 2 || src_height < 2 || dst_width == 0 || dst_height == 0 ||
+		offset.lensCount() == 0 || offset.lensCount() > 2)
+	{
+		return false;
+	}
+
+	plane.lens_count = (unsigned int)offset.lensCount();
+	for (unsigned int i = 0; i < plane.lens_count; i++)
+	{
+		lensModel(offset.lens(i), scale, offset.fov(), plane.lenses[i]);
+	}
+	plane.feather = featherWidth(plane.lenses[0]);
+
+	plane.src_width = src_width;
+	plane.src_height = src_height;
+	plane.dst_width = dst_width;
+	plane.dst_height = dst_height;
+	plane.columns = (dst_width + MESH_TILE_SIZE - 1) / MESH_TILE_SIZE + 1;
+	plane.rows = (dst_height + MESH_TILE_SIZE - 1) / MESH_TILE_SIZE + 1;
+	plane.nodes.assign((size_t)plane.columns * plane.rows, MeshNode());
+	plane.directions.assign(plane.nodes.size() * 3, 0);
+
+	//
+	// Nodes sit on the pixel centers of every MESH_TILE_SIZE-th pixel, the last
+	// column and row lie past the frame and extend the projection beyond it
+	//
+	for (unsigned int r = 0; r < plane.rows; r++)
+	{
+		for (unsigned int c = 0; c < plane.columns; c++)
+		{
+			outputDirection(projection, (c * MESH_TILE_SIZE + 0.5) / dst_width, (r * MESH_TILE_SIZE + 0.5) / dst_height,
+				&plane.directions[3 * ((size_t)r * plane.columns + c)]);
+		}
+	}
+	evaluateNodes(plane, rotation);
+	return true;
+}
+
+// Bilinear sample of a 1/16 pixel position, scaled by 256
+static inline unsigned int sampleBilinear(const PlaneView& src, int x, int y)
+{
+	const unsigned char* p = src.data + (size_t)(y >> REMAP_FRACTION_BITS) * src.stride + (size_t)(x >> REMAP_FRACTION_BITS) * src.step;
+	unsigned int fx = x & ((1 << REMAP_FRACTION_BITS) - 1);
+	unsigned int fy = y & ((1 << REMAP_FRACTION_BITS) - 1);
+	unsigned int top = p[0] * (16 - fx) + p[src.step] * fx;
+	unsigned int bottom = p[src.stride] * (16 - fx) + p[src.stride + src.step] * fx;
+	return top * (16 - fy) + bottom * fy;
+}
+
+//
+// CMeshRemap
+//
+CMeshRemap::CMeshRemap()
+{
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			m_rotation[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+}
+
+bool CMeshRemap::build(const CAirOffset& offset, const RemapKey& key)
+{
+	if (key.input_width < 4 || key.input_height < 4 || key.output_width < 2 || key.output_height < 2)
+	{
+		return false;
+	}
+
+	double scale = offset.sourceWidth() ? (double)key.input_width / offset.sourceWidth() : 1.0;
+	MeshPlane luma, chroma;
+	if (!buildPlane(offset, key.projection, scale, key.input_width, key.input_height,
+			key.output_width, key.output_height, m_rotation, luma) ||
+		!buildPlane(offset, key.projection, scale / 2, (key.input_width + 1) / 2, (key.input_height + 1) / 2,
+			(key.output_width + 1) / 2, (key.output_height + 1) / 2, m_rotation, chroma))
+	{
+		return false;
+	}
+
+	m_key = key;
+	m_planes[STITCH_PLANE_LUMA] = std::move(luma);
+	m_planes[STITCH_PLANE_CHROMA] = std::move(chroma);
+	return true;
+}
+
+bool CMeshRemap::setRotation(const float matrix[9])
+{
+	double rotation[3][3];
+	bool changed = false;
+	for (int i = 0; i < 9; i++)
+	{
+		rotation[i / 3][i % 3] = matrix[i];
+		changed = changed || rotation[i / 3][i % 3] != m_rotation[i / 3][i % 3];
+	}
+	if (!changed)
+	{
+		return true;
+	}
+
+	memcpy(m_rotation, rotation, sizeof(m_rotation));
+	for (int i = 0; i < 2; i++)
+	{
+		if (!m_planes[i].nodes.empty())
+		{
+			evaluateNodes(m_planes[i], m_rotation);
+		}
+	}
+	return true;
+}
+
+size_t CMeshRemap::memorySize() const
+{
+	return (m_planes[0].nodes.size() + m_planes[1].nodes.size()) * sizeof(MeshNode);
+}
+
+bool CMeshRemap::remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+	unsigned int row_begin, unsigned int row_end)
+{
+	const MeshPlane& mesh = m_planes[plane];
+	if (mesh.nodes.empty() || src.width != mesh.src_width || src.height != mesh.src_height ||
+		dst.width != mesh.dst_width || dst.height != mesh.dst_height || row_end > dst.height)
+	{
+		return false;
+	}
+
+	MeshSpanFunc interpolate = selectMeshSpan();
+	MeshEdges edges;
+	for (int f = 0; f < MESH_FIELD_COUNT; f++)
+	{
+		edges.low[f] = 0;
+	}
+	edges.high[MESH_FIELD_X0] = edges.high[MESH_FIELD_X1] = (int)((src.width - 1) << REMAP_FRACTION_BITS) - 1;
+	edges.high[MESH_FIELD_Y0] = edges.high[MESH_FIELD_Y1] = (int)((src.height - 1) << REMAP_FRACTION_BITS) - 1;
+	edges.high[MESH_FIELD_WEIGHT] = 256;
+
+	MeshSpan span;
+	for (unsigned int y = row_begin; y < row_end; y++)
+	{
+		const MeshNode* top = &mesh.nodes[(size_t)(y >> MESH_TILE_SHIFT) * mesh.columns];
+		const MeshNode* bottom = top + mesh.columns;
+		int fy = (int)(y & (MESH_TILE_SIZE - 1));
+		unsigned char* d = dst.data + (size_t)y * dst.stride;
+
+		for (unsigned int x0 = 0, tile = 0; x0 < dst.width; x0 += MESH_TILE_SIZE, tile++)
+		{
+			// vertical interpolation at both tile edges, horizontal steps in between
+			for (int f = 0; f < MESH_FIELD_COUNT; f++)
+			{
+				int left = top[tile].fields[f] * (MESH_TILE_SIZE - fy) + bottom[tile].fields[f] * fy;
+				int right = top[tile + 1].fields[f] * (MESH_TILE_SIZE - fy) + bottom[tile + 1].fields[f] * fy;
+				edges.left[f] = left * MESH_TILE_SIZE;
+				edges.step[f] = right - left;
+			}
+			unsigned int count = dst.width - x0 < MESH_TILE_SIZE ? dst.width - x0 : MESH_TILE_SIZE;
+			unsigned char* out = d + (size_t)x0 * dst.step;
+
+			//
+			// Tiles whose four corners see one lens only, most of the frame,
+			// interpolate and gather that lens alone
+			//
+			int corners = top[tile].fields[MESH_FIELD_WEIGHT] + top[tile + 1].fields[MESH_FIELD_WEIGHT] +
+				bottom[tile].fields[MESH_FIELD_WEIGHT] + bottom[tile + 1].fields[MESH_FIELD_WEIGHT];
+			if (corners == 0 || corners == 4 * 256)
+			{
+				int fx = corners ? MESH_FIELD_X0 : MESH_FIELD_X1;
+				interpolate(edges, span, fx, fx + 2);
+				for (unsigned int i = 0; i < count; i++)
+				{
+					out[(size_t)i * dst.step] = (unsigned char)((sampleBilinear(src, span.fields[fx][i], span.fields[fx + 1][i]) + (1 << 7)) >> 8);
+				}
+				continue;
+			}
+
+			interpolate(edges, span, 0, MESH_FIELD_COUNT);
+			for (unsigned int i = 0; i < count; i++)
+			{
+				int weight = span.fields[MESH_FIELD_WEIGHT][i];
+				unsigned int first = sampleBilinear(src, span.fields[MESH_FIELD_X0][i], span.fields[MESH_FIELD_Y0][i]);
+				unsigned int second = sampleBilinear(src, span.fields[MESH_FIELD_X1][i], span.fields[MESH_FIELD_Y1][i]);
+				out[(size_t)i * dst.step] = (unsigned char)((first * weight + second * (256 - weight) + (1 << 15)) >> 16);
+			}
+		}
+	}
+	return true;
+}
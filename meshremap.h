@@ -0,0 +1,71 @@
+#ifndef MESH_REMAP_H
+#define MESH_REMAP_H
+
+//
+// Sparse alternative to CRemapTable. Source positions are only stored every
+// MESH_TILE_SIZE output pixels in both directions, and the positions of the
+// pixels in between are interpolated while gathering. A 3040x1520 panorama
+// needs about half a megabyte instead of fifty, which stays in cache.
+//
+
+#include "lensgeometry.h"
+#include "remaptable.h"
+#include "yuvstitch.h"
+#include <vector>
+
+#define MESH_TILE_SHIFT     4
+#define MESH_TILE_SIZE      (1 << MESH_TILE_SHIFT)
+
+enum MESH_FIELD {
+	MESH_FIELD_X0       = 0,    // lens 0 position, 1/16 pixel, not clamped
+	MESH_FIELD_Y0       = 1,
+	MESH_FIELD_X1       = 2,    // lens 1 position
+	MESH_FIELD_Y1       = 3,
+	MESH_FIELD_WEIGHT   = 4,    // share of lens 0, 0..256
+	MESH_FIELD_COUNT    = 5,
+};
+
+typedef struct _MeshNode {
+	int     fields[MESH_FIELD_COUNT];
+}MeshNode, *MeshNodePtr;
+
+typedef struct _MeshPlane {
+	unsigned int            src_width   = 0;
+	unsigned int            src_height  = 0;
+	unsigned int            dst_width   = 0;
+	unsigned int            dst_height  = 0;
+	unsigned int            columns     = 0;    // nodes per row, one past the last tile
+	unsigned int            rows        = 0;
+	std::vector<MeshNode>   nodes;
+	// what the nodes are evaluated from, kept so a rotation only re-projects them
+	std::vector<double>     directions;         // unrotated view direction of each node, 3 per node
+	LensModel               lenses[2];
+	unsigned int            lens_count  = 0;
+	double                  feather     = 0;
+}MeshPlane, *MeshPlanePtr;
+
+class CMeshRemap : public CPlaneRemap
+{
+public:
+	CMeshRemap();
+
+	// Evaluates the lens geometry on the node grid of both planes, at most two lenses
+	bool build(const CAirOffset& offset, const RemapKey& key);
+
+	const RemapKey& key() const { return m_key; }
+	const MeshPlane& plane(STITCH_PLANE plane) const { return m_planes[plane]; }
+	size_t memorySize() const;
+
+	const char* name() const { return "mesh"; }
+	bool remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+		unsigned int row_begin, unsigned int row_end);
+	// Re-projects the nodes only, the same matrix twice costs nothing
+	bool setRotation(const float matrix[9]);
+
+private:
+	RemapKey    m_key;
+	MeshPlane   m_planes[2];
+	double      m_rotation[3][3];
+};
+
+#endif
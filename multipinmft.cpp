@@ -43,9 +43,16 @@ CMultipinMft::CMultipinMft()
     m_spAttributes( nullptr ),
     m_spSourceTransform( nullptr ),
 	m_spVideoDecoder(nullptr),
-	m_spStitcher(nullptr),
-	m_spConvertI420ToRGBA(nullptr),
-	m_spConvertRGBAToNV12(nullptr),
+	m_spStitchStage(nullptr),
+	m_spYuvStitchStage(nullptr),
+	m_spStitchWorkers(nullptr),
+	m_spSamplePool(nullptr),
+	m_spPipeline(nullptr),
+	m_spanTraceStarted(FALSE),
+	m_stitchMode(STITCH_MODE_YUV),
+	m_blenderType(CBlenderWrapper::PANORAMIC_BLENDER),
+	m_colorMatrix(COLOR_MATRIX_BT601),
+	m_colorRange(COLOR_RANGE_LIMITED),
     m_PhotoTriggerSent(false),
     m_filterHasIndependentPin( false ),
     m_FilterInPhotoSequence( false ),
@@ -70,6 +77,10 @@ CMultipinMft::~CMultipinMft( )
 {
     CBasePin *pioPin = NULL;
 
+    // the stage threads use the pins and the stitch stages, they go first
+    StopPipeline();
+    m_pinRoutes.Clear();
+
     for ( ULONG ulIndex = 0, ulSize = (ULONG) m_InPins.size(); ulIndex < ulSize; ulIndex++ )
     {
         pioPin = m_InPins[ ulIndex ];
@@ -86,9 +97,10 @@ CMultipinMft::~CMultipinMft( )
 
     m_spSourceTransform = nullptr;
 	m_spVideoDecoder = nullptr;
-	m_spConvertI420ToRGBA = nullptr;
-	m_spConvertRGBAToNV12 = nullptr; 
-	m_spStitcher = nullptr;
+	m_spStitchStage = nullptr;
+	m_spYuvStitchStage = nullptr;
+	m_spStitchWorkers = nullptr;
+	m_spSamplePool = nullptr;
 }
 
 STDMETHODIMP_(ULONG) CMultipinMft::AddRef(
@@ -217,6 +229,15 @@ STDMETHODIMP CMultipinMft::InitializeTransform (
     DMFTCHECKHR_GOTO( spFilterUnk.As( &m_spSourceTransform ), done );
     
     DMFTCHECKHR_GOTO( m_spSourceTransform.As( &m_spIkscontrol ), done );
+
+    DMFTCHECKHR_GOTO( CSamplePool::CreateInstance( m_spSamplePool.ReleaseAndGetAddressOf() ), done );
+
+    // DMFT_SPAN_TRACE names the Chrome trace file the stage spans go to when the
+    // last transform of the process shuts down
+    if ( !m_spanTraceStarted )
+    {
+        m_spanTraceStarted = CSpanTrace::instance().startFromEnvironment();
+    }
     
     DMFTCHECKHR_GOTO( m_spSourceTransform->MFTGetStreamCount( &inputStreams, &outputStreams ), done );
 
@@ -417,6 +438,20 @@ STDMETHODIMP CMultipinMft::InitializeTransform (
     
     m_InputPinCount =  ULONG ( m_InPins.size() );
     m_OutputPinCount = ULONG ( m_OutPins.size() );
+    DMFTCHECKHR_GOTO( RebuildPinRoutes(), done );
+
+    //
+    // Preview is watched live, it keeps its latency at two frames and shows the newest
+    //
+    for ( ULONG ulIndex = 0; ulIndex < m_OutputPinCount; ulIndex++ )
+    {
+        COutPin *poPin = ( COutPin* )m_OutPins[ ulIndex ];
+        if ( poPin && SUCCEEDED( poPin->GetGUID( MF_DEVICESTREAM_STREAM_CATEGORY, &streamCategory ) )
+            && IsEqualGUID( streamCategory, PINNAME_VIDEO_PREVIEW ) )
+        {
+            DMFTCHECKHR_GOTO( poPin->SetQueuePolicy( DMFT_QUEUE_DROP_OLDEST, DMFT_PREVIEW_QUEUE_DEPTH ), done );
+        }
+    }
     
 	// create decoder
 	hr = FindVideoDecoder(MFVideoFormat_MJPG); 
@@ -439,6 +474,7 @@ done:
     if ( FAILED( hr ) )
     {
         //Release the pins and the resources acquired
+        m_pinRoutes.Clear();
         while ( m_InPins.size() > 0 )
         {
             CInPin *pInPin = nullptr;
@@ -511,6 +547,219 @@ STDMETHODIMP CMultipinMft::GetAirOffset()
 	return hr;
 }
 
+//
+// Sample time a stage span is tagged with, so one frame can be followed
+// through the stages; only asked for while spans are recorded
+//
+static LONGLONG SpanFrame(
+    _In_opt_ IMFSample* pSample
+    )
+{
+	LONGLONG llSampleTime = -1;
+	if (CSpanTrace::enabled() && pSample && FAILED(pSample->GetSampleTime(&llSampleTime)))
+	{
+		llSampleTime = -1;
+	}
+	return llSampleTime;
+}
+
+//
+// Remap engine and projection of the planar stitcher for each blender type.
+// The 3D layouts have no planar equivalent and fall back to a mono panorama.
+//
+static const struct {
+	CBlenderWrapper::BLENDER_TYPE   type;
+	STITCH_REMAP                    remap;
+	STITCH_PROJECTION               projection;
+} s_stitchRemaps[] = {
+	{ CBlenderWrapper::PANORAMIC_BLENDER,           STITCH_REMAP_TABLE, STITCH_PROJECTION_EQUIRECTANGULAR },
+	{ CBlenderWrapper::PANORAMIC_CYLINDER_BLENDER,  STITCH_REMAP_MESH,  STITCH_PROJECTION_CYLINDRICAL },
+	{ CBlenderWrapper::CENTER_3D_BLENDER,           STITCH_REMAP_MESH,  STITCH_PROJECTION_EQUIRECTANGULAR },
+	{ CBlenderWrapper::LEFT_RIGHT_3D_BLENDER,       STITCH_REMAP_MESH,  STITCH_PROJECTION_EQUIRECTANGULAR },
+};
+
+/*++
+Description:
+    Builds the remap of the planar stitcher for the current blender type and
+    offset. Returns nullptr, which leaves the stage on its identity remap, if
+    the offset cannot be used.
+--*/
+std::shared_ptr<CPlaneRemap> CMultipinMft::CreateStitchRemap(
+    _In_ UINT32 uWidth,
+    _In_ UINT32 uHeight
+    )
+{
+	STITCH_REMAP remap = STITCH_REMAP_TABLE;
+	RemapKey remapKey;
+	remapKey.input_width = uWidth;
+	remapKey.input_height = uHeight;
+	remapKey.output_width = uWidth;
+	remapKey.output_height = uHeight;
+	remapKey.projection = STITCH_PROJECTION_EQUIRECTANGULAR;
+	for (size_t i = 0; i < sizeof(s_stitchRemaps) / sizeof(s_stitchRemaps[0]); i++)
+	{
+		if (s_stitchRemaps[i].type == m_blenderType)
+		{
+			remap = s_stitchRemaps[i].remap;
+			remapKey.projection = s_stitchRemaps[i].projection;
+		}
+	}
+	// a dense table cannot follow a rotation, the mesh re-projects its nodes per change
+	if (m_blendParams.rotate)
+	{
+		remap = STITCH_REMAP_MESH;
+	}
+
+	if (remap == STITCH_REMAP_MESH)
+	{
+		CAirOffset airOffset;
+		std::shared_ptr<CMeshRemap> spMesh = std::make_shared<CMeshRemap>();
+		if (!airOffset.parse(m_offset) || !spMesh->build(airOffset, remapKey))
+		{
+			return nullptr;
+		}
+		return spMesh;
+	}
+	// mapped from the table cache when this camera was opened before
+	CRemapCache remapCache(CRemapCache::defaultDirectory());
+	return remapCache.acquire(m_offset, remapKey);
+}
+
+/*++
+Description:
+    Stamps the stitched frame with the timestamps of the compressed frame,
+    hands it to the output pins connected to pInPin and tells the pipeline
+    there is output
+--*/
+STDMETHODIMP CMultipinMft::DeliverFrame(
+    _In_ CInPin* pInPin,
+    _In_ IMFSample* pSource,
+    _In_ IMFSample* pResultSample
+    )
+{
+	HRESULT hr = S_OK;
+	LONGLONG llSampleTime = 0;
+	CSpanScope span("queue", SpanFrame(pSource));
+
+	if (SUCCEEDED(pSource->GetSampleTime(&llSampleTime)))
+	{
+		DMFTCHECKHR_GOTO(pResultSample->SetSampleTime(llSampleTime), done);
+	}
+	if (SUCCEEDED(pSource->GetSampleDuration(&llSampleTime)))
+	{
+		DMFTCHECKHR_GOTO(pResultSample->SetSampleDuration(llSampleTime), done);
+	}
+
+	DMFTCHECKHR_GOTO(pInPin->SendSample(pResultSample), done);
+
+	QueueEvent(METransformHaveOutput, GUID_NULL, S_OK, NULL);
+done:
+	return hr;
+}
+
+/*++
+Description:
+    Starts one thread per stage of the current stitch mode. Each stage runs
+    the same function as the serial ProcessInput; the last one delivers, so
+    frames reach the output pins in the order they came in.
+--*/
+STDMETHODIMP_(VOID) CMultipinMft::CreatePipeline()
+{
+	typedef HRESULT (STDMETHODCALLTYPE CMultipinMft::*FRAME_STEP)(IMFSample*, IMFSample**);
+	std::vector<CStagePipeline<PipelineFrame>::StageFunc> stages;
+	std::vector<FRAME_STEP> steps;
+	std::vector<const char*> names;     // thread names in the span timeline
+
+	stages.push_back([this](PipelineFrame& frame) {
+		if (CSpanTrace::enabled())
+		{
+			CSpanTrace::instance().nameThread("decode");
+		}
+		ComPtr<IMFSample> spOutput;
+		HRESULT hr = DecodeFrame(frame.dwStreamId, frame.spSample.Get(), &spOutput);
+		frame.spSample = spOutput;
+		return SUCCEEDED(hr);
+	});
+	if (m_stitchMode == STITCH_MODE_YUV)
+	{
+		steps.push_back(&CMultipinMft::StitchYuvFrame);
+		names.push_back("stitch");
+	}
+	else
+	{
+		steps.push_back(&CMultipinMft::ConvertToBgraFrame);
+		steps.push_back(&CMultipinMft::BlendBgraFrame);
+		steps.push_back(&CMultipinMft::ConvertToNv12Frame);
+		names.push_back("convert");
+		names.push_back("stitch");
+		names.push_back("convert");
+	}
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		FRAME_STEP pfnStep = steps[i];
+		const char* pName = names[i];
+		BOOL fDeliver = (i + 1 == steps.size());
+		stages.push_back([this, pfnStep, pName, fDeliver](PipelineFrame& frame) {
+			if (CSpanTrace::enabled())
+			{
+				CSpanTrace::instance().nameThread(pName);
+			}
+			ComPtr<IMFSample> spOutput;
+			HRESULT hr = (this->*pfnStep)(frame.spSample.Get(), &spOutput);
+			frame.spSample = spOutput;
+			if (SUCCEEDED(hr) && fDeliver)
+			{
+				hr = DeliverFrame(frame.pInPin, frame.spSource.Get(), frame.spSample.Get());
+			}
+			return SUCCEEDED(hr);
+		});
+	}
+
+	std::shared_ptr<CStagePipeline<PipelineFrame>> spPipeline = std::make_shared<CStagePipeline<PipelineFrame>>(
+		stages, [](PipelineFrame& frame) { frame = PipelineFrame(); });
+	std::atomic_store(&m_spPipeline, spPipeline);
+}
+
+/*++
+Description:
+    Joins the stage threads. Frames still queued are dropped; a ProcessInput
+    racing with this sees the pipeline stopped and drops its frame too.
+--*/
+STDMETHODIMP_(VOID) CMultipinMft::StopPipeline()
+{
+	std::shared_ptr<CStagePipeline<PipelineFrame>> spPipeline =
+		std::atomic_exchange(&m_spPipeline, std::shared_ptr<CStagePipeline<PipelineFrame>>());
+	if (spPipeline)
+	{
+		spPipeline->stop();
+	}
+}
+
+/*++
+Description:
+    Colorimetry of the decoded frames and the NV12 output, from the type the
+    input pin streams with. MJPG types rarely carry it, BT.601 limited range is
+    what the XVP assumed then.
+--*/
+STDMETHODIMP_(VOID) CMultipinMft::SetColorimetry(
+	_In_opt_ IMFMediaType* pInputMediaType
+	)
+{
+	m_colorMatrix = COLOR_MATRIX_BT601;
+	m_colorRange = COLOR_RANGE_LIMITED;
+	if (pInputMediaType)
+	{
+		if (MFGetAttributeUINT32(pInputMediaType, MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT601) == MFVideoTransferMatrix_BT709)
+		{
+			m_colorMatrix = COLOR_MATRIX_BT709;
+		}
+		if (MFGetAttributeUINT32(pInputMediaType, MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235) == MFNominalRange_0_255)
+		{
+			m_colorRange = COLOR_RANGE_FULL;
+		}
+	}
+}
+
 
 STDMETHODIMP CMultipinMft::SetWorkQueueEx(
     _In_  DWORD dwWorkQueueId,
@@ -778,11 +1027,18 @@ STDMETHODIMP  CMultipinMft::ProcessMessage(
     switch ( eMessage )
     {
     case MFT_MESSAGE_COMMAND_FLUSH:
+    {
         //
         //This is MFT wide flush.. Flush all output pins
         //
+        auto spPipeline = std::atomic_load( &m_spPipeline );
+        if ( spPipeline )
+        {
+            spPipeline->flush();
+        }
         (VOID)FlushAllStreams();
         break;
+    }
     case MFT_MESSAGE_COMMAND_DRAIN:
         //
         //There is no draining for Device MFT. Just kept here for reference
@@ -837,6 +1093,14 @@ STDMETHODIMP  CMultipinMft::ProcessMessage(
     {
         SetStreamingState(DeviceStreamState_Stop);
         //
+        // Frames still in the stage threads belong to the stopped stream
+        //
+        auto spPipeline = std::atomic_load( &m_spPipeline );
+        if ( spPipeline )
+        {
+            spPipeline->flush();
+        }
+        //
         // Stop streaming custom pins if the device transform has any
         //
         SetStreamingStateCustomPins( DeviceStreamState_Stop );
@@ -875,22 +1139,9 @@ STDMETHODIMP  CMultipinMft::ProcessInput(
     UNREFERENCED_PARAMETER( dwFlags );
 
     MFTLOCKED();
-	DWORD len;
-	ComPtr<IMFMediaBuffer> bf;
-	MFT_OUTPUT_STREAM_INFO mftStreamInfo = { 0 };
-	MFT_OUTPUT_DATA_BUFFER mftDecodingOutputData = { 0 };
-	ComPtr<IMFSample> spConvertedSample2 = NULL;
-	ComPtr<IMFMediaBuffer> spResultBuffer = NULL;
-	MFT_OUTPUT_DATA_BUFFER mftResultData = { 0 };
-	ComPtr<IMFSample> spSampleOutput = NULL;
-	ComPtr<IMFMediaBuffer> spBufferOut = NULL;
-	ComPtr<IMFMediaBuffer> spStitchInputBuffer = nullptr;
-	BYTE* pbStichInputBufferPtr;
-	ComPtr<IMFMediaBuffer> spStitchOutputBuffer = nullptr;
-	BYTE* pbStitchOutputBufferPtr;
-	ComPtr<IMFSample> spConvertedSample1 = NULL;
-	ComPtr<IMFSample> pStitchedSample = NULL;
-	MFT_OUTPUT_DATA_BUFFER mftConvertedOutputData = { 0 };
+	ComPtr<IMFSample> spDecodedSample = NULL;
+	ComPtr<IMFSample> spResultSample = NULL;
+	std::shared_ptr<CStagePipeline<PipelineFrame>> spPipeline;
     CInPin *inPin = ( CInPin* )GetInPin( dwInputStreamID );
     DMFTCHECKNULL_GOTO( inPin, done, E_INVALIDARG );
 
@@ -899,76 +1150,230 @@ STDMETHODIMP  CMultipinMft::ProcessInput(
         goto done;
     }
 
-	hr = pSample->GetBufferByIndex(0, &bf);
-	hr = bf->GetCurrentLength(&len);
-	
+	///////// pipelined, the stage threads take it from here ////////////////////
+	spPipeline = std::atomic_load(&m_spPipeline);
+	if (spPipeline)
+	{
+		PipelineFrame frame;
+		frame.spSample = pSample;
+		frame.spSource = pSample;
+		frame.pInPin = inPin;
+		frame.dwStreamId = dwInputStreamID;
+		// waits while the decode stage is behind, a stopped pipeline drops the frame
+		if (!spPipeline->push(std::move(frame)))
+		{
+			DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! pipeline stopped, frame dropped");
+		}
+		goto done;
+	}
+
 	////// decode frame ////////////////////////////////////////////////////////////
-	hr = m_spVideoDecoder->MFTProcessInput(dwInputStreamID, pSample, dwFlags);
-	
+	DMFTCHECKHR_GOTO(DecodeFrame(dwInputStreamID, pSample, &spDecodedSample), done);
+
+	///////// stitch ///////////////////////////////////////////////////////////////
+	if (m_stitchMode == STITCH_MODE_YUV)
+	{
+		DMFTCHECKHR_GOTO(StitchYuvFrame(spDecodedSample.Get(), &spResultSample), done);
+	}
+	else
+	{
+		DMFTCHECKHR_GOTO(StitchBgraFrame(spDecodedSample.Get(), &spResultSample), done);
+	}
+
+	DMFTCHECKHR_GOTO(DeliverFrame(inPin, pSample, spResultSample.Get()), done);
+   
+done:
+    SAFERELEASE( pSample );
+    DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr );
+    return hr;
+
+}
+
+/*++
+Description:
+    Runs one compressed frame through the video decoder and returns the
+    decoded I420 frame in ppDecodedSample
+--*/
+STDMETHODIMP CMultipinMft::DecodeFrame(
+    _In_ DWORD dwInputStreamID,
+    _In_ IMFSample* pSample,
+    _Outptr_ IMFSample** ppDecodedSample
+    )
+{
+	HRESULT hr = S_OK;
+	MFT_OUTPUT_STREAM_INFO mftStreamInfo = { 0 };
+	MFT_OUTPUT_DATA_BUFFER mftDecodingOutputData = { 0 };
+	ComPtr<IMFSample> spSampleOutput = NULL;
+	ComPtr<IMFMediaBuffer> spBufferOut = NULL;
+	CSpanScope span("decode", SpanFrame(pSample));
+
+	(VOID)m_spVideoDecoder->MFTProcessInput(dwInputStreamID, pSample, 0);
+
 	DMFTCHECKHR_GOTO(m_spVideoDecoder->MFTGetOutputStreamInfo(0, &mftStreamInfo), done);
 	DMFTCHECKHR_GOTO(CreateMediaSample(mftStreamInfo.cbSize, &spSampleOutput), done);
-	hr = spSampleOutput->GetBufferByIndex(0, &spBufferOut);
-	if (FAILED(hr))
-	{ 
-		DMFTCHECKHR_GOTO(hr, done);
-	}
+	DMFTCHECKHR_GOTO(spSampleOutput->GetBufferByIndex(0, &spBufferOut), done);
 	DMFTCHECKHR_GOTO(spBufferOut->SetCurrentLength(0), done);
 	//Set the output sample
 	mftDecodingOutputData.pSample = spSampleOutput.Get();
 	//Set the output id
 	mftDecodingOutputData.dwStreamID = dwInputStreamID;
-	hr = m_spVideoDecoder->MFTProcessOutput(0, 1, &mftDecodingOutputData, 0);
+	// the decoder status is not checked, the sample goes on to the stitcher
+	(VOID)m_spVideoDecoder->MFTProcessOutput(0, 1, &mftDecodingOutputData, 0);
 
-	///////// convert color space ////////////////////////////////////////////////////
-	m_spConvertI420ToRGBA->MFTProcessInput(dwInputStreamID, mftDecodingOutputData.pSample, dwFlags);
-	DMFTCHECKHR_GOTO(m_spConvertI420ToRGBA->MFTGetOutputStreamInfo(0, &mftStreamInfo), done);
-	DMFTCHECKHR_GOTO(CreateMediaSample(mftStreamInfo.cbSize, &spConvertedSample1), done);
-	hr = spConvertedSample1->GetBufferByIndex(0, &spBufferOut);
-	if (FAILED(hr))
+	*ppDecodedSample = spSampleOutput.Detach();
+done:
+	return hr;
+}
+
+/*++
+Description:
+    Converts a decoded I420 frame to the BGRA sample returned in ppBgraSample
+--*/
+STDMETHODIMP CMultipinMft::ConvertToBgraFrame(
+    _In_ IMFSample* pDecodedSample,
+    _Outptr_ IMFSample** ppBgraSample
+    )
+{
+	HRESULT hr = S_OK;
+	CSampleFrameLock convertInput;
+	CSampleFrameLock convertOutput;
+	ComPtr<IMFSample> spConvertedSample = NULL;
+	CSpanScope span("convert", SpanFrame(pDecodedSample));
+
+	DMFTCHECKHR_GOTO(CreateMediaSample((DWORD)frameBufferSize(FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight), &spConvertedSample), done);
+	DMFTCHECKHR_GOTO(convertInput.Lock(pDecodedSample, FRAME_FORMAT_I420, m_frameWidth, m_frameHeight, FALSE), done);
+	DMFTCHECKHR_GOTO(convertOutput.Lock(spConvertedSample.Get(), FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight, TRUE), done);
+	if (!convertI420ToBGRA(convertInput.Frame(), convertOutput.Frame(), m_colorMatrix, m_colorRange))
 	{
-		DMFTCHECKHR_GOTO(hr, done);
+		DMFTCHECKHR_GOTO(E_FAIL, done);
 	}
-	DMFTCHECKHR_GOTO(spBufferOut->SetCurrentLength(0), done);
-	mftConvertedOutputData.pSample = spConvertedSample1.Get();
-	mftConvertedOutputData.dwStreamID = dwInputStreamID; 
-	m_spConvertI420ToRGBA->MFTProcessOutput(0, 1, &mftConvertedOutputData, 0);
-	DMFTCHECKHR_GOTO(CreateMediaSample(mftStreamInfo.cbSize, &pStitchedSample), done);
-	
-	// do stitching stuff
-	DMFTCHECKHR_GOTO(mftConvertedOutputData.pSample->GetBufferByIndex(0, &spStitchInputBuffer),done);
-	DMFTCHECKHR_GOTO(pStitchedSample->GetBufferByIndex(0, &spStitchOutputBuffer), done);
-	spStitchInputBuffer->Lock(&pbStichInputBufferPtr, nullptr, nullptr);
-	spStitchOutputBuffer->Lock(&pbStitchOutputBufferPtr, nullptr, nullptr);
-	m_blendParams.input_data = pbStichInputBufferPtr;
-	m_blendParams.output_data = pbStitchOutputBufferPtr;
-	//m_spStitcher->runImageBlender(m_blendParams, CBlenderWrapper::PANORAMIC_BLENDER);
-	spStitchInputBuffer->Unlock();
-	spStitchOutputBuffer->Unlock();
-
-	///////// convert back to original color space ///////////////////////////////////
-	m_spConvertRGBAToNV12->MFTProcessInput(dwInputStreamID, pStitchedSample.Get(), dwFlags);
-	DMFTCHECKHR_GOTO(m_spConvertRGBAToNV12->MFTGetOutputStreamInfo(0, &mftStreamInfo), done);
-	DMFTCHECKHR_GOTO(CreateMediaSample(mftStreamInfo.cbSize, &spConvertedSample2), done);
-	hr = spConvertedSample2->GetBufferByIndex(0, &spResultBuffer);
-	if (FAILED(hr))
+	convertInput.Unlock();
+	convertOutput.Unlock();
+
+	*ppBgraSample = spConvertedSample.Detach();
+done:
+	return hr;
+}
+
+/*++
+Description:
+    Runs the blender stage over a BGRA frame, the panorama is returned in
+    ppStitchedSample
+--*/
+STDMETHODIMP CMultipinMft::BlendBgraFrame(
+    _In_ IMFSample* pBgraSample,
+    _Outptr_ IMFSample** ppStitchedSample
+    )
+{
+	HRESULT hr = S_OK;
+	CSampleFrameLock stitchInput;
+	CSampleFrameLock stitchOutput;
+	ComPtr<IMFSample> spStitchedSample = NULL;
+	CSpanScope span("stitch", SpanFrame(pBgraSample));
+
+	DMFTCHECKNULL_GOTO(m_spStitchStage.get(), done, MF_E_NOT_INITIALIZED);
+	DMFTCHECKHR_GOTO(CreateMediaSample((DWORD)frameBufferSize(FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight), &spStitchedSample), done);
+	DMFTCHECKHR_GOTO(stitchInput.Lock(pBgraSample, FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight, FALSE), done);
+	DMFTCHECKHR_GOTO(stitchOutput.Lock(spStitchedSample.Get(), FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight, TRUE), done);
+	if (!m_spStitchStage->process(stitchInput.Frame(), stitchOutput.Frame()))
 	{
-		DMFTCHECKHR_GOTO(hr, done);
+		DMFTCHECKHR_GOTO(E_FAIL, done);
 	}
-	DMFTCHECKHR_GOTO(spResultBuffer->SetCurrentLength(0), done);
-	mftResultData.pSample = spConvertedSample2.Get();
-	mftResultData.dwStreamID = dwInputStreamID;
+	stitchInput.Unlock();
+	stitchOutput.Unlock();
 
-	m_spConvertRGBAToNV12->MFTProcessOutput(0, 1, &mftResultData, 0);
+	*ppStitchedSample = spStitchedSample.Detach();
+done:
+	return hr;
+}
 
-    DMFTCHECKHR_GOTO( inPin->SendSample( mftResultData.pSample ), done );
+/*++
+Description:
+    Converts the stitched BGRA panorama to the NV12 sample handed to the
+    output pin, returned in ppResultSample
+--*/
+STDMETHODIMP CMultipinMft::ConvertToNv12Frame(
+    _In_ IMFSample* pStitchedSample,
+    _Outptr_ IMFSample** ppResultSample
+    )
+{
+	HRESULT hr = S_OK;
+	CSampleFrameLock resultInput;
+	CSampleFrameLock resultOutput;
+	ComPtr<IMFSample> spResultSample = NULL;
+	CSpanScope span("convert", SpanFrame(pStitchedSample));
+
+	DMFTCHECKHR_GOTO(CreateMediaSample((DWORD)frameBufferSize(FRAME_FORMAT_NV12, m_frameWidth, m_frameHeight), &spResultSample), done);
+	DMFTCHECKHR_GOTO(resultInput.Lock(pStitchedSample, FRAME_FORMAT_BGRA, m_frameWidth, m_frameHeight, FALSE), done);
+	DMFTCHECKHR_GOTO(resultOutput.Lock(spResultSample.Get(), FRAME_FORMAT_NV12, m_frameWidth, m_frameHeight, TRUE), done);
+	if (!convertBGRAToNV12(resultInput.Frame(), resultOutput.Frame(), m_colorMatrix, m_colorRange))
+	{
+		DMFTCHECKHR_GOTO(E_FAIL, done);
+	}
+	resultInput.Unlock();
+	resultOutput.Unlock();
 
-    QueueEvent( METransformHaveOutput, GUID_NULL, S_OK, NULL );
-   
+	*ppResultSample = spResultSample.Detach();
 done:
-    SAFERELEASE( pSample );
-    DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr );
-    return hr;
+	return hr;
+}
+
+/*++
+Description:
+    Stitches a decoded I420 frame through BGRA: converts it, runs the blender
+    stage and converts the panorama to the NV12 sample returned in ppResultSample
+--*/
+STDMETHODIMP CMultipinMft::StitchBgraFrame(
+    _In_ IMFSample* pDecodedSample,
+    _Outptr_ IMFSample** ppResultSample
+    )
+{
+	HRESULT hr = S_OK;
+	ComPtr<IMFSample> spConvertedSample = NULL;
+	ComPtr<IMFSample> spStitchedSample = NULL;
 
+	DMFTCHECKHR_GOTO(ConvertToBgraFrame(pDecodedSample, &spConvertedSample), done);
+	DMFTCHECKHR_GOTO(BlendBgraFrame(spConvertedSample.Get(), &spStitchedSample), done);
+	DMFTCHECKHR_GOTO(ConvertToNv12Frame(spStitchedSample.Get(), ppResultSample), done);
+done:
+	return hr;
+}
+
+/*++
+Description:
+    Stitches a decoded I420 frame plane by plane straight into the NV12 sample
+    returned in ppResultSample, without going through BGRA
+--*/
+STDMETHODIMP CMultipinMft::StitchYuvFrame(
+    _In_ IMFSample* pDecodedSample,
+    _Outptr_ IMFSample** ppResultSample
+    )
+{
+	HRESULT hr = S_OK;
+	CSampleFrameLock stitchInput;
+	CSampleFrameLock stitchOutput;
+	ComPtr<IMFSample> spResultSample = NULL;
+	CSpanScope span("stitch", SpanFrame(pDecodedSample));
+
+	DMFTCHECKNULL_GOTO(m_spYuvStitchStage.get(), done, MF_E_NOT_INITIALIZED);
+	// the orientation goes into the remap, an unchanged matrix is not re-evaluated
+	if (m_blendParams.rotate && m_blendParams.rotate_mat)
+	{
+		m_spYuvStitchStage->remap()->setRotation(m_blendParams.rotate_mat);
+	}
+	DMFTCHECKHR_GOTO(CreateMediaSample((DWORD)frameBufferSize(FRAME_FORMAT_NV12, m_frameWidth, m_frameHeight), &spResultSample), done);
+	DMFTCHECKHR_GOTO(stitchInput.Lock(pDecodedSample, FRAME_FORMAT_I420, m_frameWidth, m_frameHeight, FALSE), done);
+	DMFTCHECKHR_GOTO(stitchOutput.Lock(spResultSample.Get(), FRAME_FORMAT_NV12, m_frameWidth, m_frameHeight, TRUE), done);
+	if (!m_spYuvStitchStage->process(stitchInput.Frame(), stitchOutput.Frame()))
+	{
+		DMFTCHECKHR_GOTO(E_FAIL, done);
+	}
+	stitchInput.Unlock();
+	stitchOutput.Unlock();
+
+	*ppResultSample = spResultSample.Detach();
+done:
+	return hr;
 }
 
 STDMETHODIMP  CMultipinMft::ProcessOutput(
@@ -989,6 +1394,7 @@ output pins and populate the corresponding MFT_OUTPUT_DATA_BUFFER with the sampl
 { 
     HRESULT     hr      = S_OK;
     BOOL       gotOne   = false;
+    CSpanScope span( "ProcessOutput" );
     MFTLOCKED();
     UNREFERENCED_PARAMETER( dwFlags );
 
@@ -1100,6 +1506,13 @@ STDMETHODIMP CMultipinMft::SetInputStreamState(
     HRESULT hr = S_OK;
     CInPin *piPin = (CInPin*)GetInPin(dwStreamID);
     DMFTCHECKNULL_GOTO(piPin, done, MF_E_INVALIDSTREAMNUMBER);
+    //
+    // The converters follow the type the input streams with, before its frames arrive
+    //
+    if ( pMediaType && !IsPinStateInActive( value ) )
+    {
+        SetColorimetry( pMediaType );
+    }
     
     DMFTCHECKHR_GOTO(piPin->SetInputStreamState(pMediaType, value, dwFlags),done);
    
@@ -1322,6 +1735,16 @@ STDMETHODIMP CMultipinMft::KsProperty(
         goto done;
     }
 
+    //
+    // Queue control is ours, it never reaches the driver
+    //
+    if (IsEqualCLSID(pProperty->Set, PROPSETID_DMFT_QUEUE))
+    {
+        hr = QueueControlHandler(pProperty,
+            ulPropertyLength, pvPropertyData, ulDataLength, pulBytesReturned);
+        goto done;
+    }
+
     if (IsEqualCLSID(pProperty->Set, KSPROPERTYSETID_ExtendedCameraControl)
         && (pProperty->Id == KSPROPERTY_CAMERACONTROL_EXTENDED_PHOTOTHUMBNAIL))
     {
@@ -1635,6 +2058,14 @@ STDMETHODIMP_(CBasePin*) CMultipinMft::GetInPin(
     )
 {
     CInPin *inPin = NULL;
+    const PinRouteTable *pRoutes = m_pinRoutes.Get();
+    if ( pRoutes )
+    {
+        return ( dwStreamId < pRoutes->inPins.size() ) ? pRoutes->inPins[ dwStreamId ] : NULL;
+    }
+    //
+    //No table before the pins are created or with stream ids too sparse to index
+    //
     for (DWORD dwIndex = 0, dwSize = (DWORD)m_InPins.size(); dwIndex < dwSize; dwIndex++)
     {
          inPin = (CInPin *)m_InPins[dwIndex];
@@ -1652,6 +2083,11 @@ STDMETHODIMP_(CBasePin*) CMultipinMft::GetOutPin(
     )
 {
     COutPin *outPin = NULL;
+    const PinRouteTable *pRoutes = m_pinRoutes.Get();
+    if ( pRoutes )
+    {
+        return ( dwStreamId < pRoutes->outPins.size() ) ? pRoutes->outPins[ dwStreamId ] : NULL;
+    }
 
     for ( DWORD dwIndex = 0, dwSize = (DWORD) m_OutPins.size(); dwIndex < dwSize; dwIndex++ )
     {
@@ -1668,6 +2104,62 @@ STDMETHODIMP_(CBasePin*) CMultipinMft::GetOutPin(
     return outPin;
 }
 
+/*++
+Description:
+    Indexes the pins by stream id and publishes the table GetInPin and
+    GetOutPin read. Called once the pins are created and whenever an input
+    pin is bridged to an output pin. Without a table, stream ids beyond
+    DMFT_ROUTE_MAX_STREAM_ID for instance, the lookups scan the pin arrays.
+--*/
+STDMETHODIMP CMultipinMft::RebuildPinRoutes(
+    )
+{
+    HRESULT hr = S_OK;
+    PinRouteTable *pRoutes = new (std::nothrow) PinRouteTable();
+    DMFTCHECKNULL_GOTO( pRoutes, done, E_OUTOFMEMORY );
+
+    hr = ExceptionBoundary([&]()
+    {
+        for ( DWORD dwIndex = 0, dwSize = (DWORD)m_InPins.size(); dwIndex < dwSize; dwIndex++ )
+        {
+            DWORD dwStreamId = m_InPins[ dwIndex ]->streamId();
+            if ( dwStreamId >= DMFT_ROUTE_MAX_STREAM_ID )
+            {
+                throw std::out_of_range( "input stream id" );
+            }
+            if ( dwStreamId >= pRoutes->inPins.size() )
+            {
+                pRoutes->inPins.resize( dwStreamId + 1, nullptr );
+            }
+            pRoutes->inPins[ dwStreamId ] = m_InPins[ dwIndex ];
+        }
+        for ( DWORD dwIndex = 0, dwSize = (DWORD)m_OutPins.size(); dwIndex < dwSize; dwIndex++ )
+        {
+            DWORD dwStreamId = m_OutPins[ dwIndex ]->streamId();
+            if ( dwStreamId >= DMFT_ROUTE_MAX_STREAM_ID )
+            {
+                throw std::out_of_range( "output stream id" );
+            }
+            if ( dwStreamId >= pRoutes->outPins.size() )
+            {
+                pRoutes->outPins.resize( dwStreamId + 1, nullptr );
+            }
+            pRoutes->outPins[ dwStreamId ] = m_OutPins[ dwIndex ];
+        }
+    });
+    if ( FAILED( hr ) )
+    {
+        DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! pins stay unindexed %x = %!HRESULT!", hr, hr );
+        delete pRoutes;
+        m_pinRoutes.Clear();
+        hr = S_OK;
+        goto done;
+    }
+    DMFTCHECKHR_GOTO( m_pinRoutes.Publish( pRoutes ), done );
+done:
+    return hr;
+}
+
 /*++
 Description:
 This is a critical function which changes the state on an output pin
@@ -2038,6 +2530,12 @@ STDMETHODIMP CMultipinMft::CreateMediaSample(
 	IMFSample *pSample = NULL;
 	IMFMediaBuffer *pBuffer = NULL;
 
+	// samples come back to the pool when downstream releases them
+	if (m_spSamplePool)
+	{
+		return m_spSamplePool->GetSample(cbData, ppSample);
+	}
+
 	DMFTCHECKHR_GOTO(MFCreateSample(&pSample), done);
 	DMFTCHECKHR_GOTO(MFCreateMemoryBuffer(cbData, &pBuffer), done);
 	DMFTCHECKHR_GOTO(pSample->AddBuffer(pBuffer), done);
@@ -2197,52 +2695,86 @@ STDMETHODIMP CMultipinMft::BridgeInputPinOutputPin(
 	UINT32  uHeight          = 0;
     ComPtr<IMFMediaType> pMediaType = nullptr; 
 	ComPtr<IMFMediaType> pOutputMeidaType = nullptr;
+	ComPtr<IMFMediaType> pListedMediaType = nullptr;
 
     DMFTCHECKNULL_GOTO( piPin, done, E_INVALIDARG );
     DMFTCHECKNULL_GOTO( poPin, done, E_INVALIDARG ); 
 
+	//
+	// Every input type is offered as the same NV12 type on the output pin, it is
+	// created once and listed once rather than once per input type
+	//
+	DMFTCHECKHR_GOTO(CreateVideoType(&MFVideoFormat_NV12, &pOutputMeidaType, 0, 0), done);
+
     while ( SUCCEEDED( hr = piPin->GetMediaTypeAt( ulIndex++, &pMediaType )))
     { 
 		DMFTCHECKHR_GOTO(MFGetAttributeSize(pMediaType.Get(), MF_MT_FRAME_SIZE, &uWidth, &uHeight), done);
-		DMFTCHECKHR_GOTO(CreateVideoType(&MFVideoFormat_NV12, &pOutputMeidaType, 0, 0), done);
-        DMFTCHECKHR_GOTO(poPin->AddMediaType(NULL, pOutputMeidaType.Get() ), done );
+		pListedMediaType = nullptr;
+		(VOID)poPin->IsMediaTypeSupported(pOutputMeidaType.Get(), &pListedMediaType);
+		if (!pListedMediaType)
+		{
+			DMFTCHECKHR_GOTO(poPin->AddMediaType(NULL, pOutputMeidaType.Get() ), done );
+		}
 		pMediaType = nullptr;
-		pOutputMeidaType = nullptr;
     }
+	pOutputMeidaType = nullptr;
 	 
 	// create stitcher instance
 	if (uWidth != 0 && uHeight != 0)
 	{
 		if (uWidth != m_frameWidth || uHeight != m_frameHeight)
 		{
+			// the stage threads must be off the old stitch stages before they go
+			StopPipeline();
 			m_blendParams.input_width = uWidth;
 			m_blendParams.input_height = uHeight;
 			m_blendParams.output_width = uWidth;
 			m_blendParams.output_height = uHeight;
 			
-			/*m_spStitcher = std::make_unique<CBlenderWrapper>();
-			m_spStitcher->capabilityAssessment();
-			m_spStitcher->getSingleInstance(BLENDER_FOUR_CHANNELS);
-			m_spStitcher->initializeDevice();*/
+			m_spStitchStage = std::make_unique<CBlenderStage>();
+			m_spStitchStage->configure(m_blendParams, m_blenderType);
+			//m_spStitchStage->initializeDevice();
+			m_spYuvStitchStage = std::make_unique<CYuvStitchStage>();
+			m_spYuvStitchStage->configure(uWidth, uHeight);
+			// the threads outlive format changes, they are created with the first stitcher
+			if (!m_spStitchWorkers)
+			{
+				m_spStitchWorkers = std::make_shared<CWorkerPool>();
+			}
+			m_spYuvStitchStage->setWorkerPool(m_spStitchWorkers);
+			// samples of the old size are freed instead of kept when they come back
+			if (m_spSamplePool)
+			{
+				m_spSamplePool->Trim();
+			}
+			// the lens geometry is evaluated once per frame size, frames only gather through the table
+			if (m_offset.empty())
+			{
+				GetAirOffset();
+			}
+			m_blendParams.offset = m_offset;
+			if (!m_offset.empty())
+			{
+				m_spYuvStitchStage->setRemap(CreateStitchRemap(uWidth, uHeight));
+			}
+			// the blender only takes BGRA, without it the frame stays planar end to end
+			m_stitchMode = m_spStitchStage->hasDevice() ? STITCH_MODE_BGRA : STITCH_MODE_YUV;
 
 			m_frameWidth = uWidth;
 			m_frameHeight = uHeight;
+
+			// the stages follow the stitch mode, so the threads start after it is chosen
+			if (MFGetAttributeUINT32(m_spAttributes.Get(), MF_DEVICEMFT_PIPELINED_PROCESSING, FALSE))
+			{
+				CreatePipeline();
+			}
 		}
 	}
 	
-	if (!m_spConvertI420ToRGBA) {
-		BOOL isVideoProcessorSupported = false;
-		if (SUCCEEDED(hr = IsVideoProcessorSupported(&isVideoProcessorSupported)) && isVideoProcessorSupported)
-		{
-			DMFTCHECKHR_GOTO(GetBestVideoProcessor(MFVideoFormat_I420, MFVideoFormat_ARGB32, &m_spConvertI420ToRGBA), done);
-			DMFTCHECKHR_GOTO(GetBestVideoProcessor(MFVideoFormat_ARGB32, MFVideoFormat_NV12, &m_spConvertRGBAToNV12), done);
-		}
-	}
-
     //
     //Add the Input Pin to the output Pin
     //
-    DMFTCHECKHR_GOTO(poPin->AddPin(piPin->streamId()), done);
+    DMFTCHECKHR_GOTO(poPin->AddPin(piPin->streamId(), piPin->Conversions()), done);
     hr = ExceptionBoundary([&](){
         //
         //Add the output pin to the input pin. 
@@ -2255,6 +2787,7 @@ STDMETHODIMP CMultipinMft::BridgeInputPinOutputPin(
     //
     m_inputPinMap.insert  ( std::pair< int,int >( piPin->streamId(), poPin->streamId())  );
     m_outputPinMap.insert ( std::pair< int, int >( poPin->streamId(), piPin->streamId()) );
+    DMFTCHECKHR_GOTO( RebuildPinRoutes(), done );
 done:
     //
     //Failed adding media types
@@ -2629,6 +3162,86 @@ done:
 }
 
 
+/*++
+Description:
+    PROPSETID_DMFT_QUEUE. Gets or sets the queue policy of an output pin and
+    gets its drop statistics. The KSP_PIN header names the output stream.
+--*/
+STDMETHODIMP CMultipinMft::QueueControlHandler(
+    _In_       PKSPROPERTY Property,
+    _In_       ULONG       ulPropertyLength,
+    _In_       LPVOID      pData,
+    _In_       ULONG       ulOutputBufferLength,
+    _Inout_    PULONG      pulBytesReturned
+    )
+{
+    HRESULT hr = S_OK;
+    COutPin *poPin = nullptr;
+    ULONG ulSize = 0;
+
+    *pulBytesReturned = 0;
+    if ( ulPropertyLength < sizeof( KSP_PIN ) )
+    {
+        DMFTCHECKHR_GOTO( E_INVALIDARG, done );
+    }
+    poPin = ( COutPin* )GetOutPin( ( ( PKSP_PIN )Property )->PinId );
+    DMFTCHECKNULL_GOTO( poPin, done, MF_E_INVALIDSTREAMNUMBER );
+
+    switch ( Property->Id )
+    {
+    case KSPROPERTY_DMFT_QUEUE_POLICY:
+        ulSize = sizeof( DMFT_QUEUE_POLICY_S );
+        break;
+    case KSPROPERTY_DMFT_QUEUE_STATISTICS:
+        ulSize = sizeof( DMFT_QUEUE_STATISTICS_S );
+        break;
+    default:
+        DMFTCHECKHR_GOTO( HRESULT_FROM_WIN32( ERROR_NOT_FOUND ), done );
+    }
+    if ( ulOutputBufferLength < ulSize )
+    {
+        *pulBytesReturned = ulSize;
+        DMFTCHECKHR_GOTO( HRESULT_FROM_WIN32( ERROR_MORE_DATA ), done );
+    }
+    DMFTCHECKNULL_GOTO( pData, done, E_INVALIDARG );
+
+    if ( Property->Flags & KSPROPERTY_TYPE_SET )
+    {
+        if ( Property->Id != KSPROPERTY_DMFT_QUEUE_POLICY )
+        {
+            //
+            //The statistics are read only
+            //
+            DMFTCHECKHR_GOTO( E_INVALIDARG, done );
+        }
+        PDMFT_QUEUE_POLICY_S pPolicy = ( PDMFT_QUEUE_POLICY_S )pData;
+        DMFTCHECKHR_GOTO( poPin->SetQueuePolicy( ( DMFT_QUEUE_POLICY )pPolicy->Policy, pPolicy->MaxDepth ), done );
+    }
+    else if ( Property->Flags & KSPROPERTY_TYPE_GET )
+    {
+        if ( Property->Id == KSPROPERTY_DMFT_QUEUE_POLICY )
+        {
+            PDMFT_QUEUE_POLICY_S pPolicy = ( PDMFT_QUEUE_POLICY_S )pData;
+            DMFT_QUEUE_POLICY policy = DMFT_QUEUE_DROP_OLDEST;
+            poPin->GetQueuePolicy( &policy, &pPolicy->MaxDepth );
+            pPolicy->Policy = policy;
+        }
+        else
+        {
+            PDMFT_QUEUE_STATISTICS_S pStatistics = ( PDMFT_QUEUE_STATISTICS_S )pData;
+            poPin->GetQueueStatistics( &pStatistics->Queued, &pStatistics->Dropped, &pStatistics->Depth, &pStatistics->HighWater );
+        }
+        *pulBytesReturned = ulSize;
+    }
+    else
+    {
+        DMFTCHECKHR_GOTO( E_INVALIDARG, done );
+    }
+done:
+    DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr );
+    return hr;
+}
+
 STDMETHODIMP CMultipinMft::WarmStartHandler(
     _In_       PKSPROPERTY Property,
     _In_       ULONG       ulPropertyLength,
@@ -2735,6 +3348,12 @@ STDMETHODIMP CMultipinMft::Shutdown(
     )
 {
     CAutoLock Lock(m_critSec);
+    StopPipeline();
+    if ( m_spanTraceStarted )
+    {
+        (VOID) CSpanTrace::instance().stop();
+        m_spanTraceStarted = FALSE;
+    }
     (VOID) m_eventHandler.Clear();
     return ShutdownEventGenerator();
 }
@@ -2787,14 +3406,21 @@ STDMETHODIMP CMultipinMft::ProcessCapturePhotoConfirmationCallBack(
     HRESULT hr = S_OK;
     ComPtr<IMFMediaType> spMediaType = nullptr;
     LONGLONG timeStamp = 0;
+    IMFSample* pConfirmation = pSample;
+
+    //
+    //The sample may be shared with other pins, the confirmation attributes go on a private one
+    //
+    pConfirmation->AddRef();
+    DMFTCHECKHR_GOTO(MakeSampleWritable(&pConfirmation), done);
 
     DMFTCHECKHR_GOTO(MFCreateMediaType(&spMediaType), done);
     DMFTCHECKHR_GOTO(pMediaType->CopyAllItems(spMediaType.Get()), done);
 
-    DMFTCHECKHR_GOTO(pSample->SetUnknown(MFSourceReader_SampleAttribute_MediaType_priv, spMediaType.Get()), done);
+    DMFTCHECKHR_GOTO(pConfirmation->SetUnknown(MFSourceReader_SampleAttribute_MediaType_priv, spMediaType.Get()), done);
 
-    DMFTCHECKHR_GOTO(pSample->GetSampleTime(&timeStamp), done);
-    DMFTCHECKHR_GOTO(pSample->SetUINT64(MFSampleExtension_DeviceReferenceSystemTime, timeStamp), done);
+    DMFTCHECKHR_GOTO(pConfirmation->GetSampleTime(&timeStamp), done);
+    DMFTCHECKHR_GOTO(pConfirmation->SetUINT64(MFSampleExtension_DeviceReferenceSystemTime, timeStamp), done);
 
     if (m_spPhotoConfirmationCallback)
     {
@@ -2803,10 +3429,11 @@ STDMETHODIMP CMultipinMft::ProcessCapturePhotoConfirmationCallBack(
         //We are directly sending the photo sample over to the consumers of the photoconfirmation interface.
         //
         ComPtr<IMFAsyncResult> spResult;
-        DMFTCHECKHR_GOTO(MFCreateAsyncResult(pSample, m_spPhotoConfirmationCallback.Get(), NULL, &spResult), done);
+        DMFTCHECKHR_GOTO(MFCreateAsyncResult(pConfirmation, m_spPhotoConfirmationCallback.Get(), NULL, &spResult), done);
         DMFTCHECKHR_GOTO(MFInvokeCallback(spResult.Get()), done);
     }
 done:
+    SAFE_RELEASE(pConfirmation);
     DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr);
     return hr;
 }
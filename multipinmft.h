@@ -13,7 +13,13 @@
 #include "basepin.h"
 #include "custompin.h"
 #include "multipinmfthelpers.h"
-#include "BlenderWrapper.h"
+#include "blenderstage.h"
+#include "colorconvert.h"
+#include "yuvstitch.h"
+#include "remapcache.h"
+#include "meshremap.h"
+#include "stagepipeline.h"
+#include "spantrace.h"
 //
 // The Below GUID is needed to transfer photoconfirmation sample successfully in the pipeline
 // It is used to propagate the mediatype of the sample to the pipeline which will consume the sample
@@ -23,6 +29,74 @@
 DEFINE_GUID(MFSourceReader_SampleAttribute_MediaType_priv,
     0x0ea5c1e8, 0x9845, 0x41e0, 0xa2, 0x43, 0x72, 0x32, 0x07, 0xfc, 0x78, 0x1f);
 
+//
+// UINT32 on the transform attributes. When TRUE, ProcessInput hands frames to
+// one thread per stage instead of decoding, converting and stitching them
+// itself. Read when the frame size is set.
+//
+DEFINE_GUID(MF_DEVICEMFT_PIPELINED_PROCESSING,
+    0x1a19b032, 0x48bd, 0x40f3, 0xae, 0xa3, 0x48, 0x8e, 0x94, 0x18, 0x46, 0xe0);
+
+//
+// UINT32 on a sample delivered to more than one output pin, the input sample
+// of a fan-out or a conversion the pins share. Whoever writes to such a sample
+// takes a private one with MakeSampleWritable first.
+//
+DEFINE_GUID(DMFTSampleExtension_Shared,
+    0x5207cb3e, 0x90cb, 0x425a, 0xb9, 0xa5, 0xf6, 0x42, 0x49, 0x5e, 0xc3, 0x01);
+
+//
+// IUnknown on a private sample from MakeSampleWritable: the shared sample whose
+// buffers it carries, held so a pool cannot recycle them underneath it.
+//
+DEFINE_GUID(DMFTSampleExtension_SharedSource,
+    0xa5fd5988, 0xfdc1, 0x4da7, 0x93, 0x3f, 0x78, 0xa7, 0x4e, 0x86, 0x9f, 0x0c);
+
+//
+// Output pin queue control. Sent to the transform's IKsControl with a KSP_PIN
+// header whose PinId is the output stream id.
+//
+DEFINE_GUID(PROPSETID_DMFT_QUEUE,
+    0x3f956821, 0xd5be, 0x4734, 0x86, 0x88, 0xf7, 0x16, 0x54, 0x27, 0x4d, 0xa7);
+
+typedef enum {
+    KSPROPERTY_DMFT_QUEUE_POLICY     = 0,  // DMFT_QUEUE_POLICY_S, get and set
+    KSPROPERTY_DMFT_QUEUE_STATISTICS = 1   // DMFT_QUEUE_STATISTICS_S, get only
+} KSPROPERTY_DMFT_QUEUE;
+
+typedef struct _DMFT_QUEUE_POLICY_S {
+    ULONG       Policy;         // DMFT_QUEUE_POLICY
+    ULONG       MaxDepth;       // 1 to SAMPLE_QUEUE_CAPACITY samples
+} DMFT_QUEUE_POLICY_S, *PDMFT_QUEUE_POLICY_S;
+
+typedef struct _DMFT_QUEUE_STATISTICS_S {
+    ULONGLONG   Queued;         // Samples that reached the queues of the pin
+    ULONGLONG   Dropped;        // Samples the policy threw away
+    ULONG       Depth;          // Samples waiting now
+    ULONG       HighWater;      // Most samples ever waiting
+} DMFT_QUEUE_STATISTICS_S, *PDMFT_QUEUE_STATISTICS_S;
+
+//
+// A frame on its way through the pipelined ProcessInput. Every stage replaces
+// spSample with its output; the last one hands it to the input pin.
+//
+typedef struct _PipelineFrame {
+    ComPtr<IMFSample>   spSample;
+    ComPtr<IMFSample>   spSource;       // The compressed input, carries the timestamps
+    CInPin*             pInPin;
+    DWORD               dwStreamId;
+}PipelineFrame, *PipelineFramePtr;
+
+//
+// The pins indexed by stream id, so GetInPin and GetOutPin do not scan the
+// pin arrays on every ProcessInput and ProcessOutput. Rebuilt by
+// RebuildPinRoutes, read without a lock.
+//
+typedef struct _PinRouteTable {
+    CBasePinArray       inPins;
+    CBasePinArray       outPins;
+}PinRouteTable, *PinRouteTablePtr;
+
 
 interface IDirect3DDeviceManager9;
 
@@ -334,6 +408,9 @@ protected:
         _In_ DWORD dwStreamID
         );
 
+    STDMETHODIMP RebuildPinRoutes(
+        );
+
     STDMETHODIMP ChangeMediaTypeEx(
         _In_ ULONG pinId,
         _In_opt_ IMFMediaType *pMediaType,
@@ -399,6 +476,13 @@ protected:
         _In_    ULONG       ulOutputBufferLength,
         _Inout_   PULONG      pulBytesReturned
         );
+    STDMETHODIMP QueueControlHandler(
+        _In_    PKSPROPERTY Property,
+        _In_    ULONG       ulPropertyLength,
+        _In_    LPVOID      pData,
+        _In_    ULONG       ulOutputBufferLength,
+        _Inout_   PULONG      pulBytesReturned
+        );
 #if defined (MF_DEVICEMFT_ALLOW_MFT0_LOAD) && defined (MFT_UNIQUE_METHOD_NAMES)
     STDMETHODIMP CMultipinMft::GetAttributes(
         _COM_Outptr_opt_result_maybenull_ IMFAttributes** ppAttributes
@@ -435,6 +519,45 @@ protected:
 		IMFTransform **ppProcessor // Receives the video processor
 	);
 	STDMETHODIMP GetAirOffset();
+	STDMETHODIMP DecodeFrame(
+		_In_ DWORD dwInputStreamID,
+		_In_ IMFSample* pSample,               // Compressed frame from the device
+		_Outptr_ IMFSample** ppDecodedSample   // Receives the decoded I420 frame
+	);
+	STDMETHODIMP ConvertToBgraFrame(
+		_In_ IMFSample* pDecodedSample,        // Decoded I420 frame
+		_Outptr_ IMFSample** ppBgraSample      // Receives the BGRA frame
+	);
+	STDMETHODIMP BlendBgraFrame(
+		_In_ IMFSample* pBgraSample,           // BGRA frame
+		_Outptr_ IMFSample** ppStitchedSample  // Receives the stitched BGRA frame
+	);
+	STDMETHODIMP ConvertToNv12Frame(
+		_In_ IMFSample* pStitchedSample,       // Stitched BGRA frame
+		_Outptr_ IMFSample** ppResultSample    // Receives the NV12 frame
+	);
+	STDMETHODIMP StitchBgraFrame(
+		_In_ IMFSample* pDecodedSample,        // Decoded I420 frame
+		_Outptr_ IMFSample** ppResultSample    // Receives the stitched NV12 frame
+	);
+	STDMETHODIMP StitchYuvFrame(
+		_In_ IMFSample* pDecodedSample,        // Decoded I420 frame
+		_Outptr_ IMFSample** ppResultSample    // Receives the stitched NV12 frame
+	);
+	std::shared_ptr<CPlaneRemap> CreateStitchRemap(
+		_In_ UINT32 uWidth,
+		_In_ UINT32 uHeight
+	);
+	STDMETHODIMP DeliverFrame(
+		_In_ CInPin* pInPin,
+		_In_ IMFSample* pSource,               // Compressed frame the result was made from
+		_In_ IMFSample* pResultSample          // Stitched NV12 frame
+	);
+	STDMETHODIMP_(VOID) CreatePipeline();
+	STDMETHODIMP_(VOID) StopPipeline();
+	STDMETHODIMP_(VOID) SetColorimetry(
+		_In_opt_ IMFMediaType* pInputMediaType  // Type negotiated on the input pin
+	);
 
     //
     //Inline functions
@@ -481,13 +604,21 @@ private:
     ComPtr<IKsControl>           m_spIkscontrol;
     ComPtr<IMFAttributes>        m_spAttributes;
 	ComPtr<IMFTransform>         m_spVideoDecoder;            // The video decoder transform
-	ComPtr<IMFTransform>         m_spConvertRGBAToNV12;      // The color conversion transform
-	ComPtr<IMFTransform>         m_spConvertI420ToRGBA;      // The color conversion transform
-	std::unique_ptr<CBlenderWrapper>             m_spStitcher;
+	COLOR_MATRIX                 m_colorMatrix;              // Colorimetry of the decoded I420 frames and the NV12 output
+	COLOR_RANGE                  m_colorRange;
+	std::unique_ptr<CBlenderStage> m_spStitchStage;          // Stitching, passes the frame through until the blender is up
+	std::unique_ptr<CYuvStitchStage> m_spYuvStitchStage;     // Planar stitching, used while the blender has no device
+	std::shared_ptr<CWorkerPool> m_spStitchWorkers;          // Row band threads of the planar stitcher
+	ComPtr<CSamplePool>          m_spSamplePool;             // Recycles the decode, intermediate and output samples
+	std::shared_ptr<CStagePipeline<PipelineFrame>> m_spPipeline; // Stage threads of the pipelined ProcessInput, null when serial
+	BOOL                         m_spanTraceStarted;         // This transform counts in the process wide span recording
+	STITCH_MODE                  m_stitchMode;
+	CBlenderWrapper::BLENDER_TYPE m_blenderType;            // Layout of the panorama, also picks the planar remap
 	UINT32                       m_frameWidth;
 	UINT32                       m_frameHeight;
 	BlenderParams                m_blendParams;
 
+    CTopologySnapshot<PinRouteTable> m_pinRoutes;         // Stream id to pin, published when pins are created or connected
     multimap<int, int>          m_inputPinMap;            // How input pins are connected to output pins o-><0..inpins>
     multimap<int, int>          m_outputPinMap;           // How output pins are connected to input pins i-><0..outpins>
     CDMFTEventHandler           m_eventHandler;
@@ -13,14 +13,21 @@ class CMediaTypePrinter;
 //Queue implementation
 //
 
-CPinQueue::CPinQueue( _In_ DWORD _InpinId )
+CPinQueue::CPinQueue( _In_ DWORD _InpinId, _In_opt_ CConversionCache *pConversions )
 :   m_teer(0),
     m_discotinuity(0),
     m_sampleCount(0),
-    m_dwInPinId(_InpinId)
+    m_dwInPinId(_InpinId),
+    m_policy(DMFT_QUEUE_DROP_NEWEST),
+    m_maxDepth(SAMPLE_QUEUE_CAPACITY),
+    m_highWater(0),
+    m_queued(0),
+    m_dropped(0),
+    m_pConversions(pConversions)
     /*
     Description
     _InpinId is the input pin Id to which this queue corresponds
+    pConversions is the input pin's conversion cache, the tee shares results through it
     */
 {
 }
@@ -30,23 +37,57 @@ CPinQueue::~CPinQueue( )
 
 /*++
 Description:
-    Insert sample into the list once we reach the open queue
+    Insert sample into the list once we reach the open queue. The queue owns
+    the reference the sample arrives with; at the maximum depth the policy
+    decides which sample gives its references up. A blocking queue only gets
+    here full once the producer has waited out the timeout.
+    Called by the single producer of the queue, under the pin lock. Neither
+    the push nor dropping the oldest locks; the producer pops the oldest the
+    same way ProcessOutput does, so it never waits behind a pull.
 --*/
 STDMETHODIMP_(VOID) CPinQueue::InsertInternal( _In_ IMFSample *pSample )
 {
-    pSample->AddRef();
-    HRESULT hr = ExceptionBoundary([&]()
+    if ( Full() && ( m_policy == DMFT_QUEUE_DROP_OLDEST ) )
     {
-        m_sampleList.push_back(pSample);
-    });
+        IMFSample *pOldest = nullptr;
+        while ( Full() && Remove( &pOldest ) )
+        {
+            DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! queue full, sample %p dropped", pOldest);
+            SAFE_RELEASE( pOldest );
+            InterlockedIncrement64( &m_dropped );
+        }
+    }
 
-    if (FAILED(hr))
+    pSample->AddRef();
+    //
+    // The depth never exceeds the ring, so push only fails on a full queue
+    //
+    if ( Full() || !m_sampleList.push( pSample ) )
     {
-        DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! exiting %x = %!HRESULT!", hr, hr);
-        SAFE_RELEASE(pSample);
+        DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! queue full, sample %p dropped", pSample);
+        pSample->Release();
+        SAFE_RELEASE( pSample );
+        InterlockedIncrement64( &m_dropped );
+        return;
+    }
+    InterlockedIncrement64( &m_queued );
+    if ( m_sampleList.size() > m_highWater )
+    {
+        m_highWater = (ULONG)m_sampleList.size();
     }
 }
 
+/*++
+Description:
+    Sets the depth and what happens to samples beyond it. A smaller depth
+    takes effect with the next insert.
+--*/
+STDMETHODIMP_(VOID) CPinQueue::SetPolicy( _In_ DMFT_QUEUE_POLICY policy, _In_ ULONG ulMaxDepth )
+{
+    m_policy   = policy;
+    m_maxDepth = ( ulMaxDepth == 0 ) ? 1 : ( ( ulMaxDepth > m_sampleList.capacity() ) ? (ULONG)m_sampleList.capacity() : ulMaxDepth );
+}
+
 STDMETHODIMP_(BOOL) CPinQueue::Insert( _In_ IMFSample *pSample )
 //
 //m_teer is the wraptee.. this could be a null tee which is a passthrough, an xvp tee, which inserts an xvp into the queue
@@ -58,7 +99,8 @@ STDMETHODIMP_(BOOL) CPinQueue::Insert( _In_ IMFSample *pSample )
 
 /*++
 Description:
-    This extracts the first sample from the queue. called from Pin's ProcessOutput 
+    This extracts the first sample from the queue. called from Pin's ProcessOutput,
+    a flush and a drop of the oldest sample, possibly at the same time
 --*/
 
 STDMETHODIMP_(BOOL) CPinQueue::Remove( _Outptr_result_maybenull_ IMFSample **ppSample)
@@ -67,16 +109,11 @@ STDMETHODIMP_(BOOL) CPinQueue::Remove( _Outptr_result_maybenull_ IMFSample **ppS
     DMFTCHECKNULL_GOTO( ppSample, done,E_INVALIDARG );
     *ppSample = nullptr;
 
-    if ( !m_sampleList.empty() )
-    {
-        *ppSample = m_sampleList.front();
-    }
+    m_sampleList.pop( ppSample );
 
     DMFTCHECKNULL_GOTO( *ppSample, done, MF_E_TRANSFORM_NEED_MORE_INPUT );
     
     (*ppSample)->Release( );
-    
-    m_sampleList.erase( m_sampleList.begin() );
 done:
     return SUCCEEDED( hr ) ? TRUE : FALSE;
 }
@@ -88,9 +125,8 @@ Description:
 VOID CPinQueue::Clear( )
 {
     IMFSample* pSample = nullptr;
-    while ( !Empty() )
+    while ( Remove( &pSample ) )
     {
-        Remove( &pSample );
         SAFE_RELEASE( pSample );
     }
 }
@@ -110,6 +146,7 @@ STDMETHODIMP CPinQueue::RecreateTee( _In_  IMFMediaType *inMediatype,
 {
     HRESULT hr = S_OK;
     MF_TRANSFORM_XVP_OPERATION operation = DeviceMftTransformXVPIllegal;
+    FRAME_FORMAT scaleFormat = FRAME_FORMAT_UNKNOWN;
     
     DMFTCHECKNULL_GOTO(inMediatype, done, E_INVALIDARG);
     DMFTCHECKNULL_GOTO(outMediatype, done, E_INVALIDARG);
@@ -121,17 +158,49 @@ STDMETHODIMP CPinQueue::RecreateTee( _In_  IMFMediaType *inMediatype,
 
     DMFTCHECKHR_GOTO( CompareMediaTypesForXVP(inMediatype, outMediatype, &operation), done);
 
-    if ( (operation != DeviceMftTransformXVPCurrent) && (operation!= DeviceMftTransformXVPIllegal) )
+    if ( ( operation == DeviceMftTransformXVPDisruptiveOut ) && ( punkManager == nullptr ) )
     {
-        CXvptee* pXvptee = new (std::nothrow) CXvptee(nulltee);
-        DMFTCHECKNULL_GOTO(pXvptee, done, E_OUTOFMEMORY);
-        (void)pXvptee->SetD3DManager( punkManager );
-        (void)pXvptee->SetMediaTypes( inMediatype, outMediatype );
-        m_teer = dynamic_cast< Ctee* >( pXvptee );
+        scaleFormat = CScaletee::ScaleOnlyFormat( inMediatype, outMediatype );
     }
-    else
+
+    if ( scaleFormat != FRAME_FORMAT_UNKNOWN )
     {
-        m_teer = nulltee; /*A simple passthrough*/
+        //
+        //Only the frame size changes, no video processor needed
+        //
+        CScaletee* pScaletee = new (std::nothrow) CScaletee( nulltee, scaleFormat );
+        DMFTCHECKNULL_GOTO(pScaletee, done, E_OUTOFMEMORY);
+        if ( SUCCEEDED( pScaletee->SetMediaTypes( inMediatype, outMediatype ) ) )
+        {
+            m_teer = dynamic_cast< Ctee* >( pScaletee );
+        }
+        else
+        {
+            //
+            //The scaler cannot take this ratio, the video processor scales instead.
+            //Deleting the scale tee deletes the null tee it wraps too
+            //
+            DMFTRACE( DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! ratio not scalable without an XVP" );
+            delete pScaletee;
+            scaleFormat = FRAME_FORMAT_UNKNOWN;
+            nulltee = new (std::nothrow) CNullTee();
+            DMFTCHECKNULL_GOTO( nulltee, done, E_OUTOFMEMORY);
+        }
+    }
+    if ( scaleFormat == FRAME_FORMAT_UNKNOWN )
+    {
+        if ( (operation != DeviceMftTransformXVPCurrent) && (operation!= DeviceMftTransformXVPIllegal) )
+        {
+            CXvptee* pXvptee = new (std::nothrow) CXvptee(nulltee);
+            DMFTCHECKNULL_GOTO(pXvptee, done, E_OUTOFMEMORY);
+            (void)pXvptee->SetD3DManager( punkManager );
+            (void)pXvptee->SetMediaTypes( inMediatype, outMediatype );
+            m_teer = dynamic_cast< Ctee* >( pXvptee );
+        }
+        else
+        {
+            m_teer = nulltee; /*A simple passthrough*/
+        }
     }
 
 done:
@@ -205,8 +274,31 @@ STDMETHODIMP CWrapTee::PassThrough(_In_ IMFSample* pInSample, _In_ CPinQueue *pQ
 {
     HRESULT hr = S_OK;
     IMFSample* pOutSample = nullptr;
+    CConversionCache *pConversions = Shareable() ? pQue->Conversions() : nullptr;
 
-    DMFTCHECKHR_GOTO(Do(pInSample, &pOutSample),done);
+    if (pConversions && pConversions->Lookup(pInSample, m_pInputMediaType.Get(), m_pOutputMediaType.Get(), &pOutSample))
+    {
+        //
+        //Another output pin converted this sample to the same type, take its
+        //result and give the input up as Do would have
+        //
+        pInSample->Release();
+    }
+    else
+    {
+        DMFTCHECKHR_GOTO(Do(pInSample, &pOutSample),done);
+        if (pOutSample)
+        {
+            //
+            //The tees copy the input's attributes, the input of a fan-out is marked shared
+            //
+            (VOID)pOutSample->DeleteItem(DMFTSampleExtension_Shared);
+            if (pConversions)
+            {
+                pConversions->Add(pInSample, m_pInputMediaType.Get(), m_pOutputMediaType.Get(), pOutSample);
+            }
+        }
+    }
     
     if (m_objectWrapped)
     {
@@ -234,24 +326,18 @@ Output Pin.
 
 If the DX manager is set on the Transform and we receieve a DX sample then we will
 undertake the DX transform in the XVP else we will skip it and go the software way
+
+The XVP stays in one streaming session for the life of the media types, see
+StartStreaming, and the software output samples come from the tee's sample pool.
 --*/
 STDMETHODIMP CXvptee::Do(_In_ IMFSample *pSample, _Outptr_ IMFSample** pOutSample)
 {
-    //
-    //Since we are streaming in the software mode we will create a new sample
-    //
     HRESULT                hr = S_OK,pohr = S_OK;
-    MFT_OUTPUT_DATA_BUFFER outputSample;
-    MFT_OUTPUT_STREAM_INFO StreamInfo;
+    MFT_OUTPUT_DATA_BUFFER outputSample = {};
     IMFSample*             spXVPOutputSample    = nullptr;
-    IMFMediaType*          pOutMediaType        = nullptr;
-    ComPtr <IMFMediaBuffer> spIMFMediaBuffer    = nullptr;
-    GUID  guidOutputSubType = GUID_NULL;
-    pOutMediaType = getOutMediaType();
+    DWORD                  dwStatus = 0;
 
     DMFTCHECKNULL_GOTO(pOutSample, done, E_INVALIDARG);
-
-    DMFTCHECKHR_GOTO(pOutMediaType->GetGUID(MF_MT_SUBTYPE, &guidOutputSubType), done);
     
     BOOL isDx = false;
 
@@ -259,77 +345,45 @@ STDMETHODIMP CXvptee::Do(_In_ IMFSample *pSample, _Outptr_ IMFSample** pOutSampl
     {
         DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! DX Sample sent to XVP %p", pSample);
     }
-    
-    outputSample.dwStreamID = 0;
-    outputSample.pSample = NULL;
+
+    DMFTCHECKHR_GOTO(StartStreaming(), done);
 
     if (!(isDx && m_spDeviceManagerUnk!=nullptr))
     {
-        //
-        //Create a new sample for software encoding
-        //
-        DMFTCHECKHR_GOTO(MFCreateSample(&spXVPOutputSample), done);
+        if (m_isOutPutImage)
+        {
+            DMFTCHECKHR_GOTO(MFCreateSample(&spXVPOutputSample), done);
+        }
+        else
+        {
+            //
+            //Goes back to the pool when the client releases it
+            //
+            DMFTCHECKHR_GOTO(m_spSamplePool->GetSample(m_cbOutputSize, &spXVPOutputSample), done);
+        }
 
         DMFTCHECKHR_GOTO(pSample->CopyAllItems(spXVPOutputSample), done);
 
         outputSample.pSample = spXVPOutputSample;
-        
-
-        DMFTCHECKHR_GOTO(Transform()->MFTGetOutputStreamInfo(0, &StreamInfo), done);
-
-        if (!m_isOutPutImage)
-        {
-            DMFTCHECKHR_GOTO(MFGetAttributeSize(pOutMediaType, MF_MT_FRAME_SIZE, &m_uWidth, &m_uHeight), done);
-            hr = MFCreate2DMediaBuffer(
-                m_uWidth,
-                m_uHeight,
-                guidOutputSubType.Data1,
-                FALSE, // top-down buffer (DX compatible)
-                &spIMFMediaBuffer);
-            if (FAILED(hr))
-            {
-                spIMFMediaBuffer = nullptr;
-                spXVPOutputSample->Release();
-
-                DMFTCHECKHR_GOTO(MFCreateAlignedMemoryBuffer(
-                    StreamInfo.cbSize,
-                    StreamInfo.cbAlignment,
-                    &spIMFMediaBuffer), done);
-                DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP Configured without DX, Created a 1D buffer");
-
-            }
-            else
-            {
-                DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP Configured with DX, Created a 2D buffer");
-            }
-            DMFTCHECKHR_GOTO(spXVPOutputSample->AddBuffer(spIMFMediaBuffer.Get()), done);
-        }
     }
-     
-
-    //
-    //Start streaming the xvp transform..
-    //
-    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0), done); // ulParam set to zero
-    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0), done); // ulParam set to zero
-
 
     DMFTCHECKHR_GOTO(Transform()->MFTProcessInput(0, pSample, 0),done);
 
-    DWORD dwStatus = 0;
-
     pohr = Transform()->MFTProcessOutput(0, 1, &outputSample, &dwStatus);
 
+    SAFE_RELEASE(outputSample.pEvents);
+
     if (FAILED(pohr))
     {
         DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! XVP ProcessOutput,failure %x sample =%p", pohr, &outputSample);
         SAFERELEASE(spXVPOutputSample);
+        outputSample.pSample = nullptr;
+        //
+        //Drop the input the XVP may still hold, the session stays up
+        //
+        (VOID)Transform()->MFTProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0);
     }
 
-    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, 0), done); // Flush the stream
-    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0), done); // Notify end of stream
-    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0), done); // Notify end of streaming
-
     spXVPOutputSample = outputSample.pSample;
 
     if ( SUCCEEDED(pohr) )
@@ -345,16 +399,70 @@ STDMETHODIMP CXvptee::Do(_In_ IMFSample *pSample, _Outptr_ IMFSample** pOutSampl
     }
 
     *pOutSample = spXVPOutputSample;
+    spXVPOutputSample = nullptr;
     //
     //Release the Sample back to the pipeline
     //
     pSample->Release();
 
 done:
+    SAFE_RELEASE(spXVPOutputSample);
     hr = FAILED(pohr) ? pohr : hr;
     return hr;
 }
 
+/*++
+Description:
+    Opens the XVP streaming session on the first sample after the media types
+    were set. The output size is read once here instead of on every sample.
+    Nothing is sent again until StopStreaming, so the per sample path only
+    does ProcessInput and ProcessOutput.
+--*/
+STDMETHODIMP CXvptee::StartStreaming()
+{
+    HRESULT                hr = S_OK;
+    MFT_OUTPUT_STREAM_INFO StreamInfo = {};
+
+    if (m_fStreaming)
+    {
+        goto done;
+    }
+
+    DMFTCHECKNULL_GOTO(Transform(), done, MF_E_NOT_INITIALIZED);
+
+    if (!m_isOutPutImage)
+    {
+        DMFTCHECKHR_GOTO(Transform()->MFTGetOutputStreamInfo(0, &StreamInfo), done);
+        m_cbOutputSize = StreamInfo.cbSize;
+        if (m_spSamplePool == nullptr)
+        {
+            DMFTCHECKHR_GOTO(CSamplePool::CreateInstance(m_spSamplePool.ReleaseAndGetAddressOf()), done);
+        }
+    }
+
+    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0), done); // ulParam set to zero
+    DMFTCHECKHR_GOTO(Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0), done); // ulParam set to zero
+    m_fStreaming = TRUE;
+
+done:
+    return hr;
+}
+
+/*++
+Description:
+    Closes the session StartStreaming opened. Called when the XVP is
+    reconfigured and when the tee goes away with the pin's media type.
+--*/
+STDMETHODIMP_(VOID) CXvptee::StopStreaming()
+{
+    if (m_fStreaming && (Transform() != nullptr))
+    {
+        (VOID)Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, 0); // Notify end of stream
+        (VOID)Transform()->MFTProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0); // Notify end of streaming
+    }
+    m_fStreaming = FALSE;
+}
+
 /*++
 Description:
     Set the D3D Manager on the XVP
@@ -388,6 +496,12 @@ STDMETHODIMP CXvptee::Configure(
     
     DMFTCHECKNULL_GOTO(ppTransform, done, E_INVALIDARG);
 
+    //
+    //The new media types start a new session on a new XVP
+    //
+    StopStreaming();
+    m_spSamplePool = nullptr;
+
     m_isOutPutImage = false;
     m_isoptimizedPlanarInputOutput = false;
 
@@ -509,7 +623,9 @@ CWrapTee(tee),
     m_isoptimizedPlanarInputOutput(true),
     m_spDeviceManagerUnk(nullptr),
     m_uHeight(0),
-    m_uWidth(0)
+    m_uWidth(0),
+    m_fStreaming(FALSE),
+    m_cbOutputSize(0)
 
 {
 
@@ -518,9 +634,151 @@ CWrapTee(tee),
 
 CXvptee::~CXvptee()
 {
+    StopStreaming();
     m_spDeviceManagerUnk = nullptr;
 }
 
+/*++
+Description:
+    CScaletee. The wrapped null tee queues the scaled sample, there is no
+    transform behind it.
+--*/
+CScaletee::CScaletee( _In_ Ctee *tee, _In_ FRAME_FORMAT format ) :
+CWrapTee(tee),
+    m_format(format),
+    m_uInWidth(0),
+    m_uInHeight(0),
+    m_uOutWidth(0),
+    m_uOutHeight(0)
+{
+
+}
+
+CScaletee::~CScaletee()
+{
+    m_spSamplePool = nullptr;
+}
+
+/*++
+Description:
+    The frame format of a media type pair CScaletee handles: same subtype,
+    NV12 or I420. The caller has already found that only the frame size
+    shrinks (DeviceMftTransformXVPDisruptiveOut).
+--*/
+FRAME_FORMAT CScaletee::ScaleOnlyFormat( _In_ IMFMediaType *inMediaType, _In_ IMFMediaType *outMediaType )
+{
+    GUID guidIn  = GUID_NULL;
+    GUID guidOut = GUID_NULL;
+
+    if ( FAILED( inMediaType->GetGUID( MF_MT_SUBTYPE, &guidIn ) ) ||
+         FAILED( outMediaType->GetGUID( MF_MT_SUBTYPE, &guidOut ) ) ||
+         !IsEqualGUID( guidIn, guidOut ) )
+    {
+        return FRAME_FORMAT_UNKNOWN;
+    }
+    if ( IsEqualGUID( guidIn, MFVideoFormat_NV12 ) )
+    {
+        return FRAME_FORMAT_NV12;
+    }
+    if ( IsEqualGUID( guidIn, MFVideoFormat_I420 ) || IsEqualGUID( guidIn, MFVideoFormat_IYUV ) )
+    {
+        return FRAME_FORMAT_I420;
+    }
+    return FRAME_FORMAT_UNKNOWN;
+}
+
+/*++
+Description:
+    Reads the two frame sizes and builds the scaler's tables for them,
+    MF_E_INVALIDMEDIATYPE when it cannot take the ratio. No transform is
+    created, ppTransform comes back empty and CWrapTee keeps no video processor.
+--*/
+STDMETHODIMP CScaletee::Configure(
+    _In_opt_ IMFMediaType* inMediaType,
+    _In_opt_ IMFMediaType* outMediaType,
+    _Outptr_ IMFTransform **ppTransform
+    )
+{
+    HRESULT hr = S_OK;
+
+    DMFTCHECKNULL_GOTO(ppTransform, done, E_INVALIDARG);
+    *ppTransform = nullptr;
+    DMFTCHECKNULL_GOTO(inMediaType, done, E_INVALIDARG);
+    DMFTCHECKNULL_GOTO(outMediaType, done, E_INVALIDARG);
+
+    DMFTCHECKHR_GOTO(MFGetAttributeSize(inMediaType, MF_MT_FRAME_SIZE, &m_uInWidth, &m_uInHeight), done);
+    DMFTCHECKHR_GOTO(MFGetAttributeSize(outMediaType, MF_MT_FRAME_SIZE, &m_uOutWidth, &m_uOutHeight), done);
+    //
+    //A ratio the scaler refuses fails here, so the queue takes an XVP rather than failing every frame
+    //
+    if (!m_uInWidth || !m_uInHeight || !m_uOutWidth || !m_uOutHeight ||
+        !m_scaler.prepare(m_uInWidth, m_uInHeight, m_uOutWidth, m_uOutHeight))
+    {
+        DMFTCHECKHR_GOTO(MF_E_INVALIDMEDIATYPE, done);
+    }
+    if (m_spSamplePool == nullptr)
+    {
+        DMFTCHECKHR_GOTO(CSamplePool::CreateInstance(m_spSamplePool.ReleaseAndGetAddressOf()), done);
+    }
+    DMFTRACE(DMFT_GENERAL, TRACE_LEVEL_INFORMATION, "%!FUNC! scaling %dx%d to %dx%d without an XVP",
+        m_uInWidth, m_uInHeight, m_uOutWidth, m_uOutHeight);
+done:
+    return hr;
+}
+
+/*++
+Description:
+    Scales the sample into one from the tee's pool. Like CXvptee::Do the
+    input reference is consumed and the scaled sample carries the attributes
+    and time stamps of the input.
+--*/
+STDMETHODIMP CScaletee::Do(_In_ IMFSample *pSample, _Outptr_ IMFSample** pOutSample)
+{
+    HRESULT          hr = S_OK;
+    IMFSample*       pScaledSample = nullptr;
+    LONGLONG         hnsTime = 0;
+    CSampleFrameLock inputLock;
+    CSampleFrameLock outputLock;
+
+    DMFTCHECKNULL_GOTO(pSample, done, E_INVALIDARG);
+    DMFTCHECKNULL_GOTO(pOutSample, done, E_INVALIDARG);
+    DMFTCHECKNULL_GOTO(m_spSamplePool.Get(), done, MF_E_NOT_INITIALIZED);
+
+    DMFTCHECKHR_GOTO(m_spSamplePool->GetSample((DWORD)frameBufferSize(m_format, m_uOutWidth, m_uOutHeight), &pScaledSample), done);
+    DMFTCHECKHR_GOTO(pSample->CopyAllItems(pScaledSample), done);
+
+    DMFTCHECKHR_GOTO(inputLock.Lock(pSample, m_format, m_uInWidth, m_uInHeight, FALSE), done);
+    DMFTCHECKHR_GOTO(outputLock.Lock(pScaledSample, m_format, m_uOutWidth, m_uOutHeight, TRUE), done);
+    if (!m_scaler.scale(inputLock.Frame(), outputLock.Frame()))
+    {
+        DMFTCHECKHR_GOTO(MF_E_INVALIDMEDIATYPE, done);
+    }
+    outputLock.Unlock();
+    inputLock.Unlock();
+
+    if (SUCCEEDED(pSample->GetSampleTime(&hnsTime)))
+    {
+        (VOID)pScaledSample->SetSampleTime(hnsTime);
+    }
+    if (SUCCEEDED(pSample->GetSampleDuration(&hnsTime)))
+    {
+        (VOID)pScaledSample->SetSampleDuration(hnsTime);
+    }
+
+    *pOutSample = pScaledSample;
+    pScaledSample = nullptr;
+done:
+    SAFE_RELEASE(pScaledSample);
+    if (pSample)
+    {
+        //
+        //Release the Sample back to the pipeline
+        //
+        pSample->Release();
+    }
+    return hr;
+}
+
 //To be implemented..Not needed for the sample!!
 /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 
@@ -986,3 +1244,442 @@ STDMETHODIMP CDMFTEventHandler::Clear()
 done:
     return hr;
 }
+
+//
+//CSampleFrameLock
+//
+CSampleFrameLock::CSampleFrameLock()
+:   m_fLocked(FALSE),
+    m_fWrite(FALSE)
+{
+}
+
+CSampleFrameLock::~CSampleFrameLock()
+{
+    Unlock();
+}
+
+/*++
+Description:
+    Locks the first buffer of the sample. 2D buffers are locked through IMF2DBuffer
+    so the pitch of the surface is honoured, everything else is treated as a
+    contiguous, tightly packed frame. fWrite sets the current length on Unlock
+--*/
+STDMETHODIMP CSampleFrameLock::Lock( _In_ IMFSample *pSample, _In_ FRAME_FORMAT format, _In_ UINT32 uWidth, _In_ UINT32 uHeight, _In_ BOOL fWrite )
+{
+    HRESULT hr          = S_OK;
+    BYTE    *pbData     = nullptr;
+    DWORD   cbMaxLength = 0;
+    LONG    lPitch      = 0;
+    LONGLONG llTime     = 0;
+
+    DMFTCHECKNULL_GOTO( pSample, done, E_INVALIDARG );
+    Unlock();
+
+    DMFTCHECKHR_GOTO( pSample->GetBufferByIndex( 0, &m_spBuffer ), done );
+    if ( SUCCEEDED( m_spBuffer.As( &m_sp2DBuffer ) ) )
+    {
+        if ( FAILED( m_sp2DBuffer->Lock2D( &pbData, &lPitch ) ) )
+        {
+            m_sp2DBuffer = nullptr;
+        }
+        else if ( lPitch <= 0 )
+        {
+            //
+            // Bottom up surfaces are handed to the stages as a contiguous frame
+            //
+            m_sp2DBuffer->Unlock2D();
+            m_sp2DBuffer = nullptr;
+        }
+    }
+    if ( !m_sp2DBuffer )
+    {
+        lPitch = 0;
+        DMFTCHECKHR_GOTO( m_spBuffer->Lock( &pbData, &cbMaxLength, nullptr ), done );
+    }
+    m_fLocked = TRUE;
+    if ( m_sp2DBuffer )
+    {
+        DMFTCHECKHR_GOTO( m_spBuffer->GetMaxLength( &cbMaxLength ), done );
+    }
+
+    if ( !frameAttach( m_frame, format, uWidth, uHeight, pbData, cbMaxLength, (unsigned int)lPitch ) )
+    {
+        DMFTCHECKHR_GOTO( MF_E_BUFFERTOOSMALL, done );
+    }
+    m_fWrite = fWrite;
+
+    if ( SUCCEEDED( pSample->GetSampleTime( &llTime ) ) )
+    {
+        m_frame.sample_time = llTime;
+    }
+    if ( SUCCEEDED( pSample->GetSampleDuration( &llTime ) ) )
+    {
+        m_frame.sample_duration = llTime;
+    }
+done:
+    if ( FAILED( hr ) )
+    {
+        Unlock();
+    }
+    return hr;
+}
+
+STDMETHODIMP_(VOID) CSampleFrameLock::Unlock()
+{
+    if ( m_fLocked )
+    {
+        if ( m_sp2DBuffer )
+        {
+            m_sp2DBuffer->Unlock2D();
+        }
+        else
+        {
+            m_spBuffer->Unlock();
+        }
+        if ( m_fWrite )
+        {
+            (VOID)m_spBuffer->SetCurrentLength( (DWORD)frameBufferSize( m_frame.format, m_frame.width, m_frame.height ) );
+        }
+    }
+    m_sp2DBuffer = nullptr;
+    m_spBuffer   = nullptr;
+    m_fLocked    = FALSE;
+    m_fWrite     = FALSE;
+    m_frame      = FrameDesc();
+}
+
+/*++
+Description:
+    Marks a sample that more than one output pin holds, see MakeSampleWritable
+--*/
+STDMETHODIMP MarkSampleShared( _In_ IMFSample *pSample )
+{
+    HRESULT hr = S_OK;
+    DMFTCHECKNULL_GOTO( pSample, done, E_INVALIDARG );
+    DMFTCHECKHR_GOTO( pSample->SetUINT32( DMFTSampleExtension_Shared, TRUE ), done );
+done:
+    return hr;
+}
+
+/*++
+Description:
+    Leaves *ppSample alone unless it is shared. A shared sample is swapped
+    for a new one with a copy of its attributes, times and flags that adds
+    the same buffers; the caller's reference moves to the new sample, which
+    holds the shared one through DMFTSampleExtension_SharedSource so a pool
+    does not recycle the buffers while they are in use. The pixels are not
+    copied, only the attributes of the new sample may be written.
+--*/
+STDMETHODIMP MakeSampleWritable( _Inout_ IMFSample **ppSample )
+{
+    HRESULT         hr = S_OK;
+    IMFSample*      pPrivate = nullptr;
+    IMFMediaBuffer* pBuffer = nullptr;
+    LONGLONG        hnsTime = 0;
+    DWORD           dwFlags = 0;
+    DWORD           dwBuffers = 0;
+
+    DMFTCHECKNULL_GOTO( ppSample, done, E_INVALIDARG );
+    DMFTCHECKNULL_GOTO( *ppSample, done, E_INVALIDARG );
+
+    if ( !MFGetAttributeUINT32( *ppSample, DMFTSampleExtension_Shared, FALSE ) )
+    {
+        goto done;
+    }
+
+    DMFTCHECKHR_GOTO( MFCreateSample( &pPrivate ), done );
+    DMFTCHECKHR_GOTO( (*ppSample)->CopyAllItems( pPrivate ), done );
+    DMFTCHECKHR_GOTO( pPrivate->DeleteItem( DMFTSampleExtension_Shared ), done );
+    DMFTCHECKHR_GOTO( pPrivate->SetUnknown( DMFTSampleExtension_SharedSource, *ppSample ), done );
+
+    if ( SUCCEEDED( (*ppSample)->GetSampleTime( &hnsTime ) ) )
+    {
+        DMFTCHECKHR_GOTO( pPrivate->SetSampleTime( hnsTime ), done );
+    }
+    if ( SUCCEEDED( (*ppSample)->GetSampleDuration( &hnsTime ) ) )
+    {
+        DMFTCHECKHR_GOTO( pPrivate->SetSampleDuration( hnsTime ), done );
+    }
+    DMFTCHECKHR_GOTO( (*ppSample)->GetSampleFlags( &dwFlags ), done );
+    DMFTCHECKHR_GOTO( pPrivate->SetSampleFlags( dwFlags ), done );
+
+    DMFTCHECKHR_GOTO( (*ppSample)->GetBufferCount( &dwBuffers ), done );
+    for ( DWORD dwIndex = 0; dwIndex < dwBuffers; dwIndex++ )
+    {
+        DMFTCHECKHR_GOTO( (*ppSample)->GetBufferByIndex( dwIndex, &pBuffer ), done );
+        DMFTCHECKHR_GOTO( pPrivate->AddBuffer( pBuffer ), done );
+        SAFE_RELEASE( pBuffer );
+    }
+
+    (*ppSample)->Release();
+    *ppSample = pPrivate;
+    pPrivate = nullptr;
+done:
+    SAFE_RELEASE( pBuffer );
+    SAFE_RELEASE( pPrivate );
+    return hr;
+}
+
+/*++
+Description:
+    Media types a tee converts between are the same conversion when the
+    major type, format type and format data match. User data does not count.
+--*/
+static BOOL IsSameConversionType( _In_opt_ IMFMediaType *pA, _In_opt_ IMFMediaType *pB )
+{
+    DWORD dwResult = 0;
+    HRESULT hr = S_OK;
+
+    if ( pA == pB )
+    {
+        return TRUE;
+    }
+    if ( !pA || !pB )
+    {
+        return FALSE;
+    }
+    hr = pA->IsEqual( pB, &dwResult );
+    return ( hr == S_OK ) ||
+        ( ( hr == S_FALSE ) &&
+          ( dwResult & MF_MEDIATYPE_EQUAL_MAJOR_TYPES ) &&
+          ( dwResult & MF_MEDIATYPE_EQUAL_FORMAT_TYPES ) &&
+          ( dwResult & MF_MEDIATYPE_EQUAL_FORMAT_DATA ) );
+}
+
+/*++
+Description:
+    CConversionCache
+--*/
+CConversionCache::CConversionCache()
+    : m_pInput( nullptr )
+{
+}
+
+CConversionCache::~CConversionCache()
+{
+    Close();
+}
+
+STDMETHODIMP_(VOID) CConversionCache::Open( _In_ IMFSample *pInput )
+{
+    CAutoLock lock( m_lock );
+    m_entries.clear();
+    m_pInput = pInput;
+}
+
+STDMETHODIMP_(VOID) CConversionCache::Close()
+{
+    CAutoLock lock( m_lock );
+    m_entries.clear();
+    m_pInput = nullptr;
+}
+
+/*++
+Description:
+    Hands out a reference to the result of converting pInput from pInType to
+    pOutType if a tee already did. Only the sample the cache is open for is
+    looked up, tees outside a fan-out always convert themselves.
+--*/
+STDMETHODIMP_(BOOL) CConversionCache::Lookup(
+    _In_ IMFSample *pInput,
+    _In_ IMFMediaType *pInType,
+    _In_ IMFMediaType *pOutType,
+    _Outptr_ IMFSample **ppOutput
+    )
+{
+    CAutoLock lock( m_lock );
+    *ppOutput = nullptr;
+
+    if ( ( pInput == nullptr ) || ( pInput != m_pInput ) )
+    {
+        return FALSE;
+    }
+    for ( DWORD dwIndex = 0, dwSize = (DWORD)m_entries.size(); dwIndex < dwSize; dwIndex++ )
+    {
+        if ( IsSameConversionType( m_entries[ dwIndex ].spInType.Get(), pInType ) &&
+             IsSameConversionType( m_entries[ dwIndex ].spOutType.Get(), pOutType ) )
+        {
+            (VOID)m_entries[ dwIndex ].spOutput.CopyTo( ppOutput );
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*++
+Description:
+    Keeps pOutput for the other output pins of the fan-out. It is marked
+    shared before any of them can see it, a pin writing to it gets its own.
+--*/
+STDMETHODIMP_(VOID) CConversionCache::Add(
+    _In_ IMFSample *pInput,
+    _In_ IMFMediaType *pInType,
+    _In_ IMFMediaType *pOutType,
+    _In_ IMFSample *pOutput
+    )
+{
+    CAutoLock lock( m_lock );
+
+    if ( ( pInput == nullptr ) || ( pInput != m_pInput ) || FAILED( MarkSampleShared( pOutput ) ) )
+    {
+        return;
+    }
+    (VOID)ExceptionBoundary([&]()
+    {
+        CachedConversion entry;
+        entry.spInType  = pInType;
+        entry.spOutType = pOutType;
+        entry.spOutput  = pOutput;
+        m_entries.push_back( entry );
+    });
+}
+
+/*++
+Description:
+    CSamplePool. The free lists hold a reference on every idle sample, a
+    sample handed out holds one on the pool through its allocator, so the
+    pool lives until the last outstanding sample has come back.
+--*/
+CSamplePool::CSamplePool()
+    : m_nRefCount( 1 )
+    , m_pool( []( IMFSample *pSample ) { pSample->Release(); } )
+{
+}
+
+CSamplePool::~CSamplePool()
+{
+    m_pool.trim();
+}
+
+STDMETHODIMP CSamplePool::CreateInstance( _Outptr_ CSamplePool **ppPool )
+{
+    HRESULT hr = S_OK;
+    DMFTCHECKNULL_GOTO( ppPool, done, E_POINTER );
+    *ppPool = new (std::nothrow) CSamplePool();
+    DMFTCHECKNULL_GOTO( *ppPool, done, E_OUTOFMEMORY );
+done:
+    return hr;
+}
+
+STDMETHODIMP_(ULONG) CSamplePool::AddRef()
+{
+    return InterlockedIncrement( &m_nRefCount );
+}
+
+STDMETHODIMP_(ULONG) CSamplePool::Release()
+{
+    ULONG uCount = InterlockedDecrement( &m_nRefCount );
+    if ( uCount == 0 )
+    {
+        delete this;
+    }
+    return uCount;
+}
+
+STDMETHODIMP CSamplePool::QueryInterface( _In_ REFIID iid, _COM_Outptr_ void** ppv )
+{
+    HRESULT hr = S_OK;
+    DMFTCHECKNULL_GOTO( ppv, done, E_POINTER );
+    *ppv = nullptr;
+    if ( ( iid == __uuidof( IUnknown ) ) || ( iid == __uuidof( IMFAsyncCallback ) ) )
+    {
+        *ppv = static_cast< IMFAsyncCallback* >( this );
+        AddRef();
+    }
+    else
+    {
+        hr = E_NOINTERFACE;
+    }
+done:
+    return hr;
+}
+
+/*++
+Description:
+    Hands out an idle sample of this buffer size or creates one. The
+    allocator is armed on every hand out, the tracked sample clears it once
+    it has called Invoke.
+--*/
+STDMETHODIMP CSamplePool::GetSample( _In_ DWORD cbData, _Outptr_ IMFSample **ppSample )
+{
+    HRESULT hr = S_OK;
+    IMFSample *pSample = nullptr;
+    ComPtr<IMFTrackedSample> spTracked;
+    ComPtr<IMFMediaBuffer>   spBuffer;
+    BOOL fCounted = FALSE;
+
+    DMFTCHECKNULL_GOTO( ppSample, done, E_POINTER );
+    *ppSample = nullptr;
+
+    if ( m_pool.acquire( cbData, &pSample ) )
+    {
+        fCounted = TRUE;
+        DMFTCHECKHR_GOTO( pSample->QueryInterface( IID_PPV_ARGS( &spTracked ) ), done );
+    }
+    else
+    {
+        DMFTCHECKHR_GOTO( MFCreateTrackedSample( &spTracked ), done );
+        DMFTCHECKHR_GOTO( spTracked.CopyTo( &pSample ), done );
+        DMFTCHECKHR_GOTO( MFCreateAlignedMemoryBuffer( cbData, MF_64_BYTE_ALIGNMENT, &spBuffer ), done );
+        DMFTCHECKHR_GOTO( pSample->AddBuffer( spBuffer.Get() ), done );
+        m_pool.created();
+        fCounted = TRUE;
+    }
+    DMFTCHECKHR_GOTO( spTracked->SetAllocator( this, nullptr ), done );
+
+    *ppSample = pSample;
+    pSample = nullptr;
+done:
+    if ( pSample )
+    {
+        if ( fCounted )
+        {
+            // counted as handed out, give it back so the stats stay balanced
+            m_pool.recycle( cbData, pSample );
+        }
+        else
+        {
+            pSample->Release();
+        }
+    }
+    return hr;
+}
+
+/*++
+Description:
+    Called by a tracked sample whose last reference went. The sample is reset
+    and put back on the free list of its buffer size.
+--*/
+STDMETHODIMP CSamplePool::Invoke( _In_ IMFAsyncResult *pResult )
+{
+    HRESULT hr = S_OK;
+    ComPtr<IUnknown>       spObject;
+    ComPtr<IMFMediaBuffer> spBuffer;
+    IMFSample *pSample = nullptr;
+    DWORD cbMaxLength = 0;
+
+    DMFTCHECKNULL_GOTO( pResult, done, E_POINTER );
+    DMFTCHECKHR_GOTO( pResult->GetObject( &spObject ), done );
+    DMFTCHECKHR_GOTO( spObject.CopyTo( &pSample ), done );
+    DMFTCHECKHR_GOTO( pSample->GetBufferByIndex( 0, &spBuffer ), done );
+    DMFTCHECKHR_GOTO( spBuffer->GetMaxLength( &cbMaxLength ), done );
+    (VOID)spBuffer->SetCurrentLength( 0 );
+    (VOID)pSample->DeleteAllItems();
+    (VOID)pSample->SetSampleFlags( 0 );
+
+    m_pool.recycle( cbMaxLength, pSample );
+    pSample = nullptr;
+done:
+    if ( pSample )
+    {
+        // no buffer to size it by, it cannot go back to a free list
+        pSample->Release();
+    }
+    return hr;
+}
+
+STDMETHODIMP_(VOID) CSamplePool::Trim()
+{
+    m_pool.trim();
+}
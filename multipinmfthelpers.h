@@ -8,6 +8,10 @@
 #pragma once
 #include "stdafx.h"
 #include "common.h"
+#include "framecore.h"
+#include "framescale.h"
+#include "samplepool.h"
+#include "samplequeue.h"
 
 
 
@@ -15,12 +19,14 @@
 //Queue class!!!
 //
 class Ctee;
+class CSamplePool;
+class CConversionCache;
 //typedef CMFAttributesTrace CMediaTypeTrace; /* Only used for debug. take this out*/
 
 
 class CPinQueue{
 public:
-    CPinQueue(_In_ DWORD _inPinId);
+    CPinQueue(_In_ DWORD _inPinId, _In_opt_ CConversionCache *pConversions = nullptr);
     ~CPinQueue();
 
     STDMETHODIMP_(BOOL) SetState        ( _In_  BOOL state ); 
@@ -29,13 +35,44 @@ public:
     STDMETHODIMP_(BOOL) Remove          (_Outptr_result_maybenull_ IMFSample **pSample);
     STDMETHODIMP        RecreateTee     ( _In_  IMFMediaType *inMediatype, _In_ IMFMediaType *outMediatype, _In_opt_ IUnknown* punkManager );
     STDMETHODIMP_(VOID) Clear();
+    STDMETHODIMP_(VOID) SetPolicy       ( _In_ DMFT_QUEUE_POLICY policy, _In_ ULONG ulMaxDepth );
   
     //
     //Inline functions
     //
     __inline BOOL Empty()
     {
-        return (!m_sampleList.size());
+        return m_sampleList.empty();
+    }
+
+    __inline BOOL Full()
+    {
+        return m_sampleList.size() >= m_maxDepth;
+    }
+
+    __inline DMFT_QUEUE_POLICY policy()
+    {
+        return m_policy;
+    }
+
+    __inline ULONG depth()
+    {
+        return (ULONG)m_sampleList.size();
+    }
+
+    __inline ULONG highWater()
+    {
+        return m_highWater;
+    }
+
+    __inline ULONGLONG dropped()
+    {
+        return (ULONGLONG)InterlockedCompareExchange64( &m_dropped, 0, 0 );
+    }
+
+    __inline ULONGLONG queued()
+    {
+        return (ULONGLONG)InterlockedCompareExchange64( &m_queued, 0, 0 );
     }
 
     __inline DWORD pinStreamId()
@@ -43,12 +80,23 @@ public:
         return m_dwInPinId;
     }
 
+    __inline CConversionCache* Conversions()
+    {
+        return m_pConversions;
+    }
+
 private:
     DWORD                m_dwInPinId;           /*This is the input pin       */
-    IMFSampleList        m_sampleList;          /*List storing the samples    */
+    CSampleQueue<IMFSample*> m_sampleList;      /*List storing the samples    */
     ULONG                m_sampleCount;         /*Numebr of sampels           */     
     Ctee*                m_teer;                /*Tee that acts as a passthrough or an XVP  */
     BOOL                 m_discotinuity;        /*Set after the queue is emptied or flushed */
+    DMFT_QUEUE_POLICY    m_policy;              /*What happens to a sample at m_maxDepth     */
+    ULONG                m_maxDepth;            /*At most SAMPLE_QUEUE_CAPACITY              */
+    ULONG                m_highWater;           /*Deepest the queue has been                 */
+    volatile LONGLONG    m_queued;              /*Samples that made it into the queue        */
+    volatile LONGLONG    m_dropped;             /*Samples the policy threw away              */
+    CConversionCache*    m_pConversions;        /*The input pin's, shared by its queues      */
 
 };
 
@@ -144,6 +192,14 @@ public:
     virtual STDMETHODIMP Configure  ( _In_ IMFMediaType *, _In_ IMFMediaType *, _Inout_ IMFTransform** ) = 0;
     virtual STDMETHODIMP Do         ( _In_ IMFSample* pSample, _Out_ IMFSample ** ) = 0;
     STDMETHODIMP SetMediaTypes      ( _In_ IMFMediaType* pInMediaType, _In_ IMFMediaType* pOutMediaType );
+    //
+    //TRUE when Do is a pure function of the sample and the media types, so
+    //queues converting to the same type can share its result
+    //
+    virtual STDMETHODIMP_(BOOL) Shareable()
+    {
+        return FALSE;
+    }
     
     //
     //Inline functions
@@ -181,13 +237,51 @@ public:
     STDMETHODIMP Do             (   _In_ IMFSample* pSample, _Outptr_ IMFSample ** );
     STDMETHODIMP Configure      (   _In_opt_ IMFMediaType *, _In_opt_ IMFMediaType *, _Outptr_ IMFTransform** );
     STDMETHODIMP_(VOID) SetD3DManager( IUnknown* punk );
+    STDMETHODIMP_(BOOL) Shareable()
+    {
+        return TRUE;
+    }
 
 private:
+    STDMETHODIMP StartStreaming();
+    STDMETHODIMP_(VOID) StopStreaming();
+
     BOOL  m_isoptimizedPlanarInputOutput;
     BOOL  m_isOutPutImage;
     UINT32 m_uWidth;
     UINT32 m_uHeight;
     ComPtr<IUnknown> m_spDeviceManagerUnk;
+    BOOL  m_fStreaming;         /*BEGIN_STREAMING sent, END_STREAMING not yet*/
+    DWORD m_cbOutputSize;
+    ComPtr<CSamplePool> m_spSamplePool;
+};
+
+//
+// Scale only path: the output pin's media type is the input pin's at a
+// smaller frame size. NV12 and I420 are scaled in software by CFrameScaler
+// instead of going through a video processor.
+//
+class CScaletee : public CWrapTee{
+public:
+    CScaletee( _In_ Ctee *, _In_ FRAME_FORMAT format );
+    ~CScaletee();
+    STDMETHODIMP Do             (   _In_ IMFSample* pSample, _Outptr_ IMFSample ** );
+    STDMETHODIMP Configure      (   _In_opt_ IMFMediaType *, _In_opt_ IMFMediaType *, _Outptr_ IMFTransform** );
+    STDMETHODIMP_(BOOL) Shareable()
+    {
+        return TRUE;
+    }
+
+    static FRAME_FORMAT ScaleOnlyFormat( _In_ IMFMediaType *inMediaType, _In_ IMFMediaType *outMediaType );
+
+private:
+    FRAME_FORMAT        m_format;
+    UINT32              m_uInWidth;
+    UINT32              m_uInHeight;
+    UINT32              m_uOutWidth;
+    UINT32              m_uOutHeight;
+    CFrameScaler        m_scaler;
+    ComPtr<CSamplePool> m_spSamplePool;
 };
 
 class CDecoderTee : public CWrapTee{
@@ -289,3 +383,109 @@ private:
 
 
 
+
+//
+// Locks the first buffer of a sample and describes it as a FrameDesc so the
+// portable frame stages (framecore.h) can work on it. Unlocks on destruction.
+//
+class CSampleFrameLock{
+public:
+    CSampleFrameLock();
+    ~CSampleFrameLock();
+
+    STDMETHODIMP Lock( _In_ IMFSample *pSample, _In_ FRAME_FORMAT format, _In_ UINT32 uWidth, _In_ UINT32 uHeight, _In_ BOOL fWrite );
+    STDMETHODIMP_(VOID) Unlock();
+
+    __inline FrameDesc& Frame()
+    {
+        return m_frame;
+    }
+
+private:
+    ComPtr<IMFMediaBuffer>  m_spBuffer;
+    ComPtr<IMF2DBuffer>     m_sp2DBuffer;
+    FrameDesc               m_frame;
+    BOOL                    m_fLocked;
+    BOOL                    m_fWrite;
+};
+
+//
+// Samples handed to several output pins are shared, not copied: the queues
+// hold references to one sample. Anything about to write to a sample calls
+// MakeSampleWritable, which swaps a shared sample for a private one carrying
+// a copy of its attributes and the same buffers.
+//
+STDMETHODIMP MarkSampleShared( _In_ IMFSample *pSample );
+STDMETHODIMP MakeSampleWritable( _Inout_ IMFSample **ppSample );
+
+//
+// The conversions of the sample an input pin is fanning out. The first tee
+// converting it to a media type adds its result, tees of the other output
+// pins wanting the same conversion take that sample instead of converting
+// again. CInPin::SendSample opens the cache for its sample and closes it
+// when every output pin has the sample, so entries never outlive a fan-out.
+//
+class CConversionCache{
+public:
+    CConversionCache();
+    ~CConversionCache();
+
+    STDMETHODIMP_(VOID) Open    ( _In_ IMFSample *pInput );
+    STDMETHODIMP_(VOID) Close   ();
+    STDMETHODIMP_(BOOL) Lookup  ( _In_ IMFSample *pInput, _In_ IMFMediaType *pInType, _In_ IMFMediaType *pOutType, _Outptr_ IMFSample **ppOutput );
+    STDMETHODIMP_(VOID) Add     ( _In_ IMFSample *pInput, _In_ IMFMediaType *pInType, _In_ IMFMediaType *pOutType, _In_ IMFSample *pOutput );
+
+private:
+    typedef struct _CachedConversion {
+        ComPtr<IMFMediaType>    spInType;
+        ComPtr<IMFMediaType>    spOutType;
+        ComPtr<IMFSample>       spOutput;
+    } CachedConversion, *CachedConversionPtr;
+
+    CCritSec                    m_lock;
+    IMFSample*                  m_pInput;       /*The sample being fanned out, not referenced*/
+    vector< CachedConversion >  m_entries;      /*One per distinct conversion of m_pInput*/
+};
+
+//
+// Recycles the samples of CMultipinMft::CreateMediaSample. Every sample is a
+// tracked sample holding one 64 byte aligned buffer; when the last reference
+// downstream goes the sample calls Invoke and returns to the free list of its
+// buffer size instead of being freed.
+//
+class CSamplePool : public IMFAsyncCallback{
+public:
+    static STDMETHODIMP CreateInstance( _Outptr_ CSamplePool **ppPool );
+
+    STDMETHODIMP GetSample( _In_ DWORD cbData, _Outptr_ IMFSample **ppSample );
+    STDMETHODIMP_(VOID) Trim();
+    __inline SamplePoolStats GetStats()
+    {
+        return m_pool.stats();
+    }
+
+    //
+    // IUnknown
+    //
+    STDMETHODIMP_(ULONG) AddRef();
+    STDMETHODIMP_(ULONG) Release();
+    STDMETHODIMP QueryInterface( _In_ REFIID iid, _COM_Outptr_ void** ppv );
+
+    //
+    // IMFAsyncCallback
+    //
+    STDMETHODIMP GetParameters( _Out_ DWORD *pdwFlags, _Out_ DWORD *pdwQueue )
+    {
+        UNREFERENCED_PARAMETER( pdwFlags );
+        UNREFERENCED_PARAMETER( pdwQueue );
+        return E_NOTIMPL;
+    }
+    STDMETHODIMP Invoke( _In_ IMFAsyncResult *pResult );
+
+private:
+    CSamplePool();
+    ~CSamplePool();
+
+    ULONG                       m_nRefCount;
+    CRecyclePool<IMFSample*>    m_pool;
+};
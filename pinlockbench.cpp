@@ -0,0 +1,173 @@
+//
+// Contention benchmark of the output pin locking. A producer thread plays
+// ProcessInput: it converts a frame (busy work standing in for the tee's
+// video processor) under the pin lock and queues it. A consumer thread plays
+// COutPin::ProcessOutput pulling at a fixed interval and records how long
+// each pull waits. Two layouts are timed:
+//   shared  - one pin lock around the conversion, the queue and the pull,
+//             as COutPin was locked before
+//   split   - the pin lock stays with the producer and the control plane,
+//             the pull only takes the queue's consumer lock
+//
+// usage: pinlockbench [-n pulls] [-w work_us] [-i interval_us]
+//
+
+#include "samplequeue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock BenchClock;
+
+static void busyWork(unsigned int us)
+{
+	BenchClock::time_point end = BenchClock::now() + std::chrono::microseconds(us);
+	while (BenchClock::now() < end)
+	{
+	}
+}
+
+static double elapsedUs(BenchClock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(BenchClock::now() - start).count();
+}
+
+struct PullWaits {
+	double  p50;
+	double  p99;
+	double  max;
+	size_t  pulled;
+};
+
+static PullWaits summarize(std::vector<double>& waits, size_t pulled)
+{
+	PullWaits result = { 0, 0, 0, pulled };
+	if (!waits.empty())
+	{
+		std::sort(waits.begin(), waits.end());
+		result.p50 = waits[waits.size() / 2];
+		result.p99 = waits[std::min(waits.size() - 1, waits.size() * 99 / 100)];
+		result.max = waits.back();
+	}
+	return result;
+}
+
+//
+// One pin lock for everything
+//
+static PullWaits runShared(unsigned int pulls, unsigned int workUs, unsigned int intervalUs)
+{
+	std::mutex pinLock;
+	std::deque<size_t> queue;
+	std::atomic<bool> stop(false);
+	std::vector<double> waits;
+	size_t pulled = 0;
+
+	std::thread producer([&] {
+		for (size_t frame = 1; !stop; frame++)
+		{
+			std::lock_guard<std::mutex> lock(pinLock);
+			busyWork(workUs);
+			if (queue.size() < SAMPLE_QUEUE_CAPACITY)
+			{
+				queue.push_back(frame);
+			}
+		}
+	});
+	for (unsigned int i = 0; i < pulls; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+		BenchClock::time_point start = BenchClock::now();
+		{
+			std::lock_guard<std::mutex> lock(pinLock);
+			if (!queue.empty())
+			{
+				queue.pop_front();
+				pulled++;
+			}
+		}
+		waits.push_back(elapsedUs(start));
+	}
+	stop = true;
+	producer.join();
+	return summarize(waits, pulled);
+}
+
+//
+// The pin lock for the producer, the ring and its consumer lock for the pull
+//
+static PullWaits runSplit(unsigned int pulls, unsigned int workUs, unsigned int intervalUs)
+{
+	std::mutex pinLock;
+	std::mutex removeLock;
+	CSampleQueue<size_t> queue;
+	std::atomic<bool> stop(false);
+	std::vector<double> waits;
+	size_t pulled = 0;
+
+	std::thread producer([&] {
+		for (size_t frame = 1; !stop; frame++)
+		{
+			std::lock_guard<std::mutex> lock(pinLock);
+			busyWork(workUs);
+			queue.push(frame);
+		}
+	});
+	for (unsigned int i = 0; i < pulls; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(intervalUs));
+		BenchClock::time_point start = BenchClock::now();
+		{
+			std::lock_guard<std::mutex> lock(removeLock);
+			size_t frame = 0;
+			if (queue.pop(&frame))
+			{
+				pulled++;
+			}
+		}
+		waits.push_back(elapsedUs(start));
+	}
+	stop = true;
+	producer.join();
+	return summarize(waits, pulled);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int pulls = 2000;
+	unsigned int workUs = 3000;
+	unsigned int intervalUs = 1000;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			pulls = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-w"))
+		{
+			workUs = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-i"))
+		{
+			intervalUs = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+
+	printf("%u pulls every %u us, %u us of conversion per frame, %u hardware threads\n",
+		pulls, intervalUs, workUs, std::thread::hardware_concurrency());
+	PullWaits shared = runShared(pulls, workUs, intervalUs);
+	PullWaits split = runSplit(pulls, workUs, intervalUs);
+	printf("  %-8s %10s %10s %10s %8s\n", "locking", "p50 us", "p99 us", "max us", "pulled");
+	printf("  %-8s %10.1f %10.1f %10.1f %8zu\n", "shared", shared.p50, shared.p99, shared.max, shared.pulled);
+	printf("  %-8s %10.1f %10.1f %10.1f %8zu\n", "split", split.p50, split.p99, split.max, split.pulled);
+	return 0;
+}
@@ -0,0 +1,242 @@
+//
+// Stress and throughput test of the pin sample queue. A producer thread
+// pushes a numbered sequence into CSampleQueue while a consumer thread pops
+// it, the way ProcessInput and COutPin::ProcessOutput share a pin queue. The
+// consumer checks every value arrives once and in order. The same traffic
+// through a locked deque, what the queue replaced, is timed for comparison.
+// Then the producer drops the oldest value of a full ring itself, as a
+// DMFT_QUEUE_DROP_OLDEST pin does, while two consumers pop; every value must
+// be popped or dropped exactly once, each consumer seeing them in order.
+// Exits with 1 when a value is lost, repeated or out of order.
+//
+// usage: queuestress [-n items] [-c capacity]
+//
+
+#include "samplequeue.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock StressClock;
+
+//
+// The container CPinQueue used before, under the lock the pin held around it
+//
+class CLockedQueue
+{
+public:
+	explicit CLockedQueue(size_t capacity) : m_capacity(capacity) {}
+
+	bool push(size_t value)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_items.size() == m_capacity)
+		{
+			return false;
+		}
+		m_items.push_back(value);
+		return true;
+	}
+
+	bool pop(size_t* value)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_items.empty())
+		{
+			return false;
+		}
+		*value = m_items.front();
+		m_items.pop_front();
+		return true;
+	}
+
+private:
+	size_t              m_capacity;
+	std::mutex          m_lock;
+	std::deque<size_t>  m_items;
+};
+
+//
+// Runs items values through the queue from two threads. Returns the elapsed
+// milliseconds, or a negative value when the consumer saw the sequence broken.
+//
+template <typename Q>
+static double hammer(Q& queue, size_t items, size_t* fullSpins)
+{
+	bool ordered = true;
+	size_t spins = 0;
+	StressClock::time_point start = StressClock::now();
+
+	// values start at 1 so a slot left at zero shows up as a lost push
+	std::thread producer([&] {
+		for (size_t value = 1; value <= items; value++)
+		{
+			while (!queue.push(value))
+			{
+				spins++;
+				std::this_thread::yield();
+			}
+		}
+	});
+	std::thread consumer([&] {
+		size_t expected = 1;
+		while (expected <= items)
+		{
+			size_t value = 0;
+			if (!queue.pop(&value))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if (value != expected)
+			{
+				printf("expected %zu, popped %zu\n", expected, value);
+				ordered = false;
+				return;
+			}
+			expected++;
+		}
+	});
+	producer.join();
+	consumer.join();
+
+	double ms = std::chrono::duration<double, std::milli>(StressClock::now() - start).count();
+	*fullSpins = spins;
+	return ordered ? ms : -1;
+}
+
+//
+// The producer never waits: a full ring loses its oldest value to the
+// producer. Returns the elapsed milliseconds, negative when a value was seen
+// twice, never, or out of order by one consumer.
+//
+static double dropOldest(CSampleQueue<size_t>& queue, size_t items, size_t* dropped)
+{
+	std::vector<std::atomic<unsigned char>> seen(items + 1);
+	for (size_t i = 0; i <= items; i++)
+	{
+		seen[i].store(0, std::memory_order_relaxed);
+	}
+	std::atomic<bool> ordered(true);
+	std::atomic<bool> produced(false);
+	size_t drops = 0;
+	StressClock::time_point start = StressClock::now();
+
+	std::thread producer([&] {
+		for (size_t value = 1; value <= items; value++)
+		{
+			size_t oldest = 0;
+			while (!queue.push(value))
+			{
+				if (queue.pop(&oldest))
+				{
+					seen[oldest]++;
+					drops++;
+				}
+			}
+		}
+		produced = true;
+	});
+	std::vector<std::thread> consumers;
+	for (int c = 0; c < 2; c++)
+	{
+		consumers.push_back(std::thread([&] {
+			size_t last = 0;
+			for (;;)
+			{
+				size_t value = 0;
+				if (!queue.pop(&value))
+				{
+					if (produced.load() && queue.empty())
+					{
+						return;
+					}
+					std::this_thread::yield();
+					continue;
+				}
+				if (value <= last || value > items)
+				{
+					printf("popped %zu after %zu\n", value, last);
+					ordered = false;
+				}
+				seen[value]++;
+				last = value;
+			}
+		}));
+	}
+	producer.join();
+	for (size_t c = 0; c < consumers.size(); c++)
+	{
+		consumers[c].join();
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(StressClock::now() - start).count();
+	for (size_t value = 1; value <= items && ordered; value++)
+	{
+		if (seen[value] != 1)
+		{
+			printf("value %zu taken %u times\n", value, (unsigned int)seen[value]);
+			ordered = false;
+		}
+	}
+	*dropped = drops;
+	return ordered ? ms : -1;
+}
+
+int main(int argc, char** argv)
+{
+	size_t items = 10000000;
+	size_t capacity = SAMPLE_QUEUE_CAPACITY;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			items = (size_t)atoll(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-c"))
+		{
+			capacity = (size_t)atoll(argv[i + 1]);
+		}
+	}
+
+	CSampleQueue<size_t> ring(capacity);
+	size_t ringSpins = 0;
+	double ringMs = hammer(ring, items, &ringSpins);
+	if (ringMs < 0 || !ring.empty())
+	{
+		printf("ring: sequence broken\n");
+		return 1;
+	}
+
+	CLockedQueue locked(ring.capacity());
+	size_t lockedSpins = 0;
+	double lockedMs = hammer(locked, items, &lockedSpins);
+	if (lockedMs < 0)
+	{
+		printf("locked deque: sequence broken\n");
+		return 1;
+	}
+
+	CSampleQueue<size_t> shared(capacity);
+	size_t dropped = 0;
+	double droppingMs = dropOldest(shared, items, &dropped);
+	if (droppingMs < 0)
+	{
+		printf("drop oldest: sequence broken\n");
+		return 1;
+	}
+
+	printf("%zu items, capacity %zu, %u hardware threads\n", items, ring.capacity(), std::thread::hardware_concurrency());
+	printf("  %-14s %9.1f ms %8.1f Mitems/s %10zu full\n", "spsc ring", ringMs, items / ringMs / 1000.0, ringSpins);
+	printf("  %-14s %9.1f ms %8.1f Mitems/s %10zu full\n", "locked deque", lockedMs, items / lockedMs / 1000.0, lockedSpins);
+	printf("  %-14s %9.1f ms %8.1f Mitems/s %10zu dropped\n", "drop oldest", droppingMs, items / droppingMs / 1000.0, dropped);
+	return 0;
+}
@@ -0,0 +1,572 @@
+#include "remapcache.h"
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#define PATH_SEPARATOR "\\"
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#define PATH_SEPARATOR "/"
+#endif
+
+#define REMAP_CACHE_ALIGN       64
+#define REMAP_CACHE_SECTIONS    11
+
+//
+// File layout: header, then the payload the checksum covers: the offset
+// string and, for luma then chroma, the points, row spans, spans, seam points
+// and seam weights, each section starting on a REMAP_CACHE_ALIGN boundary.
+//
+typedef struct _RemapCacheHeader {
+	char                magic[8];
+	unsigned int        version;
+	unsigned int        header_size;
+	unsigned long long  key_hash;
+	unsigned int        key[5];         // input width, height, output width, height, projection
+	unsigned int        offset_length;
+	unsigned int        planes[2][6];   // source width, height, destination width, height, spans, seam pixels
+	unsigned long long  payload_size;
+	unsigned long long  checksum;
+}RemapCacheHeader;
+
+static const char s_magic[8] = { 'D', 'M', 'F', 'T', 'L', 'U', 'T', 0 };
+
+static size_t alignUp(size_t size)
+{
+	return (size + REMAP_CACHE_ALIGN - 1) & ~(size_t)(REMAP_CACHE_ALIGN - 1);
+}
+
+static unsigned long long fnv1a(unsigned long long hash, const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// FNV-1a over 64 bit words, the payload is tens of megabytes
+static unsigned long long payloadChecksum(const unsigned char* data, size_t size)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	size_t words = size / 8;
+	for (size_t i = 0; i < words; i++)
+	{
+		unsigned long long word;
+		memcpy(&word, data + i * 8, 8);
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	}
+	return fnv1a(hash, data + words * 8, size - words * 8);
+}
+
+static void keyFields(const RemapKey& key, unsigned int fields[5])
+{
+	fields[0] = key.input_width;
+	fields[1] = key.input_height;
+	fields[2] = key.output_width;
+	fields[3] = key.output_height;
+	fields[4] = (unsigned int)key.projection;
+}
+
+// Sections of the payload in file order, sizes unpadded
+static void payloadSections(unsigned int offset_length, const unsigned int planes[2][6], size_t sizes[REMAP_CACHE_SECTIONS])
+{
+	sizes[0] = offset_length;
+	for (int i = 0; i < 2; i++)
+	{
+		size_t* plane = sizes + 1 + 5 * i;
+		plane[0] = (size_t)planes[i][2] * planes[i][3] * sizeof(RemapPoint);
+		plane[1] = ((size_t)planes[i][3] + 1) * sizeof(unsigned int);
+		plane[2] = (size_t)planes[i][4] * sizeof(RemapSpan);
+		plane[3] = (size_t)planes[i][5] * sizeof(RemapPoint);
+		plane[4] = (size_t)planes[i][5];
+	}
+}
+
+static unsigned long long processId()
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return (unsigned long long)getpid();
+#endif
+}
+
+// Marks a file as just used, eviction goes by modification time
+static void touchFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		SetFileTime(file, NULL, NULL, &now);
+		CloseHandle(file);
+	}
+#else
+	utime(path.c_str(), nullptr);
+#endif
+}
+
+static bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+//
+// CMappedFile
+//
+CMappedFile::CMappedFile()
+: m_data(nullptr)
+, m_size(0)
+#ifdef _WIN32
+, m_file(INVALID_HANDLE_VALUE)
+, m_mapping(NULL)
+#endif
+{
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifdef _WIN32
+	if (m_data)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+	}
+#else
+	if (m_data)
+	{
+		munmap((void*)m_data, m_size);
+	}
+#endif
+}
+
+std::shared_ptr<CMappedFile> CMappedFile::open(const std::string& path)
+{
+	std::shared_ptr<CMappedFile> mapped(new CMappedFile());
+#ifdef _WIN32
+	// share delete, so the cache can still evict or replace the file while it is mapped
+	mapped->m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped->m_file == INVALID_HANDLE_VALUE)
+	{
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped->m_file, &size) || size.QuadPart == 0 || (unsigned long long)size.QuadPart > (size_t)-1)
+	{
+		return nullptr;
+	}
+	mapped->m_mapping = CreateFileMappingA(mapped->m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapped->m_mapping)
+	{
+		return nullptr;
+	}
+	mapped->m_data = (const unsigned char*)MapViewOfFile(mapped->m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mapped->m_data)
+	{
+		return nullptr;
+	}
+	mapped->m_size = (size_t)size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	mapped->m_data = (const unsigned char*)data;
+	mapped->m_size = (size_t)st.st_size;
+#endif
+	return mapped;
+}
+
+//
+// CRemapCache
+//
+CRemapCache::CRemapCache(const std::string& directory, unsigned long long max_bytes)
+: m_directory(directory)
+, m_maxBytes(max_bytes)
+{
+}
+
+std::string CRemapCache::defaultDirectory()
+{
+#ifdef _WIN32
+	char temp[MAX_PATH + 1];
+	DWORD length = GetTempPathA(MAX_PATH + 1, temp);
+	std::string directory = (length && length <= MAX_PATH) ? std::string(temp, length) : std::string(".\\");
+	return directory + "insta360_dmft";
+#else
+	const char* temp = getenv("TMPDIR");
+	return std::string(temp && *temp ? temp : "/tmp") + "/insta360_dmft";
+#endif
+}
+
+unsigned long long CRemapCache::hashKey(const std::string& offset, const RemapKey& key)
+{
+	unsigned int fields[5];
+	keyFields(key, fields);
+	unsigned int version = REMAP_CACHE_VERSION;
+	unsigned long long hash = fnv1a(0xcbf29ce484222325ULL, &version, sizeof(version));
+	hash = fnv1a(hash, fields, sizeof(fields));
+	return fnv1a(hash, offset.data(), offset.size());
+}
+
+std::string CRemapCache::path(const std::string& offset, const RemapKey& key) const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "remap_%016llx.lut", hashKey(offset, key));
+	return m_directory + PATH_SEPARATOR + name;
+}
+
+bool CRemapCache::load(const std::string& offset, const RemapKey& key, CRemapTable& table)
+{
+	std::string file_path = path(offset, key);
+	std::shared_ptr<CMappedFile> file = CMappedFile::open(file_path);
+	if (!file)
+	{
+		return false;
+	}
+
+	RemapCacheHeader header;
+	size_t payload_begin = alignUp(sizeof(RemapCacheHeader));
+	if (file->size() < payload_begin)
+	{
+		remove(file_path.c_str());
+		return false;
+	}
+	memcpy(&header, file->data(), sizeof(header));
+
+	unsigned int fields[5];
+	keyFields(key, fields);
+	unsigned int expected[2][4] = {
+		{ key.input_width, key.input_height, key.output_width, key.output_height },
+		{ (key.input_width + 1) / 2, (key.input_height + 1) / 2, (key.output_width + 1) / 2, (key.output_height + 1) / 2 },
+	};
+	bool valid = !memcmp(header.magic, s_magic, sizeof(s_magic)) &&
+		header.version == REMAP_CACHE_VERSION &&
+		header.header_size == sizeof(RemapCacheHeader) &&
+		header.key_hash == hashKey(offset, key) &&
+		!memcmp(header.key, fields, sizeof(fields)) &&
+		!memcmp(header.planes[0], expected[0], sizeof(expected[0])) &&
+		!memcmp(header.planes[1], expected[1], sizeof(expected[1])) &&
+		header.offset_length == offset.size() &&
+		header.payload_size == file->size() - payload_begin;
+
+	size_t sections[REMAP_CACHE_SECTIONS];
+	payloadSections(header.offset_length, header.planes, sections);
+	size_t position[REMAP_CACHE_SECTIONS];
+	size_t end = payload_begin;
+	for (int i = 0; valid && i < REMAP_CACHE_SECTIONS; i++)
+	{
+		position[i] = end;
+		end += alignUp(sections[i]);
+	}
+	valid = valid && end == file->size() &&
+		!memcmp(file->data() + position[0], offset.data(), offset.size()) &&
+		payloadChecksum(file->data() + payload_begin, (size_t)header.payload_size) == header.checksum;
+	if (!valid)
+	{
+		// stale or damaged, the caller rebuilds and stores a new one
+		file.reset();
+		remove(file_path.c_str());
+		return false;
+	}
+
+	RemapPlaneTable planes[2];
+	for (int i = 0; i < 2; i++)
+	{
+		const size_t* section = position + 1 + 5 * i;
+		planes[i].src_width = header.planes[i][0];
+		planes[i].src_height = header.planes[i][1];
+		planes[i].dst_width = header.planes[i][2];
+		planes[i].dst_height = header.planes[i][3];
+		planes[i].span_count = header.planes[i][4];
+		planes[i].seam_count = header.planes[i][5];
+		planes[i].points = (const RemapPoint*)(file->data() + section[0]);
+		planes[i].row_spans = (const unsigned int*)(file->data() + section[1]);
+		planes[i].spans = (const RemapSpan*)(file->data() + section[2]);
+		planes[i].seam_points = (const RemapPoint*)(file->data() + section[3]);
+		planes[i].seam_weights = file->data() + section[4];
+		if (!remapPlaneValid(planes[i]))
+		{
+			file.reset();
+			remove(file_path.c_str());
+			return false;
+		}
+	}
+	table.attach(key, planes, file);
+	touchFile(file_path);
+	return true;
+}
+
+bool CRemapCache::store(const std::string& offset, const CRemapTable& table)
+{
+	const RemapKey& key = table.key();
+	RemapCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, s_magic, sizeof(s_magic));
+	header.version = REMAP_CACHE_VERSION;
+	header.header_size = sizeof(RemapCacheHeader);
+	header.key_hash = hashKey(offset, key);
+	keyFields(key, header.key);
+	header.offset_length = (unsigned int)offset.size();
+	for (int i = 0; i < 2; i++)
+	{
+		const RemapPlaneTable& plane = table.plane((STITCH_PLANE)i);
+		if (!plane.points)
+		{
+			return false;
+		}
+		header.planes[i][0] = plane.src_width;
+		header.planes[i][1] = plane.src_height;
+		header.planes[i][2] = plane.dst_width;
+		header.planes[i][3] = plane.dst_height;
+		header.planes[i][4] = plane.span_count;
+		header.planes[i][5] = plane.seam_count;
+	}
+
+	size_t sections[REMAP_CACHE_SECTIONS];
+	payloadSections(header.offset_length, header.planes, sections);
+	const void* sources[REMAP_CACHE_SECTIONS] = { offset.data() };
+	for (int i = 0; i < 2; i++)
+	{
+		const RemapPlaneTable& plane = table.plane((STITCH_PLANE)i);
+		const void** source = sources + 1 + 5 * i;
+		source[0] = plane.points;
+		source[1] = plane.row_spans;
+		source[2] = plane.spans;
+		source[3] = plane.seam_points;
+		source[4] = plane.seam_weights;
+	}
+	size_t payload_size = 0;
+	for (int i = 0; i < REMAP_CACHE_SECTIONS; i++)
+	{
+		payload_size += alignUp(sections[i]);
+	}
+	std::vector<unsigned char> payload(payload_size, 0);
+	size_t position = 0;
+	for (int i = 0; i < REMAP_CACHE_SECTIONS; i++)
+	{
+		if (sections[i])
+		{
+			memcpy(payload.data() + position, sources[i], sections[i]);
+		}
+		position += alignUp(sections[i]);
+	}
+	header.payload_size = payload_size;
+	header.checksum = payloadChecksum(payload.data(), payload_size);
+
+#ifdef _WIN32
+	CreateDirectoryA(m_directory.c_str(), NULL);
+#else
+	mkdir(m_directory.c_str(), 0755);
+#endif
+
+	//
+	// Readers only ever see a complete file, concurrent writers of the same key
+	// each write their own temporary and the last rename wins
+	//
+	static std::atomic<unsigned int> s_sequence(0);
+	std::string file_path = path(offset, key);
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%llu.%u.tmp", processId(), s_sequence++);
+	std::string temp_path = file_path + suffix;
+
+	FILE* file = fopen(temp_path.c_str(), "wb");
+	if (!file)
+	{
+		return false;
+	}
+	unsigned char padding[REMAP_CACHE_ALIGN] = { 0 };
+	size_t header_padding = alignUp(sizeof(header)) - sizeof(header);
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(padding, 1, header_padding, file) == header_padding &&
+		fwrite(payload.data(), 1, payload_size, file) == payload_size &&
+		fflush(file) == 0;
+#ifdef _WIN32
+	ok = ok && _commit(_fileno(file)) == 0;
+#else
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || !replaceFile(temp_path, file_path))
+	{
+		remove(temp_path.c_str());
+		return false;
+	}
+
+	evict(file_path);
+	return true;
+}
+
+// remap_*.lut is a cache file, remap_*.tmp one being written or left by a crashed writer
+static bool cacheFileName(const char* name, const char* suffix)
+{
+	size_t length = strlen(name);
+	return !strncmp(name, "remap_", 6) && length >= 10 && !strcmp(name + length - 4, suffix);
+}
+
+void CRemapCache::evict(const std::string& keep)
+{
+	struct CacheFile {
+		std::string         path;
+		unsigned long long  size;
+		unsigned long long  time;
+	};
+	std::vector<CacheFile> files;
+	std::vector<std::string> stale;     // temporaries past the grace period
+	unsigned long long total = 0;
+
+#ifdef _WIN32
+	FILETIME now_time;
+	GetSystemTimeAsFileTime(&now_time);
+	// FILETIME counts 100 ns intervals
+	const unsigned long long now = ((unsigned long long)now_time.dwHighDateTime << 32) | now_time.dwLowDateTime;
+	const unsigned long long grace = REMAP_CACHE_TEMP_GRACE_S * 10000000ULL;
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((m_directory + "\\remap_*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	do
+	{
+		CacheFile file;
+		file.path = m_directory + "\\" + data.cFileName;
+		file.size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		file.time = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+		if (cacheFileName(data.cFileName, ".tmp"))
+		{
+			if (now > file.time && now - file.time >= grace)
+			{
+				stale.push_back(file.path);
+			}
+			continue;
+		}
+		if (!cacheFileName(data.cFileName, ".lut"))
+		{
+			continue;
+		}
+		total += file.size;
+		files.push_back(file);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	const unsigned long long now = (unsigned long long)time(NULL);
+	const unsigned long long grace = REMAP_CACHE_TEMP_GRACE_S;
+	DIR* dir = opendir(m_directory.c_str());
+	if (!dir)
+	{
+		return;
+	}
+	while (struct dirent* entry = readdir(dir))
+	{
+		bool temp = cacheFileName(entry->d_name, ".tmp");
+		if (!temp && !cacheFileName(entry->d_name, ".lut"))
+		{
+			continue;
+		}
+		CacheFile file;
+		file.path = m_directory + "/" + entry->d_name;
+		struct stat st;
+		if (stat(file.path.c_str(), &st) != 0)
+		{
+			continue;
+		}
+		file.size = (unsigned long long)st.st_size;
+		file.time = (unsigned long long)st.st_mtime;
+		if (temp)
+		{
+			if (now > file.time && now - file.time >= grace)
+			{
+				stale.push_back(file.path);
+			}
+			continue;
+		}
+		total += file.size;
+		files.push_back(file);
+	}
+	closedir(dir);
+#endif
+
+	for (size_t i = 0; i < stale.size(); i++)
+	{
+		remove(stale[i].c_str());
+	}
+
+	std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+	for (size_t i = 0; i < files.size() && total > m_maxBytes; i++)
+	{
+		if (files[i].path != keep && remove(files[i].path.c_str()) == 0)
+		{
+			total -= files[i].size;
+		}
+	}
+}
+
+std::shared_ptr<CRemapTable> CRemapCache::acquire(const std::string& offset, const RemapKey& key, bool* cache_hit)
+{
+	std::shared_ptr<CRemapTable> table = std::make_shared<CRemapTable>();
+	if (cache_hit)
+	{
+		*cache_hit = false;
+	}
+	if (load(offset, key, *table))
+	{
+		if (cache_hit)
+		{
+			*cache_hit = true;
+		}
+		return table;
+	}
+
+	CAirOffset airOffset;
+	if (!airOffset.parse(offset) || !table->build(airOffset, key))
+	{
+		return nullptr;
+	}
+	// a failed store only costs the next open a rebuild
+	store(offset, *table);
+	return table;
+}
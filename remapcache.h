@@ -0,0 +1,70 @@
+#ifndef REMAP_CACHE_H
+#define REMAP_CACHE_H
+
+//
+// On-disk cache of remap tables. A table is stored once per (offset string,
+// sizes, projection) and later camera opens map the file read only instead of
+// evaluating the lens geometry again.
+//
+// Files are written under a temporary name and renamed into place, carry a
+// checksum of their payload and are evicted least recently used first once
+// the directory grows past its size cap. Temporaries a crashed writer left
+// behind are removed by the same scan once REMAP_CACHE_TEMP_GRACE_S old.
+//
+
+#include "remaptable.h"
+#include <memory>
+#include <string>
+
+#define REMAP_CACHE_VERSION     2
+#define REMAP_CACHE_MAX_BYTES   (256ULL * 1024 * 1024)
+#define REMAP_CACHE_TEMP_GRACE_S 600    // a temporary file this old has no writer any more
+
+// Read-only mapping of a whole file
+class CMappedFile
+{
+public:
+	static std::shared_ptr<CMappedFile> open(const std::string& path);
+	~CMappedFile();
+
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	CMappedFile();
+	CMappedFile(const CMappedFile&);
+	CMappedFile& operator=(const CMappedFile&);
+
+	const unsigned char*    m_data;
+	size_t                  m_size;
+#ifdef _WIN32
+	void*                   m_file;
+	void*                   m_mapping;
+#endif
+};
+
+class CRemapCache
+{
+public:
+	CRemapCache(const std::string& directory, unsigned long long max_bytes = REMAP_CACHE_MAX_BYTES);
+
+	// The table for offset and key, mapped from the cache or built and stored
+	std::shared_ptr<CRemapTable> acquire(const std::string& offset, const RemapKey& key, bool* cache_hit = nullptr);
+
+	bool load(const std::string& offset, const RemapKey& key, CRemapTable& table);
+	bool store(const std::string& offset, const CRemapTable& table);
+
+	std::string path(const std::string& offset, const RemapKey& key) const;
+	static unsigned long long hashKey(const std::string& offset, const RemapKey& key);
+
+	// Default location, a directory under the temporary path of the user
+	static std::string defaultDirectory();
+
+private:
+	void evict(const std::string& keep);
+
+	std::string         m_directory;
+	unsigned long long  m_maxBytes;
+};
+
+#endif
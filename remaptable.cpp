@@ -0,0 +1,335 @@
+#include "remaptable.h"
+#include "cpufeatures.h"
+
+#if (defined CPU_X86)
+#include <emmintrin.h>
+#endif
+
+// Pixel position to a clamped table coordinate, so the 2x2 gather stays inside the plane
+static unsigned short tableCoordinate(double position, unsigned int size)
+{
+	double limit = (double)((size - 1) << REMAP_FRACTION_BITS) - 1.0;
+	double value = (position - 0.5) * (1 << REMAP_FRACTION_BITS);
+	value = value < 0 ? 0 : (value > limit ? limit : value);
+	return (unsigned short)(value + 0.5 > limit ? limit : value + 0.5);
+}
+
+static bool buildPlane(const CAirOffset& offset, STITCH_PROJECTION projection, double scale,
+	unsigned int src_width, unsigned int src_height, unsigned int dst_width, unsigned int dst_height,
+	RemapPlaneTable& table, RemapPlaneStorage& storage)
+{
+	if (src_width < 2 || src_height < 2 || src_width > REMAP_MAX_SOURCE_SIZE || src_height > REMAP_MAX_SOURCE_SIZE ||
+		dst_width == 0 || dst_height == 0 || dst_width > REMAP_MAX_OUTPUT_WIDTH || offset.lensCount() == 0)
+	{
+		return false;
+	}
+
+	std::vector<LensModel> lenses(offset.lensCount());
+	for (size_t i = 0; i < lenses.size(); i++)
+	{
+		lensModel(offset.lens(i), scale, offset.fov(), lenses[i]);
+	}
+	double feather = featherWidth(lenses[0]);
+
+	storage.points.assign((size_t)dst_width * dst_height, RemapPoint());
+	storage.row_spans.assign((size_t)dst_height + 1, 0);
+	storage.spans.clear();
+	storage.seam_points.clear();
+	storage.seam_weights.clear();
+
+	for (unsigned int y = 0; y < dst_height; y++)
+	{
+		storage.row_spans[y] = (unsigned int)storage.spans.size();
+		bool in_span = false;
+		for (unsigned int x = 0; x < dst_width; x++)
+		{
+			double dir[3];
+			outputDirection(projection, (x + 0.5) / dst_width, (y + 0.5) / dst_height, dir);
+
+			// the two lenses closest to the direction
+			double best_theta[2] = { 1e9, 1e9 };
+			double best_x[2] = { 0, 0 }, best_y[2] = { 0, 0 };
+			for (size_t i = 0; i < lenses.size(); i++)
+			{
+				double sx, sy;
+				double theta = projectToLens(lenses[i], dir, sx, sy);
+				if (theta < best_theta[0])
+				{
+					best_theta[1] = best_theta[0];
+					best_x[1] = best_x[0];
+					best_y[1] = best_y[0];
+					best_theta[0] = theta;
+					best_x[0] = sx;
+					best_y[0] = sy;
+				}
+				else if (theta < best_theta[1])
+				{
+					best_theta[1] = theta;
+					best_x[1] = sx;
+					best_y[1] = sy;
+				}
+			}
+
+			RemapPoint& point = storage.points[(size_t)y * dst_width + x];
+			point.x = tableCoordinate(best_x[0], src_width);
+			point.y = tableCoordinate(best_y[0], src_height);
+
+			unsigned char weight = 0;
+			if (best_theta[1] <= lenses[0].half_fov)
+			{
+				double share = 0.5 * (1.0 - (best_theta[1] - best_theta[0]) / feather);
+				weight = share > 0 ? (unsigned char)(share * 256.0 + 0.5) : 0;
+			}
+			if (!weight)
+			{
+				in_span = false;
+				continue;
+			}
+
+			// consecutive seam pixels of the row form one span
+			if (!in_span)
+			{
+				RemapSpan span;
+				span.begin = (unsigned short)x;
+				span.end = (unsigned short)x;
+				span.first = (unsigned int)storage.seam_points.size();
+				storage.spans.push_back(span);
+				in_span = true;
+			}
+			storage.spans.back().end = (unsigned short)(x + 1);
+			RemapPoint seam;
+			seam.x = tableCoordinate(best_x[1], src_width);
+			seam.y = tableCoordinate(best_y[1], src_height);
+			storage.seam_points.push_back(seam);
+			storage.seam_weights.push_back(weight);
+		}
+	}
+	storage.row_spans[dst_height] = (unsigned int)storage.spans.size();
+
+	table.src_width = src_width;
+	table.src_height = src_height;
+	table.dst_width = dst_width;
+	table.dst_height = dst_height;
+	table.span_count = (unsigned int)storage.spans.size();
+	table.seam_count = (unsigned int)storage.seam_points.size();
+	table.points = storage.points.data();
+	table.row_spans = storage.row_spans.data();
+	table.spans = storage.spans.data();
+	table.seam_points = storage.seam_points.data();
+	table.seam_weights = storage.seam_weights.data();
+	return true;
+}
+
+bool remapPlaneValid(const RemapPlaneTable& table)
+{
+	if (!table.points || !table.row_spans || (table.span_count && !table.spans) || (table.seam_count && (!table.seam_points || !table.seam_weights)) ||
+		table.row_spans[0] != 0 || table.row_spans[table.dst_height] != table.span_count)
+	{
+		return false;
+	}
+	for (unsigned int y = 0; y < table.dst_height; y++)
+	{
+		if (table.row_spans[y] > table.row_spans[y + 1])
+		{
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < table.span_count; i++)
+	{
+		const RemapSpan& span = table.spans[i];
+		if (span.begin >= span.end || span.end > table.dst_width ||
+			span.first > table.seam_count || (unsigned int)(span.end - span.begin) > table.seam_count - span.first)
+		{
+			return false;
+		}
+	}
+	// positions are clamped when the table is built, recheck what came from disk
+	unsigned int max_x = ((table.src_width - 1) << REMAP_FRACTION_BITS) - 1;
+	unsigned int max_y = ((table.src_height - 1) << REMAP_FRACTION_BITS) - 1;
+	size_t count = (size_t)table.dst_width * table.dst_height;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (table.points[i].x > max_x || table.points[i].y > max_y)
+		{
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < table.seam_count; i++)
+	{
+		if (table.seam_points[i].x > max_x || table.seam_points[i].y > max_y)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Bilinear sample of a 1/16 pixel position, rounded to 8 bit
+static inline unsigned char sampleBilinear(const PlaneView& src, RemapPoint point)
+{
+	const unsigned char* p = src.data + (size_t)(point.y >> REMAP_FRACTION_BITS) * src.stride + (size_t)(point.x >> REMAP_FRACTION_BITS) * src.step;
+	unsigned int fx = point.x & ((1 << REMAP_FRACTION_BITS) - 1);
+	unsigned int fy = point.y & ((1 << REMAP_FRACTION_BITS) - 1);
+	unsigned int top = p[0] * (16 - fx) + p[src.step] * fx;
+	unsigned int bottom = p[src.stride] * (16 - fx) + p[src.stride + src.step] * fx;
+	return (unsigned char)((top * (16 - fy) + bottom * fy + (1 << 7)) >> 8);
+}
+
+// first = (first * (256 - weight) + second * weight + 128) >> 8
+typedef void (*SeamBlendRowFunc)(unsigned char* first, const unsigned char* second, const unsigned char* weights, unsigned int count);
+
+static void seamBlendRow_C(unsigned char* first, const unsigned char* second, const unsigned char* weights, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		first[i] = (unsigned char)((first[i] * (256 - weights[i]) + second[i] * weights[i] + (1 << 7)) >> 8);
+	}
+}
+
+#if (defined CPU_X86)
+// The weighted sum stays below 65536, so unsigned 16 bit lanes hold it
+static void seamBlendRow_SSE2(unsigned char* first, const unsigned char* second, const unsigned char* weights, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(256);
+	const __m128i round = _mm_set1_epi16(1 << 7);
+	unsigned int i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(first + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(second + i));
+		__m128i w = _mm_loadu_si128((const __m128i*)(weights + i));
+
+		__m128i w_lo = _mm_unpacklo_epi8(w, zero);
+		__m128i w_hi = _mm_unpackhi_epi8(w, zero);
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_sub_epi16(full, w_lo)),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w_lo));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_sub_epi16(full, w_hi)),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w_hi));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i*)(first + i), _mm_packus_epi16(lo, hi));
+	}
+	seamBlendRow_C(first + i, second + i, weights + i, count - i);
+}
+#endif
+
+static SeamBlendRowFunc selectSeamBlendRow()
+{
+#if (defined CPU_X86)
+	if (cpuFeatures() & CPU_FEATURE_SSE2)
+	{
+		return seamBlendRow_SSE2;
+	}
+#endif
+	return seamBlendRow_C;
+}
+
+//
+// CRemapTable
+//
+CRemapTable::CRemapTable()
+{
+}
+
+bool CRemapTable::build(const CAirOffset& offset, const RemapKey& key)
+{
+	if (key.input_width < 4 || key.input_height < 4 || key.output_width < 2 || key.output_height < 2)
+	{
+		return false;
+	}
+
+	// lens parameters are given for the calibration frame, scale them to the input
+	double scale = offset.sourceWidth() ? (double)key.input_width / offset.sourceWidth() : 1.0;
+	RemapPlaneTable planes[2];
+	RemapPlaneStorage storage[2];
+	if (!buildPlane(offset, key.projection, scale, key.input_width, key.input_height,
+			key.output_width, key.output_height, planes[STITCH_PLANE_LUMA], storage[STITCH_PLANE_LUMA]) ||
+		!buildPlane(offset, key.projection, scale / 2, (key.input_width + 1) / 2, (key.input_height + 1) / 2,
+			(key.output_width + 1) / 2, (key.output_height + 1) / 2, planes[STITCH_PLANE_CHROMA], storage[STITCH_PLANE_CHROMA]))
+	{
+		return false;
+	}
+
+	m_key = key;
+	m_external.reset();
+	for (int i = 0; i < 2; i++)
+	{
+		// moving a vector keeps its buffer, the plane pointers stay valid
+		m_storage[i] = std::move(storage[i]);
+		m_planes[i] = planes[i];
+	}
+	return true;
+}
+
+void CRemapTable::attach(const RemapKey& key, const RemapPlaneTable planes[2], std::shared_ptr<const void> storage)
+{
+	m_key = key;
+	for (int i = 0; i < 2; i++)
+	{
+		m_storage[i] = RemapPlaneStorage();
+		m_planes[i] = planes[i];
+	}
+	m_external = storage;
+}
+
+size_t CRemapTable::memorySize() const
+{
+	size_t size = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		const RemapPlaneTable& table = m_planes[i];
+		size += (size_t)table.dst_width * table.dst_height * sizeof(RemapPoint) + ((size_t)table.dst_height + 1) * sizeof(unsigned int) +
+			(size_t)table.span_count * sizeof(RemapSpan) + (size_t)table.seam_count * (sizeof(RemapPoint) + 1);
+	}
+	return size;
+}
+
+bool CRemapTable::remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+	unsigned int row_begin, unsigned int row_end)
+{
+	const RemapPlaneTable& table = m_planes[plane];
+	if (!table.points || src.width != table.src_width || src.height != table.src_height ||
+		dst.width != table.dst_width || dst.height != table.dst_height || row_end > dst.height)
+	{
+		return false;
+	}
+
+	SeamBlendRowFunc blend = selectSeamBlendRow();
+	const unsigned int chunk = 256;
+	unsigned char first[chunk], second[chunk];
+
+	for (unsigned int y = row_begin; y < row_end; y++)
+	{
+		const RemapPoint* point = &table.points[(size_t)y * table.dst_width];
+		unsigned char* d = dst.data + (size_t)y * dst.stride;
+
+		// the nearest lens everywhere, a plain gather
+		for (unsigned int x = 0; x < dst.width; x++)
+		{
+			d[(size_t)x * dst.step] = sampleBilinear(src, point[x]);
+		}
+
+		// then the narrow bands around the seams mix in the other lens
+		for (unsigned int s = table.row_spans[y]; s < table.row_spans[y + 1]; s++)
+		{
+			const RemapSpan& span = table.spans[s];
+			for (unsigned int x = span.begin; x < span.end; x += chunk)
+			{
+				unsigned int count = span.end - x < chunk ? span.end - x : chunk;
+				const RemapPoint* seam = &table.seam_points[span.first + (x - span.begin)];
+				for (unsigned int i = 0; i < count; i++)
+				{
+					first[i] = d[(size_t)(x + i) * dst.step];
+					second[i] = sampleBilinear(src, seam[i]);
+				}
+				blend(first, second, &table.seam_weights[span.first + (x - span.begin)], count);
+				for (unsigned int i = 0; i < count; i++)
+				{
+					d[(size_t)(x + i) * dst.step] = first[i];
+				}
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,98 @@
+#ifndef REMAP_TABLE_H
+#define REMAP_TABLE_H
+
+//
+// Per output pixel remap tables for the planar stitch path. The lens geometry
+// of the offset string is evaluated once per (input size, output size,
+// projection); every frame after that is a pure gather.
+//
+
+#include "lensgeometry.h"
+#include "yuvstitch.h"
+#include <memory>
+#include <vector>
+
+#define REMAP_FRACTION_BITS     4       // source coordinates are stored in 1/16 pixel
+#define REMAP_MAX_SOURCE_SIZE   4095    // largest source plane the coordinates can address
+#define REMAP_MAX_OUTPUT_WIDTH  65535   // widest output a span can address
+
+typedef struct _RemapKey {
+	unsigned int        input_width     = 0;
+	unsigned int        input_height    = 0;
+	unsigned int        output_width    = 0;
+	unsigned int        output_height   = 0;
+	STITCH_PROJECTION   projection      = STITCH_PROJECTION_EQUIRECTANGULAR;
+}RemapKey, *RemapKeyPtr;
+
+// Source position of an output pixel, 1/16 pixel
+typedef struct _RemapPoint {
+	unsigned short  x;
+	unsigned short  y;
+}RemapPoint, *RemapPointPtr;
+
+//
+// Output columns [begin, end) of a row that lie in the overlap of two lenses.
+// Their second source and its share are seam_points[first..] and seam_weights[first..].
+//
+typedef struct _RemapSpan {
+	unsigned short  begin;
+	unsigned short  end;
+	unsigned int    first;
+}RemapSpan, *RemapSpanPtr;
+
+//
+// Every pixel gathers from the nearest lens through points; only the seam
+// spans blend in the other lens. The arrays are owned by the table or by its
+// cache file.
+//
+typedef struct _RemapPlaneTable {
+	unsigned int            src_width       = 0;
+	unsigned int            src_height      = 0;
+	unsigned int            dst_width       = 0;
+	unsigned int            dst_height      = 0;
+	unsigned int            span_count      = 0;
+	unsigned int            seam_count      = 0;
+	const RemapPoint*       points          = nullptr;  // dst_width * dst_height
+	const unsigned int*     row_spans       = nullptr;  // dst_height + 1, spans of row y are [row_spans[y], row_spans[y + 1])
+	const RemapSpan*        spans           = nullptr;  // span_count
+	const RemapPoint*       seam_points     = nullptr;  // seam_count
+	const unsigned char*    seam_weights    = nullptr;  // seam_count, 1..128, share of the seam point in 1/256
+}RemapPlaneTable, *RemapPlaneTablePtr;
+
+typedef struct _RemapPlaneStorage {
+	std::vector<RemapPoint>     points;
+	std::vector<unsigned int>   row_spans;
+	std::vector<RemapSpan>      spans;
+	std::vector<RemapPoint>     seam_points;
+	std::vector<unsigned char>  seam_weights;
+}RemapPlaneStorage, *RemapPlaneStoragePtr;
+
+// Checks that every index of the plane stays inside its arrays
+bool remapPlaneValid(const RemapPlaneTable& table);
+
+class CRemapTable : public CPlaneRemap
+{
+public:
+	CRemapTable();
+
+	// Evaluates the lens geometry for the luma and the chroma plane
+	bool build(const CAirOffset& offset, const RemapKey& key);
+	// Uses tables that live elsewhere, storage keeps that memory alive
+	void attach(const RemapKey& key, const RemapPlaneTable planes[2], std::shared_ptr<const void> storage);
+
+	const RemapKey& key() const { return m_key; }
+	const RemapPlaneTable& plane(STITCH_PLANE plane) const { return m_planes[plane]; }
+	size_t memorySize() const;
+
+	const char* name() const { return "lut"; }
+	bool remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+		unsigned int row_begin, unsigned int row_end);
+
+private:
+	RemapKey                    m_key;
+	RemapPlaneTable             m_planes[2];
+	RemapPlaneStorage           m_storage[2];
+	std::shared_ptr<const void> m_external;
+};
+
+#endif
@@ -0,0 +1,271 @@
+//
+// Per line cost of CMyLog with size based rotation. A million lines go through
+// the log as CMyLog wrote them before, checking the file size with stat() after
+// every line, and through CMyLog with its in-memory byte count, written
+// synchronously and by the async writer. Afterwards the rotated files are
+// checked: no more than the retained count, each rotated at the size limit,
+// and the lines in them in order with none missing between files unless the
+// async ring dropped them. Exits with 1 otherwise.
+//
+// usage: rotatebench [-n lines] [-s file_size] [-k retained] [-d dir]
+//
+
+#include "log.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef std::chrono::steady_clock RotateClock;
+
+//
+// CMyLog::Log and ChangeLogFile as they were: the path and a stat() per line,
+// rotated files named by the time of rotation
+//
+class CStatLog
+{
+public:
+	CStatLog(const std::string& path, unsigned int fileSize) : m_path(path), m_fileSize(fileSize)
+	{
+		m_fp = fopen((m_path + "/dmft.log").c_str(), "a+");
+	}
+	~CStatLog()
+	{
+		if (m_fp)
+		{
+			fclose(m_fp);
+		}
+	}
+
+	void Log(unsigned char level, const char* file, int line, const char* fmt, ...)
+	{
+		static char LogLevelString[][10] = { "ERROR", "INFO ", "DEBUG" };
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		time_t timer = time(NULL);
+		struct tm *tmt = localtime(&timer);
+		va_list arg;
+
+		if (m_fp)
+		{
+			fprintf(m_fp, "%04d-%02d-%02d %02d:%02d:%02d %s ",
+				tmt->tm_year + 1900, tmt->tm_mon + 1, tmt->tm_mday,
+				tmt->tm_hour, tmt->tm_min, tmt->tm_sec, LogLevelString[level]);
+			va_start(arg, fmt);
+			vfprintf(m_fp, fmt, arg);
+			va_end(arg);
+			fprintf(m_fp, " %s:%d\n", file, line);
+			fflush(m_fp);
+			ChangeLogFile();
+		}
+	}
+
+private:
+	void ChangeLogFile()
+	{
+		std::string origfile = m_path + "/dmft.log";
+
+		struct stat statbuff;
+		if (stat(origfile.c_str(), &statbuff) < 0 || statbuff.st_size < (int)m_fileSize)
+		{
+			return;
+		}
+
+		fclose(m_fp);
+		char filename[256] = { 0 };
+		time_t timer = time(NULL);
+		struct tm *tmt = localtime(&timer);
+		snprintf(filename, 256 - 1, "/dmft.%04d_%02d_%02d_%02d_%02d_%02d.log",
+			tmt->tm_year + 1900, tmt->tm_mon + 1, tmt->tm_mday, tmt->tm_hour, tmt->tm_min, tmt->tm_sec);
+		rename(origfile.c_str(), (m_path + filename).c_str());
+		m_fp = fopen(origfile.c_str(), "a+");
+	}
+
+	std::string     m_path;
+	unsigned int    m_fileSize;
+	FILE*           m_fp;
+	std::mutex      m_lock;
+};
+
+static void clearDir(const std::string& dir, unsigned int retained)
+{
+	mkdir(dir.c_str(), 0766);
+	remove((dir + "/dmft.log").c_str());
+	for (unsigned int i = 1; i <= retained + 1; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "/dmft.%u.log", i);
+		remove((dir + name).c_str());
+	}
+}
+
+static long long fileSize(const std::string& path)
+{
+	struct stat statbuff;
+	return stat(path.c_str(), &statbuff) < 0 ? -1 : (long long)statbuff.st_size;
+}
+
+//
+// Reads the retained files oldest first: line numbers rise, and without drops
+// follow on from one file to the next and end with the last line logged
+//
+static bool checkFiles(const std::string& dir, const char* mode, unsigned int lines, unsigned int size, unsigned int retained, bool dropped)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/dmft.%u.log", retained + 1);
+	if (fileSize(dir + name) >= 0)
+	{
+		printf("%s: more than %u rotated files kept\n", mode, retained);
+		return false;
+	}
+
+	long long last = -1;
+	bool first = true;
+	for (unsigned int i = retained + 1; i-- > 0;)
+	{
+		std::string path = dir + "/dmft.log";
+		if (i)
+		{
+			snprintf(name, sizeof(name), "/dmft.%u.log", i);
+			path = dir + name;
+		}
+		long long bytes = fileSize(path);
+		if (bytes < 0)
+		{
+			continue;
+		}
+		if (i && (bytes < size || bytes > (long long)size + LOG_WRITE_BATCH + LOG_RING_LINE_SIZE))
+		{
+			printf("%s: %s rotated at %lld bytes, limit %u\n", mode, path.c_str(), bytes, size);
+			return false;
+		}
+
+		FILE* fp = fopen(path.c_str(), "r");
+		char text[LOG_RING_LINE_SIZE * 2];
+		while (fp && fgets(text, sizeof(text), fp))
+		{
+			unsigned int line = 0;
+			const char* body = strstr(text, "line ");
+			if (!body || sscanf(body, "line %u", &line) != 1)
+			{
+				continue;
+			}
+			if ((long long)line <= last || (!dropped && !first && (long long)line != last + 1))
+			{
+				printf("%s: line %u follows line %lld in %s\n", mode, line, last, path.c_str());
+				fclose(fp);
+				return false;
+			}
+			last = line;
+			first = false;
+		}
+		if (fp)
+		{
+			fclose(fp);
+		}
+	}
+	if (!dropped && last != (long long)lines - 1)
+	{
+		printf("%s: last line %lld, expected %u\n", mode, last, lines - 1);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int lines = 1000000;
+	unsigned int size = LOG_FILE_SIZE;
+	unsigned int retained = 3;
+	std::string dir;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			lines = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-s"))
+		{
+			size = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-k"))
+		{
+			retained = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-d"))
+		{
+			dir = argv[i + 1];
+		}
+	}
+	if (!lines)
+	{
+		return 0;
+	}
+	if (dir.empty())
+	{
+		char temp[] = "/tmp/rotatebenchXXXXXX";
+		if (!mkdtemp(temp))
+		{
+			printf("cannot create a log directory\n");
+			return 1;
+		}
+		dir = temp;
+	}
+	mkdir(dir.c_str(), 0766);
+
+	double statNs = 0.0;
+	{
+		std::string statDir = dir + "/stat";
+		mkdir(statDir.c_str(), 0766);
+		CStatLog log(statDir, size);
+		RotateClock::time_point start = RotateClock::now();
+		for (unsigned int i = 0; i < lines; i++)
+		{
+			log.Log(LOG_LEVEL_INFO, __FILE__, __LINE__, "line %u frame stage done", i);
+		}
+		statNs = std::chrono::duration<double, std::nano>(RotateClock::now() - start).count() / lines;
+	}
+
+	double countNs[2] = { 0.0, 0.0 };
+	unsigned long long dropped[2] = { 0, 0 };
+	int result = 0;
+	for (int async = 0; async < 2; async++)
+	{
+		const char* mode = async ? "async" : "count";
+		std::string logDir = dir + "/" + mode;
+		clearDir(logDir, retained);
+
+		CMyLog log(logDir.c_str());
+		log.SetRotation(size, retained);
+		if (async && !log.StartAsync(1 << 16))
+		{
+			printf("cannot start the async writer\n");
+			return 1;
+		}
+		RotateClock::time_point start = RotateClock::now();
+		for (unsigned int i = 0; i < lines; i++)
+		{
+			log.Log(LOG_LEVEL_INFO, __FILE__, __LINE__, "line %u frame stage done", i);
+		}
+		countNs[async] = std::chrono::duration<double, std::nano>(RotateClock::now() - start).count() / lines;
+		log.StopAsync();
+		dropped[async] = log.Dropped();
+
+		if (!checkFiles(logDir, mode, lines, size, retained, dropped[async] != 0))
+		{
+			result = 1;
+		}
+	}
+
+	printf("%u lines, rotated at %u bytes, %u files kept\n", lines, size, retained);
+	printf("  %-6s %10s %8s\n", "rotate", "ns/line", "dropped");
+	printf("  %-6s %10.0f %8d\n", "stat", statNs, 0);
+	printf("  %-6s %10.0f %8llu\n", "count", countNs[0], dropped[0]);
+	printf("  %-6s %10.0f %8llu\n", "async", countNs[1], dropped[1]);
+	return result;
+}
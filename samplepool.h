@@ -0,0 +1,163 @@
+#ifndef SAMPLE_POOL_H
+#define SAMPLE_POOL_H
+
+//
+// Bounded free lists of frame samples, one per buffer size. T is IMFSample*
+// in the transform and CHostSample* in the host harness; the owner creates
+// the samples and destroy() frees the ones the pool does not keep. The pool
+// is called from the producer and from whichever thread releases a sample
+// downstream, so every call locks.
+//
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#define SAMPLE_POOL_MAX_IDLE    8       // idle samples kept per buffer size
+
+typedef struct _SamplePoolStats {
+	unsigned long long  allocations = 0;    // samples created because none was idle
+	unsigned long long  reuses      = 0;    // requests served from a free list
+	unsigned int        outstanding = 0;    // handed out and not back yet
+	unsigned int        high_water  = 0;    // most samples outstanding at once
+	unsigned int        idle        = 0;
+	unsigned long long  idle_bytes  = 0;
+}SamplePoolStats, *SamplePoolStatsPtr;
+
+template <typename T>
+class CRecyclePool
+{
+public:
+	CRecyclePool(std::function<void(T)> destroy, unsigned int max_idle = SAMPLE_POOL_MAX_IDLE)
+	: m_destroy(destroy)
+	, m_maxIdle(max_idle)
+	{
+	}
+
+	~CRecyclePool()
+	{
+		trim();
+	}
+
+	//
+	// Pops an idle sample of this size. Returns false when there is none; the
+	// caller then creates one and reports it through created().
+	//
+	bool acquire(size_t size, T* item)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		Bucket& bucket = find(size);
+		bucket.active = true;
+		if (bucket.items.empty())
+		{
+			return false;
+		}
+		*item = bucket.items.back();
+		bucket.items.pop_back();
+		m_stats.reuses++;
+		m_stats.idle--;
+		m_stats.idle_bytes -= size;
+		handedOut();
+		return true;
+	}
+
+	void created()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stats.allocations++;
+		handedOut();
+	}
+
+	//
+	// Takes a sample back. It is destroyed instead of kept when its free list
+	// is full or its size has not been asked for since the last trim().
+	//
+	void recycle(size_t size, T item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stats.outstanding--;
+			Bucket& bucket = find(size);
+			if (bucket.active && bucket.items.size() < m_maxIdle)
+			{
+				bucket.items.push_back(item);
+				m_stats.idle++;
+				m_stats.idle_bytes += size;
+				return;
+			}
+		}
+		m_destroy(item);
+	}
+
+	//
+	// Frees every idle sample, for a format change. Samples still outstanding
+	// are destroyed when they come back unless their size is used again.
+	//
+	void trim()
+	{
+		std::vector<T> items;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			for (size_t i = 0; i < m_buckets.size(); i++)
+			{
+				items.insert(items.end(), m_buckets[i].items.begin(), m_buckets[i].items.end());
+				m_buckets[i].items.clear();
+				m_buckets[i].active = false;
+			}
+			m_stats.idle = 0;
+			m_stats.idle_bytes = 0;
+		}
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			m_destroy(items[i]);
+		}
+	}
+
+	SamplePoolStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_stats;
+	}
+
+private:
+	CRecyclePool(const CRecyclePool&);
+	CRecyclePool& operator=(const CRecyclePool&);
+
+	struct Bucket {
+		size_t          size;
+		bool            active;
+		std::vector<T>  items;
+	};
+
+	// a handful of formats are alive at once, a linear search is enough
+	Bucket& find(size_t size)
+	{
+		for (size_t i = 0; i < m_buckets.size(); i++)
+		{
+			if (m_buckets[i].size == size)
+			{
+				return m_buckets[i];
+			}
+		}
+		Bucket bucket;
+		bucket.size = size;
+		bucket.active = false;
+		bucket.items.reserve(m_maxIdle);
+		m_buckets.push_back(bucket);
+		return m_buckets.back();
+	}
+
+	void handedOut()
+	{
+		m_stats.outstanding++;
+		m_stats.high_water = m_stats.outstanding > m_stats.high_water ? m_stats.outstanding : m_stats.high_water;
+	}
+
+	std::function<void(T)>  m_destroy;
+	unsigned int            m_maxIdle;
+	mutable std::mutex      m_lock;
+	std::vector<Bucket>     m_buckets;
+	SamplePoolStats         m_stats;
+};
+
+#endif
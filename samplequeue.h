@@ -0,0 +1,116 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+#define SAMPLE_QUEUE_CAPACITY   32      // samples a pin holds before it drops new ones
+#define SAMPLE_QUEUE_CACHE_LINE 64
+
+//
+// Fixed capacity FIFO of samples between the input and the output side of a
+// pin. T is IMFSample* in the transform and CHostSample* in the host harness.
+// One thread pushes (ProcessInput). Any thread pops: ProcessOutput, a flush,
+// and the producer itself dropping the oldest sample of a full queue; a pop
+// claims its slot with a compare-exchange on the head, so none of them locks.
+// The slots are allocated by the constructor, push() and pop() never
+// allocate. The queue does not touch reference counts, the owner does.
+//
+template <typename T>
+class CSampleQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit CSampleQueue(size_t capacity = SAMPLE_QUEUE_CAPACITY)
+	: m_tail(0)
+	, m_headCache(0)
+	, m_head(0)
+	, m_tailCache(0)
+	{
+		size_t slots = 1;
+		while (slots < capacity)
+		{
+			slots <<= 1;
+		}
+		m_slots.reset(new std::atomic<T>[slots]);
+		m_size = slots;
+		m_mask = slots - 1;
+	}
+
+	// Producer side. Returns false, leaving the sample to the caller, when the queue is full
+	bool push(T sample)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCache == m_size)
+		{
+			// only look at the consumer's line when the cached view says full
+			m_headCache = m_head.load(std::memory_order_acquire);
+			if (tail - m_headCache == m_size)
+			{
+				return false;
+			}
+		}
+		m_slots[tail & m_mask].store(sample, std::memory_order_relaxed);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	//
+	// Consumer side, safe from several threads at once. The slot is read
+	// before the head moves past it; the producer only reuses a slot once the
+	// head is past it, so a read that wins the compare-exchange is the sample
+	// that was pushed there.
+	//
+	bool pop(T* sample)
+	{
+		size_t head = m_head.load(std::memory_order_acquire);
+		for (;;)
+		{
+			// another consumer may have moved the head past the cached tail
+			if ((ptrdiff_t)(m_tailCache.load(std::memory_order_acquire) - head) <= 0)
+			{
+				size_t tail = m_tail.load(std::memory_order_acquire);
+				if (tail == head)
+				{
+					return false;
+				}
+				m_tailCache.store(tail, std::memory_order_release);
+			}
+			T value = m_slots[head & m_mask].load(std::memory_order_relaxed);
+			if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				*sample = value;
+				return true;
+			}
+		}
+	}
+
+	bool empty() const { return size() == 0; }
+	size_t size() const
+	{
+		// the head first, so a pop between the loads cannot make it pass the tail read
+		size_t head = m_head.load(std::memory_order_acquire);
+		return m_tail.load(std::memory_order_acquire) - head;
+	}
+	size_t capacity() const { return m_size; }
+
+private:
+	CSampleQueue(const CSampleQueue&);
+	CSampleQueue& operator=(const CSampleQueue&);
+
+	// the indices of the two sides sit on their own cache lines, padded rather
+	// than aligned since the queue lives in heap objects
+	std::unique_ptr<std::atomic<T>[]> m_slots;
+	size_t              m_size;
+	size_t              m_mask;
+	char                m_pad0[SAMPLE_QUEUE_CACHE_LINE];
+	std::atomic<size_t> m_tail;         // written by the producer
+	size_t              m_headCache;    // producer's last view of m_head
+	char                m_pad1[SAMPLE_QUEUE_CACHE_LINE];
+	std::atomic<size_t> m_head;         // moved by the consumers
+	std::atomic<size_t> m_tailCache;    // consumers' last view of m_tail, never past it
+	char                m_pad2[SAMPLE_QUEUE_CACHE_LINE];
+};
+
+#endif
@@ -0,0 +1,182 @@
+//
+// Benchmark of the YUV scaler. Every kernel set the CPU offers is timed
+// against the scalar reference for the preview sizes of the secondary pins,
+// with both filters and both formats, and its output is compared byte for
+// byte with the reference. A flat frame must stay flat after scaling. Exits
+// with 1 when a kernel is not bit exact or the flat frame changes.
+//
+// usage: scalebench [-w width] [-h height] [-n iterations]
+//
+
+#include "framecore.h"
+#include "framescale.h"
+#include "cpufeatures.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct KernelSet {
+	const char*     name;
+	unsigned int    mask;
+};
+
+static const KernelSet s_kernels[] = {
+	{ "c", 0 },
+	{ "sse2", CPU_FEATURE_SSE2 },
+	{ "avx2", CPU_FEATURE_SSE2 | CPU_FEATURE_AVX2 },
+};
+
+static void fillRandom(CFrameBuffer& frame, unsigned int seed)
+{
+	srand(seed);
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		frame.data()[i] = (unsigned char)(rand() >> 4);
+	}
+}
+
+static bool framesEqual(const FrameDesc& a, const FrameDesc& b)
+{
+	for (unsigned int plane = 0; plane < framePlaneCount(a.format); plane++)
+	{
+		unsigned int rows = plane ? (a.height + 1) / 2 : a.height;
+		size_t row_bytes = plane == 0 ? a.width : (a.format == FRAME_FORMAT_NV12 ? ((a.width + 1) / 2) * 2 : (a.width + 1) / 2);
+		for (unsigned int y = 0; y < rows; y++)
+		{
+			if (memcmp(a.planes[plane].data + (size_t)y * a.planes[plane].stride,
+				b.planes[plane].data + (size_t)y * b.planes[plane].stride, row_bytes))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//
+// A frame of one value in every plane scales to the same frame
+//
+static bool flatStaysFlat(FRAME_FORMAT format, SCALE_FILTER filter, unsigned int in_width, unsigned int in_height,
+	unsigned int out_width, unsigned int out_height)
+{
+	CFrameBuffer input, output, flat;
+	if (!input.allocate(format, in_width, in_height) || !output.allocate(format, out_width, out_height) ||
+		!flat.allocate(format, out_width, out_height))
+	{
+		return false;
+	}
+	memset(input.data(), 0xa7, input.size());
+	memset(flat.data(), 0xa7, flat.size());
+	CFrameScaler scaler(filter);
+	return scaler.scale(input.desc(), output.desc()) && framesEqual(flat.desc(), output.desc());
+}
+
+//
+// Runs one scale with every kernel set, returns false on a mismatch
+//
+static bool benchScale(FRAME_FORMAT format, SCALE_FILTER filter, unsigned int in_width, unsigned int in_height,
+	unsigned int out_width, unsigned int out_height, unsigned int iterations)
+{
+	const char* title = format == FRAME_FORMAT_NV12 ? "nv12" : "i420";
+	const char* filter_name = filter == SCALE_FILTER_AREA ? "area" : "bilinear";
+	CFrameBuffer input, reference, output;
+	if (!input.allocate(format, in_width, in_height) || !reference.allocate(format, out_width, out_height) ||
+		!output.allocate(format, out_width, out_height))
+	{
+		printf("%s: out of memory\n", title);
+		return false;
+	}
+	fillRandom(input, in_width * 31 + in_height);
+
+	bool exact = flatStaysFlat(format, filter, in_width, in_height, out_width, out_height);
+	double reference_ms = 0;
+	printf("%s %s %ux%u -> %ux%u%s\n", title, filter_name, in_width, in_height, out_width, out_height,
+		exact ? "" : "  FLAT FRAME CHANGED");
+	for (size_t k = 0; k < sizeof(s_kernels) / sizeof(s_kernels[0]); k++)
+	{
+		if ((cpuFeatures() & s_kernels[k].mask) != s_kernels[k].mask)
+		{
+			continue;
+		}
+		CFrameScaler scaler(filter);
+
+		setCpuFeatureMask(0);
+		bool kernel_exact = scaler.scale(input.desc(), reference.desc());
+		setCpuFeatureMask(s_kernels[k].mask);
+		kernel_exact = kernel_exact && scaler.scale(input.desc(), output.desc()) && framesEqual(reference.desc(), output.desc());
+
+		double best_ms = 1e30, total_ms = 0;
+		for (unsigned int i = 0; i < iterations; i++)
+		{
+			BenchClock::time_point start = BenchClock::now();
+			scaler.scale(input.desc(), output.desc());
+			double ms = std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+			total_ms += ms;
+			best_ms = ms < best_ms ? ms : best_ms;
+		}
+		if (k == 0)
+		{
+			reference_ms = best_ms;
+		}
+		setCpuFeatureMask(~0u);
+
+		printf("  %-5s best %7.3f ms  avg %7.3f ms  x%.2f  %s\n", s_kernels[k].name, best_ms, total_ms / iterations,
+			reference_ms / best_ms, kernel_exact ? "bit exact" : "MISMATCH");
+		exact = exact && kernel_exact;
+	}
+	return exact;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 1920;
+	unsigned int height = 960;
+	unsigned int iterations = 50;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			width = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-h"))
+		{
+			height = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			iterations = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+	if (width == 0 || height == 0 || iterations == 0)
+	{
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	bool exact = true;
+	for (int format = FRAME_FORMAT_I420; format <= FRAME_FORMAT_NV12; format++)
+	{
+		for (int filter = SCALE_FILTER_BILINEAR; filter <= SCALE_FILTER_AREA; filter++)
+		{
+			exact = benchScale((FRAME_FORMAT)format, (SCALE_FILTER)filter, width, height, 1280, 720, iterations) && exact;
+			exact = benchScale((FRAME_FORMAT)format, (SCALE_FILTER)filter, width, height, 854, 480, iterations) && exact;
+			// odd sizes and upscaling exercise the tails and the edge padding
+			exact = benchScale((FRAME_FORMAT)format, (SCALE_FILTER)filter, 37, 19, 13, 7, 1) && exact;
+			exact = benchScale((FRAME_FORMAT)format, (SCALE_FILTER)filter, 13, 7, 37, 19, 1) && exact;
+		}
+	}
+
+	// a ratio past SCALE_MAX_TAPS is refused up front, before any frame
+	CFrameScaler area(SCALE_FILTER_AREA);
+	if (area.prepare(4096, 64, 16, 16) || !area.prepare(width, height, 1280, 720))
+	{
+		printf("area scaler: prepare took 4096x64 to 16x16 or refused %ux%u to 1280x720\n", width, height);
+		exact = false;
+	}
+	return exact ? 0 : 1;
+}
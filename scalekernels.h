@@ -0,0 +1,49 @@
+#ifndef SCALE_KERNELS_H
+#define SCALE_KERNELS_H
+
+//
+// Row kernels behind framescale.h. Every SIMD kernel writes exactly the same
+// values as its _C counterpart and hands the leftover samples of a row to it.
+//
+
+#include "cpufeatures.h"
+
+#define SCALE_WEIGHT_BITS       14      // filter weights are Q14, the taps of one output sum to 1 << 14
+#define SCALE_ROW_BITS          7       // fraction bits the vertical pass keeps for the horizontal one
+#define SCALE_MAX_TAPS          64      // taps of one output, bounds the downscale ratio of the area filter
+
+//
+// Vertical pass: blends taps source rows into one row of 16 bit samples
+//   dst[x] = (sum(weights[k] * rows[k][x]) + (1 << 6)) >> 7
+// taps is even, the filter tables pad an odd count with a zero weight.
+//
+typedef void (*ScaleRowVerticalFunc)(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width);
+
+void scaleRowVertical_C(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width);
+#if (defined CPU_X86)
+void scaleRowVertical_SSE2(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width);
+void scaleRowVertical_AVX2(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width);
+#endif
+
+//
+// Horizontal pass over a row of the vertical pass. Output sample x of channel
+// c reads taps samples from (starts[x] + k) * channels + c:
+//   dst[x * channels + c] = clamp((sum(weights[x * taps + k] * src[...]) + (1 << 20)) >> 21)
+// taps is even and channels is 1 (Y, U, V planes) or 2 (NV12 UV plane). src
+// carries taps samples of padding past the row, starts may run into it.
+//
+typedef void (*ScaleRowHorizontalFunc)(const short* src, const unsigned int* starts, const short* weights,
+	unsigned int taps, unsigned int channels, unsigned char* dst, unsigned int width);
+
+void scaleRowHorizontal_C(const short* src, const unsigned int* starts, const short* weights,
+	unsigned int taps, unsigned int channels, unsigned char* dst, unsigned int width);
+#if (defined CPU_X86)
+void scaleRowHorizontal_SSE2(const short* src, const unsigned int* starts, const short* weights,
+	unsigned int taps, unsigned int channels, unsigned char* dst, unsigned int width);
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+//
+// Built with AVX2 code generation (-mavx2, /arch:AVX2). Only reached through
+// the cpuFeatures() dispatch in framescale.cpp.
+//
+#include "scalekernels.h"
+
+#if (defined CPU_X86)
+#include <immintrin.h>
+#include <string.h>
+
+static inline __m256i pairWeights(const short* weights)
+{
+	int value;
+	memcpy(&value, weights, sizeof(value));
+	return _mm256_set1_epi32(value);
+}
+
+void scaleRowVertical_AVX2(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width)
+{
+	const __m256i round = _mm256_set1_epi32(1 << (SCALE_ROW_BITS - 1));
+
+	//
+	// Widening 16 pixels to 16 bit keeps the unpacks inside their lanes, so
+	// the pack at the end puts the pixels back in order without a permute.
+	//
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i sum_lo = round, sum_hi = round;
+		for (unsigned int k = 0; k < taps; k += 2)
+		{
+			const __m256i w = pairWeights(weights + k);
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[k] + x)));
+			__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(rows[k + 1] + x)));
+			sum_lo = _mm256_add_epi32(sum_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+			sum_hi = _mm256_add_epi32(sum_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+		}
+		sum_lo = _mm256_srai_epi32(sum_lo, SCALE_ROW_BITS);
+		sum_hi = _mm256_srai_epi32(sum_hi, SCALE_ROW_BITS);
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_packs_epi32(sum_lo, sum_hi));
+	}
+
+	if (x < width)
+	{
+		const unsigned char* rest[SCALE_MAX_TAPS];
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			rest[k] = rows[k] + x;
+		}
+		scaleRowVertical_C(rest, weights, taps, dst + x, width - x);
+	}
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "scalekernels.h"
+
+#if (defined CPU_X86)
+#include <emmintrin.h>
+#include <string.h>
+
+// Two 16 bit weights for _mm_madd_epi16, lo multiplies the even lane
+static inline __m128i pairWeights(const short* weights)
+{
+	int value;
+	memcpy(&value, weights, sizeof(value));
+	return _mm_set1_epi32(value);
+}
+
+static inline int loadPair(const void* src)
+{
+	int value;
+	memcpy(&value, src, sizeof(value));
+	return value;
+}
+
+void scaleRowVertical_SSE2(const unsigned char* const* rows, const short* weights, unsigned int taps,
+	short* dst, unsigned int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (SCALE_ROW_BITS - 1));
+
+	unsigned int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i sum0 = round, sum1 = round, sum2 = round, sum3 = round;
+		for (unsigned int k = 0; k < taps; k += 2)
+		{
+			const __m128i w = pairWeights(weights + k);
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + x));
+			__m128i lo = _mm_unpacklo_epi8(a, b);
+			__m128i hi = _mm_unpackhi_epi8(a, b);
+			sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+		sum0 = _mm_srai_epi32(sum0, SCALE_ROW_BITS);
+		sum1 = _mm_srai_epi32(sum1, SCALE_ROW_BITS);
+		sum2 = _mm_srai_epi32(sum2, SCALE_ROW_BITS);
+		sum3 = _mm_srai_epi32(sum3, SCALE_ROW_BITS);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packs_epi32(sum0, sum1));
+		_mm_storeu_si128((__m128i*)(dst + x + 8), _mm_packs_epi32(sum2, sum3));
+	}
+
+	if (x < width)
+	{
+		const unsigned char* rest[SCALE_MAX_TAPS];
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			rest[k] = rows[k] + x;
+		}
+		scaleRowVertical_C(rest, weights, taps, dst + x, width - x);
+	}
+}
+
+void scaleRowHorizontal_SSE2(const short* src, const unsigned int* starts, const short* weights,
+	unsigned int taps, unsigned int channels, unsigned char* dst, unsigned int width)
+{
+	const __m128i round = _mm_set1_epi32(1 << (SCALE_WEIGHT_BITS + SCALE_ROW_BITS - 1));
+
+	unsigned int x = 0;
+	if (channels == 1)
+	{
+		//
+		// Four outputs at a time. Each tap pair of an output is one 32 bit
+		// load of two neighbouring samples, multiplied by its weight pair.
+		//
+		for (; x + 4 <= width; x += 4)
+		{
+			const short* w = weights + x * taps;
+			__m128i sum = round;
+			for (unsigned int k = 0; k < taps; k += 2)
+			{
+				__m128i s = _mm_setr_epi32(loadPair(src + starts[x] + k), loadPair(src + starts[x + 1] + k),
+					loadPair(src + starts[x + 2] + k), loadPair(src + starts[x + 3] + k));
+				__m128i p = _mm_setr_epi32(loadPair(w + k), loadPair(w + taps + k),
+					loadPair(w + 2 * taps + k), loadPair(w + 3 * taps + k));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(s, p));
+			}
+			sum = _mm_srai_epi32(sum, SCALE_WEIGHT_BITS + SCALE_ROW_BITS);
+			sum = _mm_packs_epi32(sum, sum);
+			int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+			memcpy(dst + x, &packed, sizeof(packed));
+		}
+	}
+	else
+	{
+		//
+		// Two UV outputs at a time. A tap pair loads U0 V0 U1 V1, which is
+		// reordered to U0 U1 V0 V1 so both channels share the weight pair.
+		//
+		for (; x + 2 <= width; x += 2)
+		{
+			const short* w = weights + x * taps;
+			__m128i sum = round;
+			for (unsigned int k = 0; k < taps; k += 2)
+			{
+				__m128i s0 = _mm_loadl_epi64((const __m128i*)(src + (starts[x] + k) * 2));
+				__m128i s1 = _mm_loadl_epi64((const __m128i*)(src + (starts[x + 1] + k) * 2));
+				s0 = _mm_shufflelo_epi16(s0, _MM_SHUFFLE(3, 1, 2, 0));
+				s1 = _mm_shufflelo_epi16(s1, _MM_SHUFFLE(3, 1, 2, 0));
+				int w0 = loadPair(w + k), w1 = loadPair(w + taps + k);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi64(s0, s1), _mm_setr_epi32(w0, w0, w1, w1)));
+			}
+			sum = _mm_srai_epi32(sum, SCALE_WEIGHT_BITS + SCALE_ROW_BITS);
+			sum = _mm_packs_epi32(sum, sum);
+			int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+			memcpy(dst + 2 * x, &packed, sizeof(packed));
+		}
+	}
+
+	if (x < width)
+	{
+		scaleRowHorizontal_C(src, starts + x, weights + x * taps, taps, channels, dst + x * channels, width - x);
+	}
+}
+
+#endif
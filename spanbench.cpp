@@ -0,0 +1,284 @@
+//
+// Cost of a stage span, with recording off and on, and a check of the Chrome
+// trace export. Several threads record spans into small rings, so the rings
+// wrap, while the main thread exports them over and over. The final export
+// must hold, for every thread, the spans still in its ring, one per line, in
+// order and without a torn one. Threads restarted without an export must take
+// over the rings of the exited ones. Exits with 1 otherwise.
+//
+// usage: spanbench [-n spans] [-t threads] [-o trace.json]
+//
+
+#include "spantrace.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREAD_RING_EVENTS  4096
+
+typedef std::chrono::steady_clock SpanClock;
+
+static const char* s_stages[] = { "decode", "convert", "stitch", "convert", "queue", "ProcessOutput" };
+
+typedef struct _ThreadSpans {
+	long long           spans = 0;
+	long long           last = -1;      // frame of the last span, they count up per thread
+	long long           lastBegin = -1;
+}ThreadSpans;
+
+//
+// Reads back an export: thread ids and names, spans per thread in frame
+// order, each duration the frame number in nanoseconds as recorded
+//
+static bool checkExport(const std::string& path, unsigned int threads, unsigned long long perThread, unsigned int capacity)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+	if (!fp)
+	{
+		printf("cannot read %s\n", path.c_str());
+		return false;
+	}
+	std::map<unsigned int, ThreadSpans> spans;
+	unsigned int names = 0;
+	char text[512];
+	bool ok = true;
+	while (ok && fgets(text, sizeof(text), fp))
+	{
+		unsigned int tid = 0;
+		char name[32] = { 0 };
+		long long us = 0, fraction = 0, frame = 0, durUs = 0, durFraction = 0;
+		if (strstr(text, "\"ph\":\"M\""))
+		{
+			names++;
+			continue;
+		}
+		if (!strstr(text, "\"ph\":\"X\""))
+		{
+			continue;
+		}
+		if (sscanf(text, "{\"name\":\"%31[^\"]\",\"cat\":\"dmft\",\"ph\":\"X\",\"pid\":%*u,\"tid\":%u,\"ts\":%lld.%lld,\"dur\":%lld.%lld,\"args\":{\"frame\":%lld}}",
+			name, &tid, &us, &fraction, &durUs, &durFraction, &frame) != 7)
+		{
+			printf("unreadable span: %s", text);
+			ok = false;
+			break;
+		}
+		ThreadSpans& thread = spans[tid];
+		long long begin = us * 1000 + fraction;
+		if (strcmp(name, s_stages[frame % 6]) || durUs * 1000 + durFraction != frame % 1000 ||
+			(thread.last >= 0 && (frame != thread.last + 1 || begin < thread.lastBegin)))
+		{
+			printf("thread %u: span %s frame %lld after frame %lld\n", tid, name, frame, thread.last);
+			ok = false;
+			break;
+		}
+		thread.spans++;
+		thread.last = frame;
+		thread.lastBegin = begin;
+	}
+	fclose(fp);
+
+	if (ok && (spans.size() != threads || names != threads))
+	{
+		printf("%zu threads with spans, %u named, expected %u\n", spans.size(), names, threads);
+		ok = false;
+	}
+	for (std::map<unsigned int, ThreadSpans>::const_iterator it = spans.begin(); ok && it != spans.end(); ++it)
+	{
+		long long kept = perThread < capacity ? (long long)perThread : capacity;
+		if (it->second.spans != kept || it->second.last != (long long)perThread - 1)
+		{
+			printf("thread %u: %lld spans up to frame %lld, expected %lld up to %llu\n",
+				it->first, it->second.spans, it->second.last, kept, perThread - 1);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int count = 1000000;
+	unsigned int threads = 4;
+	std::string path;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			count = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-t"))
+		{
+			threads = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-o"))
+		{
+			path = argv[i + 1];
+		}
+	}
+	if (!count || !threads)
+	{
+		return 0;
+	}
+	if (path.empty())
+	{
+		char temp[] = "/tmp/spanbenchXXXXXX";
+		if (!mkdtemp(temp))
+		{
+			printf("cannot create an output directory\n");
+			return 1;
+		}
+		path = std::string(temp) + "/spans.json";
+	}
+	CSpanTrace& trace = CSpanTrace::instance();
+
+	// off, then on; the main thread's ring is full size and wraps
+	double ns[2] = { 0.0, 0.0 };
+	for (int on = 0; on < 2; on++)
+	{
+		if (on)
+		{
+			trace.start();
+		}
+		SpanClock::time_point start = SpanClock::now();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			CSpanScope span(s_stages[i % 6], i);
+		}
+		ns[on] = std::chrono::duration<double, std::nano>(SpanClock::now() - start).count() / count;
+		trace.stop();
+	}
+	printf("%u spans, one thread\n", count);
+	printf("  %-4s %10s\n", "mode", "ns/span");
+	printf("  %-4s %10.2f\n", "off", ns[0]);
+	printf("  %-4s %10.2f\n", "on", ns[1]);
+
+	// the rings of the writer threads are made after this start, small ones
+	trace.start(THREAD_RING_EVENTS);
+	const unsigned long long perThread = count / threads;
+	std::atomic<unsigned int> running(threads);
+	// a writer hands its ring back as it exits, so they wait for the final export
+	std::atomic<bool> exported(false);
+	std::vector<std::thread> writers;
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		writers.push_back(std::thread([&trace, &running, &exported, perThread] {
+			trace.nameThread("writer");
+			for (unsigned long long i = 0; i < perThread; i++)
+			{
+				// the duration carries the frame, so a torn span shows up
+				long long begin = CSpanTrace::now();
+				trace.record(s_stages[i % 6], begin, begin + (long long)(i % 1000), (long long)i);
+			}
+			running--;
+			while (!exported.load())
+			{
+				std::this_thread::yield();
+			}
+		}));
+	}
+	unsigned int exports = 0;
+	std::string during = path + ".during";
+	bool ok = true;
+	while (running.load() && ok)
+	{
+		ok = trace.exportJson(during);
+		exports++;
+	}
+	remove(during.c_str());
+
+	// the main thread's spans from the timing run are in the export too, writers only are checked
+	std::string writersOnly = path + ".writers";
+	unsigned long long overwritten = trace.overwritten();
+	trace.setExportPath(path);
+	bool written = ok && trace.stop();
+	exported = true;
+	for (size_t t = 0; t < writers.size(); t++)
+	{
+		writers[t].join();
+	}
+	if (!written)
+	{
+		printf("cannot write %s\n", path.c_str());
+		return 1;
+	}
+	printf("%u threads, %llu spans each into %u span rings, %u exports while recording, %llu overwritten\n",
+		threads, perThread, THREAD_RING_EVENTS, exports, overwritten);
+
+	// drops the main thread's lines, the writers' spans are the ones checked
+	FILE* in = fopen(path.c_str(), "r");
+	FILE* out = fopen(writersOnly.c_str(), "w");
+	char text[512];
+	bool first = true;
+	unsigned int mainThread = 0;
+	while (in && out && fgets(text, sizeof(text), in))
+	{
+		unsigned int tid = 0;
+		const char* at = strstr(text, "\"tid\":");
+		if (at && sscanf(at, "\"tid\":%u", &tid) == 1)
+		{
+			if (first)
+			{
+				// the main thread recorded first, its ring is the first in the export
+				mainThread = tid;
+				first = false;
+			}
+			if (tid == mainThread)
+			{
+				continue;
+			}
+		}
+		fputs(text, out);
+	}
+	if (in)
+	{
+		fclose(in);
+	}
+	if (out)
+	{
+		fclose(out);
+	}
+	ok = checkExport(writersOnly, threads, perThread, THREAD_RING_EVENTS);
+	remove(writersOnly.c_str());
+	if (ok)
+	{
+		printf("export %s checked\n", path.c_str());
+	}
+
+	// stage threads restarted over and over without an export take over the
+	// rings of the exited ones instead of making new ones
+	trace.start(THREAD_RING_EVENTS);
+	for (unsigned int round = 0; round < 16; round++)
+	{
+		std::vector<std::thread> stages;
+		for (unsigned int t = 0; t < threads; t++)
+		{
+			stages.push_back(std::thread([&trace] {
+				long long begin = CSpanTrace::now();
+				trace.record("restart", begin, begin);
+			}));
+		}
+		for (size_t t = 0; t < stages.size(); t++)
+		{
+			stages[t].join();
+		}
+	}
+	trace.setExportPath(std::string());
+	trace.stop();
+	size_t rings = trace.rings();
+	printf("16 restarts of %u threads, %zu rings\n", threads, rings);
+	if (rings > 1 + threads + SPAN_RETIRED_RINGS)
+	{
+		printf("rings of exited threads are not reused\n");
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,336 @@
+#include "spantrace.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> CSpanTrace::s_enabled(false);
+
+// OS id of the calling thread, the one perf and the debugger show
+static unsigned int currentThread()
+{
+#ifdef _WIN32
+	return (unsigned int)GetCurrentThreadId();
+#elif defined(__APPLE__)
+	unsigned long long id = 0;
+	pthread_threadid_np(NULL, &id);
+	return (unsigned int)id;
+#else
+	return (unsigned int)syscall(SYS_gettid);
+#endif
+}
+
+static unsigned int currentProcess()
+{
+#ifdef _WIN32
+	return (unsigned int)GetCurrentProcessId();
+#else
+	return (unsigned int)getpid();
+#endif
+}
+
+// A JSON string, names are literals but are escaped anyway
+static void putString(FILE* fp, const char* text)
+{
+	fputc('"', fp);
+	for (const char* c = text ? text : ""; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			fputc('\\', fp);
+			fputc(*c, fp);
+		}
+		else if ((unsigned char)*c < 0x20)
+		{
+			fprintf(fp, "\\u%04x", (unsigned int)(unsigned char)*c);
+		}
+		else
+		{
+			fputc(*c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+// Chrome trace times are microseconds, kept to the nanosecond
+static void putMicroseconds(FILE* fp, long long ns)
+{
+	if (ns < 0)
+	{
+		fputc('-', fp);
+		ns = -ns;
+	}
+	fprintf(fp, "%lld.%03lld", ns / 1000, ns % 1000);
+}
+
+CSpanTrace& CSpanTrace::instance()
+{
+	// never deleted, stage threads may still record while statics are destroyed
+	static CSpanTrace* s_trace = new CSpanTrace;
+	return *s_trace;
+}
+
+CSpanTrace::CSpanTrace()
+: m_lost(0)
+, m_events(SPAN_RING_EVENTS)
+, m_starts(0)
+{
+}
+
+CSpanTrace::~CSpanTrace()
+{
+	for (size_t i = 0; i < m_rings.size(); i++)
+	{
+		delete[] m_rings[i]->events;
+		delete m_rings[i];
+	}
+}
+
+long long CSpanTrace::now()
+{
+	return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CSpanTrace::start(unsigned int events)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_events = events ? events : 1;
+		m_starts++;
+	}
+	s_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool CSpanTrace::startFromEnvironment()
+{
+	const char* path = getenv(SPAN_TRACE_ENV);
+	if (!path || !*path)
+	{
+		return false;
+	}
+	setExportPath(path);
+	start();
+	return true;
+}
+
+bool CSpanTrace::stop()
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_starts == 0 || --m_starts > 0)
+		{
+			// another transform is still recording
+			return true;
+		}
+		s_enabled.store(false, std::memory_order_relaxed);
+		path = m_exportPath;
+	}
+	return path.empty() || exportJson(path);
+}
+
+void CSpanTrace::setExportPath(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_exportPath = path;
+}
+
+//
+// Owns the ring of a thread and hands it back to the recorder when the thread
+// exits. The recorder is never deleted, so it is still there then
+//
+typedef struct _SpanRingHolder {
+	SpanRing* ring = nullptr;
+
+	~_SpanRingHolder()
+	{
+		if (ring)
+		{
+			CSpanTrace::instance().releaseRing(ring);
+		}
+	}
+}SpanRingHolder;
+
+// The ring of the calling thread, taken on its first span
+SpanRing* CSpanTrace::threadRing()
+{
+	static thread_local SpanRingHolder s_holder;
+	if (!s_holder.ring)
+	{
+		s_holder.ring = takeRing();
+	}
+	return s_holder.ring;
+}
+
+//
+// An exported ring of an exited thread, the oldest unexported one once too
+// many wait, or a new ring. Emptied and owned by the calling thread
+//
+SpanRing* CSpanTrace::takeRing()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	SpanRing* ring = nullptr;
+	if (!m_free.empty())
+	{
+		ring = m_free.back();
+		m_free.pop_back();
+	}
+	else if (m_retired.size() >= SPAN_RETIRED_RINGS)
+	{
+		ring = m_retired.front();
+		m_retired.erase(m_retired.begin());
+		m_lost += ring->head.load(std::memory_order_relaxed);
+	}
+	else
+	{
+		ring = new SpanRing;
+		m_rings.push_back(ring);
+	}
+
+	if (ring->capacity != m_events)
+	{
+		delete[] ring->events;
+		ring->capacity = m_events;
+		ring->events = new SpanEvent[m_events];
+	}
+	for (unsigned int i = 0; i < ring->capacity; i++)
+	{
+		ring->events[i].sequence.store(0, std::memory_order_relaxed);
+	}
+	ring->thread = currentThread();
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->name.store(nullptr, std::memory_order_relaxed);
+	return ring;
+}
+
+// Called as a thread exits; its spans stay readable until the next export
+void CSpanTrace::releaseRing(SpanRing* ring)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_retired.push_back(ring);
+}
+
+void CSpanTrace::nameThread(const char* name)
+{
+	SpanRing* ring = threadRing();
+	if (ring->name.load(std::memory_order_relaxed) != name)
+	{
+		ring->name.store(name, std::memory_order_relaxed);
+	}
+}
+
+void CSpanTrace::record(const char* name, long long begin, long long end, long long frame)
+{
+	SpanRing* ring = threadRing();
+	unsigned long long index = ring->head.load(std::memory_order_relaxed);
+	SpanEvent& event = ring->events[index % ring->capacity];
+
+	event.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event.name.store(name, std::memory_order_relaxed);
+	event.begin.store(begin, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.frame.store(frame, std::memory_order_relaxed);
+	event.sequence.store(index + 1, std::memory_order_release);
+	ring->head.store(index + 1, std::memory_order_release);
+}
+
+unsigned long long CSpanTrace::overwritten() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	unsigned long long lost = m_lost;
+	for (size_t i = 0; i < m_rings.size(); i++)
+	{
+		unsigned long long head = m_rings[i]->head.load(std::memory_order_relaxed);
+		lost += head > m_rings[i]->capacity ? head - m_rings[i]->capacity : 0;
+	}
+	return lost;
+}
+
+size_t CSpanTrace::rings() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_rings.size();
+}
+
+bool CSpanTrace::exportJson(const std::string& path) const
+{
+	FILE* fp = fopen(path.c_str(), "w");
+	if (!fp)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	const unsigned int process = currentProcess();
+	bool first = true;
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (size_t r = 0; r < m_rings.size(); r++)
+	{
+		const SpanRing* ring = m_rings[r];
+		const char* threadName = ring->name.load(std::memory_order_relaxed);
+		if (threadName)
+		{
+			fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":",
+				first ? "" : ",", process, ring->thread);
+			putString(fp, threadName);
+			fprintf(fp, "}}");
+			first = false;
+		}
+
+		// the spans still in the ring, oldest first; one the owner overwrites meanwhile is skipped
+		unsigned long long head = ring->head.load(std::memory_order_acquire);
+		for (unsigned long long i = head > ring->capacity ? head - ring->capacity : 0; i < head; i++)
+		{
+			const SpanEvent& event = ring->events[i % ring->capacity];
+			if (event.sequence.load(std::memory_order_acquire) != i + 1)
+			{
+				continue;
+			}
+			const char* name = event.name.load(std::memory_order_relaxed);
+			long long begin = event.begin.load(std::memory_order_relaxed);
+			long long end = event.end.load(std::memory_order_relaxed);
+			long long frame = event.frame.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (event.sequence.load(std::memory_order_relaxed) != i + 1)
+			{
+				continue;
+			}
+
+			fprintf(fp, "%s\n{\"name\":", first ? "" : ",");
+			putString(fp, name);
+			fprintf(fp, ",\"cat\":\"dmft\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":", process, ring->thread);
+			putMicroseconds(fp, begin);
+			fprintf(fp, ",\"dur\":");
+			putMicroseconds(fp, end - begin);
+			if (frame >= 0)
+			{
+				fprintf(fp, ",\"args\":{\"frame\":%lld}", frame);
+			}
+			fprintf(fp, "}");
+			first = false;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+
+	// the exited threads' spans are out, their rings can be taken over and are
+	// left out of later exports
+	for (size_t r = 0; r < m_retired.size(); r++)
+	{
+		unsigned long long head = m_retired[r]->head.load(std::memory_order_relaxed);
+		m_lost += head > m_retired[r]->capacity ? head - m_retired[r]->capacity : 0;
+		m_retired[r]->head.store(0, std::memory_order_relaxed);
+		m_free.push_back(m_retired[r]);
+	}
+	m_retired.clear();
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,146 @@
+#ifndef SPAN_TRACE_H
+#define SPAN_TRACE_H
+
+//
+// Timeline of the frame path. Each stage a frame goes through (decode,
+// convert, stitch, queue, ProcessOutput) is recorded as a span, its begin and
+// end on the steady clock, into a ring owned by the recording thread, so
+// writers never share a cache line or a lock. A full ring overwrites its
+// oldest spans. exportJson() writes the spans of every thread as Chrome trace
+// JSON (chrome://tracing, ui.perfetto.dev), on demand while spans are still
+// being recorded or from stop() at shutdown.
+//
+// Times are the steady clock in microseconds, CLOCK_MONOTONIC on Linux, so a
+// timeline lines up with perf record -k CLOCK_MONOTONIC; thread ids are the OS
+// ids perf shows.
+//
+// Recording is off until start(); a disabled span costs one relaxed load.
+// start() and stop() are counted, so several transforms in one process share
+// the recording and the last stop() writes the export.
+//
+// A thread's ring is handed back when the thread exits. Its spans stay in the
+// export until the next exportJson(), then a new thread takes the ring over;
+// a new thread takes the oldest one still unexported instead of allocating
+// once SPAN_RETIRED_RINGS are waiting, so restarted stage threads do not grow
+// the recorder.
+//
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define SPAN_RING_EVENTS    16384   // spans kept per thread
+#define SPAN_RETIRED_RINGS  8       // rings of exited threads kept for the next export
+#define SPAN_TRACE_ENV      "DMFT_SPAN_TRACE"   // output path, starts the recording when set
+
+//
+// One span. The writer clears sequence, fills in the rest and publishes it
+// with the span's index plus one; a reader keeps a copy only when sequence
+// is the same before and after it read the fields.
+//
+typedef struct _SpanEvent {
+	std::atomic<unsigned long long> sequence;
+	std::atomic<const char*>        name;       // a string literal
+	std::atomic<long long>          begin;      // nanoseconds on the steady clock
+	std::atomic<long long>          end;
+	std::atomic<long long>          frame;      // frame number or sample time, -1 for none
+}SpanEvent, *SpanEventPtr;
+
+typedef struct _SpanRing {
+	SpanEvent*                      events = nullptr;
+	unsigned int                    capacity = 0;
+	unsigned int                    thread = 0;         // OS thread id
+	std::atomic<unsigned long long> head;               // spans written since the ring was made
+	std::atomic<const char*>        name;               // thread name shown in the timeline, a string literal
+}SpanRing, *SpanRingPtr;
+
+class CSpanTrace
+{
+public:
+	// The process wide recorder, never deleted
+	static CSpanTrace& instance();
+
+	static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+	// Nanoseconds on the steady clock, the time base of every span
+	static long long now();
+
+	// Records from now on; rings made later hold events spans
+	void start(unsigned int events = SPAN_RING_EVENTS);
+	// Starts with the output path from DMFT_SPAN_TRACE, false when it is not set
+	// and then nothing is counted
+	bool startFromEnvironment();
+	// Undoes one start(). The last one stops recording and writes the export
+	// path given to setExportPath, if any
+	bool stop();
+	void setExportPath(const std::string& path);
+
+	// Spans of every thread recorded so far, safe while threads keep recording
+	bool exportJson(const std::string& path) const;
+
+	// Thread name for the timeline, a string literal
+	void nameThread(const char* name);
+	void record(const char* name, long long begin, long long end, long long frame = -1);
+
+	// Spans lost because a ring wrapped or was taken over before an export
+	unsigned long long overwritten() const;
+	// Rings made so far, live or handed back
+	size_t rings() const;
+
+private:
+	CSpanTrace();
+	~CSpanTrace();
+	CSpanTrace(const CSpanTrace&);
+	CSpanTrace& operator=(const CSpanTrace&);
+
+	SpanRing* threadRing();
+	SpanRing* takeRing();
+	void releaseRing(SpanRing* ring);
+
+	friend struct _SpanRingHolder;
+
+	static std::atomic<bool>    s_enabled;
+	mutable std::mutex          m_lock;         // guards the members below
+	std::vector<SpanRing*>      m_rings;        // every ring made, owned or not
+	mutable std::vector<SpanRing*> m_retired;   // rings of exited threads, oldest first, not exported yet
+	mutable std::vector<SpanRing*> m_free;      // rings of exited threads already exported
+	mutable unsigned long long  m_lost;         // spans lost by rings that were emptied
+	unsigned int                m_events;
+	unsigned int                m_starts;       // start() calls not yet stopped
+	std::string                 m_exportPath;
+};
+
+//
+// Records the span from construction to destruction on the calling thread,
+// nothing when recording is off at construction
+//
+class CSpanScope
+{
+public:
+	explicit CSpanScope(const char* name, long long frame = -1)
+	: m_name(CSpanTrace::enabled() ? name : nullptr)
+	, m_begin(m_name ? CSpanTrace::now() : 0)
+	, m_frame(frame)
+	{
+	}
+
+	~CSpanScope()
+	{
+		if (m_name)
+		{
+			CSpanTrace::instance().record(m_name, m_begin, CSpanTrace::now(), m_frame);
+		}
+	}
+
+	void setFrame(long long frame) { m_frame = frame; }
+
+private:
+	CSpanScope(const CSpanScope&);
+	CSpanScope& operator=(const CSpanScope&);
+
+	const char*     m_name;
+	long long       m_begin;
+	long long       m_frame;
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef STAGE_PIPELINE_H
+#define STAGE_PIPELINE_H
+
+//
+// Runs the stages of the frame path on one thread each, connected by bounded
+// FIFO hand-off queues, so frame N+1 is in an earlier stage while frame N is
+// in a later one. Every stage handles its frames in arrival order, so frames
+// leave the pipeline in the order they were pushed. T is the per-frame job;
+// release() is called once for every job leaving the pipeline, finished or
+// dropped.
+//
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_QUEUE_DEPTH    2       // jobs waiting in front of each stage
+
+template <typename T>
+class CStagePipeline
+{
+public:
+	// A stage returns false to drop the job, the later stages do not see it
+	typedef std::function<bool(T&)> StageFunc;
+
+	CStagePipeline(const std::vector<StageFunc>& stages, std::function<void(T&)> release,
+		unsigned int depth = PIPELINE_QUEUE_DEPTH)
+	: m_stages(stages)
+	, m_release(release)
+	, m_depth(depth ? depth : 1)
+	, m_queues(stages.size())
+	, m_inFlight(0)
+	, m_epoch(0)
+	, m_dropped(0)
+	, m_stop(false)
+	{
+		for (size_t i = 0; i < m_stages.size(); i++)
+		{
+			m_threads.push_back(std::thread(&CStagePipeline::stageLoop, this, i));
+		}
+	}
+
+	~CStagePipeline()
+	{
+		stop();
+	}
+
+	unsigned int stageCount() const { return (unsigned int)m_stages.size(); }
+
+	//
+	// Queues a job in front of the first stage, waiting while that queue is
+	// full. Returns false once the pipeline is stopped; the job is released.
+	//
+	bool push(T job)
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [this] { return m_stop || m_stages.empty() || m_queues[0].size() < m_depth; });
+		if (m_stop || m_stages.empty())
+		{
+			lock.unlock();
+			m_release(job);
+			return false;
+		}
+		m_queues[0].push_back(Entry(std::move(job), m_epoch));
+		m_inFlight++;
+		lock.unlock();
+		m_changed.notify_all();
+		return true;
+	}
+
+	// Waits until every job pushed so far has left the last stage
+	void drain()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [this] { return m_inFlight == 0; });
+	}
+
+	//
+	// Drops the queued jobs and waits for the ones a stage is working on; they
+	// are dropped instead of handed on when the stage is done with them.
+	//
+	void flush()
+	{
+		std::deque<Entry> dropped;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_epoch++;
+			for (size_t i = 0; i < m_queues.size(); i++)
+			{
+				for (size_t j = 0; j < m_queues[i].size(); j++)
+				{
+					dropped.push_back(std::move(m_queues[i][j]));
+				}
+				m_queues[i].clear();
+			}
+			m_inFlight -= (unsigned int)dropped.size();
+			m_dropped += dropped.size();
+		}
+		m_changed.notify_all();
+		for (size_t i = 0; i < dropped.size(); i++)
+		{
+			m_release(dropped[i].job);
+		}
+		drain();
+	}
+
+	// Lets the stages finish the job in hand, joins them and drops the rest
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (m_stop)
+			{
+				return;
+			}
+			m_stop = true;
+		}
+		m_changed.notify_all();
+		for (size_t i = 0; i < m_threads.size(); i++)
+		{
+			m_threads[i].join();
+		}
+		std::deque<Entry> dropped;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			for (size_t i = 0; i < m_queues.size(); i++)
+			{
+				for (size_t j = 0; j < m_queues[i].size(); j++)
+				{
+					dropped.push_back(std::move(m_queues[i][j]));
+				}
+				m_queues[i].clear();
+			}
+			m_dropped += dropped.size();
+			m_inFlight = 0;
+		}
+		// a flush() waiting in drain() returns now
+		m_changed.notify_all();
+		for (size_t i = 0; i < dropped.size(); i++)
+		{
+			m_release(dropped[i].job);
+		}
+	}
+
+	// Jobs a stage refused or a flush() or stop() threw away
+	unsigned long long droppedCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_dropped;
+	}
+
+private:
+	CStagePipeline(const CStagePipeline&);
+	CStagePipeline& operator=(const CStagePipeline&);
+
+	struct Entry {
+		Entry(T&& j, unsigned long long e) : job(std::move(j)), epoch(e) {}
+		T                   job;
+		unsigned long long  epoch;      // a flush() after the push drops the job
+	};
+
+	void stageLoop(size_t index)
+	{
+		const bool last = index + 1 == m_stages.size();
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_changed.wait(lock, [this, index] { return m_stop || !m_queues[index].empty(); });
+			if (m_stop)
+			{
+				return;
+			}
+			Entry entry = std::move(m_queues[index].front());
+			m_queues[index].pop_front();
+			lock.unlock();
+			m_changed.notify_all();
+
+			bool keep = m_stages[index](entry.job);
+
+			lock.lock();
+			if (keep && !last)
+			{
+				// the bound of the next queue holds this stage back, not the producer
+				m_changed.wait(lock, [this, index] { return m_stop || m_queues[index + 1].size() < m_depth; });
+				if (!m_stop && entry.epoch == m_epoch)
+				{
+					m_queues[index + 1].push_back(std::move(entry));
+					lock.unlock();
+					m_changed.notify_all();
+					continue;
+				}
+				keep = false;
+			}
+			if (!keep)
+			{
+				m_dropped++;
+			}
+			m_inFlight--;
+			lock.unlock();
+			m_release(entry.job);
+			m_changed.notify_all();
+		}
+	}
+
+	std::vector<StageFunc>      m_stages;
+	std::function<void(T&)>     m_release;
+	unsigned int                m_depth;
+	std::vector<std::deque<Entry>> m_queues;
+	std::vector<std::thread>    m_threads;
+	mutable std::mutex          m_lock;
+	std::condition_variable     m_changed;
+	unsigned int                m_inFlight;
+	unsigned long long          m_epoch;
+	unsigned long long          m_dropped;
+	bool                        m_stop;
+};
+
+#endif
@@ -0,0 +1,135 @@
+//
+// Runs frames through the XVP tee stand-in in its two shapes: the old one
+// that wraps every frame in its own streaming session and creates an output
+// sample for it, and the session one CXvptee uses now. Counts the messages
+// the video processor sees and the output samples created. Exits with 1 when
+// the session tee sends messages per frame, keeps allocating or converts a
+// frame differently from the old tee.
+//
+// usage: teesession [-w width] [-h height] [-n frames]
+//
+
+#include "colorconvert.h"
+#include "hostsample.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock TeeClock;
+
+struct TeeRun {
+	HostTransformStats  stats;
+	unsigned long long  allocations;
+	double              ms;
+	std::vector<unsigned char> lastFrame;
+};
+
+static bool runTee(bool session, unsigned int width, unsigned int height, unsigned int frames, TeeRun& run)
+{
+	CHostTransform transform(std::unique_ptr<CFrameStage>(new CBGRAToNV12Stage()), width, height);
+	CHostSample* input = CHostSample::create(frameBufferSize(FRAME_FORMAT_BGRA, width, height));
+	if (!input)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < input->maxLength(); i++)
+	{
+		input->buffer()[i] = (unsigned char)(i * 7);
+	}
+	input->setCurrentLength(input->maxLength());
+
+	bool ok = true;
+	TeeClock::time_point start = TeeClock::now();
+	{
+		CHostXvpTee tee(&transform, session);
+		for (unsigned int frame = 0; frame < frames && ok; frame++)
+		{
+			input->buffer()[0] = (unsigned char)frame;
+			input->setSampleTime((long long)frame * 333333);
+
+			CHostSample* output = tee.process(input);
+			if (!output)
+			{
+				ok = false;
+				break;
+			}
+			if (frame + 1 == frames)
+			{
+				run.lastFrame.assign(output->buffer(), output->buffer() + output->currentLength());
+			}
+			output->Release();
+		}
+		run.allocations = tee.allocations();
+	}
+	run.ms = std::chrono::duration<double, std::milli>(TeeClock::now() - start).count();
+	run.stats = transform.stats();
+	input->Release();
+	return ok;
+}
+
+static void printRun(const char* name, const TeeRun& run, unsigned int frames)
+{
+	printf("  %-10s %10llu %8.2f %10llu %8llu %10llu %8.1f\n", name,
+		run.stats.messages, (double)run.stats.messages / frames, run.stats.sessions,
+		run.stats.flushes, run.allocations, frames * 1000.0 / run.ms);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int width = 1920;
+	unsigned int height = 960;
+	unsigned int frames = 300;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-w"))
+		{
+			width = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-h"))
+		{
+			height = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-n"))
+		{
+			frames = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+	if (!frames)
+	{
+		return 0;
+	}
+
+	TeeRun perFrame, session;
+	if (!runTee(false, width, height, frames, perFrame) || !runTee(true, width, height, frames, session))
+	{
+		printf("tee failed to convert a frame\n");
+		return 1;
+	}
+
+	printf("%u frames of %ux%u bgra to nv12\n", frames, width, height);
+	printf("  %-10s %10s %8s %10s %8s %10s %8s\n", "tee", "messages", "/frame", "sessions", "flushes", "allocs", "fps");
+	printRun("per-frame", perFrame, frames);
+	printRun("session", session, frames);
+
+	if (session.stats.messages != 4 || session.stats.sessions != 1 || session.stats.flushes != 0)
+	{
+		printf("session tee sent messages outside the session boundaries\n");
+		return 1;
+	}
+	if (session.allocations > 1)
+	{
+		printf("session tee created %llu output samples for one in flight\n", session.allocations);
+		return 1;
+	}
+	if (session.lastFrame != perFrame.lastFrame)
+	{
+		printf("session tee output differs from the per-frame tee\n");
+		return 1;
+	}
+	return 0;
+}
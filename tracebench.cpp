@@ -0,0 +1,336 @@
+//
+// Cost of a debug line as CMyLog text, synchronous and async, and as a binary
+// trace record, in time on the logging thread and bytes on disk. The trace is
+// then decoded the way tracedecode does and every line compared with what
+// snprintf makes of the same format and arguments. A second trace run logs
+// from several threads into small segments, so segments fill up and get
+// replaced under load, and checks every record decodes in order per thread.
+// Exits with 1 when a decoded line differs or is missing.
+//
+// usage: tracebench [-n lines] [-t threads] [-d dir]
+//
+
+#include "log.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock TraceClock;
+
+static const char* s_stages[] = { "decode", "convert", "stitch", "queue" };
+
+// Every 16th line uses the second format, widths, '*' and the odd conversions
+#define LINE_FORMAT     "frame %u stage %s took %.3f ms, sample %p, hr 0x%08x, offset %lld, queue %d%%"
+#define LINE_ARGS(i)    (unsigned int)(i), s_stages[(i) % 4], (i) * 0.0125, (const void*)(size_t)(0x10000 + (i) * 16), \
+                        (unsigned int)(0x80070000u + (i) % 16), (long long)(i) * -1000, (int)((i) % 7) - 3
+#define ODD_FORMAT      "[%-8s|%5d|%*d|%c|%lu|%hd|%.2e|%s]"
+#define ODD_ARGS(i)     s_stages[(i) % 4], (int)((i) % 1000), 7, (int)(i), (int)('a' + (i) % 26), (unsigned long)(i) * 3, \
+                        (short)((i) & 0x7fff), (i) * 1e-3, ""
+
+#define THREAD_SEGMENT_SIZE (64 * 1024)
+
+static std::string expected(unsigned int i)
+{
+	char text[512];
+	if (i % 16 == 15)
+	{
+		snprintf(text, sizeof(text), ODD_FORMAT, ODD_ARGS(i));
+	}
+	else
+	{
+		snprintf(text, sizeof(text), LINE_FORMAT, LINE_ARGS(i));
+	}
+	return text;
+}
+
+static long long fileSize(const std::string& path)
+{
+	struct stat statbuff;
+	return stat(path.c_str(), &statbuff) < 0 ? -1 : (long long)statbuff.st_size;
+}
+
+// Bytes of the segments in dir and their paths, oldest first; the runs keep every segment
+static long long segments(const std::string& dir, std::vector<std::string>& paths)
+{
+	long long total = 0;
+	paths.clear();
+	for (unsigned int sequence = 0; ; sequence++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "/dmft.%u.trace", sequence);
+		long long size = fileSize(dir + name);
+		if (size < 0)
+		{
+			break;
+		}
+		paths.push_back(dir + name);
+		total += size;
+	}
+	return total;
+}
+
+// The message of a decoded line, between "[thread] " and " file:line"
+static std::string message(const char* line)
+{
+	std::string text(line);
+	while (!text.empty() && text[text.size() - 1] == '\n')
+	{
+		text.erase(text.size() - 1);
+	}
+	size_t start = text.find("] ");
+	size_t end = text.rfind(' ');
+	if (start == std::string::npos || end == std::string::npos || end < start + 2)
+	{
+		return std::string();
+	}
+	return text.substr(start + 2, end - start - 2);
+}
+
+static bool decodeAll(const std::string& dir, const std::string& output)
+{
+	std::vector<std::string> paths;
+	segments(dir, paths);
+	FILE* out = fopen(output.c_str(), "w");
+	if (!out)
+	{
+		return false;
+	}
+	CTraceDecoder decoder;
+	bool ok = !paths.empty();
+	for (size_t i = 0; i < paths.size() && ok; i++)
+	{
+		ok = decoder.decode(paths[i], out);
+	}
+	fclose(out);
+	return ok;
+}
+
+static bool checkSingle(const std::string& dir, unsigned int lines)
+{
+	std::string output = dir + "/decoded.txt";
+	if (!decodeAll(dir, output))
+	{
+		printf("trace did not decode\n");
+		return false;
+	}
+	FILE* fp = fopen(output.c_str(), "r");
+	char text[1024];
+	unsigned int i = 0;
+	bool ok = true;
+	while (fp && ok && fgets(text, sizeof(text), fp))
+	{
+		std::string decoded = message(text);
+		std::string wanted = expected(i);
+		if (decoded != wanted)
+		{
+			printf("line %u decoded as\n  %s\nexpected\n  %s\n", i, decoded.c_str(), wanted.c_str());
+			ok = false;
+		}
+		i++;
+	}
+	if (fp)
+	{
+		fclose(fp);
+	}
+	if (ok && i != lines)
+	{
+		printf("%u of %u lines decoded\n", i, lines);
+		ok = false;
+	}
+	return ok;
+}
+
+static bool checkThreads(const std::string& dir, unsigned int lines, unsigned int threads)
+{
+	std::string output = dir + "/decoded.txt";
+	if (!decodeAll(dir, output))
+	{
+		printf("threaded trace did not decode\n");
+		return false;
+	}
+	FILE* fp = fopen(output.c_str(), "r");
+	std::vector<long long> last(threads, -1);
+	unsigned long long found = 0;
+	char text[1024];
+	bool ok = true;
+	while (fp && ok && fgets(text, sizeof(text), fp))
+	{
+		unsigned int thread = 0, line = 0;
+		std::string decoded = message(text);
+		if (sscanf(decoded.c_str(), "thread %u line %u", &thread, &line) != 2 || thread >= threads ||
+			(long long)line != last[thread] + 1)
+		{
+			printf("threaded trace: unexpected line %s\n", decoded.c_str());
+			ok = false;
+			break;
+		}
+		last[thread] = line;
+		found++;
+	}
+	if (fp)
+	{
+		fclose(fp);
+	}
+	if (ok && found != (unsigned long long)(lines / threads) * threads)
+	{
+		printf("threaded trace: %llu of %u lines decoded\n", found, (lines / threads) * threads);
+		ok = false;
+	}
+	return ok;
+}
+
+static void traceLine(CMyLog& log, unsigned int i)
+{
+	static const unsigned int s_line = log.DefineTrace(LOG_LEVEL_DBG, __FILE__, __LINE__, LINE_FORMAT);
+	static const unsigned int s_odd = log.DefineTrace(LOG_LEVEL_DBG, __FILE__, __LINE__, ODD_FORMAT);
+	if (i % 16 == 15)
+	{
+		log.Trace(s_odd, ODD_ARGS(i));
+	}
+	else
+	{
+		log.Trace(s_line, LINE_ARGS(i));
+	}
+}
+
+static void textLine(CMyLog& log, unsigned int i)
+{
+	if (i % 16 == 15)
+	{
+		log.Log(LOG_LEVEL_INFO, __FILE__, __LINE__, ODD_FORMAT, ODD_ARGS(i));
+	}
+	else
+	{
+		log.Log(LOG_LEVEL_INFO, __FILE__, __LINE__, LINE_FORMAT, LINE_ARGS(i));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int lines = 200000;
+	unsigned int threads = 4;
+	std::string dir;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-n"))
+		{
+			lines = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-t"))
+		{
+			threads = (unsigned int)atoi(argv[i + 1]);
+		}
+		else if (!strcmp(argv[i], "-d"))
+		{
+			dir = argv[i + 1];
+		}
+	}
+	if (!lines || !threads)
+	{
+		return 0;
+	}
+	if (dir.empty())
+	{
+		char temp[] = "/tmp/tracebenchXXXXXX";
+		if (!mkdtemp(temp))
+		{
+			printf("cannot create a log directory\n");
+			return 1;
+		}
+		dir = temp;
+	}
+	mkdir(dir.c_str(), 0766);
+
+	const char* modes[] = { "sync", "async", "trace" };
+	double ns[3] = { 0.0, 0.0, 0.0 };
+	long long bytes[3] = { 0, 0, 0 };
+	unsigned long long dropped[3] = { 0, 0, 0 };
+	for (int mode = 0; mode < 3; mode++)
+	{
+		std::string logDir = dir + "/" + modes[mode];
+		mkdir(logDir.c_str(), 0766);
+		remove((logDir + "/dmft.log").c_str());
+
+		CMyLog log(logDir.c_str());
+		log.SetRotation(0xFFFFFFFFu, 1);
+		if ((mode == 1 && !log.StartAsync(1 << 16)) || (mode == 2 && !log.StartTrace(NULL, LOG_TRACE_SEGMENT_SIZE, 64)))
+		{
+			printf("cannot start %s mode\n", modes[mode]);
+			return 1;
+		}
+
+		TraceClock::time_point start = TraceClock::now();
+		for (unsigned int i = 0; i < lines; i++)
+		{
+			if (mode == 2)
+			{
+				traceLine(log, i);
+			}
+			else
+			{
+				textLine(log, i);
+			}
+		}
+		ns[mode] = std::chrono::duration<double, std::nano>(TraceClock::now() - start).count() / lines;
+		log.StopAsync();
+		log.StopTrace();
+		dropped[mode] = mode == 2 ? log.TraceDropped() : log.Dropped();
+
+		std::vector<std::string> paths;
+		bytes[mode] = mode == 2 ? segments(logDir, paths) : fileSize(logDir + "/dmft.log");
+	}
+
+	printf("%u debug lines, one thread\n", lines);
+	printf("  %-6s %10s %10s %8s\n", "mode", "ns/line", "bytes/line", "dropped");
+	for (int mode = 0; mode < 3; mode++)
+	{
+		printf("  %-6s %10.0f %10.1f %8llu\n", modes[mode], ns[mode], (double)bytes[mode] / lines, dropped[mode]);
+	}
+
+	if (dropped[2] || !checkSingle(dir + "/trace", lines))
+	{
+		return 1;
+	}
+
+	// several writers, segments replaced under them
+	std::string threadDir = dir + "/threads";
+	mkdir(threadDir.c_str(), 0766);
+	CMyLog log(threadDir.c_str());
+	if (!log.StartTrace(NULL, THREAD_SEGMENT_SIZE, 1u << 20))
+	{
+		printf("cannot start the threaded trace\n");
+		return 1;
+	}
+	unsigned int format = log.DefineTrace(LOG_LEVEL_DBG, __FILE__, __LINE__, "thread %u line %u %s");
+	std::vector<std::thread> writers;
+	for (unsigned int t = 0; t < threads; t++)
+	{
+		writers.push_back(std::thread([&log, format, t, lines, threads] {
+			for (unsigned int i = 0; i < lines / threads; i++)
+			{
+				log.Trace(format, t, i, s_stages[i % 4]);
+			}
+		}));
+	}
+	for (size_t t = 0; t < writers.size(); t++)
+	{
+		writers[t].join();
+	}
+	log.StopTrace();
+
+	std::vector<std::string> paths;
+	segments(threadDir, paths);
+	printf("%u threads, %zu segments of %u KB\n", threads, paths.size(), THREAD_SEGMENT_SIZE / 1024);
+	if (log.TraceDropped() || !checkThreads(threadDir, lines, threads))
+	{
+		printf("%llu records dropped\n", log.TraceDropped());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+//
+// Turns the binary trace CMyLog writes in trace mode back into text, one line
+// per record, oldest segment first:
+//
+//   2026-10-17 16:03:24.123456 DEBUG [4242] message file.cpp:120
+//
+// usage: tracedecode dmft.<n>.trace ... [-o output]
+//
+
+#include "logtrace.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+// n of dmft.<n>.trace, segments sort by it rather than by name
+static unsigned long long segmentNumber(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	unsigned int sequence = 0;
+	if (sscanf(name.c_str(), "dmft.%u.trace", &sequence) == 1)
+	{
+		return sequence;
+	}
+	return ~0ULL;
+}
+
+static bool bySegment(const std::string& a, const std::string& b)
+{
+	return segmentNumber(a) < segmentNumber(b);
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> paths;
+	const char* output = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-o") && i + 1 < argc)
+		{
+			output = argv[++i];
+		}
+		else
+		{
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty())
+	{
+		printf("usage: tracedecode dmft.<n>.trace ... [-o output]\n");
+		return 1;
+	}
+	std::stable_sort(paths.begin(), paths.end(), bySegment);
+
+	FILE* out = output ? fopen(output, "w") : stdout;
+	if (!out)
+	{
+		printf("cannot write %s\n", output);
+		return 1;
+	}
+
+	int result = 0;
+	CTraceDecoder decoder;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (!decoder.decode(paths[i], out))
+		{
+			fprintf(stderr, "%s is not a trace segment\n", paths[i].c_str());
+			result = 1;
+		}
+	}
+	if (output)
+	{
+		fclose(out);
+	}
+	return result;
+}
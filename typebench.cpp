@@ -0,0 +1,184 @@
+//
+// Media type negotiation at camera open. A pin lists every subtype, frame
+// size and frame rate the camera offers, several hundred types, and the
+// pipeline asks whether it supports each type it tries. Both ways of
+// answering are timed: comparing the query with every listed type in turn,
+// as IsMediaTypeSupported did, and comparing it only with the types listed
+// under its key, as it does now. Half of the queries ask for rates the camera
+// does not have. Exits with 1 when the two disagree on any query.
+//
+// usage: typebench [-r rounds]
+//
+
+#include "hostsample.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef std::chrono::steady_clock TypeClock;
+
+#define NO_TYPE     0xFFFFFFFFu
+
+// FourCC subtypes share the Media Foundation base GUID
+static void fourccGuid(const char* fourcc, unsigned char guid[16])
+{
+	static const unsigned char base[16] = {
+		0, 0, 0, 0, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+	memcpy(guid, base, 16);
+	memcpy(guid, fourcc, 4);
+}
+
+static CHostMediaType videoType(const char* fourcc, unsigned int bpp, unsigned int width, unsigned int height, unsigned int fps)
+{
+	static const unsigned char video[16] = {
+		0x76, 0x69, 0x64, 0x73, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+	unsigned char subtype[16];
+	fourccGuid(fourcc, subtype);
+
+	CHostMediaType type;
+	type.setGUID(HOST_MT_MAJOR_TYPE, video);
+	type.setGUID(HOST_MT_SUBTYPE, subtype);
+	type.setUINT64(HOST_MT_FRAME_SIZE, ((unsigned long long)width << 32) | height);
+	type.setUINT64(HOST_MT_FRAME_RATE, ((unsigned long long)fps << 32) | 1);
+	type.setUINT64(HOST_MT_INTERLACE_MODE, 2);         // progressive
+	type.setUINT64(HOST_MT_PIXEL_ASPECT_RATIO, (1ULL << 32) | 1);
+	type.setUINT64(HOST_MT_ALL_SAMPLES_INDEPENDENT, 1);
+	if (bpp)
+	{
+		type.setUINT64(HOST_MT_DEFAULT_STRIDE, (unsigned long long)(width * bpp / 8));
+		type.setUINT64(HOST_MT_FIXED_SIZE_SAMPLES, 1);
+	}
+	return type;
+}
+
+//
+// The pin side: the type list and its index, filled as CBasePin::AddMediaType does
+//
+struct TypeList {
+	std::vector<CHostMediaType> types;
+	CMediaTypeIndex             index;
+	unsigned long long          compares;
+
+	void add(const CHostMediaType& type)
+	{
+		types.push_back(type);
+		index.add(type.key(), (unsigned int)(types.size() - 1));
+	}
+
+	unsigned int scan(const CHostMediaType& query)
+	{
+		for (unsigned int i = 0; i < types.size(); i++)
+		{
+			compares++;
+			if (types[i].isEqual(query))
+			{
+				return i;
+			}
+		}
+		return NO_TYPE;
+	}
+
+	unsigned int lookup(const CHostMediaType& query)
+	{
+		const std::vector<unsigned int>* candidates = index.find(query.key());
+		for (size_t i = 0; candidates && i < candidates->size(); i++)
+		{
+			compares++;
+			if (types[(*candidates)[i]].isEqual(query))
+			{
+				return (*candidates)[i];
+			}
+		}
+		return NO_TYPE;
+	}
+};
+
+int main(int argc, char** argv)
+{
+	unsigned int rounds = 20;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-r"))
+		{
+			rounds = (unsigned int)atoi(argv[i + 1]);
+		}
+	}
+
+	static const struct { const char* fourcc; unsigned int bpp; } subtypes[] = {
+		{ "NV12", 12 }, { "YUY2", 16 }, { "I420", 12 }, { "MJPG", 0 } };
+	static const unsigned int sizes[][2] = {
+		{ 160, 120 }, { 176, 144 }, { 320, 180 }, { 320, 240 }, { 352, 288 }, { 424, 240 }, { 640, 360 },
+		{ 640, 480 }, { 800, 448 }, { 800, 600 }, { 848, 480 }, { 960, 540 }, { 1024, 576 }, { 1280, 720 },
+		{ 1440, 720 }, { 1600, 896 }, { 1920, 960 }, { 1920, 1080 }, { 2560, 1280 }, { 3040, 1520 } };
+	static const unsigned int rates[] = { 5, 10, 15, 24, 25, 30 };
+	static const unsigned int missingRates[] = { 20, 50, 60 };
+
+	TypeList pin;
+	pin.compares = 0;
+	std::vector<CHostMediaType> queries;
+	TypeClock::time_point start = TypeClock::now();
+	for (size_t s = 0; s < sizeof(subtypes) / sizeof(subtypes[0]); s++)
+	{
+		for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++)
+		{
+			for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+			{
+				pin.add(videoType(subtypes[s].fourcc, subtypes[s].bpp, sizes[z][0], sizes[z][1], rates[r]));
+			}
+		}
+	}
+	double buildMs = std::chrono::duration<double, std::milli>(TypeClock::now() - start).count();
+
+	// every listed type, as a separate object, and as many the camera does not offer
+	for (size_t i = 0; i < pin.types.size(); i++)
+	{
+		queries.push_back(pin.types[i]);
+		const unsigned int* size = sizes[(i / 6) % (sizeof(sizes) / sizeof(sizes[0]))];
+		queries.push_back(videoType(subtypes[i % 4].fourcc, subtypes[i % 4].bpp, size[0], size[1], missingRates[i % 3]));
+	}
+	std::shuffle(queries.begin(), queries.end(), std::mt19937(1));
+
+	std::vector<unsigned int> scanned(queries.size()), indexed(queries.size());
+	pin.compares = 0;
+	start = TypeClock::now();
+	for (unsigned int round = 0; round < rounds; round++)
+	{
+		for (size_t q = 0; q < queries.size(); q++)
+		{
+			scanned[q] = pin.scan(queries[q]);
+		}
+	}
+	double scanMs = std::chrono::duration<double, std::milli>(TypeClock::now() - start).count();
+	unsigned long long scanCompares = pin.compares;
+
+	pin.compares = 0;
+	start = TypeClock::now();
+	for (unsigned int round = 0; round < rounds; round++)
+	{
+		for (size_t q = 0; q < queries.size(); q++)
+		{
+			indexed[q] = pin.lookup(queries[q]);
+		}
+	}
+	double indexMs = std::chrono::duration<double, std::milli>(TypeClock::now() - start).count();
+	unsigned long long indexCompares = pin.compares;
+
+	unsigned long long lookups = (unsigned long long)queries.size() * rounds;
+	printf("%zu listed types under %zu keys, built in %.2f ms, %llu support checks\n",
+		pin.types.size(), pin.index.keyCount(), buildMs, lookups);
+	printf("  %-6s %12s %12s\n", "check", "ns/check", "compares");
+	printf("  %-6s %12.1f %12.1f\n", "scan", scanMs * 1e6 / lookups, (double)scanCompares / lookups);
+	printf("  %-6s %12.1f %12.1f\n", "index", indexMs * 1e6 / lookups, (double)indexCompares / lookups);
+
+	if (scanned != indexed)
+	{
+		printf("index and scan disagree on a support check\n");
+		return 1;
+	}
+	return 0;
+}
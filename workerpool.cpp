@@ -0,0 +1,163 @@
+#include "workerpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Cores in the affinity mask of the process, empty when it cannot be read
+static std::vector<unsigned int> allowedCores()
+{
+	std::vector<unsigned int> cores;
+#ifdef _WIN32
+	DWORD_PTR process = 0, system = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+	{
+		for (unsigned int core = 0; core < sizeof(DWORD_PTR) * 8; core++)
+		{
+			if (process & ((DWORD_PTR)1 << core))
+			{
+				cores.push_back(core);
+			}
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (unsigned int core = 0; core < CPU_SETSIZE; core++)
+		{
+			if (CPU_ISSET(core, &set))
+			{
+				cores.push_back(core);
+			}
+		}
+	}
+#endif
+	return cores;
+}
+
+static bool pinCurrentThread(unsigned int core)
+{
+#ifdef _WIN32
+	return core < sizeof(DWORD_PTR) * 8 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)core;
+	return false;
+#endif
+}
+
+CWorkerPool::CWorkerPool(unsigned int threads, bool pin_threads)
+: m_pinThreads(pin_threads)
+, m_pinned(0)
+, m_generation(0)
+, m_busy(0)
+, m_stop(false)
+, m_task(nullptr)
+, m_count(0)
+, m_next(0)
+{
+	unsigned int cores = std::thread::hardware_concurrency();
+	cores = cores ? cores : 1;
+	threads = threads ? threads : cores;
+	if (m_pinThreads)
+	{
+		m_cores = allowedCores();
+	}
+	// never more threads than cores to pin them to
+	m_pinThreads = m_pinThreads && threads <= m_cores.size();
+	for (unsigned int i = 1; i < threads; i++)
+	{
+		m_workers.push_back(std::thread(&CWorkerPool::workerLoop, this, i));
+	}
+}
+
+CWorkerPool::~CWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_start.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		m_workers[i].join();
+	}
+}
+
+void CWorkerPool::drain()
+{
+	unsigned int index;
+	while ((index = m_next.fetch_add(1)) < m_count)
+	{
+		(*m_task)(index);
+	}
+}
+
+void CWorkerPool::workerLoop(unsigned int index)
+{
+	// m_cores[0] is left to the caller, which stays unpinned
+	if (m_pinThreads && pinCurrentThread(m_cores[index]))
+	{
+		m_pinned++;
+	}
+
+	unsigned long long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_start.wait(lock, [&]() { return m_stop || m_generation != seen; });
+			if (m_stop)
+			{
+				return;
+			}
+			seen = m_generation;
+		}
+
+		drain();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (--m_busy == 0)
+		{
+			m_done.notify_one();
+		}
+	}
+}
+
+void CWorkerPool::run(unsigned int count, const std::function<void(unsigned int)>& task)
+{
+	if (m_workers.empty() || count <= 1)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			task(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_task = &task;
+		m_count = count;
+		m_next = 0;
+		m_busy = (unsigned int)m_workers.size();
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	drain();
+
+	// the single barrier of the frame, every worker checks in once per generation
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_done.wait(lock, [&]() { return m_busy == 0; });
+	m_task = nullptr;
+}
@@ -0,0 +1,58 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+//
+// Persistent worker threads for splitting one frame across cores. The threads
+// are created once and wait between frames; run() hands out task indices to
+// the workers and the calling thread and returns after a single barrier.
+// One run() at a time per pool.
+//
+// Workers float by default, several transforms in one service each have a
+// pool. With pin_threads worker i is pinned to the i-th core of the process
+// affinity mask; the caller is not pinned, the first core is left to it.
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CWorkerPool
+{
+public:
+	// threads counts the caller, 0 uses every hardware thread
+	explicit CWorkerPool(unsigned int threads = 0, bool pin_threads = false);
+	~CWorkerPool();
+
+	unsigned int threadCount() const { return (unsigned int)m_workers.size() + 1; }
+	// Workers whose affinity was set, fewer than asked when the OS refused
+	unsigned int pinnedCount() const { return m_pinned.load(); }
+
+	// Calls task(i) for every i in [0, count), concurrently, and waits for all of them
+	void run(unsigned int count, const std::function<void(unsigned int)>& task);
+
+private:
+	CWorkerPool(const CWorkerPool&);
+	CWorkerPool& operator=(const CWorkerPool&);
+
+	void workerLoop(unsigned int index);
+	void drain();
+
+	std::vector<std::thread>                    m_workers;
+	std::vector<unsigned int>                   m_cores;        // the process may run on these, ascending
+	bool                                        m_pinThreads;
+	std::atomic<unsigned int>                   m_pinned;
+	std::mutex                                  m_lock;
+	std::condition_variable                     m_start;
+	std::condition_variable                     m_done;
+	unsigned long long                          m_generation;
+	unsigned int                                m_busy;
+	bool                                        m_stop;
+	const std::function<void(unsigned int)>*    m_task;
+	unsigned int                                m_count;
+	std::atomic<unsigned int>                   m_next;
+};
+
+#endif
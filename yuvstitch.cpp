@@ -0,0 +1,155 @@
+#include "yuvstitch.h"
+
+#include <atomic>
+#include <string.h>
+
+#define STITCH_BAND_ROWS    32      // luma rows per band, chroma bands are half as tall
+
+//
+// CIdentityRemap
+//
+bool CIdentityRemap::remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+	unsigned int row_begin, unsigned int row_end)
+{
+	(void)plane;
+	if (src.width == 0 || src.height == 0 || row_end > dst.height)
+	{
+		return false;
+	}
+
+	bool same_size = src.width == dst.width && src.height == dst.height;
+	for (unsigned int y = row_begin; y < row_end; y++)
+	{
+		unsigned int sy = same_size ? y : (unsigned int)((unsigned long long)y * src.height / dst.height);
+		const unsigned char* s = src.data + (size_t)sy * src.stride;
+		unsigned char* d = dst.data + (size_t)y * dst.stride;
+
+		if (same_size && src.step == 1 && dst.step == 1)
+		{
+			memcpy(d, s, dst.width);
+			continue;
+		}
+		for (unsigned int x = 0; x < dst.width; x++)
+		{
+			unsigned int sx = same_size ? x : (unsigned int)((unsigned long long)x * src.width / dst.width);
+			d[(size_t)x * dst.step] = s[(size_t)sx * src.step];
+		}
+	}
+	return true;
+}
+
+//
+// CYuvStitchStage
+//
+CYuvStitchStage::CYuvStitchStage()
+: m_remap(std::make_shared<CIdentityRemap>())
+, m_outputWidth(0)
+, m_outputHeight(0)
+{
+}
+
+void CYuvStitchStage::configure(unsigned int output_width, unsigned int output_height)
+{
+	m_outputWidth = output_width;
+	m_outputHeight = output_height;
+}
+
+void CYuvStitchStage::setRemap(std::shared_ptr<CPlaneRemap> remap)
+{
+	m_remap = remap ? remap : std::make_shared<CIdentityRemap>();
+}
+
+void CYuvStitchStage::outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const
+{
+	out_width = m_outputWidth ? m_outputWidth : in_width;
+	out_height = m_outputHeight ? m_outputHeight : in_height;
+}
+
+void CYuvStitchStage::sourcePlanes(const FrameDesc& input, PlaneView planes[3])
+{
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		planes[i].data = input.planes[i].data;
+		planes[i].stride = input.planes[i].stride;
+		planes[i].step = 1;
+		planes[i].width = i ? (input.width + 1) / 2 : input.width;
+		planes[i].height = i ? (input.height + 1) / 2 : input.height;
+	}
+}
+
+void CYuvStitchStage::targetPlanes(const FrameDesc& output, PlaneView planes[3])
+{
+	planes[0].data = output.planes[0].data;
+	planes[0].stride = output.planes[0].stride;
+	planes[0].step = 1;
+	planes[0].width = output.width;
+	planes[0].height = output.height;
+	for (unsigned int i = 1; i < 3; i++)
+	{
+		planes[i].data = output.planes[1].data + (i - 1);
+		planes[i].stride = output.planes[1].stride;
+		planes[i].step = 2;
+		planes[i].width = (output.width + 1) / 2;
+		planes[i].height = (output.height + 1) / 2;
+	}
+}
+
+bool CYuvStitchStage::process(const FrameDesc& input, FrameDesc& output)
+{
+	if (input.format != FRAME_FORMAT_I420 || output.format != FRAME_FORMAT_NV12)
+	{
+		return false;
+	}
+
+	PlaneView src[3], dst[3];
+	sourcePlanes(input, src);
+	targetPlanes(output, dst);
+
+	//
+	// Bands of all three planes go into one dispatch, so the frame has a
+	// single barrier however many threads share it
+	//
+	unsigned int band_rows[3], bands[3];
+	unsigned int total = 0;
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		band_rows[i] = i ? STITCH_BAND_ROWS / 2 : STITCH_BAND_ROWS;
+		bands[i] = (dst[i].height + band_rows[i] - 1) / band_rows[i];
+		total += bands[i];
+	}
+
+	std::atomic<bool> ok(true);
+	CPlaneRemap* remap = m_remap.get();
+	auto band = [&](unsigned int index)
+	{
+		unsigned int plane = 0;
+		while (index >= bands[plane])
+		{
+			index -= bands[plane++];
+		}
+		unsigned int row_begin = index * band_rows[plane];
+		unsigned int row_end = row_begin + band_rows[plane] < dst[plane].height ? row_begin + band_rows[plane] : dst[plane].height;
+		if (!remap->remapRows(plane ? STITCH_PLANE_CHROMA : STITCH_PLANE_LUMA, src[plane], dst[plane], row_begin, row_end))
+		{
+			ok = false;
+		}
+	};
+	if (m_pool)
+	{
+		m_pool->run(total, band);
+	}
+	else
+	{
+		for (unsigned int i = 0; i < total; i++)
+		{
+			band(i);
+		}
+	}
+	if (!ok)
+	{
+		return false;
+	}
+	output.sample_time = input.sample_time;
+	output.sample_duration = input.sample_duration;
+	return true;
+}
@@ -0,0 +1,100 @@
+#ifndef YUV_STITCH_H
+#define YUV_STITCH_H
+
+//
+// Planar stitch path. The decoded I420 frame is remapped plane by plane, luma
+// at full and chroma at half resolution, and written out as NV12 in the same
+// pass, so the frame never goes through BGRA.
+//
+
+#include "framecore.h"
+#include "workerpool.h"
+#include <memory>
+
+enum STITCH_MODE {
+	STITCH_MODE_BGRA = 0,   // I420 -> BGRA -> CBlenderWrapper -> BGRA -> NV12
+	STITCH_MODE_YUV  = 1,   // I420 -> CYuvStitchStage -> NV12
+};
+
+enum STITCH_REMAP {
+	STITCH_REMAP_TABLE  = 0,    // CRemapTable, a source position per pixel, cached on disk
+	STITCH_REMAP_MESH   = 1,    // CMeshRemap, a node grid interpolated while gathering
+};
+
+enum STITCH_PLANE {
+	STITCH_PLANE_LUMA   = 0,
+	STITCH_PLANE_CHROMA = 1,
+};
+
+// One 8 bit plane, or one component of an interleaved plane (step 2 for the U or V of NV12)
+typedef struct _PlaneView {
+	unsigned char*  data    = nullptr;
+	unsigned int    stride  = 0;
+	unsigned int    step    = 1;
+	unsigned int    width   = 0;
+	unsigned int    height  = 0;
+}PlaneView, *PlaneViewPtr;
+
+//
+// Produces rows of an output plane from the source plane. Implementations
+// must allow different row ranges of the same plane to run concurrently.
+//
+class CPlaneRemap
+{
+public:
+	virtual ~CPlaneRemap() {}
+
+	virtual const char* name() const = 0;
+	virtual bool remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+		unsigned int row_begin, unsigned int row_end) = 0;
+
+	//
+	// Re-orients the panorama. matrix is row major and turns the view direction
+	// of an output pixel into the camera direction sampled for it. Not called
+	// while rows are being remapped; false if the remap cannot follow it.
+	//
+	virtual bool setRotation(const float matrix[9]) { (void)matrix; return false; }
+};
+
+//
+// Nearest neighbour resampling without any lens geometry, used until the
+// camera offset is known
+//
+class CIdentityRemap : public CPlaneRemap
+{
+public:
+	const char* name() const { return "identity"; }
+	bool remapRows(STITCH_PLANE plane, const PlaneView& src, const PlaneView& dst,
+		unsigned int row_begin, unsigned int row_end);
+};
+
+class CYuvStitchStage : public CFrameStage
+{
+public:
+	CYuvStitchStage();
+
+	// Output size of the panorama, 0 keeps the input size
+	void configure(unsigned int output_width, unsigned int output_height);
+	void setRemap(std::shared_ptr<CPlaneRemap> remap);
+	std::shared_ptr<CPlaneRemap> remap() const { return m_remap; }
+	// Splits the planes into row bands run across the pool, without one the caller does all rows
+	void setWorkerPool(std::shared_ptr<CWorkerPool> pool) { m_pool = pool; }
+
+	const char* name() const { return "yuv_stitch"; }
+	FRAME_FORMAT inputFormat() const { return FRAME_FORMAT_I420; }
+	FRAME_FORMAT outputFormat() const { return FRAME_FORMAT_NV12; }
+	void outputSize(unsigned int in_width, unsigned int in_height, unsigned int& out_width, unsigned int& out_height) const;
+	bool process(const FrameDesc& input, FrameDesc& output);
+
+	// Describes the source planes of an I420 frame and the destination planes of an NV12 frame
+	static void sourcePlanes(const FrameDesc& input, PlaneView planes[3]);
+	static void targetPlanes(const FrameDesc& output, PlaneView planes[3]);
+
+private:
+	std::shared_ptr<CPlaneRemap>    m_remap;
+	std::shared_ptr<CWorkerPool>    m_pool;
+	unsigned int                    m_outputWidth;
+	unsigned int                    m_outputHeight;
+};
+
+#endif